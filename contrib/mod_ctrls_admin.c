@@ -738,6 +738,82 @@ static int ctrls_handle_kick(pr_ctrls_t *ctrl, int reqargc,
   return res;
 }
 
+static void latency_add_responses(pr_ctrls_t *ctrl, int type) {
+  register unsigned int i;
+  unsigned int count;
+  const char *phases[] = { "PRE_CMD", "CMD", "POST_CMD", "POST_CMD_ERR",
+    "LOG_CMD", "LOG_CMD_ERR" };
+
+  pr_ctrls_add_response(ctrl, "%-14s %-12s %8s %8s %8s %8s %8s",
+    type == PR_METRICS_TYPE_CMD ? "Command" : "Module", "Phase", "Count",
+    "Avg", "50%", "90%", "99%");
+
+  count = pr_metrics_get_count(type);
+  for (i = 0; i < count; i++) {
+    int phase;
+
+    pr_signals_handle();
+
+    for (phase = PRE_CMD; phase <= LOG_CMD_ERR; phase++) {
+      pr_metrics_histo_t histo;
+
+      if (pr_metrics_get_histo(type, i, phase, &histo) < 0 ||
+          histo.count == 0) {
+        continue;
+      }
+
+      pr_ctrls_add_response(ctrl, "%-14s %-12s %8lu %8lu %8lu %8lu %8lu",
+        pr_metrics_get_name(type, i), phases[phase - 1], histo.count,
+        histo.total_usecs / histo.count,
+        pr_metrics_histo_percentile(&histo, 50),
+        pr_metrics_histo_percentile(&histo, 90),
+        pr_metrics_histo_percentile(&histo, 99));
+    }
+  }
+}
+
+static int ctrls_handle_latency(pr_ctrls_t *ctrl, int reqargc,
+    char **reqargv) {
+
+  /* Check the latency ACL. */
+  if (!pr_ctrls_check_acl(ctrl, ctrls_admin_acttab, "latency")) {
+
+    /* Access denied. */
+    pr_ctrls_add_response(ctrl, "access denied");
+    return -1;
+  }
+
+  if (reqargc > 1) {
+    pr_ctrls_add_response(ctrl, "bad number of arguments");
+    return -1;
+  }
+
+  if (!pr_metrics_enabled()) {
+    pr_ctrls_add_response(ctrl, "latency: CommandTiming not enabled");
+    return -1;
+  }
+
+  if (reqargc == 0 ||
+      strcmp(reqargv[0], "commands") == 0) {
+    latency_add_responses(ctrl, PR_METRICS_TYPE_CMD);
+    return 0;
+  }
+
+  if (strcmp(reqargv[0], "modules") == 0) {
+    latency_add_responses(ctrl, PR_METRICS_TYPE_MODULE);
+    return 0;
+  }
+
+  if (strcmp(reqargv[0], "reset") == 0) {
+    pr_metrics_reset();
+    pr_ctrls_add_response(ctrl, "latency: reset timings");
+    return 0;
+  }
+
+  pr_ctrls_add_response(ctrl, "unknown latency action '%s'", reqargv[0]);
+  return -1;
+}
+
 static int ctrls_handle_restart(pr_ctrls_t *ctrl, int reqargc,
     char **reqargv) {
 
@@ -1027,7 +1103,28 @@ static int ctrls_handle_trace(pr_ctrls_t *ctrl, int reqargc,
     return -1;
   }
 
-  if (strcmp(reqargv[0], "info") != 0) {
+  if (strcmp(reqargv[0], "dump") == 0) {
+    int res;
+
+    /* Dump the daemon's own buffered trace messages, then have the sessions
+     * dump theirs (via SIGUSR2).
+     */
+    res = pr_trace_dump();
+    if (res < 0) {
+      pr_ctrls_add_response(ctrl, "trace: error dumping trace buffer: %s",
+        errno == EPERM ? "TraceBuffer not configured" : strerror(errno));
+      return -1;
+    }
+
+    PRIVS_ROOT
+    child_signal(SIGUSR2);
+    PRIVS_RELINQUISH
+
+    pr_ctrls_add_response(ctrl,
+      "trace: dumped %d buffered messages, signalled %lu sessions", res,
+      child_count());
+
+  } else if (strcmp(reqargv[0], "info") != 0) {
     register unsigned int i;
 
     for (i = 0; i < reqargc; i++) {
@@ -1414,6 +1511,8 @@ static ctrls_acttab_t ctrls_admin_acttab[] = {
     ctrls_handle_get },
   { "kick",	"disconnect a class, host, or user",	NULL,
     ctrls_handle_kick },
+  { "latency",	"display command handling times",	NULL,
+    ctrls_handle_latency },
   { "restart",  "restart the daemon (similar to using HUP)",	NULL,
     ctrls_handle_restart },
   { "scoreboard", "clean the ScoreboardFile", NULL,
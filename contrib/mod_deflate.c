@@ -72,6 +72,47 @@ static int deflate_strategy = MOD_DEFLATE_DEFAULT_STRATEGY;
 #define MOD_DEFLATE_DEFAULT_WINDOW_BITS			15
 static int deflate_window_bits = MOD_DEFLATE_DEFAULT_WINDOW_BITS;
 
+/* Set if the client chose the compression level, via OPTS MODE Z. */
+static int deflate_client_level = FALSE;
+
+/* DeflateOptions */
+static unsigned long deflate_options = 0UL;
+#define DEFLATE_OPT_AUTO_LEVEL			0x001
+#define DEFLATE_OPT_SKIP_INCOMPRESSIBLE		0x002
+
+#ifdef PR_USE_REGEX
+static pr_regex_t *deflate_skip_pre = NULL;
+#endif /* PR_USE_REGEX */
+
+/* The zstreams are initialized once, and reset for each subsequent data
+ * transfer in the session.
+ */
+static z_stream deflate_wr_zstrm;
+static int deflate_wr_zstrm_inited = FALSE;
+static z_stream deflate_rd_zstrm;
+static int deflate_rd_zstrm_inited = FALSE;
+
+/* The compression level used for the current download, and whether its
+ * data has been sampled yet.
+ */
+static int deflate_xfer_level = MOD_DEFLATE_DEFAULT_COMPRESS_LEVEL;
+static int deflate_xfer_sampled = FALSE;
+
+/* For AutoLevel: the level to use for the next download, and the time spent
+ * compressing vs. writing to the network, since the level was last checked.
+ */
+static int deflate_auto_level = MOD_DEFLATE_DEFAULT_COMPRESS_LEVEL;
+static unsigned long deflate_auto_zusecs = 0UL;
+static unsigned long deflate_auto_wusecs = 0UL;
+static size_t deflate_auto_nbytes = 0;
+#define DEFLATE_AUTO_LEVEL_INTERVAL		(1024 * 1024)
+
+/* Bytes of the first write of a download sampled, for SkipIncompressible;
+ * smaller writes are not sampled.
+ */
+#define DEFLATE_SAMPLE_MAX_LEN			4096
+#define DEFLATE_SAMPLE_MIN_LEN			512
+
 /* The _ptr pointer always points to the start of the buffer; the _zbuf
  * pointer points to the current place within the buffer from which to read
  * data.
@@ -130,6 +171,133 @@ static const char *deflate_zstrerror(int zerrno) {
   return zstr;
 }
 
+/* Returns TRUE if the given data looks incompressible (e.g. it is already
+ * compressed, or encrypted), i.e. if its byte values are close to uniformly
+ * distributed.  The chi-square statistic over the 256 byte values is about
+ * 255 for random data, and far larger for data that deflate can shrink.
+ */
+static int deflate_is_incompressible(const unsigned char *data,
+    size_t datalen) {
+  register unsigned int i;
+  unsigned int counts[256];
+  double expected, chisq = 0.0;
+
+  if (datalen < DEFLATE_SAMPLE_MIN_LEN) {
+    return FALSE;
+  }
+
+  if (datalen > DEFLATE_SAMPLE_MAX_LEN) {
+    datalen = DEFLATE_SAMPLE_MAX_LEN;
+  }
+
+  memset(counts, 0, sizeof(counts));
+  for (i = 0; i < datalen; i++) {
+    counts[data[i]]++;
+  }
+
+  expected = (double) datalen / 256.0;
+  for (i = 0; i < 256; i++) {
+    double diff;
+
+    diff = (double) counts[i] - expected;
+    chisq += ((diff * diff) / expected);
+  }
+
+  pr_trace_msg(trace_channel, 15,
+    "sampled %lu bytes of data: chi-square = %0.1lf", (unsigned long) datalen,
+    chisq);
+
+  return (chisq < 512.0 ? TRUE : FALSE);
+}
+
+/* Returns the compression level to use for the data transfer being opened. */
+static int deflate_get_xfer_level(void) {
+#ifdef PR_USE_REGEX
+  if (deflate_skip_pre != NULL &&
+      session.curr_cmd_id == PR_CMD_RETR_ID &&
+      session.xfer.path != NULL) {
+    if (pr_regexp_exec(deflate_skip_pre, session.xfer.path, 0, NULL, 0, 0,
+        0) == 0) {
+      (void) pr_log_writefile(deflate_logfd, MOD_DEFLATE_VERSION,
+        "'%s' matches DeflateSkipFilter, sending without compression",
+        session.xfer.path);
+      return Z_NO_COMPRESSION;
+    }
+  }
+#endif /* PR_USE_REGEX */
+
+  if (deflate_client_level == FALSE &&
+      (deflate_options & DEFLATE_OPT_AUTO_LEVEL)) {
+    return deflate_auto_level;
+  }
+
+  return deflate_compression_level;
+}
+
+/* For AutoLevel: once enough data has been sent to tell whether compressing
+ * it or writing it to the network takes longer, adjust the compression level.
+ * If the network is the bottleneck, compressing harder costs nothing; if the
+ * CPU is, compressing less sends the data sooner.
+ */
+static void deflate_auto_adjust(z_stream *zstrm, size_t datalen,
+    unsigned long zusecs, unsigned long wusecs) {
+  int level, res;
+  unsigned long total_zusecs, total_wusecs;
+
+  if (deflate_client_level == TRUE ||
+      !(deflate_options & DEFLATE_OPT_AUTO_LEVEL) ||
+      deflate_xfer_level == Z_NO_COMPRESSION) {
+    return;
+  }
+
+  deflate_auto_zusecs += zusecs;
+  deflate_auto_wusecs += wusecs;
+  deflate_auto_nbytes += datalen;
+
+  if (deflate_auto_nbytes < DEFLATE_AUTO_LEVEL_INTERVAL) {
+    return;
+  }
+
+  total_zusecs = deflate_auto_zusecs;
+  total_wusecs = deflate_auto_wusecs;
+
+  deflate_auto_zusecs = deflate_auto_wusecs = 0UL;
+  deflate_auto_nbytes = 0;
+
+  level = deflate_xfer_level;
+  if (total_wusecs > (total_zusecs * 2) &&
+      level < Z_BEST_COMPRESSION) {
+    level++;
+
+  } else if (total_zusecs > (total_wusecs * 2) &&
+             level > Z_BEST_SPEED) {
+    level--;
+  }
+
+  /* Only change the parameters once all of the pending input has been
+   * compressed and written out.
+   */
+  if (level == deflate_xfer_level ||
+      zstrm->avail_in > 0) {
+    return;
+  }
+
+  res = deflateParams(zstrm, level, deflate_strategy);
+  if (res != Z_OK) {
+    pr_trace_msg(trace_channel, 3,
+      "error changing compression level to %d: [%d] %s", level, res,
+      zstrm->msg ? zstrm->msg : deflate_zstrerror(res));
+    return;
+  }
+
+  (void) pr_log_writefile(deflate_logfd, MOD_DEFLATE_VERSION,
+    "%s: changed compression level from %d to %d (%lu usecs compressing, "
+    "%lu usecs writing)", session.curr_cmd, deflate_xfer_level, level,
+    total_zusecs, total_wusecs);
+
+  deflate_xfer_level = deflate_auto_level = level;
+}
+
 /* NetIO callbacks
  */
 
@@ -144,6 +312,7 @@ static int deflate_netio_close_cb(pr_netio_stream_t *nstrm) {
       return 0;
     }
 
+    /* The zstream itself is kept, to be reset for the next data transfer. */
     if (nstrm->strm_mode == PR_NETIO_IO_WR) {
       if (zstrm->total_in > 0) {
         float ratio;
@@ -156,17 +325,6 @@ static int deflate_netio_close_cb(pr_netio_stream_t *nstrm) {
           (1.0 - ratio) * 100.0);
       }
 
-      res = deflateEnd(zstrm);
-      if (res != Z_OK) {
-        pr_trace_msg(trace_channel, 3,
-          "close: error closing deflating netio: [%d] %s", res,
-          zstrm->msg ? zstrm->msg : deflate_zstrerror(res));
-
-        (void) pr_log_writefile(deflate_logfd, MOD_DEFLATE_VERSION,
-          "error closing deflating netio: [%d] %s", res,
-          zstrm->msg ? zstrm->msg : deflate_zstrerror(res));
-      }
-
     } else if (nstrm->strm_mode == PR_NETIO_IO_RD) {
       if (zstrm->total_in > 0) {
         float ratio;
@@ -179,16 +337,6 @@ static int deflate_netio_close_cb(pr_netio_stream_t *nstrm) {
           (1.0 - ratio) * 100.0);
       }
 
-      res = inflateEnd(zstrm);
-      if (res != Z_OK) {
-        pr_trace_msg(trace_channel, 3,
-          "close: error closing inflating netio: [%d] %s", res,
-          zstrm->msg ? zstrm->msg : deflate_zstrerror(res));
-
-        (void) pr_log_writefile(deflate_logfd, MOD_DEFLATE_VERSION,
-          "error closing inflating netio: [%d] %s", res,
-          zstrm->msg ? zstrm->msg : deflate_zstrerror(res));
-      }
     }
   }
 
@@ -209,15 +357,12 @@ static pr_netio_stream_t *deflate_netio_open_cb(pr_netio_stream_t *nstrm,
     int res;
     z_stream *zstrm;
 
-    /* Set the initial ZLIB parameters. */
-    zstrm = pcalloc(nstrm->strm_pool, sizeof(z_stream));
-    zstrm->zalloc = Z_NULL;
-    zstrm->zfree = Z_NULL;
-    zstrm->opaque = Z_NULL;
-    zstrm->next_in = Z_NULL;
-    zstrm->next_out = Z_NULL;
-    zstrm->avail_in = 0;
-    zstrm->avail_out = 0;
+    if (nstrm->strm_mode == PR_NETIO_IO_WR) {
+      zstrm = &deflate_wr_zstrm;
+
+    } else {
+      zstrm = &deflate_rd_zstrm;
+    }
 
     if (pr_table_add(nstrm->notes,
         pstrdup(nstrm->strm_pool, DEFLATE_NETIO_NOTE), zstrm,
@@ -228,13 +373,36 @@ static pr_netio_stream_t *deflate_netio_open_cb(pr_netio_stream_t *nstrm,
       return NULL;
     }
 
-    memset(deflate_zbuf_ptr, '\0', deflate_zbufsz);
     deflate_zbuf = deflate_zbuf_ptr;
 
     if (nstrm->strm_mode == PR_NETIO_IO_WR) {
-      /* Initialize the zlib data for deflation. */
-      res = deflateInit2(zstrm, deflate_compression_level, Z_DEFLATED,
-        deflate_window_bits, deflate_mem_level, deflate_strategy);
+      deflate_xfer_level = deflate_get_xfer_level();
+      deflate_xfer_sampled = FALSE;
+
+      if (deflate_wr_zstrm_inited == FALSE) {
+        /* Initialize the zlib data for deflation. */
+        zstrm->zalloc = Z_NULL;
+        zstrm->zfree = Z_NULL;
+        zstrm->opaque = Z_NULL;
+
+        res = deflateInit2(zstrm, deflate_xfer_level, Z_DEFLATED,
+          deflate_window_bits, deflate_mem_level, deflate_strategy);
+        if (res == Z_OK) {
+          deflate_wr_zstrm_inited = TRUE;
+        }
+
+      } else {
+        /* Reuse the zlib data from the previous transfer; only the level
+         * may have changed since then.
+         */
+        res = deflateReset(zstrm);
+        if (res == Z_OK) {
+          res = deflateParams(zstrm, deflate_xfer_level, deflate_strategy);
+        }
+      }
+
+      zstrm->next_in = Z_NULL;
+      zstrm->avail_in = 0;
 
       switch (res) {
         case Z_OK:
@@ -242,6 +410,7 @@ static pr_netio_stream_t *deflate_netio_open_cb(pr_netio_stream_t *nstrm,
           zstrm->avail_out = deflate_zbufsz;
           break;
 
+        case Z_BUF_ERROR:
         case Z_MEM_ERROR:
         case Z_STREAM_ERROR:
           pr_trace_msg(trace_channel, 3,
@@ -262,7 +431,24 @@ static pr_netio_stream_t *deflate_netio_open_cb(pr_netio_stream_t *nstrm,
        * The magic number 32 here from the zlib.h documentation; it enables
        * the automatic header detection of zlib/gzip headers.
        */
-      res = inflateInit2(zstrm, deflate_window_bits + 32);
+      if (deflate_rd_zstrm_inited == FALSE) {
+        zstrm->zalloc = Z_NULL;
+        zstrm->zfree = Z_NULL;
+        zstrm->opaque = Z_NULL;
+        zstrm->next_in = Z_NULL;
+        zstrm->avail_in = 0;
+
+        res = inflateInit2(zstrm, deflate_window_bits + 32);
+        if (res == Z_OK) {
+          deflate_rd_zstrm_inited = TRUE;
+        }
+
+      } else {
+        res = inflateReset(zstrm);
+      }
+
+      zstrm->next_in = Z_NULL;
+      zstrm->avail_in = 0;
 
       switch (res) {
         case Z_OK:
@@ -391,10 +577,19 @@ static int deflate_netio_read_cb(pr_netio_stream_t *nstrm, char *buf,
      * new data to the inflator, and see if we can make some progress.
      */
 
+    /* Move any leftover compressed data to the start of the buffer, so that
+     * the data read in next is appended to it, rather than overwriting it.
+     */
+    deflate_rbuflen = zstrm->avail_in;
+    if (deflate_rbuflen > 0 &&
+        zstrm->next_in != deflate_rbuf) {
+      memmove(deflate_rbuf, zstrm->next_in, deflate_rbuflen);
+    }
+
     datalen = deflate_rbufsz - deflate_rbuflen;
 
     /* Read in some data from the stream's fd. */
-    nread = read(nstrm->strm_fd, deflate_rbuf, datalen);
+    nread = read(nstrm->strm_fd, deflate_rbuf + deflate_rbuflen, datalen);
     if (nread < 0) {
       xerrno = errno;
 
@@ -506,12 +701,36 @@ static int deflate_netio_read_cb(pr_netio_stream_t *nstrm, char *buf,
 
     deflate_zbuflen = deflate_zbufsz - zstrm->avail_out;
 
-    /* Now all we have to do is return EAGAIN, so that the FSIO API calls
-     * us back immediately.  That will hit the check for deflate_zbuflen
-     * earlier in this function, and return the data we just decompressed.
+    if (deflate_zbuflen == 0) {
+      /* Nothing inflated yet; have the NetIO API call us back once there is
+       * more data to read.
+       */
+      errno = EAGAIN;
+      return -1;
+    }
+
+    /* Return as much of the data we just inflated as fits.  Returning EAGAIN
+     * here instead, to be called back for it, would make the NetIO API
+     * delay before every call.
      */
-    errno = EAGAIN;
-    return -1;
+    copylen = deflate_zbuflen;
+    if (copylen > bufsz) {
+      copylen = bufsz;
+    }
+
+    memcpy(buf, deflate_zbuf, copylen);
+    deflate_zbuf += copylen;
+    deflate_zbuflen -= copylen;
+
+    if (deflate_zbuflen == 0) {
+      deflate_zbuf = deflate_zbuf_ptr;
+    }
+
+    /* Manually adjust the "raw" bytes in counter; see above. */
+    res = copylen;
+    session.total_raw_in -= res;
+
+    return res;
   }
 
   return read(nstrm->strm_fd, buf, bufsz);
@@ -593,7 +812,10 @@ static int deflate_netio_shutdown_cb(pr_netio_stream_t *nstrm, int how) {
         }
       }
 
-      return 0;
+      /* Fall through, and shut down the socket as well, so that the client
+       * sees the end of the data now, rather than once the lingering close
+       * times out.
+       */
     }
   }
 
@@ -610,6 +832,7 @@ static int deflate_netio_write_cb(pr_netio_stream_t *nstrm, char *buf,
   if (nstrm->strm_type == PR_NETIO_STRM_DATA) {
     int res = 0, xerrno;
     size_t datalen, offset = 0;
+    unsigned long start_usecs, deflate_usecs, write_usecs;
     z_stream *zstrm;
 
     zstrm = pr_table_get(nstrm->notes, DEFLATE_NETIO_NOTE, NULL);
@@ -620,6 +843,30 @@ static int deflate_netio_write_cb(pr_netio_stream_t *nstrm, char *buf,
       return -1;
     }
 
+    if (deflate_xfer_sampled == FALSE) {
+      deflate_xfer_sampled = TRUE;
+
+      /* Don't spend the CPU on data that will not get any smaller; sending
+       * it as stored (uncompressed) deflate blocks keeps the stream valid.
+       */
+      if ((deflate_options & DEFLATE_OPT_SKIP_INCOMPRESSIBLE) &&
+          deflate_xfer_level != Z_NO_COMPRESSION &&
+          deflate_is_incompressible((unsigned char *) buf, buflen) == TRUE) {
+        res = deflateParams(zstrm, Z_NO_COMPRESSION, deflate_strategy);
+        if (res == Z_OK) {
+          (void) pr_log_writefile(deflate_logfd, MOD_DEFLATE_VERSION,
+            "%s: data appears incompressible, sending without compression",
+            session.curr_cmd);
+          deflate_xfer_level = Z_NO_COMPRESSION;
+
+        } else {
+          pr_trace_msg(trace_channel, 3,
+            "write: error disabling compression: [%d] %s", res,
+            zstrm->msg ? zstrm->msg : deflate_zstrerror(res));
+        }
+      }
+    }
+
     /* Deflate the data to be written out. */
     zstrm->next_in = (Bytef *) buf;
     zstrm->avail_in = buflen;
@@ -628,8 +875,10 @@ static int deflate_netio_write_cb(pr_netio_stream_t *nstrm, char *buf,
       "write: pre-deflate zstream state: avail_in = %d, avail_out = %d",
       zstrm->avail_in, zstrm->avail_out);
 
+    start_usecs = pr_metrics_now();
     deflate_zerrno = deflate(zstrm, Z_SYNC_FLUSH);
     xerrno = errno;
+    deflate_usecs = pr_metrics_now() - start_usecs;
 
     pr_trace_msg(trace_channel, 19,
       "write: post-inflate zstream state: avail_in = %d, avail_out = %d "
@@ -654,6 +903,7 @@ static int deflate_netio_write_cb(pr_netio_stream_t *nstrm, char *buf,
     }
 
     datalen = deflate_zbufsz - zstrm->avail_out;
+    start_usecs = pr_metrics_now();
 
     while (datalen > 0) {
       pr_signals_handle();
@@ -708,6 +958,9 @@ static int deflate_netio_write_cb(pr_netio_stream_t *nstrm, char *buf,
     res = (buflen - zstrm->avail_in);
     session.total_raw_out -= res;
 
+    write_usecs = pr_metrics_now() - start_usecs;
+    deflate_auto_adjust(zstrm, res, deflate_usecs, write_usecs);
+
     pr_trace_msg(trace_channel, 9, "write: returning %d for %lu bytes",
       res, (unsigned long) buflen);
     return res;
@@ -738,6 +991,70 @@ MODRET set_deflateengine(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: DeflateOptions opt1 ... */
+MODRET set_deflateoptions(cmd_rec *cmd) {
+  config_rec *c = NULL;
+  register unsigned int i = 0;
+  unsigned long opts = 0UL;
+
+  if (cmd->argc-1 == 0)
+    CONF_ERROR(cmd, "wrong number of parameters");
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+
+  for (i = 1; i < cmd->argc; i++) {
+    if (strcmp(cmd->argv[i], "AutoLevel") == 0) {
+      opts |= DEFLATE_OPT_AUTO_LEVEL;
+
+    } else if (strcmp(cmd->argv[i], "SkipIncompressible") == 0) {
+      opts |= DEFLATE_OPT_SKIP_INCOMPRESSIBLE;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, ": unknown DeflateOption '",
+        cmd->argv[i], "'", NULL));
+    }
+  }
+
+  c->argv[0] = pcalloc(c->pool, sizeof(unsigned long));
+  *((unsigned long *) c->argv[0]) = opts;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: DeflateSkipFilter regex */
+MODRET set_deflateskipfilter(cmd_rec *cmd) {
+#ifdef PR_USE_REGEX
+  pr_regex_t *pre = NULL;
+  int res;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  pre = pr_regexp_alloc(&deflate_module);
+
+  res = pr_regexp_compile(pre, cmd->argv[1], REG_EXTENDED|REG_NOSUB|REG_ICASE);
+  if (res != 0) {
+    char errstr[200] = {'\0'};
+
+    pr_regexp_error(res, pre, errstr, 200);
+    pr_regexp_free(NULL, pre);
+
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "Unable to compile regex '",
+      cmd->argv[1], "': ", errstr, NULL));
+  }
+
+  (void) add_config_param(cmd->argv[0], 1, (void *) pre);
+  return PR_HANDLED(cmd);
+
+#else
+  CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "The ", cmd->argv[0], " directive "
+    "cannot be used on this system, as you do not have POSIX compliant "
+    "regex support", NULL));
+#endif
+}
+
 /* usage: DeflateLog path|"none" */
 MODRET set_deflatelog(cmd_rec *cmd) {
   CHECK_ARGS(cmd, 1);
@@ -774,6 +1091,7 @@ MODRET deflate_opts(cmd_rec *cmd) {
       deflate_mem_level = MOD_DEFLATE_DEFAULT_MEM_LEVEL;
       deflate_strategy = MOD_DEFLATE_DEFAULT_STRATEGY;
       deflate_window_bits = MOD_DEFLATE_DEFAULT_WINDOW_BITS;
+      deflate_client_level = FALSE;
 
       pr_response_add(R_200, _("%s OK"), cmd->argv[0]);
       return PR_HANDLED(cmd);
@@ -804,6 +1122,7 @@ MODRET deflate_opts(cmd_rec *cmd) {
           }
 
           deflate_compression_level = level;
+          deflate_client_level = TRUE;
 
         } else {
           pr_response_add_err(R_501, _("%s: unknown MODE Z option: %s"),
@@ -959,6 +1278,25 @@ static int deflate_sess_init(void) {
     }
   }
 
+  c = find_config(main_server->conf, CONF_PARAM, "DeflateOptions", FALSE);
+  while (c != NULL) {
+    unsigned long opts;
+
+    pr_signals_handle();
+
+    opts = *((unsigned long *) c->argv[0]);
+    deflate_options |= opts;
+
+    c = find_config_next(c, c->next, CONF_PARAM, "DeflateOptions", FALSE);
+  }
+
+#ifdef PR_USE_REGEX
+  c = find_config(main_server->conf, CONF_PARAM, "DeflateSkipFilter", FALSE);
+  if (c != NULL) {
+    deflate_skip_pre = c->argv[0];
+  }
+#endif /* PR_USE_REGEX */
+
   /* Allocate the buffers which will be used for inflating/deflating data.
    * Look up the optimal transfer buffer size, and use a factor of 8.
    * Later, if needed, a larger buffer will be allocated when necessary.
@@ -985,6 +1323,8 @@ static int deflate_init(void) {
 static conftable deflate_conftab[] = {
   { "DeflateEngine",		set_deflateengine,		NULL },
   { "DeflateLog",		set_deflatelog,			NULL },
+  { "DeflateOptions",		set_deflateoptions,		NULL },
+  { "DeflateSkipFilter",	set_deflateskipfilter,		NULL },
   { NULL }
 };
 
@@ -62,6 +62,16 @@ static unsigned int exec_opts = 0U;
 
 static int exec_timeout = 0;
 
+/* Socket to the ExecHelper process(es), if configured */
+static int exec_helper_fd = -1;
+static const char *exec_helper_path = NULL;
+
+/* When the ExecHelper queue is full, wait for room this many times, for up
+ * to this many milliseconds each, before executing the command directly.
+ */
+#define EXEC_HELPER_MAX_RETRIES		20
+#define EXEC_HELPER_RETRY_MS		50
+
 /* Flags for exec_ssystem() */
 #define EXEC_FL_CLEAR_GROUPS	0x0010	/* Clear supplemental groups */
 #define EXEC_FL_NO_SEND		0x0020	/* Do not send output via response */
@@ -896,6 +906,197 @@ static int exec_ssystem(cmd_rec *cmd, config_rec *c, int flags) {
   return status;
 }
 
+/* Connects to the ExecHelper socket.  This is done when the session starts,
+ * before any chroot, so that the socket remains reachable.
+ */
+static int exec_helper_open(const char *path) {
+  int fd, res, xerrno;
+  struct sockaddr_un sock;
+
+  fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    xerrno = errno;
+
+    exec_log("error creating ExecHelper socket: %s", strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+    exec_log("error setting CLOEXEC on ExecHelper socket fd %d: %s", fd,
+      strerror(errno));
+  }
+
+  /* Sessions must never block on the helper; exec_helper_send() only waits,
+   * for a bounded time, for room in its queue.
+   */
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+    exec_log("error setting O_NONBLOCK on ExecHelper socket fd %d: %s", fd,
+      strerror(errno));
+  }
+
+  memset(&sock, 0, sizeof(sock));
+  sock.sun_family = AF_UNIX;
+  sstrncpy(sock.sun_path, path, sizeof(sock.sun_path));
+
+  PRIVS_ROOT
+  res = connect(fd, (struct sockaddr *) &sock, sizeof(sock));
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (res < 0) {
+    exec_log("error connecting to ExecHelper socket '%s': %s", path,
+      strerror(xerrno));
+    (void) close(fd);
+
+    errno = xerrno;
+    return -1;
+  }
+
+  return fd;
+}
+
+/* Hands the given Exec, with its (substituted) arguments and environment,
+ * to the process(es) reading from the ExecHelper socket, rather than
+ * forking and executing it ourselves.  The Exec is sent as a single
+ * datagram of NUL-terminated strings: the path, the arguments, an empty
+ * string, then the environment.  We do not wait for the helper to run it,
+ * only (briefly) for room in its queue.  Returns zero if the Exec was sent,
+ * otherwise the errno value, in which case the caller runs the Exec itself.
+ */
+static int exec_helper_send(cmd_rec *cmd, config_rec *c) {
+  register unsigned int i;
+  pool *tmp_pool;
+  array_header *fields;
+  char **env, **elts, *buf, *ptr;
+  size_t buflen = 0;
+  unsigned int retries = 0;
+  int res, xerrno = 0;
+
+  tmp_pool = make_sub_pool(cmd ? cmd->tmp_pool : session.pool);
+  pr_pool_tag(tmp_pool, "ExecHelper pool");
+
+  fields = make_array(tmp_pool, 0, sizeof(char *));
+  *((char **) push_array(fields)) = c->argv[2];
+
+  for (i = 3; i < c->argc && c->argv[i] != NULL; i++) {
+    *((char **) push_array(fields)) = exec_subst_var(tmp_pool, c->argv[i],
+      cmd);
+  }
+
+  *((char **) push_array(fields)) = "";
+
+  for (env = exec_prepare_environ(tmp_pool, cmd); *env != NULL; env++) {
+    *((char **) push_array(fields)) = *env;
+  }
+
+  elts = fields->elts;
+  for (i = 0; i < fields->nelts; i++) {
+    buflen += strlen(elts[i]) + 1;
+  }
+
+  buf = ptr = palloc(tmp_pool, buflen);
+  for (i = 0; i < fields->nelts; i++) {
+    size_t len;
+
+    len = strlen(elts[i]) + 1;
+    memcpy(ptr, elts[i], len);
+    ptr += len;
+  }
+
+  res = send(exec_helper_fd, buf, buflen, 0);
+  while (res < 0) {
+    fd_set writefds;
+    struct timeval tv;
+
+    xerrno = errno;
+
+    if (xerrno == EINTR) {
+      pr_signals_handle();
+      res = send(exec_helper_fd, buf, buflen, 0);
+      continue;
+    }
+
+    if ((xerrno != EAGAIN &&
+         xerrno != EWOULDBLOCK &&
+         xerrno != ENOBUFS) ||
+        retries == EXEC_HELPER_MAX_RETRIES) {
+      break;
+    }
+
+    /* The helpers are busy.  Rather than forking the command ourselves,
+     * which is what the helper is meant to spare us, give them a moment to
+     * make room in the queue.
+     */
+    FD_ZERO(&writefds);
+    FD_SET(exec_helper_fd, &writefds);
+
+    tv.tv_sec = 0L;
+    tv.tv_usec = EXEC_HELPER_RETRY_MS * 1000L;
+
+    (void) select(exec_helper_fd + 1, NULL, &writefds, NULL, &tv);
+    pr_signals_handle();
+
+    retries++;
+    res = send(exec_helper_fd, buf, buflen, 0);
+  }
+
+  if (res < 0) {
+    if (xerrno == EAGAIN ||
+        xerrno == EWOULDBLOCK ||
+        xerrno == ENOBUFS) {
+      exec_log("ExecHelper '%s' queue still full after %u retries, not "
+        "sending '%s'", exec_helper_path, retries, (const char *) c->argv[2]);
+
+    } else if (xerrno == EMSGSIZE) {
+      exec_log("'%s' (%lu bytes) too large for ExecHelper '%s', not sending",
+        (const char *) c->argv[2], (unsigned long) buflen, exec_helper_path);
+
+    } else {
+      exec_log("error sending '%s' to ExecHelper '%s': %s",
+        (const char *) c->argv[2], exec_helper_path, strerror(xerrno));
+    }
+
+  } else {
+    xerrno = 0;
+    exec_log("sent '%s' (%lu bytes) to ExecHelper '%s'",
+      (const char *) c->argv[2], (unsigned long) buflen, exec_helper_path);
+  }
+
+  destroy_pool(tmp_pool);
+  return xerrno;
+}
+
+/* Runs the given Exec, or hands it off to the ExecHelper, if one is
+ * configured for this session.
+ */
+static int exec_run(cmd_rec *cmd, config_rec *c, int flags) {
+  if (exec_helper_fd >= 0) {
+    int res;
+
+    res = exec_helper_send(cmd, c);
+    if (res == 0) {
+      return 0;
+    }
+
+    /* If the helper has gone away (rather than merely being busy, or this
+     * Exec being too large for a datagram), stop using it for the rest of
+     * the session.  Either way, this Exec is not lost; run it ourselves.
+     */
+    if (res != EAGAIN &&
+        res != EWOULDBLOCK &&
+        res != ENOBUFS &&
+        res != EMSGSIZE) {
+      exec_log("ExecHelper '%s' unusable, executing commands directly",
+        exec_helper_path);
+      (void) close(exec_helper_fd);
+      exec_helper_fd = -1;
+    }
+  }
+
+  return exec_ssystem(cmd, c, flags);
+}
+
 /* Perform any substitution of "magic cookie" values. */
 static char *exec_subst_var(pool *tmp_pool, char *varstr, cmd_rec *cmd) {
   char *ptr = NULL;
@@ -1285,7 +1486,7 @@ MODRET exec_post_cmd(cmd_rec *cmd) {
 
     /* Check the command list for this program against the command. */
     if (exec_match_cmd(cmd, c->argv[1])) {
-      int res = exec_ssystem(cmd, c, 0);
+      int res = exec_run(cmd, c, 0);
       if (res != 0) {
         exec_log("%s ExecOnCommand '%s' failed: %s", cmd->argv[0],
           (const char *) c->argv[2], strerror(res));
@@ -1345,7 +1546,7 @@ MODRET exec_post_cmd_err(cmd_rec *cmd) {
     if (exec_match_cmd(cmd, c->argv[1])) {
       int res;
 
-      res = exec_ssystem(cmd, c, 0);
+      res = exec_run(cmd, c, 0);
       if (res != 0) {
         exec_log("%s ExecOnError '%s' failed: %s", cmd->argv[0],
           (const char *) c->argv[2], strerror(res));
@@ -1437,6 +1638,18 @@ MODRET set_execenviron(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: ExecHelper path */
+MODRET set_exechelper(cmd_rec *cmd) {
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (*cmd->argv[1] != '/')
+    CONF_ERROR(cmd, "path to socket must be a full path");
+
+  add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
+  return PR_HANDLED(cmd);
+}
+
 /* usage: ExecLog path|"none" */
 MODRET set_execlog(cmd_rec *cmd) {
   CHECK_ARGS(cmd, 1);
@@ -1721,7 +1934,7 @@ static void exec_any_ev(const void *event_data, void *user_data) {
   if (!exec_engine)
     return;
 
-  res = exec_ssystem(NULL, eed->c, eed->flags);
+  res = exec_run(NULL, eed->c, eed->flags);
   if (res != 0) {
     exec_log("ExecOnEvent '%s' for %s failed: %s", eed->event,
       (const char *) eed->c->argv[2], strerror(res));
@@ -1886,6 +2099,16 @@ static int exec_sess_init(void) {
   exec_closelog();
   exec_openlog();
 
+  exec_helper_path = get_param_ptr(main_server->conf, "ExecHelper", FALSE);
+  if (exec_helper_path != NULL) {
+    exec_helper_fd = exec_helper_open(exec_helper_path);
+    if (exec_helper_fd < 0) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_EXEC_VERSION
+        ": unable to connect to ExecHelper '%s', executing commands "
+        "directly: %s", exec_helper_path, strerror(errno));
+    }
+  }
+
   /* Make sure the User/Group IDs are set, so the the PRIVS_REVOKE call
    * later succeeds properly.
    */
@@ -1941,6 +2164,7 @@ static conftable exec_conftab[] = {
   { "ExecBeforeCommand",set_execbeforecommand,	NULL },
   { "ExecEngine",	set_execengine,		NULL },
   { "ExecEnviron",	set_execenviron,	NULL },
+  { "ExecHelper",	set_exechelper,		NULL },
   { "ExecLog",		set_execlog,		NULL },
   { "ExecOnCommand",	set_execoncommand,	NULL },
   { "ExecOnConnect",	set_execonconnect,	NULL },
@@ -56,49 +56,38 @@ static unsigned long forensic_criteria = FORENSIC_CRIT_DEFAULT;
 /* Use a ring buffer for the cached/buffered log messages; the index pointing
  * to where to stash the next message then moves around the ring.
  *
- * Overwritten messages will be allocated of a module-specific pool.  To
- * prevent this pool from growing unboundedly, we need to clear/destroy it
- * periodically.  But doing this without having to re-copy all of the
- * buffered log lines could be expensive.
- *
- * Instead, what if we use subpools, for every 1/10th of the ring.  When
- * the last message for a subpool is purged/overwritten, that subpool can
- * be destroyed without effecting any existing message in the ring.
+ * Both the ring of message records and the text of the messages are
+ * preallocated, so that capturing a message is just a copy: the text is
+ * appended to a circular string arena, and the record (log type, level, and
+ * the location of the text in the arena) is put in the next slot of the ring.
+ * When either the ring or the arena fills up, the oldest messages are
+ * dropped.  The "[TraceLog:10] " et al prefixes are only formatted when the
+ * messages are written out.
  */
 
 #define FORENSIC_DEFAULT_NMSGS		1024
 
-/* Regardless of the configured ForensicLogBufferSize, this defines the
- * number of messages per sub-pool.
- *
- * Why 256 messages per sub-pool?
- *
- *  80 chars (avg) per message * 256 messages = 20 KB
- *
- * This means that a given sub-pool will hold roughly 20 KB.  Which means
- * that 20 KB + ring max size is the largest memory that mod_log_forensic
- * should hold, before releasing a sub-pool back to the Pool API.
+/* The arena holds, on average, this many bytes of text per buffered message
+ * (SystemLog and TraceLog lines are usually 100-200 bytes).  Longer messages
+ * are truncated to a quarter of the arena.
  */
-
-#define FORENSIC_DEFAULT_MSGS_PER_POOL		256
-static unsigned int forensic_msgs_per_pool = FORENSIC_DEFAULT_MSGS_PER_POOL;
+#define FORENSIC_AVG_MSGLEN		256
 
 struct forensic_msg {
-  pool *fm_pool;
-  unsigned int fm_pool_msgno;
-
   unsigned int fm_log_type;
   int fm_log_level;
-  const char *fm_msg;
+  size_t fm_msgoff;
   size_t fm_msglen;
 };
 
-static struct forensic_msg **forensic_msgs = NULL;
+static struct forensic_msg *forensic_msgs = NULL;
 static unsigned int forensic_nmsgs = FORENSIC_DEFAULT_NMSGS;
 static unsigned int forensic_msg_idx = 0;
+static unsigned int forensic_msg_count = 0;
 
-static pool *forensic_subpool = NULL;
-static unsigned int forensic_subpool_msgno = 1;
+static char *forensic_arena = NULL;
+static size_t forensic_arenasz = 0;
+static size_t forensic_arena_idx = 0;
 
 #define FORENSIC_MAX_LEVELS	50
 static const char *forensic_log_levels[] = {
@@ -109,56 +98,80 @@ static const char *forensic_log_levels[] = {
   "40", "41", "42", "43", "44", "45", "46", "47", "48", "49"
 };
 
+/* Returns the oldest message in the ring. */
+static struct forensic_msg *forensic_get_oldest_msg(void) {
+  unsigned int i;
+
+  i = forensic_msg_idx + forensic_nmsgs - forensic_msg_count;
+  if (i >= forensic_nmsgs) {
+    i -= forensic_nmsgs;
+  }
+
+  return &(forensic_msgs[i]);
+}
+
 static void forensic_add_msg(unsigned int log_type, int log_level,
     const char *log_msg, size_t log_msglen) {
   struct forensic_msg *fm;
-  pool *sub_pool;
-  char *fm_msg;
+  int keep_newline = FALSE;
+
+  if (log_msglen > forensic_arenasz / 4) {
+    keep_newline = (log_msg[log_msglen-1] == '\n');
+    log_msglen = forensic_arenasz / 4;
+  }
 
-  /* Get the message that's currently in the ring where we want add our new
-   * one.
+  /* If the ring is full, the new message replaces the oldest one. */
+  if (forensic_msg_count == forensic_nmsgs) {
+    forensic_msg_count--;
+  }
+
+  /* Make room for the message text in the arena, dropping the oldest
+   * messages whose text would be overwritten.
    */
-  fm = forensic_msgs[forensic_msg_idx];
-  if (fm) {
-    /* If this message is the last one of it subpool, destroy that pool. */
-    if (fm->fm_pool_msgno == forensic_msgs_per_pool) {
-      destroy_pool(fm->fm_pool);
+  if (forensic_arena_idx + log_msglen > forensic_arenasz) {
+    /* Wrap around, dropping any messages at the end of the arena. */
+    while (forensic_msg_count > 0 &&
+           forensic_get_oldest_msg()->fm_msgoff >= forensic_arena_idx) {
+      forensic_msg_count--;
     }
 
-    forensic_msgs[forensic_msg_idx] = NULL;
+    forensic_arena_idx = 0;
+  }
+
+  while (forensic_msg_count > 0) {
+    fm = forensic_get_oldest_msg();
+    if (fm->fm_msgoff < forensic_arena_idx ||
+        fm->fm_msgoff >= forensic_arena_idx + log_msglen) {
+      break;
+    }
+
+    forensic_msg_count--;
+  }
+
+  memcpy(forensic_arena + forensic_arena_idx, log_msg, log_msglen);
+
+  /* Keep the newline which ends a truncated message, lest it run into the
+   * next line of the dump.
+   */
+  if (keep_newline == TRUE) {
+    forensic_arena[forensic_arena_idx + log_msglen - 1] = '\n';
   }
 
   /* Add this message into the ring. */
-  sub_pool = pr_pool_create_sz(forensic_subpool, 128);
-  fm = pcalloc(sub_pool, sizeof(struct forensic_msg)); 
-  fm->fm_pool = sub_pool;
-  fm->fm_pool_msgno = forensic_subpool_msgno;
+  fm = &(forensic_msgs[forensic_msg_idx]);
   fm->fm_log_type = log_type;
   fm->fm_log_level = log_level;
-
-  fm_msg = palloc(fm->fm_pool, log_msglen + 1);
-  memcpy(fm_msg, log_msg, log_msglen);
-  fm_msg[log_msglen] = '\0';   
-
-  fm->fm_msg = fm_msg;
+  fm->fm_msgoff = forensic_arena_idx;
   fm->fm_msglen = log_msglen;
 
-  forensic_msgs[forensic_msg_idx] = fm;
+  forensic_arena_idx += log_msglen;
+  forensic_msg_count++;
 
   forensic_msg_idx += 1;
   if (forensic_msg_idx == forensic_nmsgs) {
     /* Wrap around */
     forensic_msg_idx = 0;
   }
-
-  if (forensic_subpool_msgno == forensic_msgs_per_pool) {
-    /* Time to create a new subpool */
-    forensic_subpool = pr_pool_create_sz(forensic_pool, 256);
-    forensic_subpool_msgno = 1;
-
-  } else {
-    forensic_subpool_msgno++;
-  }
 }
 
 static const char *forensic_get_begin_marker(unsigned int criterion,
@@ -503,17 +516,32 @@ static void forensic_write_metadata(void) {
   res = writev(forensic_logfd, iov, niov);
 }
 
+/* Writes out the given iovecs, retrying if interrupted. */
+static void forensic_writev(struct iovec *iov, int niov) {
+  int res;
+
+  res = writev(forensic_logfd, iov, niov);
+  while (res < 0 &&
+         errno == EINTR) {
+    pr_signals_handle();
+    res = writev(forensic_logfd, iov, niov);
+  }
+}
+
+/* Each message is written using up to 5 iovecs: the log type prefix, level,
+ * prefix end, message, and (for syslog messages) newline.
+ */
+#define FORENSIC_MAX_IOVS	(5 * 64)
+
 static void forensic_write_msgs(unsigned int criterion) {
   register unsigned int i;
-  unsigned int start_idx, end_idx;
-  int res;
+  unsigned int count;
+  int res, niov = 0;
   const char *crit_marker = NULL;
   size_t crit_markerlen = 0;
-
-  /* XXX An interesting optimization would be to rework this code so that
-   * we used writev(2) to write out the buffer as quickly as possible,
-   * taking IOV_MAX into account.
-   */
+  char syslog_suffix[64];
+  size_t syslog_suffixlen;
+  struct iovec iov[FORENSIC_MAX_IOVS];
 
   crit_marker = forensic_get_begin_marker(criterion, &crit_markerlen);
   if (crit_marker != NULL) {
@@ -522,103 +550,93 @@ static void forensic_write_msgs(unsigned int criterion) {
 
   forensic_write_metadata();
 
-  /* The head of the log messages (i.e. the oldest message) is always where we
-   * want to place the newest message.
+  /* syslogd normally adds the PID; we thus need to add the PID in to the
+   * syslog messages as well, to aid in the correlation of these log lines
+   * with other tools/diagnostics.
    */
-  start_idx = forensic_msg_idx;
-  end_idx = forensic_msg_idx - 1;
-  if (forensic_msg_idx == 0) {
-    end_idx = forensic_nmsgs - 1;
+  memset(syslog_suffix, '\0', sizeof(syslog_suffix));
+  res = snprintf(syslog_suffix, sizeof(syslog_suffix)-1, ", PID %lu] ",
+    (unsigned long) (session.pid ? session.pid : getpid()));
+  syslog_suffixlen = res;
+
+  /* Write the messages out from the oldest to the newest, many at a time. */
+  i = forensic_msg_idx + forensic_nmsgs - forensic_msg_count;
+  if (i >= forensic_nmsgs) {
+    i -= forensic_nmsgs;
   }
 
-  i = start_idx;
-  while (i != end_idx) {
+  for (count = 0; count < forensic_msg_count; count++) {
     struct forensic_msg *fm;
+    const char *prefix = NULL, *level;
 
     pr_signals_handle();
 
-    fm = forensic_msgs[i];
-    if (fm != NULL) {
-      const char *level;
-      size_t level_len;
+    fm = &(forensic_msgs[i]);
+
+    switch (fm->fm_log_type) {
+      case PR_LOG_TYPE_UNSPEC:
+        prefix = "[Unspec:";
+        break;
+
+      case PR_LOG_TYPE_XFERLOG:
+        prefix = "[TransferLog:";
+        break;
+
+      case PR_LOG_TYPE_SYSLOG:
+        prefix = "[syslog:";
+        break;
+
+      case PR_LOG_TYPE_SYSTEMLOG:
+        prefix = "[SystemLog:";
+        break;
+
+      case PR_LOG_TYPE_EXTLOG:
+        prefix = "[ExtendedLog:";
+        break;
+
+      case PR_LOG_TYPE_TRACELOG:
+        prefix = "[TraceLog:";
+        break;
+    }
 
+    if (prefix != NULL) {
       level = forensic_get_level_str(fm->fm_log_level);
-      level_len = strlen(level);
-
-      switch (fm->fm_log_type) {
-        case PR_LOG_TYPE_UNSPEC:
-          res = write(forensic_logfd, "[Unspec:", 8);
-          res = write(forensic_logfd, level, level_len);
-          res = write(forensic_logfd, "] ", 2);
-          break;
-
-        case PR_LOG_TYPE_XFERLOG:
-          res = write(forensic_logfd, "[TransferLog:", 13);
-          res = write(forensic_logfd, level, level_len);
-          res = write(forensic_logfd, "] ", 2);
-          break;
-
-        case PR_LOG_TYPE_SYSLOG: {
-          char pid_str[32];
-
-          res = write(forensic_logfd, "[syslog:", 8);
-          res = write(forensic_logfd, level, level_len);
-
-          /* syslogd normally adds the PID; we thus need to add the PID in
-           * here as well, to aid in the correlation of these log lines
-           * with other tools/diagnostics.
-           */
-          res = write(forensic_logfd, ", PID ", 6);
-
-          memset(pid_str, '\0', sizeof(pid_str));
-          res = snprintf(pid_str, sizeof(pid_str)-1, "%lu",
-            (unsigned long) (session.pid ? session.pid : getpid()));
-          res = write(forensic_logfd, pid_str, res);
-
-          res = write(forensic_logfd, "] ", 2);
-          break;
-        }
-
-        case PR_LOG_TYPE_SYSTEMLOG:
-          res = write(forensic_logfd, "[SystemLog:", 11);
-          res = write(forensic_logfd, level, level_len);
-          res = write(forensic_logfd, "] ", 2);
-          break;
-
-        case PR_LOG_TYPE_EXTLOG:
-          res = write(forensic_logfd, "[ExtendedLog:", 13);
-          res = write(forensic_logfd, level, level_len);
-          res = write(forensic_logfd, "] ", 2);
-          break;
-
-        case PR_LOG_TYPE_TRACELOG:
-          res = write(forensic_logfd, "[TraceLog:", 10);
-          res = write(forensic_logfd, level, level_len);
-          res = write(forensic_logfd, "] ", 2);
-          break;
-      }
 
-      res = write(forensic_logfd, fm->fm_msg, fm->fm_msglen);
-      while (res < 0) {
-        if (errno == EINTR) {
-          pr_signals_handle();
-          res = write(forensic_logfd, fm->fm_msg, fm->fm_msglen);
-          continue;
-        }
-      }
+      iov[niov].iov_base = (char *) prefix;
+      iov[niov].iov_len = strlen(prefix);
+      niov++;
+
+      iov[niov].iov_base = (char *) level;
+      iov[niov].iov_len = strlen(level);
+      niov++;
 
-      /* syslog-type messages don't have a newline appended to them, since
-       * syslogd handles that.  So we then need to add our own newline here.
-       */
       if (fm->fm_log_type == PR_LOG_TYPE_SYSLOG) {
-        res = write(forensic_logfd, "\n", 1);
-      }
+        iov[niov].iov_base = syslog_suffix;
+        iov[niov].iov_len = syslog_suffixlen;
 
-      if (fm->fm_pool_msgno == forensic_msgs_per_pool) {
-        destroy_pool(fm->fm_pool);
+      } else {
+        iov[niov].iov_base = "] ";
+        iov[niov].iov_len = 2;
       }
+      niov++;
+    }
+
+    iov[niov].iov_base = forensic_arena + fm->fm_msgoff;
+    iov[niov].iov_len = fm->fm_msglen;
+    niov++;
 
-      forensic_msgs[i] = NULL;
+    /* syslog-type messages don't have a newline appended to them, since
+     * syslogd handles that.  So we then need to add our own newline here.
+     */
+    if (fm->fm_log_type == PR_LOG_TYPE_SYSLOG) {
+      iov[niov].iov_base = "\n";
+      iov[niov].iov_len = 1;
+      niov++;
+    }
+
+    if (niov + 5 > FORENSIC_MAX_IOVS) {
+      forensic_writev(iov, niov);
+      niov = 0;
     }
 
     i++;
@@ -628,6 +646,14 @@ static void forensic_write_msgs(unsigned int criterion) {
     }
   }
 
+  if (niov > 0) {
+    forensic_writev(iov, niov);
+  }
+
+  /* The messages have been written; empty the ring. */
+  forensic_msg_idx = forensic_msg_count = 0;
+  forensic_arena_idx = 0;
+
   crit_marker = forensic_get_end_marker(criterion, &crit_markerlen);
   if (crit_marker != NULL) {
     res = write(forensic_logfd, crit_marker, crit_markerlen);
@@ -951,15 +977,13 @@ static int forensic_sess_init(void) {
     FALSE);
   if (c) {
     forensic_nmsgs = *((unsigned int *) c->argv[0]);
-
-    if (forensic_nmsgs < forensic_msgs_per_pool) {
-      forensic_msgs_per_pool = forensic_nmsgs;
-    }
   }
 
   forensic_msgs = pcalloc(forensic_pool,
     sizeof(struct forensic_msg) * forensic_nmsgs);
-  forensic_subpool = pr_pool_create_sz(forensic_pool, 256);
+
+  forensic_arenasz = (size_t) forensic_nmsgs * FORENSIC_AVG_MSGLEN;
+  forensic_arena = palloc(forensic_pool, forensic_arenasz);
 
   /* We register our event listeners as the last thing we do. */
 
@@ -970,32 +994,32 @@ static int forensic_sess_init(void) {
   }
 
   if (unspec_listen) {
-    pr_event_register(&log_forensic_module, "core.log.unspec", forensic_log_ev,
+    pr_event_register(&log_forensic_module, PR_LOG_NAME_UNSPEC, forensic_log_ev,
       NULL);
   }
 
   if (xferlog_listen) {
-    pr_event_register(&log_forensic_module, "core.log.xferlog", forensic_log_ev,
+    pr_event_register(&log_forensic_module, PR_LOG_NAME_XFERLOG, forensic_log_ev,
       NULL);
   }
 
   if (syslog_listen) {
-    pr_event_register(&log_forensic_module, "core.log.syslog", forensic_log_ev,
+    pr_event_register(&log_forensic_module, PR_LOG_NAME_SYSLOG, forensic_log_ev,
       NULL);
   }
 
   if (systemlog_listen) {
-    pr_event_register(&log_forensic_module, "core.log.systemlog",
+    pr_event_register(&log_forensic_module, PR_LOG_NAME_SYSTEMLOG,
       forensic_log_ev, NULL);
   }
 
   if (extlog_listen) {
-    pr_event_register(&log_forensic_module, "core.log.extlog", forensic_log_ev,
+    pr_event_register(&log_forensic_module, PR_LOG_NAME_EXTLOG, forensic_log_ev,
       NULL);
   }
 
   if (tracelog_listen) {
-    pr_event_register(&log_forensic_module, "core.log.tracelog",
+    pr_event_register(&log_forensic_module, PR_LOG_NAME_TRACELOG,
       forensic_log_ev, NULL);
   }
 
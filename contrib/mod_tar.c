@@ -0,0 +1,1280 @@
+/*
+ * ProFTPD: mod_tar -- a module for streaming files to clients as tar archives
+ *
+ * Copyright (c) 2014 The ProFTPD Project team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, The ProFTPD Project team and other respective
+ * copyright holders give permission to link this program with OpenSSL, and
+ * distribute the resulting executable, without including the source code for
+ * OpenSSL in the source distribution.
+ *
+ * This is mod_tar, contrib software for proftpd 1.3.x and above.
+ */
+
+#include "conf.h"
+#include "privs.h"
+
+#define MOD_TAR_VERSION		"mod_tar/0.1"
+
+/* Make sure the version of proftpd is as necessary. */
+#if PROFTPD_VERSION_NUMBER < 0x0001030504
+# error "ProFTPD 1.3.5rc4 or later required"
+#endif
+
+module tar_module;
+
+#define TAR_DEFAULT_RETR_SUFFIX		".tar"
+
+static int tar_engine = FALSE;
+static int tar_logfd = -1;
+static const char *tar_retr_suffix = TAR_DEFAULT_RETR_SUFFIX;
+
+static const char *trace_channel = "tar";
+
+#define TAR_BLOCKSZ		512
+
+/* The POSIX ustar header. */
+struct tar_header {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char chksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char pad[12];
+};
+
+/* The archive being streamed over the data connection.  Headers, and the
+ * contents of small files, are gathered into the buffer, so that many small
+ * files go out in a few large writes; larger files are sent directly, using
+ * sendfile(2) where possible.
+ */
+struct tar_stream {
+  char *buf;
+  size_t bufsz;
+  size_t buflen;
+  int use_sendfile;
+
+  /* Whether each file is logged as a transfer of its own; when the archive
+   * is sent for a RETR, mod_xfer logs the archive instead.
+   */
+  int log_files;
+
+  unsigned int nfiles;
+  unsigned int nskipped;
+};
+
+static const char tar_zeros[TAR_BLOCKSZ];
+
+/* Archive writing
+ */
+
+static int tar_flush(struct tar_stream *ts) {
+  if (ts->buflen == 0) {
+    return 0;
+  }
+
+  if (pr_data_xfer(ts->buf, ts->buflen) < 0) {
+    return -1;
+  }
+
+  ts->buflen = 0;
+
+  /* If no throttling is configured, this simply updates the scoreboard. */
+  pr_throttle_pause(session.xfer.total_bytes, FALSE);
+  return 0;
+}
+
+static int tar_write(struct tar_stream *ts, const char *data, size_t datalen) {
+  while (datalen > 0) {
+    size_t len;
+
+    pr_signals_handle();
+
+    if (ts->buflen == ts->bufsz) {
+      if (tar_flush(ts) < 0) {
+        return -1;
+      }
+    }
+
+    len = ts->bufsz - ts->buflen;
+    if (len > datalen) {
+      len = datalen;
+    }
+
+    memcpy(ts->buf + ts->buflen, data, len);
+    ts->buflen += len;
+    data += len;
+    datalen -= len;
+  }
+
+  return 0;
+}
+
+static int tar_write_padding(struct tar_stream *ts, off_t len) {
+  size_t padlen;
+
+  padlen = (size_t) (len % TAR_BLOCKSZ);
+  if (padlen == 0) {
+    return 0;
+  }
+
+  return tar_write(ts, tar_zeros, TAR_BLOCKSZ - padlen);
+}
+
+static void tar_set_number(char *field, size_t fieldsz,
+    unsigned long long val) {
+  register int i;
+
+  /* Values that do not fit into the field as octal digits (e.g. sizes of
+   * 8GB or more) use the base-256 encoding understood by GNU tar, bsdtar
+   * et al.
+   */
+  if (val < (1ULL << (3 * (fieldsz - 1)))) {
+    for (i = fieldsz - 2; i >= 0; i--) {
+      field[i] = '0' + (char) (val & 07);
+      val >>= 3;
+    }
+
+    field[fieldsz - 1] = '\0';
+    return;
+  }
+
+  memset(field, '\0', fieldsz);
+  for (i = fieldsz - 1; i > 0; i--) {
+    field[i] = (char) (val & 0xff);
+    val >>= 8;
+  }
+  field[0] = (char) 0x80;
+}
+
+static int tar_write_longlink(struct tar_stream *ts, char typeflag,
+    const char *str, size_t len) {
+  register unsigned int i;
+  struct tar_header hdr;
+  const unsigned char *ptr;
+  unsigned long chksum = 0;
+
+  memset(&hdr, '\0', sizeof(hdr));
+  sstrncpy(hdr.name, "././@LongLink", sizeof(hdr.name));
+  tar_set_number(hdr.mode, sizeof(hdr.mode), 0644);
+  tar_set_number(hdr.uid, sizeof(hdr.uid), 0);
+  tar_set_number(hdr.gid, sizeof(hdr.gid), 0);
+  tar_set_number(hdr.size, sizeof(hdr.size), len + 1);
+  tar_set_number(hdr.mtime, sizeof(hdr.mtime), 0);
+  hdr.typeflag = typeflag;
+  memcpy(hdr.magic, "ustar ", 6);
+  memcpy(hdr.version, " ", 2);
+
+  memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+  ptr = (const unsigned char *) &hdr;
+  for (i = 0; i < sizeof(hdr); i++) {
+    chksum += ptr[i];
+  }
+  tar_set_number(hdr.chksum, sizeof(hdr.chksum) - 1, chksum);
+
+  if (tar_write(ts, (const char *) &hdr, sizeof(hdr)) < 0 ||
+      tar_write(ts, str, len + 1) < 0 ||
+      tar_write_padding(ts, len + 1) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static int tar_write_header(struct tar_stream *ts, const char *name,
+    struct stat *st, char typeflag, const char *linkname) {
+  register unsigned int i;
+  struct tar_header hdr;
+  const unsigned char *ptr;
+  unsigned long chksum = 0;
+  size_t namelen;
+
+  namelen = strlen(name);
+
+  memset(&hdr, '\0', sizeof(hdr));
+
+  if (namelen <= sizeof(hdr.name)) {
+    memcpy(hdr.name, name, namelen);
+
+  } else {
+    const char *sep = NULL;
+
+    /* Split the name into the prefix and name fields, at a slash which
+     * leaves each part short enough.
+     */
+    for (i = 0; i < namelen && i <= sizeof(hdr.prefix); i++) {
+      if (name[i] == '/' &&
+          (namelen - i - 1) <= sizeof(hdr.name)) {
+        sep = name + i;
+        break;
+      }
+    }
+
+    if (sep != NULL &&
+        sep != name &&
+        sep[1] != '\0') {
+      memcpy(hdr.prefix, name, sep - name);
+      memcpy(hdr.name, sep + 1, namelen - (sep - name) - 1);
+
+    } else {
+      /* Too long for ustar; precede the header with a GNU long name
+       * record.
+       */
+      if (tar_write_longlink(ts, 'L', name, namelen) < 0) {
+        return -1;
+      }
+
+      memcpy(hdr.name, name, sizeof(hdr.name));
+    }
+  }
+
+  if (linkname != NULL) {
+    size_t linklen;
+
+    linklen = strlen(linkname);
+    if (linklen > sizeof(hdr.linkname)) {
+      if (tar_write_longlink(ts, 'K', linkname, linklen) < 0) {
+        return -1;
+      }
+
+      linklen = sizeof(hdr.linkname);
+    }
+
+    memcpy(hdr.linkname, linkname, linklen);
+  }
+
+  tar_set_number(hdr.mode, sizeof(hdr.mode), st->st_mode & 07777);
+  tar_set_number(hdr.uid, sizeof(hdr.uid), (unsigned long) st->st_uid);
+  tar_set_number(hdr.gid, sizeof(hdr.gid), (unsigned long) st->st_gid);
+  tar_set_number(hdr.size, sizeof(hdr.size),
+    typeflag == '0' ? st->st_size : 0);
+  tar_set_number(hdr.mtime, sizeof(hdr.mtime), (unsigned long) st->st_mtime);
+  hdr.typeflag = typeflag;
+  memcpy(hdr.magic, "ustar", 6);
+  memcpy(hdr.version, "00", 2);
+
+  /* The uname/gname fields are left empty, rather than looking up the names
+   * for every entry; extracting tools fall back to the numeric IDs.
+   */
+
+  memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+  ptr = (const unsigned char *) &hdr;
+  for (i = 0; i < sizeof(hdr); i++) {
+    chksum += ptr[i];
+  }
+  tar_set_number(hdr.chksum, sizeof(hdr.chksum) - 1, chksum);
+
+  return tar_write(ts, (const char *) &hdr, sizeof(hdr));
+}
+
+/* Reads up to datalen bytes of the file into the stream.  Returns the number
+ * of bytes not sent (if the file shrank), or -1 on error.
+ */
+static off_t tar_write_fh(struct tar_stream *ts, pr_fh_t *fh, off_t datalen) {
+  while (datalen > 0) {
+    int res;
+    size_t len;
+
+    pr_signals_handle();
+
+    if (XFER_ABORTED) {
+      errno = EINTR;
+      return -1;
+    }
+
+    if (ts->buflen == ts->bufsz) {
+      if (tar_flush(ts) < 0) {
+        return -1;
+      }
+    }
+
+    len = ts->bufsz - ts->buflen;
+    if ((off_t) len > datalen) {
+      len = (size_t) datalen;
+    }
+
+    res = pr_fsio_read(fh, ts->buf + ts->buflen, len);
+    if (res < 0) {
+      return -1;
+    }
+
+    if (res == 0) {
+      break;
+    }
+
+    ts->buflen += res;
+    datalen -= res;
+  }
+
+  return datalen;
+}
+
+#ifdef HAVE_SENDFILE
+/* Sends up to datalen bytes of the file using sendfile(2).  Returns the number
+ * of bytes not sent, or -1 on error.  If sendfile(2) turns out not to work
+ * here, the rest of the file is read into the stream instead.
+ */
+static off_t tar_sendfile_fh(struct tar_stream *ts, pr_fh_t *fh,
+    off_t datalen) {
+  off_t offset = 0;
+
+  if (tar_flush(ts) < 0) {
+    return -1;
+  }
+
+  while (datalen > 0) {
+    pr_sendfile_t len;
+
+    len = pr_data_sendfile(PR_FH_FD(fh), &offset, datalen);
+    if (len < 0) {
+      int xerrno = errno;
+
+      switch (xerrno) {
+        case EAGAIN:
+        case EINTR:
+          if (XFER_ABORTED) {
+            errno = xerrno;
+            return -1;
+          }
+
+          pr_signals_handle();
+          continue;
+
+#ifdef ENOSYS
+        case ENOSYS:
+#endif /* ENOSYS */
+#ifdef EOVERFLOW
+        case EOVERFLOW:
+#endif /* EOVERFLOW */
+        case EINVAL:
+          pr_trace_msg(trace_channel, 3,
+            "unable to use sendfile for '%s' (%s), reading instead",
+            fh->fh_path, strerror(xerrno));
+          ts->use_sendfile = FALSE;
+
+          if (pr_fsio_lseek(fh, offset, SEEK_SET) == (off_t) -1) {
+            return -1;
+          }
+
+          return tar_write_fh(ts, fh, datalen);
+
+        default:
+          errno = xerrno;
+          return -1;
+      }
+    }
+
+    if (len == 0) {
+      break;
+    }
+
+    datalen -= len;
+    pr_throttle_pause(session.xfer.total_bytes, FALSE);
+  }
+
+  return datalen;
+}
+#endif /* HAVE_SENDFILE */
+
+/* Returns the name to use for the given path in the archive: relative, and
+ * without any ".." components.
+ */
+static const char *tar_get_entry_name(pool *p, const char *path) {
+  const char *name;
+
+  name = path;
+  if (strstr(name, "..") != NULL) {
+    name = dir_canonical_vpath(p, name);
+  }
+
+  while (*name == '/') {
+    name++;
+  }
+
+  if (*name == '\0') {
+    name = ".";
+  }
+
+  return name;
+}
+
+/* Checks the given path as if it were being downloaded with RETR, so that
+ * the same <Limit> and <Directory> configuration applies.  Returns TRUE if
+ * the path may be sent; *hidden is set if it is hidden by e.g. HideFiles.
+ */
+static int tar_check_path(pool *p, const char *path, int *hidden) {
+  cmd_rec *retr_cmd;
+
+  retr_cmd = pr_cmd_alloc(p, 2, pstrdup(p, C_RETR), pstrdup(p, path));
+  retr_cmd->arg = pstrdup(p, path);
+  retr_cmd->cmd_class = CL_READ;
+  retr_cmd->cmd_id = pr_cmd_get_id(C_RETR);
+  retr_cmd->group = G_READ;
+
+  return dir_check(p, retr_cmd, G_READ, path, hidden);
+}
+
+/* Adds the given regular file to the archive, as the given name.  Returns
+ * 0 if the file was added, 1 if it was skipped, and -1 if the archive could
+ * not be written.
+ */
+static int tar_add_file(pool *p, struct tar_stream *ts, const char *path,
+    struct stat *st, const char *name) {
+  pr_fh_t *fh;
+  off_t remaining;
+  struct timeval start_time, end_time;
+
+  fh = pr_fsio_open(path, O_RDONLY);
+  if (fh == NULL) {
+    int xerrno = errno;
+
+    (void) pr_trace_msg("fileperms", 1, "%s, user '%s' (UID %lu, GID %lu): "
+      "error opening '%s': %s", session.curr_cmd, session.user,
+      (unsigned long) session.uid, (unsigned long) session.gid,
+      path, strerror(xerrno));
+
+    (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+      "skipping '%s': %s", path, strerror(xerrno));
+    ts->nskipped++;
+    return 1;
+  }
+
+  gettimeofday(&start_time, NULL);
+
+  if (tar_write_header(ts, name, st, '0', NULL) < 0) {
+    int xerrno = errno;
+
+    pr_fsio_close(fh);
+    errno = xerrno;
+    return -1;
+  }
+
+#ifdef HAVE_SENDFILE
+  /* Small files are gathered into the buffer along with their headers;
+   * sendfile(2) only pays off for larger ones.
+   */
+  if (ts->use_sendfile &&
+      st->st_size >= (off_t) ts->bufsz) {
+    remaining = tar_sendfile_fh(ts, fh, st->st_size);
+
+  } else {
+    remaining = tar_write_fh(ts, fh, st->st_size);
+  }
+#else
+  remaining = tar_write_fh(ts, fh, st->st_size);
+#endif /* HAVE_SENDFILE */
+
+  if (remaining < 0) {
+    int xerrno = errno;
+
+    pr_fsio_close(fh);
+    errno = xerrno;
+    return -1;
+  }
+
+  pr_fsio_close(fh);
+
+  /* The header has already been sent; if the file shrank since then, pad
+   * it out to the size given in the header, to keep the archive readable.
+   */
+  if (remaining > 0) {
+    (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+      "'%s' shrank while being sent, padding %" PR_LU " missing bytes", path,
+      (pr_off_t) remaining);
+
+    while (remaining > 0) {
+      size_t len = TAR_BLOCKSZ;
+
+      if ((off_t) len > remaining) {
+        len = (size_t) remaining;
+      }
+
+      if (tar_write(ts, tar_zeros, len) < 0) {
+        return -1;
+      }
+
+      remaining -= len;
+    }
+  }
+
+  if (tar_write_padding(ts, st->st_size) < 0) {
+    return -1;
+  }
+
+  ts->nfiles++;
+
+  if (ts->log_files) {
+    char *full_path;
+
+    /* Log each file, as RETR would. */
+    gettimeofday(&end_time, NULL);
+    full_path = dir_abs_path(p, path, TRUE);
+
+    xferlog_write(end_time.tv_sec - start_time.tv_sec,
+      pr_netaddr_get_sess_remote_name(), st->st_size, full_path, 'b', 'o',
+      (session.sf_flags & SF_ANON) ? 'a' : 'r',
+      (session.sf_flags & SF_ANON) ? session.anon_user : session.user, 'c',
+      "_");
+
+    session.total_files_out++;
+    session.total_files_xfer++;
+    pr_metrics_incr(PR_METRICS_CTR_FILES_OUT, 1);
+  }
+
+  pr_scoreboard_entry_update(session.pid,
+    PR_SCORE_XFER_DONE, session.xfer.total_bytes,
+    NULL);
+
+  pr_trace_msg(trace_channel, 15, "added '%s' (%" PR_LU " bytes) as '%s'",
+    path, (pr_off_t) st->st_size, name);
+  return 0;
+}
+
+static int tar_add_symlink(pool *p, struct tar_stream *ts, const char *path,
+    struct stat *st, const char *name) {
+  char linkname[PR_TUNABLE_PATH_MAX + 1];
+  int len;
+
+  len = pr_fsio_readlink(path, linkname, sizeof(linkname) - 1);
+  if (len < 0) {
+    (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+      "skipping '%s': %s", path, strerror(errno));
+    ts->nskipped++;
+    return 1;
+  }
+
+  linkname[len] = '\0';
+
+  if (tar_write_header(ts, name, st, '2', linkname) < 0) {
+    return -1;
+  }
+
+  pr_trace_msg(trace_channel, 15, "added symlink '%s' (-> '%s') as '%s'",
+    path, linkname, name);
+  return 0;
+}
+
+static int tar_entry_cmp(const void *a, const void *b) {
+  return strcmp(*((const char **) a), *((const char **) b));
+}
+
+/* Adds the given directory, and everything below it which the session may
+ * RETR, to the archive.  Symlinks are added as symlinks, not followed, so
+ * the walk cannot leave the tree (or loop).
+ */
+static int tar_add_dir(pool *p, struct tar_stream *ts, const char *path,
+    struct stat *st, const char *name) {
+  register unsigned int i;
+  void *dirh;
+  struct dirent *dent;
+  array_header *entries;
+
+  if (tar_write_header(ts, pstrcat(p, name, "/", NULL), st, '5', NULL) < 0) {
+    return -1;
+  }
+
+  /* Read the entire directory before descending into it, so that a deep
+   * tree does not hold a directory handle open for every level; sorting the
+   * entries also means that the same tree always yields the same archive.
+   */
+  dirh = pr_fsio_opendir(path);
+  if (dirh == NULL) {
+    (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+      "unable to read directory '%s': %s", path, strerror(errno));
+    ts->nskipped++;
+    return 1;
+  }
+
+  entries = make_array(p, 0, sizeof(char *));
+
+  while ((dent = pr_fsio_readdir(dirh)) != NULL) {
+    pr_signals_handle();
+
+    if (strcmp(dent->d_name, ".") == 0 ||
+        strcmp(dent->d_name, "..") == 0) {
+      continue;
+    }
+
+    *((char **) push_array(entries)) = pstrdup(p, dent->d_name);
+  }
+
+  pr_fsio_closedir(dirh);
+
+  qsort(entries->elts, entries->nelts, sizeof(char *), tar_entry_cmp);
+
+  for (i = 0; i < entries->nelts; i++) {
+    int res, hidden = FALSE;
+    char *entry, *entry_path, *entry_name;
+    struct stat entry_st;
+    pool *tmp_pool;
+
+    pr_signals_handle();
+
+    if (XFER_ABORTED) {
+      errno = EINTR;
+      return -1;
+    }
+
+    entry = ((char **) entries->elts)[i];
+
+    tmp_pool = make_sub_pool(p);
+    entry_path = pdircat(tmp_pool, path, entry, NULL);
+    entry_name = pstrcat(tmp_pool, name, "/", entry, NULL);
+
+    pr_fs_clear_cache();
+    if (pr_fsio_lstat(entry_path, &entry_st) < 0) {
+      (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+        "skipping '%s': %s", entry_path, strerror(errno));
+      ts->nskipped++;
+      destroy_pool(tmp_pool);
+      continue;
+    }
+
+    if (!tar_check_path(tmp_pool, entry_path, &hidden) ||
+        hidden) {
+      /* Hidden entries are left out quietly, as they would be from LIST. */
+      if (!hidden) {
+        (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+          "skipping '%s': %s", entry_path, strerror(EACCES));
+        ts->nskipped++;
+      }
+
+      destroy_pool(tmp_pool);
+      continue;
+    }
+
+    if (S_ISREG(entry_st.st_mode)) {
+      res = tar_add_file(tmp_pool, ts, entry_path, &entry_st, entry_name);
+
+    } else if (S_ISDIR(entry_st.st_mode)) {
+      res = tar_add_dir(tmp_pool, ts, entry_path, &entry_st, entry_name);
+
+    } else if (S_ISLNK(entry_st.st_mode)) {
+      res = tar_add_symlink(tmp_pool, ts, entry_path, &entry_st, entry_name);
+
+    } else {
+      (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+        "skipping '%s': not a regular file, directory, or symlink",
+        entry_path);
+      ts->nskipped++;
+      res = 1;
+    }
+
+    destroy_pool(tmp_pool);
+
+    if (res < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Adds the given path (a file, or a directory tree) to the archive, as the
+ * given name, if the session may RETR it.  Returns 0 if the path was added,
+ * 1 if it was skipped, and -1 if the archive could not be written.
+ */
+static int tar_add_path(pool *p, struct tar_stream *ts, const char *path,
+    const char *name) {
+  char *real_path;
+  struct stat st;
+
+  real_path = dir_realpath(p, path);
+  if (real_path == NULL ||
+      !tar_check_path(p, real_path, NULL)) {
+    (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+      "skipping '%s': %s", path, strerror(errno));
+    ts->nskipped++;
+    return 1;
+  }
+
+  pr_fs_clear_cache();
+  if (pr_fsio_stat(real_path, &st) < 0) {
+    (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+      "skipping '%s': %s", path, strerror(errno));
+    ts->nskipped++;
+    return 1;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    return tar_add_file(p, ts, real_path, &st, name);
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    return tar_add_dir(p, ts, real_path, &st, name);
+  }
+
+  (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+    "skipping '%s': not a regular file or directory", path);
+  ts->nskipped++;
+  return 1;
+}
+
+/* Ends the archive with two zero blocks, and flushes it out. */
+static int tar_finish(struct tar_stream *ts) {
+  if (tar_write(ts, tar_zeros, TAR_BLOCKSZ) < 0 ||
+      tar_write(ts, tar_zeros, TAR_BLOCKSZ) < 0) {
+    return -1;
+  }
+
+  return tar_flush(ts);
+}
+
+static void tar_stream_init(pool *p, struct tar_stream *ts) {
+  memset(ts, '\0', sizeof(struct tar_stream));
+
+  ts->bufsz = pr_config_get_server_xfer_bufsz(PR_NETIO_IO_WR);
+  ts->buf = palloc(p, ts->bufsz);
+  ts->buflen = 0;
+
+  /* As for RETR, sendfile(2) cannot be used if the data has to be modified
+   * on its way out (e.g. for TLS, or MODE Z), or throttled.
+   */
+  ts->use_sendfile = FALSE;
+
+#ifdef HAVE_SENDFILE
+  if (pr_get_netio(PR_NETIO_STRM_DATA) == NULL &&
+      pr_throttle_have_rate() == FALSE) {
+    unsigned char *use_sendfile;
+
+    use_sendfile = get_param_ptr(CURRENT_CONF, "UseSendfile", FALSE);
+    if (use_sendfile == NULL ||
+        *use_sendfile == TRUE) {
+      ts->use_sendfile = TRUE;
+    }
+  }
+#endif /* HAVE_SENDFILE */
+}
+
+/* Streams an archive of the given paths (an array of char * pairs, the path
+ * and its name in the archive) over a new data connection.  On success, the
+ * data connection is closed quietly, for the caller to send the final
+ * response; on failure, it is aborted.
+ */
+static int tar_send_archive(cmd_rec *cmd, const char *xfer_path,
+    array_header *paths, struct tar_stream *ts) {
+  register unsigned int i;
+  int res, ascii = FALSE;
+  const char *cmd_name;
+
+  cmd_name = cmd->argv[0];
+  if (pr_cmd_cmp(cmd, PR_CMD_SITE_ID) == 0) {
+    cmd_name = pstrcat(cmd->tmp_pool, cmd_name, " ", cmd->argv[1], NULL);
+  }
+
+  /* The archive is binary data, regardless of the current TYPE. */
+  if (session.sf_flags & SF_ASCII) {
+    ascii = TRUE;
+    session.sf_flags &= ~SF_ASCII;
+  }
+
+  pr_throttle_init(cmd);
+  tar_stream_init(cmd->tmp_pool, ts);
+  ts->log_files = (pr_cmd_cmp(cmd, PR_CMD_RETR_ID) != 0);
+
+  pr_data_init((char *) xfer_path, PR_NETIO_IO_WR);
+  session.xfer.path = pstrdup(session.xfer.p, xfer_path);
+  session.xfer.file_size = 0;
+
+  if (pr_data_open((char *) xfer_path, NULL, PR_NETIO_IO_WR, 0) < 0) {
+    int xerrno = errno;
+
+    if (ascii) {
+      session.sf_flags |= SF_ASCII;
+    }
+
+    pr_data_abort(0, TRUE);
+
+    errno = xerrno;
+    return -1;
+  }
+
+  if (pr_inet_set_proto_cork(PR_NETIO_FD(session.d->outstrm), 1) < 0) {
+    pr_trace_msg(trace_channel, 9, "error corking socket fd %d: %s",
+      PR_NETIO_FD(session.d->outstrm), strerror(errno));
+  }
+
+  res = 0;
+  for (i = 0; i < paths->nelts; i += 2) {
+    char *path, *name;
+    pool *tmp_pool;
+
+    pr_signals_handle();
+
+    if (XFER_ABORTED) {
+      res = -1;
+      break;
+    }
+
+    path = ((char **) paths->elts)[i];
+    name = ((char **) paths->elts)[i+1];
+
+    tmp_pool = make_sub_pool(cmd->tmp_pool);
+    res = tar_add_path(tmp_pool, ts, path, name);
+    destroy_pool(tmp_pool);
+
+    if (res < 0) {
+      break;
+    }
+
+    res = 0;
+  }
+
+  if (res == 0) {
+    res = tar_finish(ts);
+  }
+
+  if (ascii) {
+    session.sf_flags |= SF_ASCII;
+  }
+
+  if (res < 0 ||
+      XFER_ABORTED) {
+    int xerrno = XFER_ABORTED ? 0 : errno;
+
+    (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+      "%s %s aborted after %u %s", cmd_name, xfer_path,
+      ts->nfiles, ts->nfiles != 1 ? "files" : "file");
+
+    pr_data_abort(xerrno, FALSE);
+    return -1;
+  }
+
+  (void) pr_inet_set_proto_cork(PR_NETIO_FD(session.d->outstrm), 0);
+  pr_throttle_pause(session.xfer.total_bytes, TRUE);
+
+  (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+    "%s %s: sent %u %s (%" PR_LU " bytes), skipped %u",
+    cmd_name, xfer_path, ts->nfiles,
+    ts->nfiles != 1 ? "files" : "file",
+    (pr_off_t) session.xfer.total_bytes, ts->nskipped);
+
+  pr_data_close(TRUE);
+  return 0;
+}
+
+/* Command handlers
+ */
+
+/* Handles RETR of a directory name plus the TarRetrSuffix (e.g. "dir.tar"),
+ * when no such file exists, by streaming an archive of the directory.  The
+ * full path of the directory is left in cmd->notes for the CMD handler, and
+ * the 'mod_xfer.retr-handled' note tells mod_xfer's PRE_CMD handler not to
+ * reject the nonexistent file.  The command is declined, so that any other
+ * PRE_CMD RETR handlers still run.
+ */
+MODRET tar_pre_retr(cmd_rec *cmd) {
+  char *path, *dir_path, *real_dir;
+  size_t pathlen, suffixlen;
+  struct stat st;
+
+  if (tar_engine == FALSE ||
+      tar_retr_suffix == NULL) {
+    return PR_DECLINED(cmd);
+  }
+
+  if (cmd->argc < 2) {
+    return PR_DECLINED(cmd);
+  }
+
+  path = pr_fs_decode_path(cmd->tmp_pool, cmd->arg);
+  pathlen = strlen(path);
+  suffixlen = strlen(tar_retr_suffix);
+
+  if (pathlen <= suffixlen ||
+      strcmp(path + pathlen - suffixlen, tar_retr_suffix) != 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  /* An actual file of that name is sent as is. */
+  pr_fs_clear_cache();
+  if (pr_fsio_stat(path, &st) == 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  dir_path = pstrndup(cmd->tmp_pool, path, pathlen - suffixlen);
+  if (dir_path[strlen(dir_path)-1] == '/') {
+    return PR_DECLINED(cmd);
+  }
+
+  real_dir = dir_realpath(cmd->tmp_pool, dir_path);
+  if (real_dir == NULL ||
+      pr_fsio_stat(real_dir, &st) < 0 ||
+      !S_ISDIR(st.st_mode)) {
+    return PR_DECLINED(cmd);
+  }
+
+  if (!dir_check(cmd->tmp_pool, cmd, cmd->group, real_dir, NULL)) {
+    int xerrno = errno;
+
+    pr_response_add_err(R_550, "%s: %s", cmd->arg, strerror(xerrno));
+
+    errno = xerrno;
+    return PR_ERROR(cmd);
+  }
+
+  if (session.restart_pos) {
+    pr_response_add_err(R_451, _("%s: Restart not permitted, try again"),
+      cmd->arg);
+    session.restart_pos = 0L;
+
+    errno = EPERM;
+    return PR_ERROR(cmd);
+  }
+
+  if (pr_table_add(cmd->notes, "mod_tar.retr-dir",
+      pstrdup(cmd->pool, real_dir), 0) < 0) {
+    if (errno != EEXIST) {
+      (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+        "error adding 'mod_tar.retr-dir' note: %s", strerror(errno));
+    }
+  }
+
+  /* For logging, e.g. the %f LogFormat variable. */
+  if (pr_table_add(cmd->notes, "mod_xfer.retr-path",
+      pstrcat(cmd->pool, real_dir, tar_retr_suffix, NULL), 0) < 0) {
+    if (errno != EEXIST) {
+      (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+        "error adding 'mod_xfer.retr-path' note: %s", strerror(errno));
+    }
+  }
+
+  if (pr_table_add(cmd->notes, "mod_xfer.retr-handled",
+      pstrdup(cmd->pool, "true"), 0) < 0) {
+    if (errno != EEXIST) {
+      (void) pr_log_writefile(tar_logfd, MOD_TAR_VERSION,
+        "error adding 'mod_xfer.retr-handled' note: %s", strerror(errno));
+    }
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+MODRET tar_retr(cmd_rec *cmd) {
+  char *real_dir, *name;
+  array_header *paths;
+  struct tar_stream ts;
+
+  real_dir = pr_table_get(cmd->notes, "mod_tar.retr-dir", NULL);
+  if (real_dir == NULL) {
+    return PR_DECLINED(cmd);
+  }
+
+  /* The archive contains the directory itself, by its own name. */
+  name = strrchr(real_dir, '/');
+  name = (name != NULL && name[1] != '\0') ? name + 1 : "root";
+
+  paths = make_array(cmd->tmp_pool, 2, sizeof(char *));
+  *((char **) push_array(paths)) = real_dir;
+  *((char **) push_array(paths)) = name;
+
+  if (tar_send_archive(cmd, pr_fs_decode_path(cmd->tmp_pool, cmd->arg),
+      paths, &ts) < 0) {
+    return PR_ERROR(cmd);
+  }
+
+  pr_response_add(R_226, _("Transfer complete (%u %s sent, %u skipped)"),
+    ts.nfiles, ts.nfiles != 1 ? "files" : "file", ts.nskipped);
+  return PR_HANDLED(cmd);
+}
+
+MODRET tar_mretr(cmd_rec *cmd) {
+  register unsigned int i;
+  int res;
+  char *patterns = "";
+  unsigned char *authenticated = NULL;
+  array_header *paths;
+  struct tar_stream ts;
+
+  if (tar_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  if (cmd->argc < 3 ||
+      strncasecmp(cmd->argv[1], "MRETR", 6) != 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  authenticated = get_param_ptr(cmd->server->conf, "authenticated", FALSE);
+  if (authenticated == NULL ||
+      *authenticated == FALSE) {
+    pr_response_add_err(R_530, _("Please login with USER and PASS"));
+
+    errno = EPERM;
+    return PR_ERROR(cmd);
+  }
+
+  /* Expand each of the given paths/glob patterns into the list of files
+   * (and directories) to send.
+   */
+  paths = make_array(cmd->tmp_pool, 0, sizeof(char *));
+
+  for (i = 2; i < cmd->argc; i++) {
+    register unsigned int j;
+    char *pattern;
+    glob_t gl;
+
+    pattern = pr_fs_decode_path(cmd->tmp_pool, cmd->argv[i]);
+    patterns = pstrcat(cmd->tmp_pool, patterns, *patterns ? " " : "",
+      pattern, NULL);
+
+    memset(&gl, '\0', sizeof(gl));
+
+    res = pr_fs_glob(pattern, GLOB_NOCHECK, NULL, &gl);
+    if (res != 0) {
+      pr_trace_msg(trace_channel, 3, "error globbing '%s': %s", pattern,
+        res == GLOB_NOSPACE ? "out of memory" : "read error");
+      pr_fs_globfree(&gl);
+      continue;
+    }
+
+    for (j = 0; j < gl.gl_pathc; j++) {
+      char *path;
+
+      path = pstrdup(cmd->tmp_pool, gl.gl_pathv[j]);
+      *((char **) push_array(paths)) = path;
+      *((const char **) push_array(paths)) = tar_get_entry_name(cmd->tmp_pool,
+        path);
+    }
+
+    pr_fs_globfree(&gl);
+  }
+
+  if (paths->nelts == 0) {
+    pr_response_add_err(R_550, _("%s: No files found"), patterns);
+
+    errno = ENOENT;
+    return PR_ERROR(cmd);
+  }
+
+  if (tar_send_archive(cmd, patterns, paths, &ts) < 0) {
+    return PR_ERROR(cmd);
+  }
+
+  pr_response_add(R_226, _("Transfer complete (%u %s sent, %u skipped)"),
+    ts.nfiles, ts.nfiles != 1 ? "files" : "file", ts.nskipped);
+  return PR_HANDLED(cmd);
+}
+
+MODRET tar_log_site(cmd_rec *cmd) {
+  if (tar_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  if (cmd->argc < 3 ||
+      strncasecmp(cmd->argv[1], "MRETR", 6) != 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  /* Clean up the data connection info in the session structure. */
+  pr_data_cleanup();
+
+  return PR_DECLINED(cmd);
+}
+
+MODRET tar_post_pass(cmd_rec *cmd) {
+  config_rec *c;
+
+  /* The TarEngine directive may have been changed for this user by
+   * e.g. mod_ifsession, thus we check again.
+   */
+  c = find_config(main_server->conf, CONF_PARAM, "TarEngine", FALSE);
+  if (c != NULL) {
+    tar_engine = *((int *) c->argv[0]);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "TarRetrSuffix", FALSE);
+  if (c != NULL) {
+    tar_retr_suffix = c->argv[0];
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+/* Configuration handlers
+ */
+
+/* usage: TarEngine on|off */
+MODRET set_tarengine(cmd_rec *cmd) {
+  int engine = 1;
+  config_rec *c;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1)
+    CONF_ERROR(cmd, "expected Boolean parameter");
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: TarLog path|"none" */
+MODRET set_tarlog(cmd_rec *cmd) {
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (strcasecmp(cmd->argv[1], "none") != 0 &&
+      pr_fs_valid_path(cmd->argv[1]) < 0)
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, ": ", cmd->argv[1],
+      " is not a valid path", NULL));
+
+  add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
+  return PR_HANDLED(cmd);
+}
+
+/* usage: TarRetrSuffix suffix|"none" */
+MODRET set_tarretrsuffix(cmd_rec *cmd) {
+  config_rec *c;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (strchr(cmd->argv[1], '/') != NULL)
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "suffix '", cmd->argv[1],
+      "' must not contain '/'", NULL));
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  if (strcasecmp(cmd->argv[1], "none") != 0) {
+    c->argv[0] = pstrdup(c->pool, cmd->argv[1]);
+  }
+
+  return PR_HANDLED(cmd);
+}
+
+/* Initialization functions
+ */
+
+static int tar_sess_init(void) {
+  config_rec *c;
+
+  c = find_config(main_server->conf, CONF_PARAM, "TarEngine", FALSE);
+  if (c != NULL) {
+    tar_engine = *((int *) c->argv[0]);
+  }
+
+  if (tar_engine == FALSE) {
+    return 0;
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "TarRetrSuffix", FALSE);
+  if (c != NULL) {
+    tar_retr_suffix = c->argv[0];
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "TarLog", FALSE);
+  if (c != NULL &&
+      strcasecmp(c->argv[0], "none") != 0) {
+    int res, xerrno = 0;
+
+    pr_signals_block();
+    PRIVS_ROOT
+    res = pr_log_openfile(c->argv[0], &tar_logfd, PR_LOG_SYSTEM_MODE);
+    xerrno = errno;
+    PRIVS_RELINQUISH
+    pr_signals_unblock();
+
+    switch (res) {
+      case -1:
+        pr_log_pri(PR_LOG_NOTICE, MOD_TAR_VERSION
+          ": notice: unable to open TarLog '%s': %s",
+          (char *) c->argv[0], strerror(xerrno));
+        break;
+
+      case PR_LOG_WRITABLE_DIR:
+        pr_log_pri(PR_LOG_WARNING, MOD_TAR_VERSION
+          ": notice: unable to use TarLog '%s': parent directory is "
+            "world-writable", (char *) c->argv[0]);
+        break;
+
+      case PR_LOG_SYMLINK:
+        pr_log_pri(PR_LOG_WARNING, MOD_TAR_VERSION
+          ": notice: unable to use TarLog '%s': cannot log to a symlink",
+          (char *) c->argv[0]);
+        break;
+    }
+  }
+
+  /* Advertise support for the SITE command */
+  pr_feat_add("SITE MRETR");
+  return 0;
+}
+
+/* Module API tables
+ */
+
+static conftable tar_conftab[] = {
+  { "TarEngine",	set_tarengine,		NULL },
+  { "TarLog",		set_tarlog,		NULL },
+  { "TarRetrSuffix",	set_tarretrsuffix,	NULL },
+
+  { NULL }
+};
+
+static cmdtable tar_cmdtab[] = {
+  { PRE_CMD,	C_RETR,	G_READ,		tar_pre_retr,	TRUE,	FALSE },
+  { CMD,	C_RETR,	G_READ,		tar_retr,	TRUE,	FALSE, CL_READ },
+  { CMD,	C_SITE,	G_READ,		tar_mretr,	FALSE,	FALSE, CL_READ },
+  { POST_CMD,	C_PASS,	G_NONE,		tar_post_pass,	FALSE,	FALSE },
+  { LOG_CMD,	C_SITE,	G_NONE,		tar_log_site,	FALSE,	FALSE },
+  { LOG_CMD_ERR, C_SITE, G_NONE,	tar_log_site,	FALSE,	FALSE },
+
+  { 0, NULL }
+};
+
+module tar_module = {
+  NULL, NULL,
+
+  /* Module API version 2.0 */
+  0x20,
+
+  /* Module name */
+  "tar",
+
+  /* Module configuration handler table */
+  tar_conftab,
+
+  /* Module command handler table */
+  tar_cmdtab,
+
+  /* Module authentication handler table */
+  NULL,
+
+  /* Module initialization function */
+  NULL,
+
+  /* Session initialization function */
+  tar_sess_init,
+
+  /* Module version */
+  MOD_TAR_VERSION
+};
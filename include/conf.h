@@ -469,6 +469,7 @@ typedef struct {
 #include "env.h"
 #include "pr-syslog.h"
 #include "memcache.h"
+#include "metrics.h"
 
 # ifdef HAVE_SETPASSENT
 #  define setpwent()	setpassent(1)
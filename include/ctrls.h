@@ -68,6 +68,17 @@ typedef struct cl_obj {
   /* Pointers to all controls matching client request */
   array_header *cl_ctrls;
 
+  /* Request data read from, or response data to be written to, the client,
+   * when the client is serviced using nonblocking I/O.
+   */
+  char *cl_buf;
+  size_t cl_bufsz;
+  size_t cl_buflen;
+  size_t cl_bufpos;
+
+  /* When the client connected */
+  time_t cl_connected;
+
 } pr_ctrls_cl_t;
 
 /* Controls client flag values
@@ -203,6 +214,14 @@ int pr_ctrls_parse_msg(pool *msg_pool, char *msg, unsigned int *msgargc,
  */
 int pr_ctrls_recv_request(pr_ctrls_cl_t *cl);
 
+/* Parses a client control request from the given buffer of data read from
+ * the client, e.g. by nonblocking reads, rather than reading it from the
+ * client socket.  Returns the number of bytes of the request on success, 0 if
+ * the buffer does not yet hold the entire request, or -1 (with errno set as
+ * for pr_ctrls_recv_request()) on error.
+ */
+int pr_ctrls_parse_request(pr_ctrls_cl_t *cl, const char *buf, size_t buflen);
+
 /* respargv can be NULL, as when the client does not care to know the
  * response messages, just that a response was successfully received.
  * Returns respargc, or -1 if there was an error.
@@ -210,11 +229,20 @@ int pr_ctrls_recv_request(pr_ctrls_cl_t *cl);
 int pr_ctrls_recv_response(pool *resp_pool, int ctrls_sockfd, int *status,
   char ***respargv);
 
-/* Useful for core routines that themselves want to send a control message
+/* Useful for core routines that themselves want to send a control message.
+ * If the socket is nonblocking, and the peer does not read the message within
+ * a couple of seconds, returns -1 with errno set to ETIMEDOUT.
  */
 int pr_ctrls_send_msg(int sockfd, int msgstatus, unsigned int msgargc,
   char **msgargv);
 
+/* Encodes a control message, as pr_ctrls_send_msg() sends it, into a buffer
+ * allocated from the given pool, for sending using nonblocking writes.
+ * Returns the message, and its length in msglen, or NULL on error.
+ */
+char *pr_ctrls_encode_msg(pool *msg_pool, int msgstatus, unsigned int msgargc,
+  char **msgargv, size_t *msglen);
+
 /* Determine whether the given socket mode is for a Unix domain socket.
  * Returns zero if true, -1 otherwise.
  */
@@ -255,6 +283,21 @@ int pr_run_ctrls(module *mod, const char *action);
 /* XXX */
 int pr_reset_ctrls(void);
 
+/* Registers the handler (e.g. of mod_ctrls) for servicing the Controls
+ * sockets from the daemon's main loop.  The add_fds callback adds the
+ * descriptors to be watched for reading and writing to the given sets, and
+ * returns the new highest descriptor; handle_fds is called with the sets of
+ * ready descriptors.
+ */
+int pr_ctrls_set_fds_handler(int (*add_fds)(fd_set *, fd_set *, int),
+  void (*handle_fds)(fd_set *, fd_set *));
+
+/* Called by the daemon's main loop, before and after waiting for activity,
+ * to invoke the registered handler, if any.
+ */
+int pr_ctrls_add_fds(fd_set *rfds, fd_set *wfds, int maxfd);
+void pr_ctrls_handle_fds(fd_set *rfds, fd_set *wfds);
+
 /* For internal use only. */
 void init_ctrls(void);
 
@@ -315,6 +315,15 @@ xaset_t *get_dir_ctxt(pool *, char *);
 config_rec *dir_match_path(pool *, char *);
 void build_dyn_config(pool *, const char *, struct stat *, unsigned char);
 unsigned char dir_hide_file(const char *);
+
+/* Between dir_hide_begin() and dir_hide_end(), e.g. while listing a
+ * directory, the HideUser, HideGroup, HideNoAccess, UserOwner and GroupOwner
+ * settings are resolved once per configuration context, and the HideFiles
+ * policy and <Directory> match once per directory, and then reused, so that
+ * checking each entry needs only a few comparisons.  Calls may be nested.
+ */
+int dir_hide_begin(void);
+int dir_hide_end(void);
 int dir_check_full(pool *, cmd_rec *, const char *, const char *, int *);
 int dir_check_limits(cmd_rec *, config_rec *, const char *, int);
 int dir_check(pool *, cmd_rec *, const char *, const char *, int *);
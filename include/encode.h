@@ -39,6 +39,17 @@ char *pr_decode_str(pool *p, const char *in, size_t inlen, size_t *outlen);
  */
 char *pr_encode_str(pool *p, const char *in, size_t inlen, size_t *outlen);
 
+/* Returns TRUE if the given string consists solely of 7-bit ASCII
+ * characters, FALSE otherwise.  Returns -1 if the string is NULL.
+ */
+int pr_encode_is_ascii(const char *in, size_t inlen);
+
+/* Returns TRUE if ASCII strings are returned unchanged by pr_decode_str()
+ * and pr_encode_str() for the current charset and encoding, FALSE if they
+ * need converting (e.g. for UCS-2).
+ */
+int pr_encode_supports_ascii(void);
+
 /* Disables runtime use of encoding (assuming NLS is supported). */
 void pr_encode_disable_encoding(void);
 
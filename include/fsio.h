@@ -165,6 +165,17 @@ struct fs_rec {
    * command to complete.
    */
   int allow_xdev_rename;
+
+  /* Copies the entire contents of the first open file to the second, e.g.
+   * using reflinks or in-kernel copying, without passing the data through
+   * userspace.  On failure (e.g. if not supported for these files), the
+   * caller copies the remaining data itself, using read() and write() from
+   * the files' current offsets.
+   *
+   * Note that this is at the end of the struct, so that modules built
+   * against older versions of this header still work.
+   */
+  int (*fcopy)(pr_fh_t *, int, pr_fh_t *, int);
 };
 
 struct fh_rec {
@@ -275,6 +286,7 @@ int pr_fsio_access(const char *, int, uid_t, gid_t, array_header *);
 int pr_fsio_faccess(pr_fh_t *, int, uid_t, gid_t, array_header *);
 int pr_fsio_utimes(const char *, struct timeval *);
 int pr_fsio_futimes(pr_fh_t *, struct timeval *);
+int pr_fsio_fcopy(pr_fh_t *, pr_fh_t *);
 off_t pr_fsio_lseek(pr_fh_t *, off_t, int);
 
 /* Set a flag determining whether we guard against write operations in
@@ -283,6 +295,12 @@ off_t pr_fsio_lseek(pr_fh_t *, off_t, int);
  */
 int pr_fsio_guard_chroot(int);
 
+/* Set a flag determining whether to use openat(2) and related functions
+ * (if available), relative to a descriptor for the current directory, for
+ * paths under that directory.  Returns the previously-set value.
+ */
+int pr_fsio_set_use_openat(int);
+
 /* Set a flag determining whether to use mkdtemp(3) (if available) or not.
  * Returns the previously-set value.
  */
@@ -314,6 +332,26 @@ int pr_unregister_fs_match(const char *);
 #endif /* PR_USE_REGEX and PR_FS_MATCH */
 
 void pr_fs_clear_cache(void);
+
+/* Clears the cache of resolved directories used by pr_fs_resolve_path() and
+ * pr_fs_resolve_partial().  This is done automatically when a path is
+ * renamed or removed via the FSIO API, and for each command dispatched;
+ * callers which change the filesystem by other means should call this.
+ */
+void pr_fs_clear_resolve_cache(void);
+
+/* Checks the requested access mode (R_OK, W_OK, X_OK), for the given user
+ * and groups, against the given stat(2) data, the same way that the system
+ * access handler does.  Returns 0 if allowed, -1 (with errno set) otherwise.
+ */
+int pr_fs_check_access(struct stat *, int, uid_t, gid_t, array_header *);
+
+/* Returns TRUE if no registered FS overrides the system access handler,
+ * i.e. if access to any path can be determined from its stat(2) data
+ * alone (see pr_fs_check_access()), FALSE otherwise.
+ */
+int pr_fs_have_sys_access(void);
+
 int pr_fs_copy_file(const char *, const char *);
 int pr_fs_setcwd(const char *);
 const char *pr_fs_getcwd(void);
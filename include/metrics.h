@@ -0,0 +1,155 @@
+/*
+ * ProFTPD - FTP server daemon
+ * Copyright (c) 2014 The ProFTPD Project team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, The ProFTPD Project team and other respective
+ * copyright holders give permission to link this program with OpenSSL, and
+ * distribute the resulting executable, without including the source code for
+ * OpenSSL in the source distribution.
+ */
+
+/* Metrics API */
+
+#ifndef PR_METRICS_H
+#define PR_METRICS_H
+
+/* Latency histograms use power-of-two buckets: bucket N counts durations
+ * of less than 2^N microseconds (and at least 2^(N-1) microseconds).  The
+ * last bucket counts everything longer.
+ */
+#define PR_METRICS_HISTO_NBUCKETS	24
+
+typedef struct {
+  unsigned long count;
+  unsigned long total_usecs;
+  unsigned long buckets[PR_METRICS_HISTO_NBUCKETS];
+} pr_metrics_histo_t;
+
+/* Types of histograms. */
+#define PR_METRICS_TYPE_CMD		1
+#define PR_METRICS_TYPE_MODULE		2
+
+/* Allocates the metrics memory, shared with any session processes
+ * subsequently forked, and indexes the commands and modules currently
+ * loaded.  Any previously allocated metrics are released.  Returns 0 on
+ * success, -1 on failure (with errno set appropriately).
+ */
+int pr_metrics_init(void);
+
+/* Releases the metrics memory; returns 0 on success, -1 on failure. */
+int pr_metrics_free(void);
+
+/* Returns TRUE if metrics are being collected, FALSE otherwise. */
+int pr_metrics_enabled(void);
+
+/* Clears all of the collected metrics. */
+int pr_metrics_reset(void);
+
+/* Returns a monotonic timestamp, in microseconds, for use in measuring
+ * elapsed times.  Differences between timestamps are meaningful; the
+ * timestamps themselves are not.
+ */
+unsigned long pr_metrics_now(void);
+
+/* Records the time spent by the handler of the given module, in the given
+ * phase (e.g. PRE_CMD, CMD) of the given command.  The time spent in the
+ * PRE_CMD, CMD and POST_CMD phases is also accumulated for the command
+ * itself, and is retrievable using pr_metrics_get_cmd_usecs().
+ */
+int pr_metrics_add_cmd_time(cmd_rec *cmd, int phase, module *m,
+  unsigned long usecs);
+
+/* Returns the time spent so far, in microseconds, by the PRE_CMD, CMD and
+ * POST_CMD handlers of the given command.
+ */
+int pr_metrics_get_cmd_usecs(cmd_rec *cmd, unsigned long *usecs);
+
+/* Returns the number of histogram keys (command or module names) of the
+ * given type, and the name for a given index.
+ */
+unsigned int pr_metrics_get_count(int type);
+const char *pr_metrics_get_name(int type, unsigned int idx);
+
+/* Copies the histogram for the given type, index and phase into the
+ * provided histogram.
+ */
+int pr_metrics_get_histo(int type, unsigned int idx, int phase,
+  pr_metrics_histo_t *histo);
+
+/* Returns the upper bound, in microseconds, of the bucket containing the
+ * given percentile (e.g. 50, 99) of the histogram's counts.
+ */
+unsigned long pr_metrics_histo_percentile(const pr_metrics_histo_t *histo,
+  unsigned int pct);
+
+/* Per-vhost counters. */
+#define PR_METRICS_CTR_CONNECTIONS	0
+#define PR_METRICS_CTR_LOGINS		1
+#define PR_METRICS_CTR_LOGIN_FAILURES	2
+#define PR_METRICS_CTR_COMMANDS		3
+#define PR_METRICS_CTR_COMMAND_ERRORS	4
+#define PR_METRICS_CTR_BYTES_IN		5
+#define PR_METRICS_CTR_BYTES_OUT	6
+#define PR_METRICS_CTR_FILES_IN		7
+#define PR_METRICS_CTR_FILES_OUT	8
+#define PR_METRICS_NCOUNTERS		9
+
+/* Allocates the per-vhost counters, shared with any session processes
+ * subsequently forked, for the servers currently configured.  Any previously
+ * allocated counters are released.  Returns 0 on success, -1 on failure.
+ */
+int pr_metrics_counters_init(void);
+int pr_metrics_counters_free(void);
+
+/* Adds the given amount to the given counter of the current server
+ * (i.e. main_server).  Does nothing if the counters are not allocated.
+ */
+void pr_metrics_incr(int ctr, unsigned long n);
+
+/* Retrieves the value of the given counter for the server with the given
+ * SID.
+ */
+int pr_metrics_get_counter(unsigned int sid, int ctr, unsigned long *val);
+
+/* Returns the counters (and any command latency histograms) formatted in
+ * the Prometheus text exposition format, allocated out of the given pool.
+ */
+char *pr_metrics_get_text(pool *p);
+
+/* Listens on a Unix domain socket at the given path, with the given mode,
+ * for HTTP requests for the metrics text.  A stale socket at the path is
+ * replaced; any other existing file is left alone, failing with EEXIST.
+ * Returns the listening fd on success, -1 on failure.
+ */
+int pr_metrics_listen(const char *path, mode_t mode);
+
+/* Returns the listening fd, or -1 if not listening. */
+int pr_metrics_get_listen_fd(void);
+
+/* Called by the daemon's main loop, before and after waiting for activity.
+ * pr_metrics_add_fds() adds the listening socket and any clients being served
+ * to the given sets, dropping clients which have taken too long, and returns
+ * the new highest descriptor; pr_metrics_handle_fds() accepts new clients,
+ * and reads requests from/writes responses to those which are ready.
+ */
+int pr_metrics_add_fds(fd_set *rfds, fd_set *wfds, int maxfd);
+void pr_metrics_handle_fds(fd_set *rfds, fd_set *wfds);
+
+/* Closes the listening socket, and drops any clients being served. */
+int pr_metrics_close(void);
+
+#endif /* PR_METRICS_H */
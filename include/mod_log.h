@@ -75,5 +75,6 @@
 #define LOGFMT_META_ISO8601		42
 #define LOGFMT_META_GROUP		43
 #define LOGFMT_META_BASENAME		44
+#define LOGFMT_META_CMD_LATENCY		45
 
 #endif /* MOD_LOG_H */
@@ -202,6 +202,11 @@ int pr_netio_shutdown(pr_netio_stream_t *, int);
 char *pr_netio_telnet_gets(char *, size_t, pr_netio_stream_t *,
   pr_netio_stream_t *);
 
+/* Returns TRUE if a complete line (e.g. a pipelined command) has already
+ * been read into the stream's buffer, FALSE otherwise.
+ */
+int pr_netio_telnet_has_line(pr_netio_stream_t *);
+
 int pr_netio_write(pr_netio_stream_t *, char *, size_t);
 
 /* This is a bit odd, because io_ functions are opaque, we can't be sure
@@ -52,6 +52,31 @@ void *pcalloc(struct pool_rec *, size_t);
 void *pcallocsz(struct pool_rec *, size_t);
 void pr_pool_tag(struct pool_rec *, const char *);
 
+/* Returns the arena pool.  Sub-pools of the arena pool hold long-lived,
+ * read-mostly data (e.g. configuration trees), kept on pages of their own so
+ * that the daemon can share them with its forked session processes.
+ */
+pool *pr_pool_get_arena(void);
+
+/* Freezes the arena before the daemon starts forking, releasing unused
+ * memory.  With PR_POOL_ARENA_FL_PROTECT, the arena is also made read-only
+ * (any write to it then faults) until thawed.
+ */
+int pr_pool_arena_freeze(int flags);
+#define PR_POOL_ARENA_FL_PROTECT	0x001
+
+int pr_pool_arena_thaw(void);
+
+/* Returns the flags with which the arena is currently frozen, e.g.
+ * PR_POOL_ARENA_FL_PROTECT if it is read-only.
+ */
+int pr_pool_arena_get_flags(void);
+
+/* Reports the resident memory of the current process which is shared with
+ * other processes (e.g. the daemon), and private to it, in KB.
+ */
+int pr_pool_get_page_usage(unsigned long *shared_kb, unsigned long *private_kb);
+
 #ifdef PR_USE_DEVEL
 void pr_pool_debug_memory(void (*)(const char *, ...));
 
@@ -56,6 +56,12 @@ void pr_response_add_err(const char *, const char *, ...)
 #endif
 
 int pr_response_block(int);
+
+/* Defer the writing of responses flushed via pr_response_flush(), so that
+ * the responses to several pipelined commands can be written out at once.
+ * Disabling deferral writes out any deferred responses.
+ */
+int pr_response_defer(int);
 void pr_response_clear(pr_response_t **);
 void pr_response_flush(pr_response_t **);
 
@@ -45,6 +45,9 @@ struct XAset {
   xasetmember_t *xas_list;
   struct pool_rec *pool;
   XASET_COMPARE xas_compare;
+
+  /* Last member in the list, for appending without walking the list. */
+  xasetmember_t *xas_last;
 };
 
 /* Prototypes */
@@ -50,6 +50,20 @@ int pr_trace_set_file(const char *);
 int pr_trace_set_levels(const char *, int, int);
 int pr_trace_use_stderr(int);
 
+/* Buffer trace messages in memory, in a ring of the given size, rather than
+ * formatting and writing them to the TraceLog as they are logged.  A size of
+ * zero disables the buffering.  Any previously buffered messages are written
+ * out first.  Returns 0 on success, or -1 (setting errno) if the size is too
+ * small.
+ */
+int pr_trace_set_buffer(size_t size);
+
+/* Formats and writes any buffered trace messages to the TraceLog, then
+ * empties the buffer.  Returns the number of messages written, or -1
+ * (with errno set to EPERM) if trace messages are not being buffered.
+ */
+int pr_trace_dump(void);
+
 int pr_trace_set_options(unsigned long trace_opts);
 #define PR_TRACE_OPT_LOG_CONN_IPS		0x0001
 #define PR_TRACE_OPT_USE_TIMESTAMP_MILLIS	0x0002
@@ -317,6 +317,7 @@ MODRET auth_err_pass(cmd_rec *cmd) {
    * using USER.
    */
   pr_table_remove(session.notes, "mod_auth.orig-user", NULL);
+  pr_metrics_incr(PR_METRICS_CTR_LOGIN_FAILURES, 1);
 
   return PR_HANDLED(cmd);
 }
@@ -329,6 +330,7 @@ MODRET auth_log_pass(cmd_rec *cmd) {
    */
   pr_log_auth(PR_LOG_INFO, "%s %s: Login successful.",
     (session.anon_config != NULL) ? "ANON" : C_USER, session.user);
+  pr_metrics_incr(PR_METRICS_CTR_LOGINS, 1);
 
   if (cmd->arg != NULL) {
     /* And scrub the memory holding the password sent by the client, for
@@ -57,6 +57,8 @@ static pr_fh_t *displayquit_fh = NULL;
 
 #ifdef PR_USE_TRACE
 static const char *trace_log = NULL;
+static int trace_flush_interval = 0;
+static int core_trace_flush_timer_id = -1;
 #endif /* PR_USE_TRACE */
 
 /* Necessary prototypes. */
@@ -184,6 +186,15 @@ static int core_scrub_scoreboard_cb(CALLBACK_FRAME) {
   return 1;
 }
 
+#ifdef PR_USE_TRACE
+static int core_trace_flush_cb(CALLBACK_FRAME) {
+  (void) pr_trace_dump();
+
+  /* Always restart the timer. */
+  return 1;
+}
+#endif /* PR_USE_TRACE */
+
 MODRET start_ifdefine(cmd_rec *cmd) {
   unsigned int ifdefine_ctx_count = 1;
   unsigned char not_define = FALSE, defined = FALSE;
@@ -367,6 +378,44 @@ MODRET add_include(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: ConfigMemoryProtect on|off */
+MODRET set_configmemoryprotect(cmd_rec *cmd) {
+  int bool = -1;
+  config_rec *c = NULL;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  bool = get_boolean(cmd, 1);
+  if (bool == -1)
+    CONF_ERROR(cmd, "expected Boolean parameter");
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(unsigned char));
+  *((unsigned char *) c->argv[0]) = bool;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: CommandTiming on|off */
+MODRET set_commandtiming(cmd_rec *cmd) {
+  int bool = -1;
+  config_rec *c = NULL;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  bool = get_boolean(cmd, 1);
+  if (bool == -1)
+    CONF_ERROR(cmd, "expected Boolean parameter");
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(unsigned char));
+  *((unsigned char *) c->argv[0]) = bool;
+
+  return PR_HANDLED(cmd);
+}
+
 MODRET set_debuglevel(cmd_rec *cmd) {
   config_rec *c = NULL;
   int debuglevel = -1;
@@ -628,6 +677,32 @@ MODRET set_useipv6(cmd_rec *cmd) {
 #endif /* PR_USE_IPV6 */
 }
 
+/* usage: UseOpenat on|off */
+MODRET set_useopenat(cmd_rec *cmd) {
+  int bool = -1;
+  config_rec *c = NULL;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  bool = get_boolean(cmd, 1);
+  if (bool == -1)
+    CONF_ERROR(cmd, "expected Boolean parameter");
+
+#ifndef HAVE_OPENAT
+  if (bool == TRUE) {
+    pr_log_debug(DEBUG0, "%s: openat(2) not supported on this system, "
+      "ignoring", cmd->argv[0]);
+  }
+#endif /* HAVE_OPENAT */
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = bool;
+
+  return PR_HANDLED(cmd);
+}
+
 MODRET set_usereversedns(cmd_rec *cmd) {
   int bool = -1;
 
@@ -1168,6 +1243,36 @@ MODRET set_socketoptions(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: MetricsSocket path [mode] */
+MODRET set_metricssocket(cmd_rec *cmd) {
+  config_rec *c;
+  mode_t mode = 0600;
+
+  CHECK_VARARGS(cmd, 1, 2);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  if (*cmd->argv[1] != '/') {
+    CONF_ERROR(cmd, "must be an absolute path");
+  }
+
+  if (CHECK_HASARGS(cmd, 2)) {
+    char *endp = NULL;
+
+    mode = (mode_t) strtol(cmd->argv[2], &endp, 8);
+    if (endp && *endp) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "'", cmd->argv[2],
+        "' is not a valid mode", NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = pstrdup(c->pool, cmd->argv[1]);
+  c->argv[1] = pcalloc(c->pool, sizeof(mode_t));
+  *((mode_t *) c->argv[1]) = mode;
+
+  return PR_HANDLED(cmd);
+}
+
 MODRET set_multilinerfc2228(cmd_rec *cmd) {
   int bool;
   config_rec *c;
@@ -1437,6 +1542,52 @@ MODRET set_trace(cmd_rec *cmd) {
 #endif /* PR_USE_TRACE */
 }
 
+/* usage: TraceBuffer size [flush-interval] */
+MODRET set_tracebuffer(cmd_rec *cmd) {
+#ifdef PR_USE_TRACE
+  char *size_str, *ptr, *units = NULL;
+  off_t nbytes = 0;
+  int interval = 0;
+
+  if (cmd->argc < 2 || cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  /* Allow for sizes such as "256KB". */
+  size_str = pstrdup(cmd->tmp_pool, cmd->argv[1]);
+  ptr = size_str + strspn(size_str, "0123456789");
+  if (*ptr) {
+    units = pstrdup(cmd->tmp_pool, ptr);
+    *ptr = '\0';
+  }
+
+  if (pr_str_get_nbytes(size_str, units, &nbytes) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unable to parse size '",
+      cmd->argv[1], "': ", strerror(errno), NULL));
+  }
+
+  if (cmd->argc == 3) {
+    if (pr_str_get_duration(cmd->argv[2], &interval) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "error parsing flush interval '",
+        cmd->argv[2], "': ", strerror(errno), NULL));
+    }
+  }
+
+  if (pr_trace_set_buffer((size_t) nbytes) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "error using TraceBuffer size '",
+      cmd->argv[1], "': ", strerror(errno), NULL));
+  }
+
+  trace_flush_interval = interval;
+  return PR_HANDLED(cmd);
+#else
+  CONF_ERROR(cmd,
+    "Use of the TraceBuffer directive requires trace support (--enable-trace)");
+#endif /* PR_USE_TRACE */
+}
+
 /* usage: TraceLog path */
 MODRET set_tracelog(cmd_rec *cmd) {
 #ifdef PR_USE_TRACE
@@ -3075,8 +3226,59 @@ MODRET add_virtualhost(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* Index of the address/port combinations of the <VirtualHost> sections
+ * parsed so far, used for detecting address collisions without rescanning
+ * (and re-resolving the addresses of) every previously configured server.
+ */
+static pool *vhost_addr_pool = NULL;
+static pr_table_t *vhost_addr_tab = NULL;
+
+static const char *get_vhost_addr_key(pool *p, pr_netaddr_t *addr,
+    unsigned int port) {
+  char portstr[32];
+
+  if (pr_netaddr_is_v4mappedv6(addr) == TRUE) {
+    addr = pr_netaddr_v6tov4(p, addr);
+    if (addr == NULL) {
+      return NULL;
+    }
+  }
+
+  memset(portstr, '\0', sizeof(portstr));
+  snprintf(portstr, sizeof(portstr)-1, "%u", port);
+
+  return pstrcat(p, pr_netaddr_get_ipstr(addr), "#", portstr, NULL);
+}
+
+static void add_vhost_addr(const char *key, server_rec *s) {
+  if (vhost_addr_tab == NULL) {
+    unsigned int max_ents = (unsigned int) -1;
+
+    vhost_addr_pool = make_sub_pool(permanent_pool);
+    pr_pool_tag(vhost_addr_pool, "<VirtualHost> Address Pool");
+
+    vhost_addr_tab = pr_table_nalloc(vhost_addr_pool, 0, 1024);
+    (void) pr_table_ctl(vhost_addr_tab, PR_TABLE_CTL_SET_MAX_ENTS, &max_ents);
+  }
+
+  if (pr_table_add(vhost_addr_tab, pstrdup(vhost_addr_pool, key), s,
+      sizeof(server_rec)) < 0 &&
+      errno != EEXIST) {
+    pr_trace_msg("config", 3, "error indexing <VirtualHost> address '%s': %s",
+      key, strerror(errno));
+  }
+}
+
+static void clear_vhost_addrs(void) {
+  if (vhost_addr_pool != NULL) {
+    destroy_pool(vhost_addr_pool);
+    vhost_addr_pool = NULL;
+    vhost_addr_tab = NULL;
+  }
+}
+
 MODRET end_virtualhost(cmd_rec *cmd) {
-  server_rec *s = NULL, *next_s = NULL;
+  server_rec *s = NULL;
   pr_netaddr_t *addr = NULL;
   const char *address = NULL;
   unsigned int addr_flags = PR_NETADDR_GET_ADDR_FL_INCL_DEVICE;
@@ -3103,57 +3305,76 @@ MODRET end_virtualhost(cmd_rec *cmd) {
       "warning: unable to determine IP address of '%s'", address);
   }
 
-  if (AddressCollisionCheck) {
-    /* Check if this server's address/port combination is already being used. */
-    for (s = (server_rec *) server_list->xas_list; addr && s; s = next_s) {
-      next_s = s->next;
+  if (AddressCollisionCheck &&
+      addr != NULL) {
+    const char *key;
+
+    /* Check if this server's address/port combination is already being used,
+     * first by the previously parsed <VirtualHost> sections, and then by the
+     * main server.
+     */
+    key = get_vhost_addr_key(cmd->tmp_pool, addr, cmd->server->ServerPort);
+
+    s = NULL;
+    if (key != NULL &&
+        vhost_addr_tab != NULL) {
+      s = (server_rec *) pr_table_get(vhost_addr_tab, key, NULL);
+    }
+
+    if (s == NULL &&
+        main_server != cmd->server) {
+      const char *serv_addrstr = NULL;
+      pr_netaddr_t *serv_addr = NULL;
 
-      /* Have to resort to duplicating some of fixup_servers()'s functionality
-       * here, to do this check The Right Way(tm).
+      /* The main server is not indexed, as its address and port may be
+       * changed by directives appearing later in the configuration.  Have to
+       * resort to duplicating some of fixup_servers()'s functionality here,
+       * to do this check The Right Way(tm).
        */
-      if (s != cmd->server) {
-        const char *serv_addrstr = NULL;
-        pr_netaddr_t *serv_addr = NULL;
+      if (main_server->addr) {
+        serv_addr = main_server->addr;
 
-        if (s->addr) {
-          serv_addr = s->addr;
+      } else {
+        serv_addrstr = main_server->ServerAddress ?
+          main_server->ServerAddress :
+          pr_netaddr_get_localaddr_str(cmd->tmp_pool);
 
-        } else {
-          serv_addrstr = s->ServerAddress ? s->ServerAddress :
-            pr_netaddr_get_localaddr_str(cmd->tmp_pool);
+        serv_addr = pr_netaddr_get_addr2(cmd->tmp_pool, serv_addrstr, NULL,
+          addr_flags);
+      }
 
-          serv_addr = pr_netaddr_get_addr2(cmd->tmp_pool, serv_addrstr, NULL,
-            addr_flags);
-        }
+      if (serv_addr == NULL) {
+        pr_log_pri(PR_LOG_WARNING,
+          "warning: unable to determine IP address of '%s'", serv_addrstr);
 
-        if (serv_addr == NULL) {
-          pr_log_pri(PR_LOG_WARNING,
-            "warning: unable to determine IP address of '%s'", serv_addrstr);
+      } else if (pr_netaddr_cmp(addr, serv_addr) == 0 &&
+          cmd->server->ServerPort == main_server->ServerPort) {
+        s = main_server;
+      }
+    }
 
-        } else if (pr_netaddr_cmp(addr, serv_addr) == 0 &&
-            cmd->server->ServerPort == s->ServerPort) {
-          config_rec *c;
+    if (s != NULL) {
+      config_rec *c;
 
-          /* If this server has a ServerAlias, it means it's a named vhost and
-           * can be used for name-based virtual hosting.  Which, in turn, means
-           * that this collision is expected, even wanted.
-           */
-          c = find_config(cmd->server->conf, CONF_PARAM, "ServerAlias", FALSE);
-          if (c == NULL) {
-            pr_log_pri(PR_LOG_WARNING,
-              "warning: \"%s\" address/port (%s:%d) already in use by \"%s\"",
-              cmd->server->ServerName ? cmd->server->ServerName : "ProFTPD",
-              pr_netaddr_get_ipstr(addr), cmd->server->ServerPort,
-              s->ServerName ? s->ServerName : "ProFTPD");
-
-            if (xaset_remove(server_list, (xasetmember_t *) cmd->server) == 1) {
-              destroy_pool(cmd->server->pool);
-            }
-          }
-        }
+      /* If this server has a ServerAlias, it means it's a named vhost and
+       * can be used for name-based virtual hosting.  Which, in turn, means
+       * that this collision is expected, even wanted.
+       */
+      c = find_config(cmd->server->conf, CONF_PARAM, "ServerAlias", FALSE);
+      if (c == NULL) {
+        pr_log_pri(PR_LOG_WARNING,
+          "warning: \"%s\" address/port (%s:%d) already in use by \"%s\"",
+          cmd->server->ServerName ? cmd->server->ServerName : "ProFTPD",
+          pr_netaddr_get_ipstr(addr), cmd->server->ServerPort,
+          s->ServerName ? s->ServerName : "ProFTPD");
 
-        continue;
+        if (xaset_remove(server_list, (xasetmember_t *) cmd->server) == 1) {
+          destroy_pool(cmd->server->pool);
+        }
       }
+
+    } else if (key != NULL) {
+      add_vhost_addr(key, cmd->server);
     }
   }
 
@@ -5577,10 +5798,30 @@ static const char *core_get_xfer_bytes_str(void *data, size_t datasz) {
 /* Event handlers
  */
 
+#ifdef PR_USE_TRACE
+static void core_trace_exit_ev(const void *event_data, void *user_data) {
+  (void) pr_trace_dump();
+}
+#endif /* PR_USE_TRACE */
+
 static void core_restart_ev(const void *event_data, void *user_data) {
   pr_scoreboard_scrub();
+  pr_fs_clear_resolve_cache();
+  pr_metrics_free();
+  pr_metrics_counters_free();
+  pr_metrics_close();
 
 #ifdef PR_USE_TRACE
+  pr_trace_set_buffer(0);
+  trace_flush_interval = 0;
+
+  if (core_trace_flush_timer_id != -1) {
+    pr_timer_remove(core_trace_flush_timer_id, &core_module);
+    core_trace_flush_timer_id = -1;
+    pr_event_unregister(NULL, "core.exit", core_trace_exit_ev);
+    pr_event_unregister(NULL, "core.shutdown", core_trace_exit_ev);
+  }
+
   if (trace_log) {
     pr_trace_set_levels(PR_TRACE_DEFAULT_CHANNEL, -1, -1);
     pr_trace_set_file(NULL);
@@ -5589,6 +5830,69 @@ static void core_restart_ev(const void *event_data, void *user_data) {
 #endif /* PR_USE_TRACE */
 }
 
+static void core_postparse_ev(const void *event_data, void *user_data) {
+  config_rec *c;
+  unsigned char *timing;
+
+  /* The <VirtualHost> address index is only needed while parsing. */
+  clear_vhost_addrs();
+
+  timing = get_param_ptr(main_server->conf, "CommandTiming", FALSE);
+  if (timing != NULL &&
+      *timing == TRUE) {
+    if (pr_metrics_init() < 0) {
+      pr_log_pri(PR_LOG_NOTICE, "unable to enable CommandTiming: %s",
+        strerror(errno));
+    }
+  }
+
+  /* There is no daemon to answer metrics requests for inetd-run servers. */
+  c = find_config(main_server->conf, CONF_PARAM, "MetricsSocket", FALSE);
+  if (c != NULL &&
+      ServerType == SERVER_STANDALONE) {
+    const char *path;
+    mode_t mode;
+    int res, xerrno = 0;
+
+    path = c->argv[0];
+    mode = *((mode_t *) c->argv[1]);
+
+    res = pr_metrics_counters_init();
+    if (res == 0) {
+      PRIVS_ROOT
+      res = pr_metrics_listen(path, mode);
+      xerrno = errno;
+      PRIVS_RELINQUISH
+
+    } else {
+      xerrno = errno;
+    }
+
+    if (res < 0) {
+      pr_log_pri(PR_LOG_NOTICE, "unable to enable MetricsSocket %s: %s",
+        path, strerror(xerrno));
+      pr_metrics_counters_free();
+    }
+  }
+
+#ifdef PR_USE_TRACE
+  /* Periodically write out the daemon's buffered trace messages, and write
+   * out any remaining ones on shutdown.
+   */
+  if (trace_flush_interval > 0 &&
+      ServerType == SERVER_STANDALONE) {
+    core_trace_flush_timer_id = pr_timer_add(trace_flush_interval, -1,
+      &core_module, core_trace_flush_cb, "TraceBuffer flushing");
+    pr_event_register(NULL, "core.exit", core_trace_exit_ev, NULL);
+    pr_event_register(NULL, "core.shutdown", core_trace_exit_ev, NULL);
+  }
+#endif /* PR_USE_TRACE */
+}
+
+static void core_preparse_ev(const void *event_data, void *user_data) {
+  clear_vhost_addrs();
+}
+
 static void core_startup_ev(const void *event_data, void *user_data) {
 
   /* Add a scoreboard-scrubbing timer.
@@ -5680,6 +5984,8 @@ static int core_init(void) {
   pr_feat_add(C_HOST);
 #endif /* PR_USE_HOST */
 
+  pr_event_register(&core_module, "core.postparse", core_postparse_ev, NULL);
+  pr_event_register(&core_module, "core.preparse", core_preparse_ev, NULL);
   pr_event_register(&core_module, "core.restart", core_restart_ev, NULL);
   pr_event_register(&core_module, "core.startup", core_startup_ev, NULL);
 
@@ -5807,6 +6113,8 @@ static int core_sess_init(void) {
   config_rec *c = NULL;
   unsigned int *debug_level = NULL;
 
+  pr_metrics_incr(PR_METRICS_CTR_CONNECTIONS, 1);
+
   init_auth();
 
   c = find_config(main_server->conf, CONF_PARAM, "MultilineRFC2228", FALSE);
@@ -5814,6 +6122,11 @@ static int core_sess_init(void) {
     session.multiline_rfc2228 = *((int *) c->argv[0]);
   }
 
+  c = find_config(main_server->conf, CONF_PARAM, "UseOpenat", FALSE);
+  if (c != NULL) {
+    pr_fsio_set_use_openat(*((int *) c->argv[0]));
+  }
+
   /* Start the idle timer. */
 
   c = find_config(main_server->conf, CONF_PARAM, "TimeoutIdle", FALSE);
@@ -5932,6 +6245,22 @@ static int core_sess_init(void) {
         c->name, trace_opts, strerror(errno));
     }
   }
+
+  /* Periodically write out the session's buffered trace messages, and write
+   * out any remaining ones when the session ends.  Any flushing timer/exit
+   * handler here was inherited from the daemon.
+   */
+  if (trace_flush_interval > 0) {
+    if (core_trace_flush_timer_id != -1) {
+      pr_timer_remove(core_trace_flush_timer_id, &core_module);
+    }
+
+    core_trace_flush_timer_id = pr_timer_add(trace_flush_interval, -1,
+      &core_module, core_trace_flush_cb, "TraceBuffer flushing");
+
+    pr_event_unregister(NULL, "core.exit", core_trace_exit_ev);
+    pr_event_register(NULL, "core.exit", core_trace_exit_ev, NULL);
+  }
 #endif /* PR_USE_TRACE */
 
   if (ServerType == SERVER_STANDALONE) {
@@ -6090,6 +6419,8 @@ static conftable core_conftab[] = {
   { "AuthOrder",		set_authorder,			NULL },
   { "CDPath",			set_cdpath,			NULL },
   { "CommandBufferSize",	set_commandbuffersize,		NULL },
+  { "CommandTiming",		set_commandtiming,		NULL },
+  { "ConfigMemoryProtect",	set_configmemoryprotect,	NULL },
   { "DebugLevel",		set_debuglevel,			NULL },
   { "DefaultAddress",		set_defaultaddress,		NULL },
   { "DefaultServer",		set_defaultserver,		NULL },
@@ -6118,6 +6449,7 @@ static conftable core_conftab[] = {
   { "MaxCommandRate",		set_maxcommandrate,		NULL },
   { "MaxConnectionRate",	set_maxconnrate,		NULL },
   { "MaxInstances",		set_maxinstances,		NULL },
+  { "MetricsSocket",		set_metricssocket,		NULL },
   { "MultilineRFC2228",		set_multilinerfc2228,		NULL },
   { "Order",			set_order,			NULL },
   { "PassivePorts",		set_passiveports,		NULL },
@@ -6146,12 +6478,14 @@ static conftable core_conftab[] = {
   { "TimeoutLinger",		set_timeoutlinger,		NULL },
   { "TimesGMT",			set_timesgmt,			NULL },
   { "Trace",			set_trace,			NULL },
+  { "TraceBuffer",		set_tracebuffer,		NULL },
   { "TraceLog",			set_tracelog,			NULL },
   { "TraceOptions",		set_traceoptions,		NULL },
   { "TransferLog",		add_transferlog,		NULL },
   { "Umask",			set_umask,			NULL },
   { "UnsetEnv",			set_unsetenv,			NULL },
   { "UseIPv6",			set_useipv6,			NULL },
+  { "UseOpenat",		set_useopenat,			NULL },
   { "UseReverseDNS",		set_usereversedns,		NULL },
   { "User",			set_user,			NULL },
   { "UserOwner",		add_userowner,			NULL },
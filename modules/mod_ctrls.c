@@ -86,7 +86,6 @@ static unsigned char ctrls_engine = TRUE;
 #define CTRLS_LISTEN_FL_REMOVE_SOCKET	0x0001
 
 /* Necessary prototypes */
-static int ctrls_setblock(int sockfd);
 static int ctrls_setnonblock(int sockfd);
 
 static const char *ctrls_logname = NULL;
@@ -215,6 +214,7 @@ static pr_ctrls_cl_t *ctrls_add_cl(int cl_fd, uid_t cl_uid, gid_t cl_gid,
   cl->cl_group = pr_auth_gid2name(cl->cl_pool, cl->cl_gid);
   cl->cl_pid = cl_pid;
   cl->cl_flags = cl_flags;
+  cl->cl_connected = time(NULL);
 
   pr_ctrls_log(MOD_CTRLS_VERSION,
     "accepted connection from %s/%s client", cl->cl_user, cl->cl_group);
@@ -225,6 +225,28 @@ static pr_ctrls_cl_t *ctrls_add_cl(int cl_fd, uid_t cl_uid, gid_t cl_gid,
 /* Remove a client from the set */
 static void ctrls_del_cl(pr_ctrls_cl_t *cl) {
 
+  /* Make sure that none of this client's controls refer to it once it is
+   * gone.  Controls which are pending (e.g. scheduled for later) are kept,
+   * to be run from the ControlsInterval timer; the rest are discarded.
+   */
+  if (cl->cl_ctrls->nelts > 0) {
+    register unsigned int i;
+    pr_ctrls_t **ctrlv;
+
+    ctrlv = (pr_ctrls_t **) cl->cl_ctrls->elts;
+    for (i = 0; i < cl->cl_ctrls->nelts; i++) {
+      if (ctrlv[i]->ctrls_cl == cl) {
+        ctrlv[i]->ctrls_cl = NULL;
+
+        if (!(ctrlv[i]->ctrls_flags & PR_CTRLS_PENDING)) {
+          ctrlv[i]->ctrls_cb_retval = -1;
+        }
+      }
+    }
+
+    pr_reset_ctrls();
+  }
+
   /* Remove this ctr_cl_t from the list, and free it */
   if (cl->cl_next)
     cl->cl_next->cl_prev = cl->cl_prev;
@@ -249,189 +271,6 @@ static void ctrls_del_cl(pr_ctrls_cl_t *cl) {
  */
 
 
-/* Iterate through any readable descriptors, reading each into appropriate
- * client objects
- */
-static void ctrls_cls_read(void) {
-  pr_ctrls_cl_t *cl = cl_list;
-
-  while (cl) {
-    if (pr_ctrls_recv_request(cl) < 0) {
-
-      if (errno == EOF) {
-        ;
- 
-      } else if (errno == EINVAL) {
-
-        /* Unsupported action requested */
-        if (!cl->cl_flags)
-          cl->cl_flags = PR_CTRLS_CL_NOACTION;
-
-        pr_ctrls_log(MOD_CTRLS_VERSION,
-          "recvd from %s/%s client: (invalid action)", cl->cl_user,
-          cl->cl_group);
-
-      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
-
-        /* Malicious/blocked client */
-        if (!cl->cl_flags)
-          cl->cl_flags = PR_CTRLS_CL_BLOCKED;
-
-      } else {
-        pr_ctrls_log(MOD_CTRLS_VERSION,
-          "error: unable to receive client request: %s", strerror(errno)); 
-      }
-
-    } else {
-      pr_ctrls_t *ctrl = *((pr_ctrls_t **) cl->cl_ctrls->elts);
-      char *request = (char *) ctrl->ctrls_action;
-
-      /* Request successfully read.  Flag this client as being in such a
-       * state.
-       */
-      if (!cl->cl_flags)
-        cl->cl_flags = PR_CTRLS_CL_HAVEREQ;
-
-      if (ctrl->ctrls_cb_args) {
-        int reqargc = ctrl->ctrls_cb_args->nelts;
-        char **reqargv = ctrl->ctrls_cb_args->elts;
-
-        /* Reconstruct the original request string from the client for
-         * logging.
-         */
-        while (reqargc--)
-          request = pstrcat(cl->cl_pool, request, " ", *reqargv++, NULL);
-
-        pr_ctrls_log(MOD_CTRLS_VERSION,
-          "recvd from %s/%s client: '%s'", cl->cl_user, cl->cl_group,
-          request);
-      }
-    }
-
-    cl = cl->cl_next;
-  }
-
-  return;
-}
-
-/* Iterate through any writable descriptors, writing out the responses to the
- * appropriate client objects
- */
-static int ctrls_cls_write(void) {
-  pr_ctrls_cl_t *cl = cl_list;
-
-  while (cl) {
-    /* Necessary to keep track of the next client in the list while
-     * the list is being modified.
-     */
-    pr_ctrls_cl_t *tmpcl = cl->cl_next;
-
-    /* This client has something to hear */
-    if (cl->cl_flags == PR_CTRLS_CL_NOACCESS) {
-      char *msg = "access denied";
-
-      /* ACL-denied access */
-      if (pr_ctrls_send_msg(cl->cl_fd, -1, 1, &msg) < 0) {
-        pr_ctrls_log(MOD_CTRLS_VERSION,
-          "error: unable to send response to %s/%s client: %s",
-          cl->cl_user, cl->cl_group, strerror(errno));
-
-      } else {
-        pr_ctrls_log(MOD_CTRLS_VERSION, "sent to %s/%s client: '%s'",
-          cl->cl_user, cl->cl_group, msg);
-      }
-
-    } else if (cl->cl_flags == PR_CTRLS_CL_NOACTION) {
-      char *msg = "unsupported action requested";
-
-      /* Unsupported action -- no matching controls */
-      if (pr_ctrls_send_msg(cl->cl_fd, -1, 1, &msg) < 0) {
-        pr_ctrls_log(MOD_CTRLS_VERSION,
-          "error: unable to send response to %s/%s client: %s",
-          cl->cl_user, cl->cl_group, strerror(errno));
-
-      } else {
-        pr_ctrls_log(MOD_CTRLS_VERSION, "sent to %s/%s client: '%s'",
-          cl->cl_user, cl->cl_group, msg);
-      }
-
-    } else if (cl->cl_flags == PR_CTRLS_CL_BLOCKED) {
-      char *msg = "blocked connection";
-
-      if (pr_ctrls_send_msg(cl->cl_fd, -1, 1, &msg) < 0) {
-        pr_ctrls_log(MOD_CTRLS_VERSION,
-          "error: unable to send response to %s/%s client: %s",
-          cl->cl_user, cl->cl_group, strerror(errno));
-
-      } else {
-        pr_ctrls_log(MOD_CTRLS_VERSION, "sent to %s/%s client: '%s'",
-          cl->cl_user, cl->cl_group, msg);
-      }
-
-    } else if (cl->cl_flags == PR_CTRLS_CL_HAVEREQ) {
-
-      if (cl->cl_ctrls->nelts > 0) {
-        register int i = 0;
-        pr_ctrls_t **ctrlv = NULL;
-
-        ctrlv = (pr_ctrls_t **) cl->cl_ctrls->elts;
-
-        if (cl->cl_ctrls) {
-          for (i = 0; i < cl->cl_ctrls->nelts; i++) {
-            if ((ctrlv[i])->ctrls_cb_retval < 1) {
-
-              /* Make sure the callback(s) added responses */
-              if ((ctrlv[i])->ctrls_cb_resps) {
-                if (pr_ctrls_send_msg(cl->cl_fd, (ctrlv[i])->ctrls_cb_retval,
-                    (ctrlv[i])->ctrls_cb_resps->nelts,
-                    (char **) (ctrlv[i])->ctrls_cb_resps->elts) < 0) {
-                  pr_ctrls_log(MOD_CTRLS_VERSION,
-                    "error: unable to send response to %s/%s "
-                    "client: %s", cl->cl_user, cl->cl_group, strerror(errno));
-
-                } else {
-
-                  /* For logging/accounting purposes */
-                  register int j = 0;
-                  int respval = (ctrlv[i])->ctrls_cb_retval;
-                  int respargc = (ctrlv[i])->ctrls_cb_resps->nelts;
-                  char **respargv = (ctrlv[i])->ctrls_cb_resps->elts;
-
-                  pr_ctrls_log(MOD_CTRLS_VERSION,
-                    "sent to %s/%s client: return value: %d",
-                    cl->cl_user, cl->cl_group, respval);
-
-                  for (j = 0; j < respargc; j++) {
-                    pr_ctrls_log(MOD_CTRLS_VERSION,
-                      "sent to %s/%s client: '%s'", cl->cl_user, cl->cl_group,
-                      respargv[j]);
-                  }
-                }
-
-              } else {
-
-                /* No responses added by callbacks */
-                pr_ctrls_log(MOD_CTRLS_VERSION,
-                  "notice: no responses given for %s/%s client: "
-                  "check controls handlers", cl->cl_user, cl->cl_group);
-              }
-            }
-          }
-        }
-      }
-    }
-
-    pr_ctrls_log(MOD_CTRLS_VERSION,
-      "closed connection to %s/%s client", cl->cl_user, cl->cl_group);
-
-    /* Remove the client from the list */
-    ctrls_del_cl(cl);
-    cl = tmpcl;
-  }
-
-  return 0;
-}
-
 /* Create a listening local socket */
 static int ctrls_listen(const char *sock_file, int flags) {
   int sockfd = -1, len = 0;
@@ -545,6 +384,15 @@ static int ctrls_listen(const char *sock_file, int flags) {
     return -1;
   }
 
+  /* Connections are accepted from the daemon's main loop, which must not
+   * block on the ctrl socket.
+   */
+  if (ctrls_setnonblock(sockfd) < 0) {
+    pr_ctrls_log(MOD_CTRLS_VERSION,
+      "error: unable to set nonblocking on local socket: %s",
+      strerror(errno));
+  }
+
 #if !defined(SO_PEERCRED) && !defined(HAVE_GETPEEREID) && \
     !defined(HAVE_GETPEERUCRED) && defined(LOCAL_CREDS)
   /* Set the LOCAL_CREDS socket option. */
@@ -574,136 +422,427 @@ static int ctrls_listen(const char *sock_file, int flags) {
   return sockfd;
 }
 
-static int ctrls_recv_cl_reqs(void) {
-  fd_set cl_rset;
-  struct timeval timeout;
-  uid_t cl_uid;
-  gid_t cl_gid;
-  pid_t cl_pid;
-  unsigned long cl_flags = 0;
-  int cl_fd, max_fd;
+static int ctrls_setnonblock(int sockfd) {
+  int flags = 0;
+  int res = -1;
 
-  timeout.tv_usec = 500L;
-  timeout.tv_sec = 0L;
+  /* default error */
+  errno = EBADF;
 
-  /* look for any pending client connections */
-  while (cl_listlen < cl_maxlistlen) {
-    int res = 0;
+  flags = fcntl(sockfd, F_GETFL);
+  res = fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
 
-    pr_signals_handle();
+  return res;
+}
 
-    if (ctrls_sockfd < 0)
-      break;
+/* Initial size of a client's I/O buffer, and the largest request which a
+ * client may send.
+ */
+#define CTRLS_CL_BUFSZ		512
+#define CTRLS_CL_MAX_REQSZ	(64 * 1024)
 
-    FD_ZERO(&cl_rset);
-    FD_SET(ctrls_sockfd, &cl_rset);
-    max_fd = ctrls_sockfd + 1;
+/* Make sure the client's buffer can hold the given number of bytes beyond
+ * those it already holds.
+ */
+static int ctrls_cl_grow_buf(pr_ctrls_cl_t *cl, size_t len) {
+  size_t bufsz;
+  char *buf;
 
-    res = select(max_fd + 1, &cl_rset, NULL, NULL, &timeout);
-    if (res == 0) {
+  if (cl->cl_buflen + len <= cl->cl_bufsz) {
+    return 0;
+  }
 
-      /* Go through the client list */
-      ctrls_cls_read();
+  bufsz = cl->cl_bufsz > 0 ? cl->cl_bufsz : CTRLS_CL_BUFSZ;
+  while (bufsz < cl->cl_buflen + len) {
+    bufsz *= 2;
+  }
 
-      return 0;
-    }
+  buf = palloc(cl->cl_pool, bufsz);
+  if (cl->cl_buflen > 0) {
+    memcpy(buf, cl->cl_buf, cl->cl_buflen);
+  }
 
-    if (res < 0) {
-      if (errno == EINTR) {
-        pr_signals_handle();
-        continue;
+  cl->cl_buf = buf;
+  cl->cl_bufsz = bufsz;
+  return 0;
+}
+
+/* Queue a response message to be written to the client, once its socket is
+ * writable.
+ */
+static int ctrls_cl_add_msg(pr_ctrls_cl_t *cl, int status, unsigned int argc,
+    char **argv) {
+  char *msg;
+  size_t msglen = 0;
+
+  msg = pr_ctrls_encode_msg(cl->cl_pool, status, argc, argv, &msglen);
+  if (msg == NULL) {
+    pr_ctrls_log(MOD_CTRLS_VERSION,
+      "error: unable to send response to %s/%s client: %s",
+      cl->cl_user, cl->cl_group, strerror(errno));
+    return -1;
+  }
+
+  ctrls_cl_grow_buf(cl, msglen);
+  memcpy(cl->cl_buf + cl->cl_buflen, msg, msglen);
+  cl->cl_buflen += msglen;
+
+  return 0;
+}
+
+static void ctrls_cl_add_resp(pr_ctrls_cl_t *cl, char *msg) {
+  if (ctrls_cl_add_msg(cl, -1, 1, &msg) == 0) {
+    pr_ctrls_log(MOD_CTRLS_VERSION, "sent to %s/%s client: '%s'",
+      cl->cl_user, cl->cl_group, msg);
+  }
+}
+
+/* Queue the responses appropriate to the client's state, i.e. the responses
+ * of its controls, or the error for a denied or unsupported request.  The
+ * client's buffer, which held its request, is reused for the responses.
+ */
+static void ctrls_cl_respond(pr_ctrls_cl_t *cl) {
+  cl->cl_buflen = cl->cl_bufpos = 0;
+
+  if (cl->cl_flags == PR_CTRLS_CL_NOACCESS) {
+    /* ACL-denied access */
+    ctrls_cl_add_resp(cl, "access denied");
+
+  } else if (cl->cl_flags == PR_CTRLS_CL_NOACTION) {
+    /* Unsupported action -- no matching controls */
+    ctrls_cl_add_resp(cl, "unsupported action requested");
+
+  } else if (cl->cl_flags == PR_CTRLS_CL_BLOCKED) {
+    ctrls_cl_add_resp(cl, "blocked connection");
+
+  } else if (cl->cl_flags == PR_CTRLS_CL_HAVEREQ) {
+    register unsigned int i = 0;
+    pr_ctrls_t **ctrlv = NULL;
+
+    ctrlv = (pr_ctrls_t **) cl->cl_ctrls->elts;
+    for (i = 0; i < cl->cl_ctrls->nelts; i++) {
+      pr_ctrls_t *ctrl = ctrlv[i];
+
+      /* Make sure the callback(s) added responses.  A control which is still
+       * pending (e.g. scheduled for later) says so, and is kept to be run
+       * later, after this client has gone; see ctrls_del_cl().
+       */
+      if (ctrl->ctrls_cb_resps) {
+        if (ctrls_cl_add_msg(cl, ctrl->ctrls_cb_retval,
+            ctrl->ctrls_cb_resps->nelts,
+            (char **) ctrl->ctrls_cb_resps->elts) == 0) {
+
+          /* For logging/accounting purposes */
+          register int j = 0;
+          int respargc = ctrl->ctrls_cb_resps->nelts;
+          char **respargv = ctrl->ctrls_cb_resps->elts;
+
+          pr_ctrls_log(MOD_CTRLS_VERSION,
+            "sent to %s/%s client: return value: %d",
+            cl->cl_user, cl->cl_group, ctrl->ctrls_cb_retval);
+
+          for (j = 0; j < respargc; j++) {
+            pr_ctrls_log(MOD_CTRLS_VERSION,
+              "sent to %s/%s client: '%s'", cl->cl_user, cl->cl_group,
+              respargv[j]);
+          }
+        }
+
+      } else {
+
+        /* No responses added by callbacks */
+        pr_ctrls_log(MOD_CTRLS_VERSION,
+          "notice: no responses given for %s/%s client: "
+          "check controls handlers", cl->cl_user, cl->cl_group);
       }
+    }
+  }
 
+  cl->cl_flags = PR_CTRLS_CL_HAVERESP;
+}
+
+static void ctrls_cl_close(pr_ctrls_cl_t *cl) {
+  pr_ctrls_log(MOD_CTRLS_VERSION,
+    "closed connection to %s/%s client", cl->cl_user, cl->cl_group);
+  ctrls_del_cl(cl);
+}
+
+/* Read whatever the client has sent, and parse its request once all of it
+ * has arrived.  Returns TRUE if the client now has a request to be handled.
+ */
+static int ctrls_cl_read(pr_ctrls_cl_t *cl) {
+  ssize_t len;
+  int res;
+
+  if (cl->cl_buflen == cl->cl_bufsz) {
+    if (cl->cl_bufsz >= CTRLS_CL_MAX_REQSZ) {
       pr_ctrls_log(MOD_CTRLS_VERSION,
-        "error: unable to select on local socket: %s", strerror(errno));
-      return res;
+        "error: unable to receive client request: request too large");
+      ctrls_cl_close(cl);
+      return FALSE;
     }
- 
-    if (FD_ISSET(ctrls_sockfd, &cl_rset)) {
 
-      /* Make sure the ctrl socket is non-blocking */
-      if (ctrls_setnonblock(ctrls_sockfd) < 0) {
-        pr_ctrls_log(MOD_CTRLS_VERSION,
-          "error: unable to set nonblocking on local socket: %s",
-          strerror(errno));
-        return -1;
-      }
+    ctrls_cl_grow_buf(cl, 1);
+  }
 
-      /* Accept pending connections */
-      cl_fd = pr_ctrls_accept(ctrls_sockfd, &cl_uid, &cl_gid, &cl_pid,
-        ctrls_cl_freshness);
-      if (cl_fd < 0) {
-        if (errno != ETIMEDOUT) {
-          pr_ctrls_log(MOD_CTRLS_VERSION,
-            "error: unable to accept connection: %s", strerror(errno));
-        }
+  len = read(cl->cl_fd, cl->cl_buf + cl->cl_buflen,
+    cl->cl_bufsz - cl->cl_buflen);
+  if (len < 0) {
+    int xerrno = errno;
+
+    if (xerrno == EINTR ||
+        xerrno == EAGAIN ||
+        xerrno == EWOULDBLOCK) {
+      return FALSE;
+    }
+
+    pr_ctrls_log(MOD_CTRLS_VERSION,
+      "error: unable to receive client request: %s", strerror(xerrno));
+    ctrls_cl_close(cl);
+    return FALSE;
+  }
+
+  if (len == 0) {
+    /* The client went away before sending its entire request. */
+    ctrls_cl_close(cl);
+    return FALSE;
+  }
+
+  cl->cl_buflen += len;
+
+  res = pr_ctrls_parse_request(cl, cl->cl_buf, cl->cl_buflen);
+  if (res == 0) {
+    /* Wait for the rest of the request. */
+    return FALSE;
+  }
+
+  if (res < 0) {
+    if (errno == EINVAL) {
 
+      /* Unsupported action requested */
+      cl->cl_flags = PR_CTRLS_CL_NOACTION;
+
+      pr_ctrls_log(MOD_CTRLS_VERSION,
+        "recvd from %s/%s client: (invalid action)", cl->cl_user,
+        cl->cl_group);
+      return TRUE;
+    }
+
+    pr_ctrls_log(MOD_CTRLS_VERSION,
+      "error: unable to receive client request: %s", strerror(errno));
+    ctrls_cl_close(cl);
+    return FALSE;
+
+  } else {
+    pr_ctrls_t *ctrl = *((pr_ctrls_t **) cl->cl_ctrls->elts);
+    char *request = (char *) ctrl->ctrls_action;
+
+    /* Request successfully read.  Flag this client as being in such a
+     * state.
+     */
+    cl->cl_flags = PR_CTRLS_CL_HAVEREQ;
+
+    if (ctrl->ctrls_cb_args) {
+      int reqargc = ctrl->ctrls_cb_args->nelts;
+      char **reqargv = ctrl->ctrls_cb_args->elts;
+
+      /* Reconstruct the original request string from the client for
+       * logging.
+       */
+      while (reqargc--)
+        request = pstrcat(cl->cl_pool, request, " ", *reqargv++, NULL);
+
+      pr_ctrls_log(MOD_CTRLS_VERSION,
+        "recvd from %s/%s client: '%s'", cl->cl_user, cl->cl_group,
+        request);
+    }
+  }
+
+  return TRUE;
+}
+
+/* Write as much of the client's queued responses as its socket will take,
+ * closing the connection once they are all written.
+ */
+static void ctrls_cl_write(pr_ctrls_cl_t *cl) {
+  while (cl->cl_bufpos < cl->cl_buflen) {
+    ssize_t len;
+
+    len = write(cl->cl_fd, cl->cl_buf + cl->cl_bufpos,
+      cl->cl_buflen - cl->cl_bufpos);
+    if (len < 0) {
+      int xerrno = errno;
+
+      if (xerrno == EINTR) {
         continue;
       }
 
-      /* Restore blocking mode to the ctrl socket */
-      if (ctrls_setblock(ctrls_sockfd) < 0) {
-        pr_ctrls_log(MOD_CTRLS_VERSION,
-          "error: unable to set blocking on local socket: %s",
-          strerror(errno));
+      if (xerrno == EAGAIN ||
+          xerrno == EWOULDBLOCK) {
+        return;
       }
 
-      /* Set this socket as non-blocking */
-      if (ctrls_setnonblock(cl_fd) < 0) {
-        pr_ctrls_log(MOD_CTRLS_VERSION,
-          "error: unable to set nonblocking on client socket: %s",
-          strerror(errno));
+      pr_ctrls_log(MOD_CTRLS_VERSION,
+        "error: unable to send response to %s/%s client: %s",
+        cl->cl_user, cl->cl_group, strerror(xerrno));
+      break;
+    }
+
+    cl->cl_bufpos += len;
+  }
+
+  ctrls_cl_close(cl);
+}
+
+/* Accept pending connections on the ctrl socket.  The listening socket is
+ * nonblocking, so this stops once there are no more connections waiting.
+ */
+static void ctrls_accept_cls(void) {
+  while (cl_listlen < cl_maxlistlen) {
+    pr_ctrls_cl_t *cl;
+    uid_t cl_uid;
+    gid_t cl_gid;
+    pid_t cl_pid;
+    unsigned long cl_flags = 0;
+    int cl_fd;
+
+    cl_fd = pr_ctrls_accept(ctrls_sockfd, &cl_uid, &cl_gid, &cl_pid,
+      ctrls_cl_freshness);
+    if (cl_fd < 0) {
+      if (errno == EINTR ||
+          errno == ETIMEDOUT) {
         continue;
       }
 
-      if (!pr_ctrls_check_user_acl(cl_uid, &ctrls_sock_acl.acl_usrs) &&
-          !pr_ctrls_check_group_acl(cl_gid, &ctrls_sock_acl.acl_grps)) {
-        cl_flags = PR_CTRLS_CL_NOACCESS;
+      if (errno != EAGAIN &&
+          errno != EWOULDBLOCK) {
+        pr_ctrls_log(MOD_CTRLS_VERSION,
+          "error: unable to accept connection: %s", strerror(errno));
       }
 
-      /* Add the client to the list */
-      ctrls_add_cl(cl_fd, cl_uid, cl_gid, cl_pid, cl_flags);
+      break;
     }
-  }
 
-  /* Go through the client list */
-  ctrls_cls_read();
+    /* Set this socket as non-blocking */
+    if (ctrls_setnonblock(cl_fd) < 0) {
+      pr_ctrls_log(MOD_CTRLS_VERSION,
+        "error: unable to set nonblocking on client socket: %s",
+        strerror(errno));
+      (void) close(cl_fd);
+      continue;
+    }
 
-  return 0; 
+    if (!pr_ctrls_check_user_acl(cl_uid, &ctrls_sock_acl.acl_usrs) &&
+        !pr_ctrls_check_group_acl(cl_gid, &ctrls_sock_acl.acl_grps)) {
+      cl_flags = PR_CTRLS_CL_NOACCESS;
+    }
+
+    /* Add the client to the list */
+    cl = ctrls_add_cl(cl_fd, cl_uid, cl_gid, cl_pid, cl_flags);
+
+    if (cl_flags == PR_CTRLS_CL_NOACCESS) {
+      ctrls_cl_respond(cl);
+    }
+  }
 }
 
-static int ctrls_send_cl_resps(void) {
+/* Called from the daemon's main loop, to add the ctrl socket and our clients
+ * to the descriptors being watched.  Clients without a complete request are
+ * watched for reading; those with responses queued, for writing.
+ */
+static int ctrls_add_fds(fd_set *rfds, fd_set *wfds, int maxfd) {
+  pr_ctrls_cl_t *cl;
 
-  /* Go through the client list */
-  ctrls_cls_write();
+  if (ctrls_engine == FALSE ||
+      ctrls_sockfd < 0) {
+    return maxfd;
+  }
 
-  return 0;
-}
+  if (cl_listlen < cl_maxlistlen) {
+    FD_SET(ctrls_sockfd, rfds);
+    if (ctrls_sockfd > maxfd) {
+      maxfd = ctrls_sockfd;
+    }
+  }
 
-static int ctrls_setblock(int sockfd) {
-  int flags = 0;
-  int res = -1;
+  for (cl = cl_list; cl; cl = cl->cl_next) {
+    if (cl->cl_fd < 0) {
+      continue;
+    }
 
-  /* default error */
-  errno = EBADF;
+    if (cl->cl_flags == 0) {
+      FD_SET(cl->cl_fd, rfds);
 
-  flags = fcntl(sockfd, F_GETFL);
-  res = fcntl(sockfd, F_SETFL, flags & (U32BITS ^ O_NONBLOCK));
+    } else if (cl->cl_flags == PR_CTRLS_CL_HAVERESP) {
+      FD_SET(cl->cl_fd, wfds);
 
-  return res;
+    } else {
+      continue;
+    }
+
+    if (cl->cl_fd > maxfd) {
+      maxfd = cl->cl_fd;
+    }
+  }
+
+  return maxfd;
 }
 
-static int ctrls_setnonblock(int sockfd) {
-  int flags = 0;
-  int res = -1;
+/* Called from the daemon's main loop with the descriptors which are ready.
+ * Requests are handled as soon as they have been read, rather than waiting
+ * for the ControlsInterval timer.
+ */
+static void ctrls_handle_fds(fd_set *rfds, fd_set *wfds) {
+  pr_ctrls_cl_t *cl, *next_cl;
+  int have_reqs = FALSE;
 
-  /* default error */
-  errno = EBADF;
+  if (ctrls_engine == FALSE ||
+      ctrls_sockfd < 0) {
+    return;
+  }
 
-  flags = fcntl(sockfd, F_GETFL);
-  res = fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+  /* Please no alarms while doing this. */
+  pr_alarms_block();
 
-  return res;
+  for (cl = cl_list; cl; cl = next_cl) {
+    /* The client may be removed from the list while we handle it. */
+    next_cl = cl->cl_next;
+
+    if (cl->cl_flags == PR_CTRLS_CL_HAVERESP) {
+      if (FD_ISSET(cl->cl_fd, wfds)) {
+        ctrls_cl_write(cl);
+      }
+
+    } else if (cl->cl_flags == 0) {
+      if (FD_ISSET(cl->cl_fd, rfds)) {
+        if (ctrls_cl_read(cl) == TRUE) {
+          have_reqs = TRUE;
+        }
+      }
+    }
+  }
+
+  if (FD_ISSET(ctrls_sockfd, rfds)) {
+    ctrls_accept_cls();
+  }
+
+  if (have_reqs) {
+    /* Run through the controls */
+    pr_run_ctrls(NULL, NULL);
+
+    /* Queue the responses */
+    for (cl = cl_list; cl; cl = cl->cl_next) {
+      if (cl->cl_flags == PR_CTRLS_CL_HAVEREQ ||
+          cl->cl_flags == PR_CTRLS_CL_NOACTION) {
+        ctrls_cl_respond(cl);
+      }
+    }
+
+    /* Reset controls */
+    pr_reset_ctrls();
+  }
+
+  pr_alarms_unblock();
 }
 
 static int ctrls_timer_cb(CALLBACK_FRAME) {
@@ -734,20 +873,40 @@ static int ctrls_timer_cb(CALLBACK_FRAME) {
     first = FALSE;
   }
 
-  /* Please no alarms while doing this. */
+  /* Client requests are handled from the daemon's main loop, as they
+   * arrive.  Here we run any controls still pending from earlier requests,
+   * and drop clients which have not sent their entire request, or read
+   * their responses, within the interval.
+   */
   pr_alarms_block();
 
-  /* Process pending requests. */
-  ctrls_recv_cl_reqs();
-
-  /* Run through the controls */
   pr_run_ctrls(NULL, NULL);
+  pr_reset_ctrls();
 
-  /* Process pending responses */
-  ctrls_send_cl_resps();
+  if (cl_list) {
+    pr_ctrls_cl_t *cl, *next_cl;
+    time_t now;
 
-  /* Reset controls */
-  pr_reset_ctrls();
+    now = time(NULL);
+
+    for (cl = cl_list; cl; cl = next_cl) {
+      next_cl = cl->cl_next;
+
+      if (now - cl->cl_connected < (time_t) ctrls_interval) {
+        continue;
+      }
+
+      if (cl->cl_flags == 0) {
+        /* Malicious/blocked client */
+        cl->cl_flags = PR_CTRLS_CL_BLOCKED;
+        ctrls_cl_respond(cl);
+
+      } else if (cl->cl_flags == PR_CTRLS_CL_HAVERESP &&
+                 now - cl->cl_connected >= (time_t) (ctrls_interval * 2)) {
+        ctrls_cl_close(cl);
+      }
+    }
+  }
 
   pr_alarms_unblock();
   return 1;
@@ -1278,6 +1437,9 @@ static int ctrls_init(void) {
   /* Start listening on the ctrl socket */
   ctrls_sockfd = ctrls_listen(ctrls_sock_file, 0);
 
+  /* Clients are serviced from the daemon's main loop. */
+  pr_ctrls_set_fds_handler(ctrls_add_fds, ctrls_handle_fds);
+
   pr_event_register(&ctrls_module, "core.restart", ctrls_restart_ev, NULL);
   pr_event_register(&ctrls_module, "core.shutdown", ctrls_shutdown_ev, NULL);
   pr_event_register(&ctrls_module, "core.postparse", ctrls_postparse_ev, NULL);
@@ -1293,9 +1455,18 @@ static int ctrls_sess_init(void) {
 
   pr_event_unregister(&ctrls_module, "core.restart", ctrls_restart_ev);
 
-  /* Close the inherited socket */
+  /* Close the inherited socket, and any inherited client connections */
   close(ctrls_sockfd);
   ctrls_sockfd = -1;
+
+  if (cl_list) {
+    pr_ctrls_cl_t *cl = NULL;
+
+    for (cl = cl_list; cl; cl = cl->cl_next) {
+      close(cl->cl_fd);
+      cl->cl_fd = -1;
+    }
+  }
  
   return 0;
 }
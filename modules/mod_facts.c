@@ -52,7 +52,6 @@ static unsigned long facts_mlinfo_opts = 0;
 struct mlinfo {
   pool *pool;
   struct stat st;
-  struct tm *tm;
   const char *type;
   const char *perm;
   const char *path;
@@ -60,6 +59,7 @@ struct mlinfo {
 
 /* Necessary prototypes */
 static void facts_mlinfobuf_flush(void);
+static void facts_mlinfobuf_xfer(char *, size_t);
 static int facts_sess_init(void);
 
 /* Support functions
@@ -202,82 +202,236 @@ static time_t facts_mktime(unsigned int year, unsigned int month,
   return res;
 }
 
+/* The perm fact values, indexed by the FACTS_ACCESS_* bits granted on the
+ * file or directory.
+ */
+#define FACTS_ACCESS_READ	0x01
+#define FACTS_ACCESS_WRITE	0x02
+#define FACTS_ACCESS_EXEC	0x04
+
+static const char *facts_file_perms[8] = {
+  "", "adfr", "w", "adfrw", "", "adfr", "w", "adfrw"
+};
+
+static const char *facts_dir_perms[8] = {
+  "", "fl", "cdmp", "flcdmp", "e", "fle", "cdmpe", "flcdmpe"
+};
+
+/* The "unique=<dev>U" prefix is the same for every entry of most listings,
+ * so the prefix for the last device seen is kept formatted.
+ */
+static dev_t facts_unique_dev = 0;
+static char facts_unique_prefix[32];
+static size_t facts_unique_prefixlen = 0;
+
+/* Set for the duration of an MLSD/MLST when the access checks can be made
+ * against the stat(2) data already obtained, rather than by stat'ing each
+ * path again; see pr_fs_have_sys_access().
+ */
+static int facts_use_sys_access = FALSE;
+
+static char *facts_buf_add(char *ptr, char *end, const char *str,
+    size_t len) {
+  if (len > (size_t) (end - ptr)) {
+    len = end - ptr;
+  }
+
+  memcpy(ptr, str, len);
+  return ptr + len;
+}
+
+/* Formats the given number, in the given base (8, 10 or 16, using uppercase
+ * hex digits), into buf (which must hold at least 24 bytes).  Returns the
+ * number of digits written; buf is not NUL-terminated.
+ */
+static size_t facts_fmt_num(char *buf, unsigned long long num,
+    unsigned int base) {
+  static const char digits[] = "0123456789ABCDEF";
+  char tmp[24];
+  size_t len = 0, i;
+
+  do {
+    tmp[len++] = digits[num % base];
+    num /= base;
+  } while (num > 0);
+
+  for (i = 0; i < len; i++) {
+    buf[i] = tmp[len - i - 1];
+  }
+
+  return len;
+}
+
+static char *facts_buf_add_num(char *ptr, char *end, unsigned long long num,
+    unsigned int base) {
+  char tmp[24];
+  size_t len;
+
+  len = facts_fmt_num(tmp, num, base);
+  return facts_buf_add(ptr, end, tmp, len);
+}
+
+/* Formats the given time as the 14-digit YYYYMMDDHHMMSS (UTC) timestamp
+ * used by the modify fact.  The calendar date is computed directly from
+ * the day count, avoiding a gmtime(3) call (and its struct tm) per entry.
+ * Returns the length written, or 0 if the year cannot be represented in
+ * four digits.
+ */
+static size_t facts_fmt_mtime(char *buf, time_t t) {
+  long long days, secs, era, doe, yoe, doy, mp, year;
+  unsigned int mon, mday, hour, min, sec, i;
+  unsigned int fields[5];
+
+  days = (long long) t / FACTS_SECS_PER_DAY;
+  secs = (long long) t % FACTS_SECS_PER_DAY;
+  if (secs < 0) {
+    secs += FACTS_SECS_PER_DAY;
+    days--;
+  }
+
+  /* Shift the epoch to 0000-03-01, so that leap days fall at the end of
+   * each (March-based) year, and 400-year eras repeat exactly.
+   */
+  days += 719468;
+  era = (days >= 0 ? days : days - 146096) / 146097;
+  doe = days - (era * 146097);
+  yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  doy = doe - (365 * yoe + yoe/4 - yoe/100);
+  mp = (5 * doy + 2) / 153;
+
+  mday = (unsigned int) (doy - (153 * mp + 2)/5 + 1);
+  mon = (unsigned int) (mp < 10 ? mp + 3 : mp - 9);
+  year = yoe + (era * 400) + (mon <= 2 ? 1 : 0);
+
+  if (year < 0 ||
+      year > 9999) {
+    return 0;
+  }
+
+  hour = (unsigned int) (secs / FACTS_SECS_PER_HOUR);
+  min = (unsigned int) ((secs % FACTS_SECS_PER_HOUR) / FACTS_SECS_PER_MIN);
+  sec = (unsigned int) (secs % FACTS_SECS_PER_MIN);
+
+  buf[0] = '0' + (year / 1000);
+  buf[1] = '0' + ((year / 100) % 10);
+  buf[2] = '0' + ((year / 10) % 10);
+  buf[3] = '0' + (year % 10);
+
+  fields[0] = mon;
+  fields[1] = mday;
+  fields[2] = hour;
+  fields[3] = min;
+  fields[4] = sec;
+
+  for (i = 0; i < 5; i++) {
+    buf[4 + (i * 2)] = '0' + (fields[i] / 10);
+    buf[5 + (i * 2)] = '0' + (fields[i] % 10);
+  }
+
+  return 14;
+}
+
+/* Formats the facts line for the given info into buf, writing no more than
+ * bufsz bytes (including the terminating NUL).  Returns the length of the
+ * line.
+ */
 static size_t facts_mlinfo_fmt(struct mlinfo *info, char *buf, size_t bufsz,
     int flags) {
-  char *ptr;
-  size_t buflen = 0;
+  char *ptr, *end, tmp[32];
+  size_t len;
 
-  memset(buf, '\0', bufsz);
+  if (bufsz == 0) {
+    return 0;
+  }
 
   ptr = buf;
+  end = buf + bufsz - 1;
 
   if (facts_opts & FACTS_OPT_SHOW_MODIFY) {
-    snprintf(ptr, bufsz, "modify=%04d%02d%02d%02d%02d%02d;",
-      info->tm->tm_year+1900, info->tm->tm_mon+1, info->tm->tm_mday,
-      info->tm->tm_hour, info->tm->tm_min, info->tm->tm_sec);
-    buflen = strlen(buf);
-    ptr = buf + buflen;
+    len = facts_fmt_mtime(tmp, info->st.st_mtime);
+    if (len == 0) {
+      struct tm *tm;
+
+      tm = pr_gmtime(NULL, &(info->st.st_mtime));
+      if (tm != NULL) {
+        snprintf(tmp, sizeof(tmp), "%04d%02d%02d%02d%02d%02d",
+          tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday, tm->tm_hour,
+          tm->tm_min, tm->tm_sec);
+        tmp[sizeof(tmp)-1] = '\0';
+        len = strlen(tmp);
+      }
+    }
+
+    ptr = facts_buf_add(ptr, end, "modify=", 7);
+    ptr = facts_buf_add(ptr, end, tmp, len);
+    ptr = facts_buf_add(ptr, end, ";", 1);
   }
 
   if (facts_opts & FACTS_OPT_SHOW_PERM) {
-    snprintf(ptr, bufsz - buflen, "perm=%s;", info->perm);
-    buflen = strlen(buf);
-    ptr = buf + buflen;
+    ptr = facts_buf_add(ptr, end, "perm=", 5);
+    ptr = facts_buf_add(ptr, end, info->perm, strlen(info->perm));
+    ptr = facts_buf_add(ptr, end, ";", 1);
   }
 
   if (!S_ISDIR(info->st.st_mode) &&
       (facts_opts & FACTS_OPT_SHOW_SIZE)) {
-    snprintf(ptr, bufsz - buflen, "size=%" PR_LU ";",
-      (pr_off_t) info->st.st_size);
-    buflen = strlen(buf);
-    ptr = buf + buflen;
+    ptr = facts_buf_add(ptr, end, "size=", 5);
+    ptr = facts_buf_add_num(ptr, end, (unsigned long long) info->st.st_size,
+      10);
+    ptr = facts_buf_add(ptr, end, ";", 1);
   }
 
   if (facts_opts & FACTS_OPT_SHOW_TYPE) {
-    snprintf(ptr, bufsz - buflen, "type=%s;", info->type);
-    buflen = strlen(buf);
-    ptr = buf + buflen;
+    ptr = facts_buf_add(ptr, end, "type=", 5);
+    ptr = facts_buf_add(ptr, end, info->type, strlen(info->type));
+    ptr = facts_buf_add(ptr, end, ";", 1);
   }
 
   if (facts_opts & FACTS_OPT_SHOW_UNIQUE) {
-    snprintf(ptr, bufsz - buflen, "unique=%lXU%lX;",
-      (unsigned long) info->st.st_dev, (unsigned long) info->st.st_ino);
-    buflen = strlen(buf);
-    ptr = buf + buflen;
+    if (facts_unique_prefixlen == 0 ||
+        facts_unique_dev != info->st.st_dev) {
+      memcpy(facts_unique_prefix, "unique=", 7);
+      facts_unique_prefixlen = 7;
+      facts_unique_prefixlen += facts_fmt_num(facts_unique_prefix + 7,
+        (unsigned long) info->st.st_dev, 16);
+      facts_unique_prefix[facts_unique_prefixlen++] = 'U';
+      facts_unique_dev = info->st.st_dev;
+    }
+
+    ptr = facts_buf_add(ptr, end, facts_unique_prefix,
+      facts_unique_prefixlen);
+    ptr = facts_buf_add_num(ptr, end, (unsigned long) info->st.st_ino, 16);
+    ptr = facts_buf_add(ptr, end, ";", 1);
   }
 
   if (facts_opts & FACTS_OPT_SHOW_UNIX_GROUP) {
-    snprintf(ptr, bufsz - buflen, "UNIX.group=%lu;",
-      (unsigned long) info->st.st_gid);
-    buflen = strlen(buf);
-    ptr = buf + buflen;
+    ptr = facts_buf_add(ptr, end, "UNIX.group=", 11);
+    ptr = facts_buf_add_num(ptr, end, (unsigned long) info->st.st_gid, 10);
+    ptr = facts_buf_add(ptr, end, ";", 1);
   }
 
   if (facts_opts & FACTS_OPT_SHOW_UNIX_MODE) {
-    snprintf(ptr, bufsz - buflen, "UNIX.mode=0%o;",
-      (unsigned int) info->st.st_mode & 07777);
-    buflen = strlen(buf);
-    ptr = buf + buflen;
+    ptr = facts_buf_add(ptr, end, "UNIX.mode=0", 11);
+    ptr = facts_buf_add_num(ptr, end,
+      (unsigned int) info->st.st_mode & 07777, 8);
+    ptr = facts_buf_add(ptr, end, ";", 1);
   }
 
   if (facts_opts & FACTS_OPT_SHOW_UNIX_OWNER) {
-    snprintf(ptr, bufsz - buflen, "UNIX.owner=%lu;",
-      (unsigned long) info->st.st_uid);
-    buflen = strlen(buf);
-    ptr = buf + buflen;
+    ptr = facts_buf_add(ptr, end, "UNIX.owner=", 11);
+    ptr = facts_buf_add_num(ptr, end, (unsigned long) info->st.st_uid, 10);
+    ptr = facts_buf_add(ptr, end, ";", 1);
   }
 
-  if (flags & FACTS_MLINFO_FL_APPEND_CRLF) {
-    snprintf(ptr, bufsz - buflen, " %s\r\n", info->path);
+  ptr = facts_buf_add(ptr, end, " ", 1);
+  ptr = facts_buf_add(ptr, end, info->path, strlen(info->path));
 
-  } else {
-    snprintf(ptr, bufsz - buflen, " %s", info->path);
+  if (flags & FACTS_MLINFO_FL_APPEND_CRLF) {
+    ptr = facts_buf_add(ptr, end, "\r\n", 2);
   }
 
-  buf[bufsz-1] = '\0';
-  buflen = strlen(buf);
-
-  return buflen;
+  *ptr = '\0';
+  return ptr - buf;
 }
 
 /* This buffer is used by the MLSD handler, to buffer up the output lines.
@@ -294,6 +448,19 @@ static char *mlinfo_buf = NULL, *mlinfo_bufptr = NULL;
 static size_t mlinfo_bufsz = 0;
 static size_t mlinfo_buflen = 0;
 
+/* The most that the facts preceding the path in a line can occupy, other
+ * than the type fact (which, for a symlink, includes its target).
+ */
+#define FACTS_MLINFO_MAX_FACTSZ		256
+
+/* Returns the size of a buffer which will hold the entire facts line for
+ * the given info, including the CRLF and the terminating NUL.
+ */
+static size_t facts_mlinfo_bufsz(struct mlinfo *info) {
+  return FACTS_MLINFO_MAX_FACTSZ + strlen(info->type) + strlen(info->path) +
+    3;
+}
+
 static void facts_mlinfobuf_init(void) {
   if (mlinfo_buf == NULL) {
     mlinfo_bufsz = pr_config_get_server_xfer_bufsz(PR_NETIO_IO_WR);
@@ -310,55 +477,110 @@ static void facts_mlinfobuf_init(void) {
       (unsigned long) mlinfo_bufsz);
   }
 
-  memset(mlinfo_buf, '\0', mlinfo_bufsz);
   mlinfo_bufptr = mlinfo_buf;
   mlinfo_buflen = 0;
 }
 
 static void facts_mlinfobuf_add(struct mlinfo *info, int flags) {
-  char buf[PR_TUNABLE_BUFFER_SIZE];
-  size_t buflen;
- 
-  buflen = facts_mlinfo_fmt(info, buf, sizeof(buf), flags);
+  size_t buflen, bufsz;
 
-  /* If this buffer will exceed the capacity of mlinfo_buf, then flush
-   * mlinfo_buf.
+  /* Lines are formatted directly into mlinfo_buf.  If the longest line this
+   * entry could produce might not fit, flush mlinfo_buf first.
    */
-  if (buflen >= (mlinfo_bufsz - mlinfo_buflen)) {
+  bufsz = facts_mlinfo_bufsz(info);
+  if (bufsz >= (mlinfo_bufsz - mlinfo_buflen)) {
     (void) facts_mlinfobuf_flush();
   }
 
-  sstrcat(mlinfo_bufptr, buf, mlinfo_bufsz - mlinfo_buflen);
+  if (bufsz > mlinfo_bufsz) {
+    pool *tmp_pool;
+    char *buf;
+
+    /* A line longer than the entire buffer (e.g. for a symlink with a long
+     * target) is formatted, and sent, on its own.
+     */
+    tmp_pool = make_sub_pool(mlinfo_pool);
+    pr_pool_tag(tmp_pool, "Facts MLSD line pool");
+
+    buf = palloc(tmp_pool, bufsz);
+    buflen = facts_mlinfo_fmt(info, buf, bufsz, flags);
+    facts_mlinfobuf_xfer(buf, buflen);
+
+    destroy_pool(tmp_pool);
+    return;
+  }
+
+  buflen = facts_mlinfo_fmt(info, mlinfo_bufptr, bufsz, flags);
   mlinfo_bufptr += buflen;
   mlinfo_buflen += buflen;
 }
 
+static void facts_mlinfobuf_xfer(char *buf, size_t buflen) {
+  int res;
+
+  /* Make sure the ASCII flags are cleared from the session flags,
+   * so that the pr_data_xfer() function does not try to perform
+   * ASCII translation on this data.
+   */
+  session.sf_flags &= ~SF_ASCII_OVERRIDE;
+
+  res = pr_data_xfer(buf, buflen);
+  if (res < 0 &&
+      errno != 0) {
+    pr_log_debug(DEBUG3, MOD_FACTS_VERSION
+      ": error transferring data: [%d] %s", errno, strerror(errno));
+  }
+
+  session.sf_flags |= SF_ASCII_OVERRIDE;
+}
+
 static void facts_mlinfobuf_flush(void) {
   if (mlinfo_buflen > 0) {
-    int res;
+    facts_mlinfobuf_xfer(mlinfo_buf, mlinfo_buflen);
+  }
 
-    /* Make sure the ASCII flags are cleared from the session flags,
-     * so that the pr_data_xfer() function does not try to perform
-     * ASCII translation on this data.
-     */
-    session.sf_flags &= ~SF_ASCII_OVERRIDE;
+  facts_mlinfobuf_init();
+}
 
-    res = pr_data_xfer(mlinfo_buf, mlinfo_buflen);
-    if (res < 0 &&
-        errno != 0) {
-      pr_log_debug(DEBUG3, MOD_FACTS_VERSION
-        ": error transferring data: [%d] %s", errno, strerror(errno));
+/* Returns the FACTS_ACCESS_* bits granted to the session user on the given
+ * path, whose (followed) stat(2) data is in st.
+ */
+static int facts_get_access(const char *path, struct stat *st, int modes) {
+  int access = 0;
+
+  if (modes & FACTS_ACCESS_READ) {
+    if ((facts_use_sys_access ?
+        pr_fs_check_access(st, R_OK, session.uid, session.gid, session.gids) :
+        pr_fsio_access(path, R_OK, session.uid, session.gid,
+          session.gids)) == 0) {
+      access |= FACTS_ACCESS_READ;
     }
+  }
 
-    session.sf_flags |= SF_ASCII_OVERRIDE;
+  if (modes & FACTS_ACCESS_WRITE) {
+    if ((facts_use_sys_access ?
+        pr_fs_check_access(st, W_OK, session.uid, session.gid, session.gids) :
+        pr_fsio_access(path, W_OK, session.uid, session.gid,
+          session.gids)) == 0) {
+      access |= FACTS_ACCESS_WRITE;
+    }
   }
 
-  facts_mlinfobuf_init();
+  if (modes & FACTS_ACCESS_EXEC) {
+    if ((facts_use_sys_access ?
+        pr_fs_check_access(st, X_OK, session.uid, session.gid, session.gids) :
+        pr_fsio_access(path, X_OK, session.uid, session.gid,
+          session.gids)) == 0) {
+      access |= FACTS_ACCESS_EXEC;
+    }
+  }
+
+  return access;
 }
 
 static int facts_mlinfo_get(struct mlinfo *info, const char *path,
     const char *dent_name, int flags, uid_t uid, gid_t gid, mode_t *mode) {
-  char *perm = "";
+  struct stat *access_st;
   int res;
 
   res = pr_fsio_lstat(path, &(info->st));
@@ -372,20 +594,14 @@ static int facts_mlinfo_get(struct mlinfo *info, const char *path,
     return -1;
   }
 
-  if (uid != (uid_t) -1) {
-    info->st.st_uid = uid;
-  }
-
-  if (gid != (gid_t) -1) {
-    info->st.st_gid = gid;
-  }
-
-  info->tm = pr_gmtime(info->pool, &(info->st.st_mtime));
+  /* The access checks apply to the target of a symlink. */
+  access_st = &(info->st);
 
   if (!S_ISDIR(info->st.st_mode)) {
 #ifdef S_ISLNK
+    struct stat target_st;
+
     if (S_ISLNK(info->st.st_mode)) {
-      struct stat target_st;
 
       /* Now we need to use stat(2) on the path (versus lstat(2)) to get the
        * info for the target, and copy its st_dev and st_ino values to our
@@ -404,6 +620,7 @@ static int facts_mlinfo_get(struct mlinfo *info, const char *path,
         return -1;
       }
 
+      access_st = &target_st;
       info->st.st_dev = target_st.st_dev;
       info->st.st_ino = target_st.st_ino;
 
@@ -475,22 +692,13 @@ static int facts_mlinfo_get(struct mlinfo *info, const char *path,
     info->type = "file";
 #endif
 
-    if (pr_fsio_access(path, R_OK, session.uid, session.gid,
-        session.gids) == 0) {
-
-      /* XXX Need to come up with a good way of determining whether 'd'
-       * should be listed.  For example, if the parent directory does not
-       * allow write privs to the current user/group, then the file cannot
-       * be deleted.
-       */
-
-      perm = pstrcat(info->pool, perm, "adfr", NULL);
-    }
-
-    if (pr_fsio_access(path, W_OK, session.uid, session.gid,
-        session.gids) == 0) {
-      perm = pstrcat(info->pool, perm, "w", NULL);
-    }
+    /* XXX Need to come up with a good way of determining whether 'd'
+     * should be listed.  For example, if the parent directory does not
+     * allow write privs to the current user/group, then the file cannot
+     * be deleted.
+     */
+    info->perm = facts_file_perms[facts_get_access(path, access_st,
+      FACTS_ACCESS_READ|FACTS_ACCESS_WRITE)];
 
   } else {
     info->type = "dir";
@@ -510,23 +718,17 @@ static int facts_mlinfo_get(struct mlinfo *info, const char *path,
       }
     }
 
-    if (pr_fsio_access(path, R_OK, session.uid, session.gid,
-        session.gids) == 0) {
-      perm = pstrcat(info->pool, perm, "fl", NULL);
-    }
-
-    if (pr_fsio_access(path, W_OK, session.uid, session.gid,
-        session.gids) == 0) {
-      perm = pstrcat(info->pool, perm, "cdmp", NULL);
-    }
+    info->perm = facts_dir_perms[facts_get_access(path, access_st,
+      FACTS_ACCESS_READ|FACTS_ACCESS_WRITE|FACTS_ACCESS_EXEC)];
+  }
 
-    if (pr_fsio_access(path, X_OK, session.uid, session.gid,
-        session.gids) == 0) {
-      perm = pstrcat(info->pool, perm, "e", NULL);
-    }
+  if (uid != (uid_t) -1) {
+    info->st.st_uid = uid;
   }
 
-  info->perm = perm;
+  if (gid != (gid_t) -1) {
+    info->st.st_gid = gid;
+  }
 
   if (mode != NULL) {
     /* We cheat here by simply overwriting the entire st.st_mode value with
@@ -540,9 +742,12 @@ static int facts_mlinfo_get(struct mlinfo *info, const char *path,
 }
 
 static void facts_mlinfo_add(struct mlinfo *info, int flags) {
-  char buf[PR_TUNABLE_BUFFER_SIZE];
+  char *buf;
+  size_t bufsz;
 
-  (void) facts_mlinfo_fmt(info, buf, sizeof(buf), flags);
+  bufsz = facts_mlinfo_bufsz(info);
+  buf = palloc(info->pool, bufsz);
+  (void) facts_mlinfo_fmt(info, buf, bufsz, flags);
 
   /* The trailing CRLF will be added by pr_response_add(). */
   pr_response_add(R_DUP, "%s", buf);
@@ -1255,6 +1460,10 @@ MODRET facts_mlsd(cmd_rec *cmd) {
   pr_fs_clear_cache();
   facts_mlinfobuf_init();
 
+  /* Resolve the hiding policies once for the listing, not per entry. */
+  dir_hide_begin();
+  facts_use_sys_access = pr_fs_have_sys_access();
+
   while ((dent = pr_fsio_readdir(dirh)) != NULL) {
     int hidden = FALSE, res;
     char *rel_path, *abs_path;
@@ -1313,6 +1522,8 @@ MODRET facts_mlsd(cmd_rec *cmd) {
     }
   }
 
+  facts_use_sys_access = FALSE;
+  dir_hide_end();
   pr_fsio_closedir(dirh);
 
   if (XFER_ABORTED) {
@@ -1345,7 +1556,7 @@ MODRET facts_mlsd_cleanup(cmd_rec *cmd) {
 }
 
 MODRET facts_mlst(cmd_rec *cmd) {
-  int flags = 0, hidden = FALSE;
+  int flags = 0, hidden = FALSE, res;
   config_rec *c;
   uid_t fake_uid = -1;
   gid_t fake_gid = -1;
@@ -1446,8 +1657,12 @@ MODRET facts_mlst(cmd_rec *cmd) {
   flags |= FACTS_MLINFO_FL_NO_CDIR;
 
   pr_fs_clear_cache();
-  if (facts_mlinfo_get(&info, decoded_path, decoded_path, flags, fake_uid,
-      fake_gid, fake_mode) < 0) {
+  facts_use_sys_access = pr_fs_have_sys_access();
+  res = facts_mlinfo_get(&info, decoded_path, decoded_path, flags, fake_uid,
+    fake_gid, fake_mode);
+  facts_use_sys_access = FALSE;
+
+  if (res < 0) {
     pr_response_add_err(R_550, _("'%s' cannot be listed"), path);
     return PR_ERROR(cmd);
   }
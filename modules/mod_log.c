@@ -83,6 +83,7 @@ static xaset_t *log_set = NULL;
    %b			- Bytes sent for request
    %{basename}		- Basename of path
    %c			- Class
+   %{cmd-latency}	- Time spent handling the command, in microseconds
    %D			- full directory path
    %d			- directory (for client)
    %E			- End-of-session reason
@@ -191,6 +192,12 @@ static void logformat(const char *directive, char *nickname, char *fmts) {
           continue;
         }
  
+        if (strncmp(tmp, "{cmd-latency}", 13) == 0) {
+          add_meta(&outs, LOGFMT_META_CMD_LATENCY, 0);
+          tmp += 13;
+          continue;
+        }
+
         if (strncmp(tmp, "{file-modified}", 15) == 0) {
           add_meta(&outs, LOGFMT_META_FILE_MODIFIED, 0);
           tmp += 15;
@@ -1593,6 +1600,22 @@ static char *get_next_meta(pool *p, cmd_rec *cmd, unsigned char **f) {
       break;
     }
 
+    case LOGFMT_META_CMD_LATENCY: {
+      unsigned long usecs;
+
+      argp = arg;
+
+      if (pr_metrics_get_cmd_usecs(cmd, &usecs) == 0) {
+        snprintf(argp, sizeof(arg), "%lu", usecs);
+
+      } else {
+        sstrncpy(argp, "-", sizeof(arg));
+      }
+
+      m++;
+      break;
+    }
+
     case LOGFMT_META_VERSION:
       argp = arg;
       sstrncpy(argp, PROFTPD_VERSION_TEXT, sizeof(arg));
@@ -43,7 +43,7 @@
 static void addfile(cmd_rec *, const char *, const char *, time_t, off_t);
 static int outputfiles(cmd_rec *);
 
-static int listfile(cmd_rec *, pool *, const char *);
+static int listfile(cmd_rec *, pool *, const char *, const char *);
 static int listdir(cmd_rec *, pool *, const char *);
 
 static int sendline(int flags, char *fmt, ...)
@@ -164,7 +164,12 @@ static config_rec *find_ls_limit(char *cmd_name) {
   return NULL;
 }
 
-static int is_safe_symlink(pool *p, const char *path, size_t pathlen) {
+/* Checks that the given symlink target, for a symlink in the given directory
+ * (relative to the current directory, or NULL for the current directory
+ * itself), does not point to that directory or higher up the path.
+ */
+static int is_safe_symlink(pool *p, const char *dir, const char *path,
+    size_t pathlen) {
 
   /* First, check the most common cases: '.', './', '..', and '../'. */
   if ((pathlen == 1 && path[0] == '.') ||
@@ -179,20 +184,29 @@ static int is_safe_symlink(pool *p, const char *path, size_t pathlen) {
   if (pathlen >= 2 &&
       path[0] == '.' &&
       (path[pathlen-1] == '/' || path[pathlen-1] == '.')) {
-    char buf[PR_TUNABLE_PATH_MAX + 1], *full_path;
+    char buf[PR_TUNABLE_PATH_MAX + 1], dir_buf[PR_TUNABLE_PATH_MAX + 1];
+    char *full_path;
+    const char *link_dir;
     size_t buflen;
 
-    full_path = pdircat(p, pr_fs_getcwd(), path, NULL);
+    link_dir = pr_fs_getcwd();
+    if (dir != NULL) {
+      dir_buf[sizeof(dir_buf)-1] = '\0';
+      pr_fs_clean_path(pdircat(p, link_dir, dir, NULL), dir_buf,
+        sizeof(dir_buf)-1);
+      link_dir = dir_buf;
+    }
+
+    full_path = pdircat(p, link_dir, path, NULL);
 
     buf[sizeof(buf)-1] = '\0';
     pr_fs_clean_path(full_path, buf, sizeof(buf)-1);
     buflen = strlen(buf);
 
-    /* If the cleaned path appears in the current working directory, we
-     * have an "unsafe" symlink pointing to the current directory (or higher
-     * up the path).
+    /* If the cleaned path appears in the symlink's directory, we have an
+     * "unsafe" symlink pointing to that directory (or higher up the path).
      */
-    if (strncmp(pr_fs_getcwd(), buf, buflen) == 0) {
+    if (strncmp(link_dir, buf, buflen) == 0) {
       return FALSE;
     }
   }
@@ -200,6 +214,29 @@ static int is_safe_symlink(pool *p, const char *path, size_t pathlen) {
   return TRUE;
 }
 
+/* Returns TRUE if the path of the given name, within the given directory
+ * (relative to the current directory, as for listfile()), would be longer
+ * than PR_TUNABLE_PATH_MAX once made absolute.  Such paths cannot be checked
+ * against the configuration, and so are neither listed nor, for -R,
+ * descended into.
+ */
+static int ls_path_too_long(const char *dir, const char *name) {
+  size_t len;
+
+  len = strlen(pr_fs_getcwd()) + strlen(name) + 1;
+  if (dir != NULL) {
+    len += strlen(dir) + 1;
+  }
+
+  if (len > PR_TUNABLE_PATH_MAX) {
+    pr_log_debug(DEBUG3, "skipping '%s%s%s': path exceeds %d characters",
+      dir ? dir : "", dir ? "/" : "", name, PR_TUNABLE_PATH_MAX);
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
 static void push_cwd(char *_cwd, unsigned char *symhold) {
   if (!_cwd)
     _cwd = cwd;
@@ -449,7 +486,25 @@ static char months[12][4] =
   { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
 
-static int listfile(cmd_rec *cmd, pool *p, const char *name) {
+/* Returns the path to the given symlink target, for a symlink in the given
+ * directory (see listfile()).
+ */
+static const char *ls_link_target(pool *p, const char *dir,
+    const char *target) {
+  if (dir == NULL ||
+      *target == '/') {
+    return target;
+  }
+
+  return pdircat(p, dir, target, NULL);
+}
+
+/* Lists the given file.  For recursive listings, the file is in the given
+ * directory (relative to the current directory); otherwise dir is NULL, and
+ * the file is relative to the current directory.  Either way, the file is
+ * displayed using the given name.
+ */
+static int listfile(cmd_rec *cmd, pool *p, const char *dir, const char *name) {
   register unsigned int i;
   int rval = 0, len;
   time_t sort_time;
@@ -459,6 +514,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
   char suffix[2];
   int hidden = 0;
   char *filename, *ptr;
+  const char *path;
   size_t namelen;
 
   /* Note that listfile() expects to be given the file name, NOT the path.
@@ -498,7 +554,14 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
   if (!p)
     p = cmd->tmp_pool;
 
-  if (pr_fsio_lstat(name, &st) == 0) {
+  if (dir != NULL &&
+      ls_path_too_long(dir, name)) {
+    return 0;
+  }
+
+  path = (dir != NULL ? pdircat(p, dir, name, NULL) : name);
+
+  if (pr_fsio_lstat(path, &st) == 0) {
     char *display_name = NULL;
 
     suffix[0] = suffix[1] = '\0';
@@ -550,13 +613,13 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
       struct stat l_st;
 
       pr_fs_clear_cache();
-      if (pr_fsio_stat(name, &l_st) != -1) {
+      if (pr_fsio_stat(path, &l_st) != -1) {
         memcpy(&st, &l_st, sizeof(struct stat));
 
         /* First see if the symlink itself is hidden e.g. by HideFiles
          * (see Bug#3924).
          */
-        if (!ls_perms_full(p, cmd, name, &hidden)) {
+        if (!ls_perms_full(p, cmd, path, &hidden)) {
           return 0;
         }
 
@@ -564,7 +627,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
           return 0;
         }
 
-        len = pr_fsio_readlink(name, m, sizeof(m) - 1);
+        len = pr_fsio_readlink(path, m, sizeof(m) - 1);
         if (len < 0)
           return 0;
 
@@ -574,11 +637,11 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
         m[len] = '\0';
 
         /* If the symlink points to either '.' or '..', skip it (Bug#3719). */
-        if (is_safe_symlink(p, m, len) == FALSE) {
+        if (is_safe_symlink(p, dir, m, len) == FALSE) {
           return 0;
         }
 
-        if (!ls_perms_full(p, cmd, m, NULL)) {
+        if (!ls_perms_full(p, cmd, ls_link_target(p, dir, m), NULL)) {
           return 0;
         }
 
@@ -590,7 +653,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
       /* First see if the symlink itself is hidden e.g. by HideFiles
        * (see Bug#3924).
        */
-      if (!ls_perms(p, cmd, name, &hidden)) {
+      if (!ls_perms(p, cmd, path, &hidden)) {
         return 0;
       }
 
@@ -598,7 +661,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
         return 0;
       }
 
-      len = pr_fsio_readlink(name, l, sizeof(l) - 1);
+      len = pr_fsio_readlink(path, l, sizeof(l) - 1);
       if (len < 0)
         return 0;
 
@@ -608,15 +671,15 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
       l[len] = '\0';
 
       /* If the symlink points to either '.' or '..', skip it (Bug#3719). */
-      if (is_safe_symlink(p, l, len) == FALSE) {
+      if (is_safe_symlink(p, dir, l, len) == FALSE) {
         return 0;
       }
 
-      if (!ls_perms_full(p, cmd, l, &hidden)) {
+      if (!ls_perms_full(p, cmd, ls_link_target(p, dir, l), &hidden)) {
         return 0;
       }
 
-    } else if (!ls_perms(p, cmd, name, &hidden)) {
+    } else if (!ls_perms(p, cmd, is_dotdir(name) ? name : path, &hidden)) {
       return 0;
     }
 
@@ -749,7 +812,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
         if (opt_1) {
           /* One file per line, with no info other than the file name.  Easy. */
           snprintf(nameline, sizeof(nameline)-1, "%s",
-            pr_fs_encode_path(cmd->tmp_pool, display_name));
+            pr_fs_encode_path(p, display_name));
 
         } else {
           if (!opt_n) {
@@ -758,7 +821,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
               "%s %3d %-8s %-8s %s %s %2d %s %s", m, (int) st.st_nlink,
               MAP_UID(st.st_uid), MAP_GID(st.st_gid), s,
               months[t->tm_mon], t->tm_mday, timeline,
-              pr_fs_encode_path(cmd->tmp_pool, display_name));
+              pr_fs_encode_path(p, display_name));
 
           } else {
             /* Format nameline using user/group IDs. */
@@ -766,7 +829,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
               "%s %3d %-8u %-8u %s %s %2d %s %s", m, (int) st.st_nlink,
               (unsigned) st.st_uid, (unsigned) st.st_gid, s,
               months[t->tm_mon], t->tm_mday, timeline,
-              pr_fs_encode_path(cmd->tmp_pool, name));
+              pr_fs_encode_path(p, name));
           }
         }
 
@@ -776,7 +839,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
           char *buf = nameline + strlen(nameline);
 
           suffix[0] = '\0';
-          if (opt_F && pr_fsio_stat(name, &st) == 0) {
+          if (opt_F && pr_fsio_stat(path, &st) == 0) {
             if (S_ISLNK(st.st_mode)) {
               suffix[0] = '@';
 
@@ -813,7 +876,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *name) {
       if (S_ISREG(st.st_mode) ||
           S_ISDIR(st.st_mode) ||
           S_ISLNK(st.st_mode)) {
-           addfile(cmd, pr_fs_encode_path(cmd->tmp_pool, name), suffix,
+           addfile(cmd, pr_fs_encode_path(p, name), suffix,
              sort_time, st.st_size);
       }
     }
@@ -1225,12 +1288,378 @@ static char **sreaddir(const char *dirname, const int sort) {
   return p;
 }
 
-/* This listdir() requires a chdir() first. */
-static int listdir(cmd_rec *cmd, pool *workp, const char *name) {
-  char **dir;
-  int dest_workp = 0;
+/* Types of glob matches, as reported by readdir(3). */
+#define LS_GLOB_TYPE_UNKNOWN	0
+#define LS_GLOB_TYPE_DIR	1
+#define LS_GLOB_TYPE_REG	2
+#define LS_GLOB_TYPE_OTHER	3
+
+struct ls_glob_match {
+  char *path;
+  unsigned char type;
+};
+
+/* The results of ls_glob(): the matching paths, and (if known) their types.
+ * The types are NULL if the pattern had to be handed off to glob(3).
+ */
+struct ls_glob {
+  glob_t g;
+  int globbed;
+
+  char **pathv;
+  unsigned char *types;
+  size_t pathc;
+
+  /* Number of matches handed to the callback, rather than returned. */
+  size_t nstreamed;
+};
+
+static int ls_glob_cmp(const void *a, const void *b) {
+  const struct ls_glob_match *m1 = a, *m2 = b;
+
+#ifdef HAVE_STRCOLL
+  return strcoll(m1->path, m2->path);
+#else
+  return strcmp(m1->path, m2->path);
+#endif /* HAVE_STRCOLL */
+}
+
+static unsigned char ls_glob_type(struct dirent *dent) {
+#ifdef _DIRENT_HAVE_D_TYPE
+  switch (dent->d_type) {
+    case DT_DIR:
+      return LS_GLOB_TYPE_DIR;
+
+    case DT_REG:
+      return LS_GLOB_TYPE_REG;
+
+    case DT_FIFO:
+    case DT_CHR:
+    case DT_BLK:
+# ifdef DT_SOCK
+    case DT_SOCK:
+# endif /* DT_SOCK */
+      return LS_GLOB_TYPE_OTHER;
+
+    default:
+      break;
+  }
+#endif /* _DIRENT_HAVE_D_TYPE */
+
+  /* Symlinks, and entries of unknown type, need to be stat'd. */
+  return LS_GLOB_TYPE_UNKNOWN;
+}
+
+/* A single-pass replacement for glob(3), for the common case of patterns
+ * whose wildcards are all in the last path component (e.g. "*.csv" or
+ * "dir/file?.csv").  The directory is read once, keeping just the matching
+ * names and their types (where readdir(3) provides them), so that callers
+ * do not need to stat(2) every match just to find the directories.
+ *
+ * If a callback is given, matches which are known not to be directories or
+ * symlinks are handed to it as they are found, rather than being returned;
+ * callers only do this when the listing is not in glob order anyway.  Other
+ * patterns, including any with escaped characters, are handed off to
+ * pr_fs_glob().
+ *
+ * Returns zero on success, or a glob(3) error (e.g. GLOB_NOMATCH).
+ */
+static int ls_glob(cmd_rec *cmd, const char *pattern, int flags,
+    int (*file_cb)(cmd_rec *, const char *), struct ls_glob *lg) {
+  const char *base, *dir;
+  char *prefix = "";
+  void *dirh;
+  struct dirent *dent;
+  array_header *matches;
+  struct ls_glob_match *elts;
+  unsigned long nentries = 0;
+  int fnm_flags;
+  register unsigned int i;
+
+  memset(lg, '\0', sizeof(struct ls_glob));
+
+  base = strrchr(pattern, '/');
+  if (base != NULL) {
+    prefix = pstrndup(cmd->tmp_pool, pattern, (base - pattern) + 1);
+    base++;
+
+    dir = (base - pattern == 1) ? "/" : pstrndup(cmd->tmp_pool, pattern,
+      (base - pattern) - 1);
+
+  } else {
+    base = pattern;
+    dir = ".";
+  }
+
+  /* Escaped characters are left to glob(3), which removes the escapes from
+   * the directory part of the pattern as well.
+   */
+  if ((flags & ~GLOB_NOSORT) != 0 ||
+      *base == '\0' ||
+      strchr(pattern, '\\') != NULL ||
+      pr_str_is_fnmatch(prefix) == TRUE) {
+    int res;
+
+    res = pr_fs_glob(pattern, flags, NULL, &(lg->g));
+    if (res == 0) {
+      lg->globbed = TRUE;
+      lg->pathv = lg->g.gl_pathv;
+      lg->pathc = lg->g.gl_pathc;
+    }
+
+    return res;
+  }
+
+  dirh = pr_fsio_opendir(dir);
+  if (dirh == NULL) {
+    return GLOB_NOMATCH;
+  }
+
+  fnm_flags = PR_FNM_PERIOD;
+  matches = make_array(cmd->tmp_pool, 16, sizeof(struct ls_glob_match));
+
+  while ((dent = pr_fsio_readdir(dirh)) != NULL) {
+    struct ls_glob_match *m;
+    unsigned char type;
+    char *path;
+
+    pr_signals_handle();
+
+    /* Honor the same limit on the number of entries examined as glob(3). */
+    if (nentries++ > PR_TUNABLE_GLOBBING_MAX_MATCHES) {
+      break;
+    }
+
+    if (pr_fnmatch(base, dent->d_name, fnm_flags) != 0) {
+      continue;
+    }
+
+    type = ls_glob_type(dent);
+    path = pstrcat(cmd->tmp_pool, prefix, dent->d_name, NULL);
+
+    if (file_cb != NULL &&
+        (type == LS_GLOB_TYPE_REG || type == LS_GLOB_TYPE_OTHER)) {
+      lg->nstreamed++;
+      (void) file_cb(cmd, path);
+      continue;
+    }
+
+    m = push_array(matches);
+    m->path = path;
+    m->type = type;
+  }
+
+  pr_fsio_closedir(dirh);
+
+  if (matches->nelts == 0 &&
+      lg->nstreamed == 0) {
+    return GLOB_NOMATCH;
+  }
+
+  elts = matches->elts;
+  if (!(flags & GLOB_NOSORT)) {
+    qsort(elts, matches->nelts, sizeof(struct ls_glob_match), ls_glob_cmp);
+  }
+
+  lg->pathc = matches->nelts;
+  lg->pathv = pcalloc(cmd->tmp_pool, (lg->pathc + 1) * sizeof(char *));
+  lg->types = pcalloc(cmd->tmp_pool, lg->pathc + 1);
+
+  for (i = 0; i < matches->nelts; i++) {
+    lg->pathv[i] = elts[i].path;
+    lg->types[i] = elts[i].type;
+  }
+
+  return 0;
+}
+
+static void ls_globfree(struct ls_glob *lg) {
+  if (lg->globbed) {
+    pr_fs_globfree(&(lg->g));
+    lg->globbed = FALSE;
+  }
+}
+
+/* Subdirectories pending listing, for recursive (-R) listings.  These are
+ * allocated using malloc(3) rather than pools, for the same reasons as in
+ * sreaddir(): they are freed as soon as they have been listed.
+ */
+struct ls_pending_dir {
+  struct ls_pending_dir *next;
+
+  /* Path relative to the directory being listed. */
+  char *path;
+  unsigned int depth;
+};
+
+static void free_pending_dirs(struct ls_pending_dir *pending) {
+  while (pending != NULL) {
+    struct ls_pending_dir *next;
+
+    next = pending->next;
+    free(pending);
+    pending = next;
+  }
+}
+
+static void free_dir_list(char **dir) {
   register unsigned int i = 0;
 
+  /* Explicitly free the memory allocated for containing the list of
+   * filenames.
+   */
+  while (dir[i] != NULL)
+    free(dir[i++]);
+  free(dir);
+}
+
+/* Lists the entries of the given directory (relative to the current
+ * directory, or NULL for the current directory).  For recursive listings,
+ * the subdirectories to be listed are added, in order, to the front of the
+ * pending list, so that the tree is listed depth-first.  Returns -1 on error,
+ * 0 otherwise.
+ */
+static int listdir_entries(cmd_rec *cmd, pool *workp, const char *dir,
+    unsigned int depth, struct ls_pending_dir **pending) {
+  char **dir_list, **s, **r;
+  struct ls_pending_dir *first = NULL, *last = NULL;
+  int d = 0, recurse;
+
+  PR_DEVEL_CLOCK(dir_list = sreaddir(dir ? dir : ".", TRUE));
+  if (dir_list == NULL) {
+    return 0;
+  }
+
+  s = dir_list;
+  while (*s) {
+    if (**s == '.') {
+      if (!opt_a && (!opt_A || is_dotdir(*s))) {
+        d = 0;
+
+      } else {
+        d = listfile(cmd, workp, dir, *s);
+      }
+
+    } else {
+      d = listfile(cmd, workp, dir, *s);
+    }
+
+    if (opt_R && d == 0) {
+
+      /* This is a nasty hack.  If listfile() returns a zero, and we
+       * will be recursing (-R option), make sure we don't try to list
+       * this file again by changing the first character of the path
+       * to ".".  Such files are skipped later.
+       */
+      **s = '.';
+      *(*s + 1) = '\0';
+
+    } else if (d == 2)
+      break;
+
+    s++;
+  }
+
+  if (outputfiles(cmd) < 0) {
+    free_dir_list(dir_list);
+    return -1;
+  }
+
+  /* Only queue subdirectories which can be listed without exceeding any
+   * ListOptions maxdepth.
+   */
+  recurse = opt_R;
+  if (recurse &&
+      list_ndepth.max &&
+      depth + 1 >= list_ndepth.max) {
+
+    if (!list_ndepth.logged) {
+      /* Don't forget to take away the one we add to maxdepth internally. */
+      pr_log_debug(DEBUG8, "ListOptions maxdepth (%u) reached",
+        list_ndepth.max - 1);
+      list_ndepth.logged = TRUE;
+    }
+
+    recurse = FALSE;
+  }
+
+  for (r = dir_list; recurse && r != s; r++) {
+    struct ls_pending_dir *pd;
+    size_t pathlen;
+
+    if (strcmp(*r, ".") == 0 ||
+        strcmp(*r, "..") == 0) {
+      continue;
+    }
+
+    pathlen = (dir ? strlen(dir) + 1 : 0) + strlen(*r) + 1;
+
+    pd = malloc(sizeof(struct ls_pending_dir) + pathlen);
+    if (pd == NULL) {
+      pr_log_pri(PR_LOG_ALERT, "Out of memory!");
+      exit(1);
+    }
+
+    pd->next = NULL;
+    pd->path = ((char *) pd) + sizeof(struct ls_pending_dir);
+    pd->depth = depth + 1;
+
+    if (dir != NULL) {
+      snprintf(pd->path, pathlen, "%s/%s", dir, *r);
+
+    } else {
+      sstrncpy(pd->path, *r, pathlen);
+    }
+
+    if (last != NULL) {
+      last->next = pd;
+
+    } else {
+      first = pd;
+    }
+
+    last = pd;
+  }
+
+  if (last != NULL) {
+    last->next = *pending;
+    *pending = first;
+  }
+
+  free_dir_list(dir_list);
+  return 0;
+}
+
+/* Returns TRUE if the given path is a directory into which the current
+ * user could change, i.e. whose contents can be listed.
+ */
+static int is_listable_dir(const char *path) {
+  struct stat st;
+
+  if (pr_fsio_stat(path, &st) < 0 ||
+      !S_ISDIR(st.st_mode)) {
+    return FALSE;
+  }
+
+  if (pr_fsio_access(path, X_OK, session.uid, session.gid,
+      session.gids) < 0) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* This listdir() requires a chdir() first, into the directory to be listed.
+ * Recursive (-R) listings then walk the tree iteratively, using paths
+ * relative to that directory rather than changing into each subdirectory,
+ * and sending the listing of each directory as it goes.  Only the names of
+ * the subdirectories still to be listed are kept in memory.
+ */
+static int listdir(cmd_rec *cmd, pool *workp, const char *name) {
+  struct ls_pending_dir *pending = NULL;
+  pool *dirp;
+  int res;
+
   if (list_ndepth.curr && list_ndepth.max &&
       list_ndepth.curr >= list_ndepth.max) {
 
@@ -1260,177 +1689,99 @@ static int listdir(cmd_rec *cmd, pool *workp, const char *name) {
     return -1;
 
   if (!workp) {
-    workp = make_sub_pool(cmd->tmp_pool);
-    pr_pool_tag(workp, "mod_ls: listdir(): workp (from cmd->tmp_pool)");
-    dest_workp++;
-
-  } else {
-    workp = make_sub_pool(workp);
-    pr_pool_tag(workp, "mod_ls: listdir(): workp (from workp)");
-    dest_workp++;
+    workp = cmd->tmp_pool;
   }
 
-  PR_DEVEL_CLOCK(dir = sreaddir(".", TRUE));
-
-  if (dir) {
-    char **s;
-    char **r;
+  dirp = make_sub_pool(workp);
+  pr_pool_tag(dirp, "mod_ls: listdir(): dir pool");
 
-    int d = 0;
+  res = listdir_entries(cmd, dirp, NULL, list_ndepth.curr, &pending);
+  destroy_pool(dirp);
 
-    s = dir;
-    while (*s) {
-      if (**s == '.') {
-        if (!opt_a && (!opt_A || is_dotdir(*s))) {
-          d = 0;
+  while (res == 0 &&
+         pending != NULL) {
+    struct ls_pending_dir *pd;
 
-        } else {
-          d = listfile(cmd, workp, *s);
-        }
-
-      } else {
-        d = listfile(cmd, workp, *s);
-      }
-
-      if (opt_R && d == 0) {
-
-        /* This is a nasty hack.  If listfile() returns a zero, and we
-         * will be recursing (-R option), make sure we don't try to list
-         * this file again by changing the first character of the path
-         * to ".".  Such files are skipped later.
-         */
-        **s = '.';
-        *(*s + 1) = '\0';
+    /* Add some signal processing to this loop, as it can potentially
+     * traverse a deep tree.
+     */
+    pr_signals_handle();
 
-      } else if (d == 2)
-        break;
+    pd = pending;
+    pending = pd->next;
 
-      s++;
+    if (XFER_ABORTED) {
+      free(pd);
+      res = -1;
+      break;
     }
 
-    if (outputfiles(cmd) < 0) {
-      if (dest_workp)
-        destroy_pool(workp);
+    if (list_ndirs.curr && list_ndirs.max &&
+        list_ndirs.curr >= list_ndirs.max) {
 
-      /* Explicitly free the memory allocated for containing the list of
-       * filenames.
-       */
-      i = 0;
-      while (dir[i] != NULL)
-        free(dir[i++]);
-      free(dir);
+      if (!list_ndirs.logged) {
+        pr_log_debug(DEBUG8, "ListOptions maxdirs (%u) reached",
+          list_ndirs.max);
+        list_ndirs.logged = TRUE;
+      }
 
-      return -1;
+      free(pd);
+      break;
     }
 
-    r = dir;
-    while (opt_R && r != s) {
-      char cwd_buf[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
-      unsigned char symhold;
+    if (list_nfiles.curr && list_nfiles.max &&
+        list_nfiles.curr >= list_nfiles.max) {
 
-      if (*r && (strcmp(*r, ".") == 0 || strcmp(*r, "..") == 0)) {
-        r++;
-        continue;
+      if (!list_nfiles.logged) {
+        pr_log_debug(DEBUG8, "ListOptions maxfiles (%u) reached",
+          list_nfiles.max);
+        list_nfiles.logged = TRUE;
       }
 
-      /* Add some signal processing to this while loop, as it can
-       * potentially recurse deeply.
-       */
-      pr_signals_handle();
-
-      if (list_ndirs.curr && list_ndirs.max &&
-          list_ndirs.curr >= list_ndirs.max) {
+      free(pd);
+      break;
+    }
 
-        if (!list_ndirs.logged) {
-          pr_log_debug(DEBUG8, "ListOptions maxdirs (%u) reached",
-            list_ndirs.max);
-          list_ndirs.logged = TRUE;
-        }
+    /* Each directory gets its own pool, freed once it has been listed. */
+    dirp = make_sub_pool(workp);
+    pr_pool_tag(dirp, "mod_ls: listdir(): dir pool");
 
-        break;
-      }
+    if (ls_perms_full(dirp, cmd, pd->path, NULL) &&
+        is_listable_dir(pd->path)) {
+      char *subdir;
 
-      if (list_nfiles.curr && list_nfiles.max &&
-          list_nfiles.curr >= list_nfiles.max) {
+      if (strcmp(name, ".") == 0)
+        subdir = pd->path;
+      else
+        subdir = pdircat(dirp, name, pd->path, NULL);
 
-        if (!list_nfiles.logged) {
-          pr_log_debug(DEBUG8, "ListOptions maxfiles (%u) reached",
-            list_nfiles.max);
-          list_nfiles.logged = TRUE;
-        }
+      if (opt_STAT) {
+        pr_response_add(R_211, "%s", "");
+        pr_response_add(R_211, "%s:", pr_fs_encode_path(dirp, subdir));
 
-        break;
+      } else if (sendline(0, "\r\n%s:\r\n",
+                   pr_fs_encode_path(dirp, subdir)) < 0 ||
+          sendline(LS_SENDLINE_FL_FLUSH, " ") < 0) {
+        res = -1;
       }
 
-      push_cwd(cwd_buf, &symhold);
-
-      if (*r && ls_perms_full(workp, cmd, (char *) *r, NULL) &&
-          !pr_fsio_chdir_canon(*r, !opt_L && list_show_symlinks)) {
-        char *subdir;
-        int res = 0;
-
-        if (strcmp(name, ".") == 0)
-          subdir = *r;
-        else
-          subdir = pdircat(workp, name, *r, NULL);
-
-        if (opt_STAT) {
-          pr_response_add(R_211, "%s", "");
-          pr_response_add(R_211, "%s:",
-            pr_fs_encode_path(cmd->tmp_pool, subdir));
-
-        } else if (sendline(0, "\r\n%s:\r\n",
-                     pr_fs_encode_path(cmd->tmp_pool, subdir)) < 0 ||
-            sendline(LS_SENDLINE_FL_FLUSH, " ") < 0) {
-          pop_cwd(cwd_buf, &symhold);
-
-          if (dest_workp)
-            destroy_pool(workp);
-
-          return -1;
-        }
-
-        list_ndepth.curr++;
-        res = listdir(cmd, workp, subdir);
-        list_ndepth.curr--;
-        pop_cwd(cwd_buf, &symhold);
-
-        if (res > 0) {
-          break;
-
-        } else if (res < 0) {
-          if (dest_workp)
-            destroy_pool(workp);
-
-          /* Explicitly free the memory allocated for containing the list of
-           * filenames.
-           */
-          i = 0;
-          while (dir[i] != NULL)
-            free(dir[i++]);
-          free(dir);
-
-          return -1;
-        }
+      if (res == 0) {
+        list_ndirs.curr++;
+        res = listdir_entries(cmd, dirp, pd->path, pd->depth, &pending);
       }
-      r++;
     }
-  }
-
-  if (dest_workp)
-    destroy_pool(workp);
 
-  /* Explicitly free the memory allocated for containing the list of
-   * filenames.
-   */
-  if (dir) {
-    i = 0;
-    while (dir[i] != NULL)
-      free(dir[i++]);
-    free(dir);
+    destroy_pool(dirp);
+    free(pd);
   }
 
-  return 0;
+  free_pending_dirs(pending);
+  return (res < 0 ? -1 : 0);
+}
+
+/* Lists a file matched by ls_glob(), as soon as it is found. */
+static int list_glob_file(cmd_rec *cmd, const char *path) {
+  return listfile(cmd, cmd->tmp_pool, NULL, path);
 }
 
 static void ls_terminate(void) {
@@ -1818,14 +2169,14 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
 
   if (arg && *arg) {
     int justone = 1;
-    glob_t g;
+    struct ls_glob lg;
     int globbed = FALSE;
     int a;
     char pbuffer[PR_TUNABLE_PATH_MAX + 1] = "";
     char *target;
 
-    /* Make sure the glob_t is initialized. */
-    memset(&g, '\0', sizeof(g));
+    /* Make sure the glob results are initialized. */
+    memset(&lg, '\0', sizeof(lg));
 
     if (*arg == '~') {
       struct passwd *pw;
@@ -1897,10 +2248,16 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
 
       if (use_globbing &&
           pr_str_is_fnmatch(target)) {
-        a = pr_fs_glob(target, glob_flags, NULL, &g);
+        /* If the listing will be sorted by time or size anyway, then
+         * matching files can be listed as soon as they are found.
+         */
+        a = ls_glob(cmd, target, glob_flags,
+          (glob_flags & GLOB_NOSORT) || opt_S || opt_t ? list_glob_file : NULL,
+          &lg);
         if (a == 0) {
           pr_log_debug(DEBUG8, "LIST: glob(3) returned %lu %s",
-            (unsigned long) g.gl_pathc, g.gl_pathc != 1 ? "paths" : "path");
+            (unsigned long) (lg.pathc + lg.nstreamed),
+            (lg.pathc + lg.nstreamed) != 1 ? "paths" : "path");
           globbed = TRUE;
 
         } else {
@@ -1912,27 +2269,29 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
              * path.
              */
             a = 0;
-            g.gl_pathv = (char **) pcalloc(cmd->tmp_pool, 2 * sizeof(char *));
-            g.gl_pathv[0] = (char *) pstrdup(cmd->tmp_pool, target);
-            g.gl_pathv[1] = NULL;
+            lg.pathv = (char **) pcalloc(cmd->tmp_pool, 2 * sizeof(char *));
+            lg.pathv[0] = (char *) pstrdup(cmd->tmp_pool, target);
+            lg.pathv[1] = NULL;
+            lg.pathc = 1;
           }
         }
 
       } else {
         /* Trick the following code into using the non-glob() processed path */
         a = 0;
-        g.gl_pathv = (char **) pcalloc(cmd->tmp_pool, 2 * sizeof(char *));
-        g.gl_pathv[0] = (char *) pstrdup(cmd->tmp_pool, target);
-        g.gl_pathv[1] = NULL;
+        lg.pathv = (char **) pcalloc(cmd->tmp_pool, 2 * sizeof(char *));
+        lg.pathv[0] = (char *) pstrdup(cmd->tmp_pool, target);
+        lg.pathv[1] = NULL;
+        lg.pathc = 1;
       }
     }
 
     if (!a) {
       char **path;
 
-      path = g.gl_pathv;
+      path = lg.pathv;
 
-      if (path && path[0] && path[1]) {
+      if (lg.pathc + lg.nstreamed > 1) {
         justone = 0;
       }
 
@@ -1942,6 +2301,18 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
 
         pr_signals_handle();
 
+        /* Matches known not to be directories (or symlinks) can be listed
+         * without first stat'ing them here.
+         */
+        if (lg.types != NULL &&
+            (lg.types[path - lg.pathv] == LS_GLOB_TYPE_REG ||
+             lg.types[path - lg.pathv] == LS_GLOB_TYPE_OTHER)) {
+          (void) listfile(cmd, cmd->tmp_pool, NULL, *path);
+          **path = '\0';
+          path++;
+          continue;
+        }
+
         if (pr_fsio_lstat(*path, &st) == 0) {
           mode_t target_mode, lmode;
           target_mode = st.st_mode;
@@ -1963,10 +2334,10 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
               !(S_ISDIR(target_mode)) ||
               (!opt_R && S_ISDIR(target_mode) && strcmp(*path, target) != 0)) {
 
-            if (listfile(cmd, cmd->tmp_pool, *path) < 0) {
+            if (listfile(cmd, cmd->tmp_pool, NULL, *path) < 0) {
               ls_terminate();
               if (use_globbing && globbed)
-                pr_fs_globfree(&g);
+                ls_globfree(&lg);
               return -1;
             }
 
@@ -1983,17 +2354,17 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
       if (outputfiles(cmd) < 0) {
         ls_terminate();
         if (use_globbing && globbed) {
-          pr_fs_globfree(&g);
+          ls_globfree(&lg);
         }
         return -1;
       }
 
-      /* At this point, the only paths left in g.gl_pathv should be
+      /* At this point, the only paths left in lg.pathv should be
        * directories; anything else should have been listed/handled
        * above.
        */
 
-      path = g.gl_pathv;
+      path = lg.pathv;
       while (path &&
              *path) {
         pr_signals_handle();
@@ -2034,7 +2405,7 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
             } else if (res < 0) {
               ls_terminate();
               if (use_globbing && globbed)
-                pr_fs_globfree(&g);
+                ls_globfree(&lg);
               return -1;
             }
           }
@@ -2043,7 +2414,7 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
         if (XFER_ABORTED) {
           discard_output();
           if (use_globbing && globbed)
-            pr_fs_globfree(&g);
+            ls_globfree(&lg);
           return -1;
         }
 
@@ -2053,7 +2424,7 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
       if (outputfiles(cmd) < 0) {
         ls_terminate();
         if (use_globbing && globbed) {
-          pr_fs_globfree(&g);
+          ls_globfree(&lg);
         }
         return -1;
       }
@@ -2074,7 +2445,7 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
     }
 
     if (!skiparg && use_globbing && globbed)
-      pr_fs_globfree(&g);
+      ls_globfree(&lg);
 
     if (XFER_ABORTED) {
       discard_output();
@@ -2101,7 +2472,7 @@ static int dolist(cmd_rec *cmd, const char *opt, int clearflags) {
     if (ls_perms_full(cmd->tmp_pool, cmd, ".", NULL)) {
 
       if (opt_d) {
-        if (listfile(cmd, NULL, ".") < 0) {
+        if (listfile(cmd, NULL, NULL, ".") < 0) {
           ls_terminate();
           return -1;
         }
@@ -2299,6 +2670,8 @@ static int nlstdir(cmd_rec *cmd, const char *dir) {
       ignore_hidden = TRUE;
   }
 
+  dir_hide_begin();
+
   j = 0;
   while (list[j] && count >= 0) {
     p = list[j++];
@@ -2393,6 +2766,7 @@ static int nlstdir(cmd_rec *cmd, const char *dir) {
     }
   }
 
+  dir_hide_end();
   sendline(LS_SENDLINE_FL_FLUSH, " ");
 
   if (!curdir)
@@ -2490,7 +2864,9 @@ MODRET genericlist(cmd_rec *cmd) {
     list_times_gmt = *tmp;
   }
 
+  dir_hide_begin();
   res = dolist(cmd, pr_fs_decode_path(cmd->tmp_pool, cmd->arg), TRUE);
+  dir_hide_end();
 
   if (XFER_ABORTED) {
     pr_data_abort(0, 0);
@@ -2672,7 +3048,9 @@ MODRET ls_stat(cmd_rec *cmd) {
   pr_response_add(R_211, _("Status of %s:"), arg && *arg ?
     pr_fs_encode_path(cmd->tmp_pool, arg) :
     pr_fs_encode_path(cmd->tmp_pool, "."));
+  dir_hide_begin();
   res = dolist(cmd, arg && *arg ? arg : ".", FALSE);
+  dir_hide_end();
   pr_response_add(R_211, _("End of status"));
   return (res == -1 ? PR_ERROR(cmd) : PR_HANDLED(cmd));
 }
@@ -2843,17 +3221,17 @@ MODRET ls_nlst(cmd_rec *cmd) {
   /* If the target is a glob, get the listing of files/dirs to send. */
   if (use_globbing &&
       pr_str_is_fnmatch(target)) {
-    glob_t g;
+    struct ls_glob lg;
     char **path, *p;
     int globbed = FALSE;
 
-    /* Make sure the glob_t is initialized */
-    memset(&g, '\0', sizeof(glob_t));
+    /* Make sure the glob results are initialized */
+    memset(&lg, '\0', sizeof(lg));
 
-    res = pr_fs_glob(target, glob_flags, NULL, &g);
+    res = ls_glob(cmd, target, glob_flags, NULL, &lg);
     if (res == 0) {
       pr_log_debug(DEBUG8, "NLST: glob(3) returned %lu %s",
-        (unsigned long) g.gl_pathc, g.gl_pathc != 1 ? "paths" : "path");
+        (unsigned long) lg.pathc, lg.pathc != 1 ? "paths" : "path");
       globbed = TRUE;
 
     } else {
@@ -2867,9 +3245,10 @@ MODRET ls_nlst(cmd_rec *cmd) {
           /* Trick the following code into using the non-glob() processed path.
            */
           res = 0;
-          g.gl_pathv = (char **) pcalloc(cmd->tmp_pool, 2 * sizeof(char *));
-          g.gl_pathv[0] = (char *) pstrdup(cmd->tmp_pool, target);
-          g.gl_pathv[1] = NULL;
+          lg.pathv = (char **) pcalloc(cmd->tmp_pool, 2 * sizeof(char *));
+          lg.pathv[0] = (char *) pstrdup(cmd->tmp_pool, target);
+          lg.pathv[1] = NULL;
+          lg.pathc = 1;
 
         } else {
           if (list_flags & LS_FL_NO_ERROR_IF_ABSENT) {
@@ -2931,19 +3310,35 @@ MODRET ls_nlst(cmd_rec *cmd) {
     session.sf_flags |= SF_ASCII_OVERRIDE;
 
     /* Iterate through each matching entry */
-    path = g.gl_pathv;
+    path = lg.pathv;
     while (path && *path && res >= 0) {
       struct stat st;
+      unsigned char type;
 
       pr_signals_handle();
 
+      type = (lg.types ? lg.types[path - lg.pathv] : LS_GLOB_TYPE_UNKNOWN);
       p = *path;
       path++;
 
       if (*p == '.' && (!opt_A || is_dotdir(p)))
         continue;
 
-      if (pr_fsio_stat(p, &st) == 0) {
+      /* Avoid stat'ing matches whose type is already known. */
+      if (type == LS_GLOB_TYPE_OTHER) {
+        continue;
+      }
+
+      memset(&st, 0, sizeof(st));
+      if (type == LS_GLOB_TYPE_DIR) {
+        st.st_mode = S_IFDIR;
+
+      } else if (type == LS_GLOB_TYPE_REG) {
+        st.st_mode = S_IFREG;
+      }
+
+      if (type != LS_GLOB_TYPE_UNKNOWN ||
+          pr_fsio_stat(p, &st) == 0) {
         /* If it's a directory, hand off to nlstdir */
         if (S_ISDIR(st.st_mode)) {
           res = nlstdir(cmd, p);
@@ -2961,7 +3356,7 @@ MODRET ls_nlst(cmd_rec *cmd) {
 
     sendline(LS_SENDLINE_FL_FLUSH, " ");
     if (globbed) {
-      pr_fs_globfree(&g);
+      ls_globfree(&lg);
     }
 
   } else {
@@ -1956,6 +1956,22 @@ MODRET xfer_pre_retr(cmd_rec *cmd) {
     return PR_ERROR(cmd);
   }
 
+  /* A module which sends this RETR itself, rather than a file (e.g. mod_tar,
+   * for directory archives), has already checked the path, and set the
+   * 'mod_xfer.retr-path' note for logging; only the transfer limits and
+   * priority apply.
+   */
+  if (pr_table_get(cmd->notes, "mod_xfer.retr-handled", NULL) != NULL) {
+    if (xfer_check_limit(cmd) < 0) {
+      pr_response_add_err(R_451, _("%s: Too many transfers"), cmd->arg);
+      errno = EPERM;
+      return PR_ERROR(cmd);
+    }
+
+    (void) xfer_prio_adjust();
+    return PR_HANDLED(cmd);
+  }
+
   dir = dir_realpath(cmd->tmp_pool,
     pr_fs_decode_path(cmd->tmp_pool, cmd->arg));
 
@@ -2470,6 +2486,7 @@ MODRET xfer_log_stor(cmd_rec *cmd) {
   /* Increment the file counters. */
   session.total_files_in++;
   session.total_files_xfer++;
+  pr_metrics_incr(PR_METRICS_CTR_FILES_IN, 1);
 
   pr_data_cleanup();
 
@@ -2486,6 +2503,7 @@ MODRET xfer_log_retr(cmd_rec *cmd) {
   /* Increment the file counters. */
   session.total_files_out++;
   session.total_files_xfer++;
+  pr_metrics_incr(PR_METRICS_CTR_FILES_OUT, 1);
 
   pr_data_cleanup();
 
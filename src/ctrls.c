@@ -46,6 +46,12 @@
 /* Maximum length of a single request argument. */
 #define CTRLS_MAX_REQARGLEN	256
 
+/* How long pr_ctrls_send_msg() waits, in total, for a client which is not
+ * reading its responses, before giving up on it.  This may be the daemon
+ * process waiting, so this is kept short.
+ */
+#define CTRLS_SEND_TIMEOUT	2
+
 typedef struct ctrls_act_obj {
   struct ctrls_act_obj *prev, *next;
   pool *pool;
@@ -77,6 +83,10 @@ static module *action_lookup_module = NULL;
 /* Logging */
 static int ctrls_logfd = -1;
 
+/* Handlers for servicing Controls descriptors from the daemon's main loop */
+static int (*ctrls_add_fds_cb)(fd_set *, fd_set *, int) = NULL;
+static void (*ctrls_handle_fds_cb)(fd_set *, fd_set *) = NULL;
+
 /* necessary prototypes */
 static ctrls_action_t *ctrls_action_new(void);
 static pr_ctrls_t *ctrls_new(void);
@@ -104,7 +114,11 @@ static pr_ctrls_t *ctrls_prepare(ctrls_action_t *act) {
   ctrl->ctrls_flags = act->flags;
 
   /* Add this to the "in use" list */
+  ctrl->ctrls_prev = NULL;
   ctrl->ctrls_next = ctrls_active_list;
+  if (ctrls_active_list != NULL) {
+    ctrls_active_list->ctrls_prev = ctrl;
+  }
   ctrls_active_list = ctrl;
 
   pr_unblock_ctrls();
@@ -474,8 +488,19 @@ int pr_ctrls_flush_response(pr_ctrls_t *ctrl) {
   if (ctrl->ctrls_cb_resps) {
     if (pr_ctrls_send_msg(ctrl->ctrls_cl->cl_fd, ctrl->ctrls_cb_retval,
         ctrl->ctrls_cb_resps->nelts,
-        (char **) ctrl->ctrls_cb_resps->elts) < 0)
+        (char **) ctrl->ctrls_cb_resps->elts) < 0) {
+      int xerrno = errno;
+
+      if (xerrno == ETIMEDOUT) {
+        /* Drop the client; any later attempt to write to it will fail,
+         * and the client will then be closed.
+         */
+        (void) shutdown(ctrl->ctrls_cl->cl_fd, SHUT_RDWR);
+      }
+
+      errno = xerrno;
       return -1;
+    }
   }
 
   return 0;
@@ -513,8 +538,44 @@ int pr_ctrls_parse_msg(pool *msg_pool, char *msg, unsigned int *msgargc,
   return 0;
 }
 
+/* Adds the given ctrl, populated with the request's args, to the client,
+ * along with ctrls for any other handlers of the same action.
+ */
+static int ctrls_add_request(pr_ctrls_cl_t *cl, pr_ctrls_t *ctrl) {
+  pr_ctrls_t *next_ctrl = NULL;
+
+  /* Add this ctrls object to the client object. */
+  *((pr_ctrls_t **) push_array(cl->cl_ctrls)) = ctrl;
+
+  /* Set the flag that this control is ready to go */
+  ctrl->ctrls_flags |= PR_CTRLS_REQUESTED;
+  ctrl->ctrls_cl = cl;
+
+  /* Copy the populated ctrl object args to ctrl objects for all other
+   * matching action objects.
+   */
+  next_ctrl = ctrls_lookup_next_action(NULL, TRUE);
+
+  while (next_ctrl) {
+    if (pr_ctrls_copy_args(ctrl, next_ctrl)) {
+      return -1;
+    }
+
+    /* Add this ctrl object to the client object. */
+    *((pr_ctrls_t **) push_array(cl->cl_ctrls)) = next_ctrl;
+
+    /* Set the flag that this control is ready to go. */ 
+    next_ctrl->ctrls_flags |= PR_CTRLS_REQUESTED;
+    next_ctrl->ctrls_cl = cl;
+
+    next_ctrl = ctrls_lookup_next_action(NULL, TRUE);
+  }
+
+  return 0;
+}
+
 int pr_ctrls_recv_request(pr_ctrls_cl_t *cl) {
-  pr_ctrls_t *ctrl = NULL, *next_ctrl = NULL;
+  pr_ctrls_t *ctrl = NULL;
   char reqaction[128] = {'\0'}, *reqarg = NULL;
   size_t reqargsz = 0;
   unsigned int nreqargs = 0, reqarglen = 0;
@@ -661,35 +722,135 @@ int pr_ctrls_recv_request(pr_ctrls_cl_t *cl) {
     }
   }
 
-  /* Add this ctrls object to the client object. */
-  *((pr_ctrls_t **) push_array(cl->cl_ctrls)) = ctrl;
+  if (ctrls_add_request(cl, ctrl) < 0) {
+    int xerrno = errno;
 
-  /* Set the flag that this control is ready to go */
-  ctrl->ctrls_flags |= PR_CTRLS_REQUESTED;
-  ctrl->ctrls_cl = cl;
+    pr_signals_unblock();
 
-  /* Copy the populated ctrl object args to ctrl objects for all other
-   * matching action objects.
+    errno = xerrno;
+    return -1;
+  }
+
+  pr_signals_unblock();
+  return 0;
+}
+
+/* Reads a length/count field of a buffered message at the given offset,
+ * advancing the offset past it.  Returns -1 if the buffer does not yet hold
+ * the entire field.
+ */
+static int ctrls_buf_get_uint(const char *buf, size_t buflen, size_t *off,
+    unsigned int *val) {
+  if (buflen - *off < sizeof(unsigned int)) {
+    return -1;
+  }
+
+  memcpy(val, buf + *off, sizeof(unsigned int));
+  *off += sizeof(unsigned int);
+  return 0;
+}
+
+int pr_ctrls_parse_request(pr_ctrls_cl_t *cl, const char *buf,
+    size_t buflen) {
+  pr_ctrls_t *ctrl = NULL;
+  char reqaction[128] = {'\0'}, *reqarg = NULL;
+  size_t off = 0, reqoff, reqargsz = 0;
+  unsigned int nreqargs = 0, reqarglen = 0;
+  register unsigned int i = 0;
+
+  if (cl == NULL ||
+      buf == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* First, make sure the buffer holds the entire request: the status
+   * (ignored), the number of args, and the args, each preceded by its
+   * length.  The length limits are the same as pr_ctrls_recv_request()'s.
    */
-  next_ctrl = ctrls_lookup_next_action(NULL, TRUE);
+  if (buflen < sizeof(int)) {
+    return 0;
+  }
+  off = sizeof(int);
 
-  while (next_ctrl) {
-    if (pr_ctrls_copy_args(ctrl, next_ctrl)) {
+  if (ctrls_buf_get_uint(buf, buflen, &off, &nreqargs) < 0) {
+    return 0;
+  }
+
+  if (nreqargs == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  reqoff = off;
+  for (i = 0; i < nreqargs; i++) {
+    if (ctrls_buf_get_uint(buf, buflen, &off, &reqarglen) < 0) {
+      return 0;
+    }
+
+    if ((i == 0 && reqarglen >= sizeof(reqaction)) ||
+        (i > 0 && reqarglen > CTRLS_MAX_REQARGLEN)) {
+      errno = ENOMEM;
       return -1;
     }
 
-    /* Add this ctrl object to the client object. */
-    *((pr_ctrls_t **) push_array(cl->cl_ctrls)) = next_ctrl;
+    if (buflen - off < reqarglen) {
+      return 0;
+    }
+    off += reqarglen;
+  }
 
-    /* Set the flag that this control is ready to go. */ 
-    next_ctrl->ctrls_flags |= PR_CTRLS_REQUESTED;
-    next_ctrl->ctrls_cl = cl;
+  /* Now populate the ctrls, as pr_ctrls_recv_request() does. */
+  off = reqoff;
+  (void) ctrls_buf_get_uint(buf, buflen, &off, &reqarglen);
+  memcpy(reqaction, buf + off, reqarglen);
+  off += reqarglen;
 
-    next_ctrl = ctrls_lookup_next_action(NULL, TRUE);
+  ctrl = ctrls_lookup_action(NULL, reqaction, TRUE);
+  if (ctrl == NULL) {
+    errno = EINVAL;
+    return -1;
   }
 
-  pr_signals_unblock();
-  return 0;
+  for (i = 1; i < nreqargs; i++) {
+    (void) ctrls_buf_get_uint(buf, buflen, &off, &reqarglen);
+
+    if (reqarglen == 0) {
+      /* Skip any zero-length arguments. */
+      continue;
+    }
+
+    if (reqargsz < reqarglen + 1) {
+      reqargsz = CTRLS_MAX_REQARGLEN + 1;
+
+      if (!ctrl->ctrls_tmp_pool) {
+        ctrl->ctrls_tmp_pool = make_sub_pool(ctrls_pool);
+        pr_pool_tag(ctrl->ctrls_tmp_pool, "ctrls tmp pool");
+      }
+
+      reqarg = palloc(ctrl->ctrls_tmp_pool, reqargsz);
+    }
+
+    memcpy(reqarg, buf + off, reqarglen);
+    reqarg[reqarglen] = '\0';
+    off += reqarglen;
+
+    if (pr_ctrls_add_arg(ctrl, reqarg, reqarglen) < 0) {
+      int xerrno = errno;
+
+      /* Let this unrequested ctrl be reset. */
+      ctrl->ctrls_cb_retval = -1;
+
+      errno = xerrno;
+      return -1;
+    }
+  }
+
+  if (ctrls_add_request(cl, ctrl) < 0) {
+    return -1;
+  }
+
+  return (int) off;
 }
 
 int pr_ctrls_recv_response(pool *resp_pool, int ctrls_sockfd,
@@ -768,10 +929,55 @@ int pr_ctrls_recv_response(pool *resp_pool, int ctrls_sockfd,
   return respargc;
 }
 
+char *pr_ctrls_encode_msg(pool *msg_pool, int msgstatus,
+    unsigned int msgargc, char **msgargv, size_t *msglen) {
+  register unsigned int i = 0;
+  unsigned int msgarglen = 0;
+  size_t len;
+  char *msg, *ptr;
+
+  if (msg_pool == NULL ||
+      msglen == NULL ||
+      (msgargc > 0 && msgargv == NULL)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  /* The message status comes first, then the number of arguments; then,
+   * for each argument, first the length of the argument string, then the
+   * argument itself.
+   */
+  len = sizeof(int) + sizeof(unsigned int);
+  for (i = 0; i < msgargc; i++) {
+    len += sizeof(unsigned int) + strlen(msgargv[i]);
+  }
+
+  msg = ptr = palloc(msg_pool, len);
+
+  memcpy(ptr, &msgstatus, sizeof(int));
+  ptr += sizeof(int);
+  memcpy(ptr, &msgargc, sizeof(unsigned int));
+  ptr += sizeof(unsigned int);
+
+  for (i = 0; i < msgargc; i++) {
+    msgarglen = strlen(msgargv[i]);
+
+    memcpy(ptr, &msgarglen, sizeof(unsigned int));
+    ptr += sizeof(unsigned int);
+    memcpy(ptr, msgargv[i], msgarglen);
+    ptr += msgarglen;
+  }
+
+  *msglen = len;
+  return msg;
+}
+
 int pr_ctrls_send_msg(int sockfd, int msgstatus, unsigned int msgargc,
     char **msgargv) {
-  register int i = 0;
-  unsigned int msgarglen = 0;
+  pool *tmp_pool;
+  char *msg;
+  size_t msglen, off = 0;
+  time_t deadline;
 
   /* Sanity checks */
   if (sockfd < 0) {
@@ -787,62 +993,65 @@ int pr_ctrls_send_msg(int sockfd, int msgstatus, unsigned int msgargc,
     return 0;
   }
 
+  tmp_pool = make_sub_pool(ctrls_pool);
+  pr_pool_tag(tmp_pool, "ctrls send msg pool");
+
+  msg = pr_ctrls_encode_msg(tmp_pool, msgstatus, msgargc, msgargv, &msglen);
+
   /* No interruptions */
   pr_signals_block();
 
-  /* Send the message status first */
-  if (write(sockfd, &msgstatus, sizeof(int)) != sizeof(int)) {
-    pr_signals_unblock();
-    return -1;
-  }
-
-  /* Send the strings, one argument at a time.  First, send the number
-   * of arguments to be sent; then send, for each argument, first the
-   * length of the argument string, then the argument itself.
+  /* Write the entire message, even if the socket is nonblocking (as it is
+   * for the clients of the daemon), unless the client stops reading it.
    */
-  if (write(sockfd, &msgargc, sizeof(unsigned int)) !=
-      sizeof(unsigned int)) {
-    pr_signals_unblock();
-    return -1;
-  }
+  deadline = time(NULL) + CTRLS_SEND_TIMEOUT;
 
-  for (i = 0; i < msgargc; i++) {
-    int res = 0;
+  while (off < msglen) {
+    ssize_t res;
 
-    msgarglen = strlen(msgargv[i]);
-
-    while (TRUE) {
-      res = write(sockfd, &msgarglen, sizeof(unsigned int));
-
-      if (res != sizeof(unsigned int)) {
-        if (errno == EAGAIN) {
-          continue;
-        }
+    res = write(sockfd, msg + off, msglen - off);
+    if (res < 0) {
+      int xerrno = errno;
 
-        pr_signals_unblock();
-        return -1;
+      if (xerrno == EINTR) {
+        continue;
       }
 
-      break;
-    }
+      if (xerrno == EAGAIN ||
+          xerrno == EWOULDBLOCK) {
+        fd_set wfds;
+        struct timeval tv;
+        time_t now;
 
-    while (TRUE) {
-      res = write(sockfd, msgargv[i], msgarglen);
+        now = time(NULL);
+        if (now < deadline) {
+          FD_ZERO(&wfds);
+          FD_SET(sockfd, &wfds);
 
-      if (res != msgarglen) {
-        if (errno == EAGAIN) {
-          continue;
-        }
+          tv.tv_sec = deadline - now;
+          tv.tv_usec = 0;
 
-        pr_signals_unblock();
-        return -1;
+          if (select(sockfd + 1, NULL, &wfds, NULL, &tv) != 0) {
+            continue;
+          }
+        }
 
+        pr_trace_msg(trace_channel, 3,
+          "client on fd %d not reading its response, giving up", sockfd);
+        xerrno = ETIMEDOUT;
       }
 
-      break;
+      destroy_pool(tmp_pool);
+      pr_signals_unblock();
+
+      errno = xerrno;
+      return -1;
     }
+
+    off += res;
   }
 
+  destroy_pool(tmp_pool);
   pr_signals_unblock();
   return 0;
 }
@@ -1513,6 +1722,40 @@ int pr_check_actions(void) {
   return 0;
 }
 
+/* Invokes the handler for the given ctrl.  Ctrls are unblocked while the
+ * handler runs, so that it can use the Controls API functions correctly.
+ */
+static int ctrls_call_cb(pr_ctrls_t *ctrl) {
+  int arena_flags, res;
+
+  /* Handlers in the daemon may modify the configuration or the stash (e.g.
+   * "down" closing a server's bindings), which live in the arena; make sure
+   * it is writable for the duration, if ConfigMemoryProtect froze it.
+   */
+  arena_flags = pr_pool_arena_get_flags();
+  if (arena_flags & PR_POOL_ARENA_FL_PROTECT) {
+    if (pr_pool_arena_thaw() < 0) {
+      pr_trace_msg(trace_channel, 1,
+        "unable to unprotect configuration memory: %s", strerror(errno));
+    }
+  }
+
+  pr_unblock_ctrls();
+  res = ctrl->ctrls_cb(ctrl,
+    (ctrl->ctrls_cb_args ? ctrl->ctrls_cb_args->nelts : 0),
+    (ctrl->ctrls_cb_args ? (char **) ctrl->ctrls_cb_args->elts : NULL));
+  pr_block_ctrls();
+
+  if (arena_flags & PR_POOL_ARENA_FL_PROTECT) {
+    if (pr_pool_arena_freeze(arena_flags) < 0) {
+      pr_trace_msg(trace_channel, 1,
+        "unable to protect configuration memory: %s", strerror(errno));
+    }
+  }
+
+  return res;
+}
+
 int pr_run_ctrls(module *mod, const char *action) {
   pr_ctrls_t *ctrl = NULL;
 
@@ -1524,11 +1767,17 @@ int pr_run_ctrls(module *mod, const char *action) {
 
   for (ctrl = ctrls_active_list; ctrl; ctrl = ctrl->ctrls_next) {
 
-    /* Be watchful of the various client-side flags.  Note: if
-     * ctrl->ctrls_cl is ever NULL, it means there's a bug in the code.
+    /* Be watchful of the various client-side flags.  A ctrl with no client
+     * is either one whose request was never completely read, or one which
+     * is still pending after its client has gone.
      */
-    if (ctrl->ctrls_cl->cl_flags != PR_CTRLS_CL_HAVEREQ)
+    if (ctrl->ctrls_cl == NULL) {
+      if (!(ctrl->ctrls_flags & PR_CTRLS_PENDING))
+        continue;
+
+    } else if (ctrl->ctrls_cl->cl_flags != PR_CTRLS_CL_HAVEREQ) {
       continue;
+    }
 
     /* Has this control been disabled? */
     if (ctrl->ctrls_flags & PR_CTRLS_ACT_DISABLED)
@@ -1539,8 +1788,11 @@ int pr_run_ctrls(module *mod, const char *action) {
       continue;
 
     if (ctrl->ctrls_when > time(NULL)) {
-      ctrl->ctrls_flags |= PR_CTRLS_PENDING;
-      pr_ctrls_add_response(ctrl, "request pending");
+      if (!(ctrl->ctrls_flags & PR_CTRLS_PENDING)) {
+        ctrl->ctrls_flags |= PR_CTRLS_PENDING;
+        pr_ctrls_add_response(ctrl, "request pending");
+      }
+
       continue;
     }
 
@@ -1549,21 +1801,16 @@ int pr_run_ctrls(module *mod, const char *action) {
       pr_trace_msg(trace_channel, 7, "calling '%s' control handler",
         ctrl->ctrls_action);
 
-      /* Invoke the callback, if the ctrl's action matches.  Unblock
-       * ctrls before invoking the callback, then re-block them after the
-       * callback returns.  This will allow the action handlers to use some
-       * of the Controls API functions correctly.
-       */
-      pr_unblock_ctrls();
-      ctrl->ctrls_cb_retval = ctrl->ctrls_cb(ctrl,
-        (ctrl->ctrls_cb_args ? ctrl->ctrls_cb_args->nelts : 0),
-        (ctrl->ctrls_cb_args ? (char **) ctrl->ctrls_cb_args->elts : NULL));
-      pr_block_ctrls();
+      /* Invoke the callback, if the ctrl's action matches. */
+      ctrl->ctrls_cb_retval = ctrls_call_cb(ctrl);
 
       if (ctrl->ctrls_cb_retval < 1) {
         ctrl->ctrls_flags &= ~PR_CTRLS_REQUESTED;
         ctrl->ctrls_flags &= ~PR_CTRLS_PENDING;
         ctrl->ctrls_flags |= PR_CTRLS_HANDLED;
+
+      } else {
+        ctrl->ctrls_flags |= PR_CTRLS_PENDING;
       }
 
     } else if (!action) {
@@ -1571,16 +1818,15 @@ int pr_run_ctrls(module *mod, const char *action) {
         ctrl->ctrls_action);
 
       /* If no action was given, invoke every callback */
-      pr_unblock_ctrls();
-      ctrl->ctrls_cb_retval = ctrl->ctrls_cb(ctrl,
-        (ctrl->ctrls_cb_args ? ctrl->ctrls_cb_args->nelts : 0),
-        (ctrl->ctrls_cb_args ? (char **) ctrl->ctrls_cb_args->elts : NULL));
-      pr_block_ctrls();
+      ctrl->ctrls_cb_retval = ctrls_call_cb(ctrl);
 
       if (ctrl->ctrls_cb_retval < 1) {
         ctrl->ctrls_flags &= ~PR_CTRLS_REQUESTED;
         ctrl->ctrls_flags &= ~PR_CTRLS_PENDING;
         ctrl->ctrls_flags |= PR_CTRLS_HANDLED;
+
+      } else {
+        ctrl->ctrls_flags |= PR_CTRLS_PENDING;
       }
     }
   }
@@ -1609,14 +1855,41 @@ int pr_reset_ctrls(void) {
    *                             -1  processed, error (reset)
    */
 
-  for (ctrl = ctrls_active_list; ctrl; ctrl = ctrl->ctrls_next) {
+  ctrl = ctrls_active_list;
+  while (ctrl != NULL) {
+    /* ctrls_free() puts the ctrl onto the free list. */
+    pr_ctrls_t *next_ctrl = ctrl->ctrls_next;
+
     if (ctrl->ctrls_cb_retval < 1)
       ctrls_free(ctrl);
+
+    ctrl = next_ctrl;
   }
 
   return 0;
 }
 
+int pr_ctrls_set_fds_handler(int (*add_fds)(fd_set *, fd_set *, int),
+    void (*handle_fds)(fd_set *, fd_set *)) {
+  ctrls_add_fds_cb = add_fds;
+  ctrls_handle_fds_cb = handle_fds;
+  return 0;
+}
+
+int pr_ctrls_add_fds(fd_set *rfds, fd_set *wfds, int maxfd) {
+  if (ctrls_add_fds_cb == NULL) {
+    return maxfd;
+  }
+
+  return (ctrls_add_fds_cb)(rfds, wfds, maxfd);
+}
+
+void pr_ctrls_handle_fds(fd_set *rfds, fd_set *wfds) {
+  if (ctrls_handle_fds_cb != NULL) {
+    (ctrls_handle_fds_cb)(rfds, wfds);
+  }
+}
+
 /* From include/mod_ctrls.h */
 
 /* Returns TRUE if the given cl_gid is allowed by the group ACL, FALSE
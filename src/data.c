@@ -600,6 +600,11 @@ void pr_data_init(char *filename, int direction) {
 int pr_data_open(char *filename, char *reason, int direction, off_t size) {
   int res = 0;
 
+  /* The client may be waiting for the responses to earlier pipelined
+   * commands (e.g. PASV) before opening the data connection.
+   */
+  pr_response_defer(FALSE);
+
   /* Make sure that any abort flags have been cleared. */
   session.sf_flags &= ~(SF_ABORT|SF_POST_ABORT);
 
@@ -1391,9 +1396,11 @@ int pr_data_xfer(char *cl_buf, size_t cl_size) {
   session.total_bytes += total;
   if (session.xfer.direction == PR_NETIO_IO_RD) {
     session.total_bytes_in += total;
+    pr_metrics_incr(PR_METRICS_CTR_BYTES_IN, total);
 
   } else {
     session.total_bytes_out += total;
+    pr_metrics_incr(PR_METRICS_CTR_BYTES_OUT, total);
   }
 
   return (len < 0 ? -1 : len);
@@ -1475,6 +1482,7 @@ pr_sendfile_t pr_data_sendfile(int retr_fd, off_t *offset, off_t count) {
         session.total_bytes += len;
         session.total_bytes_out += len;
         session.total_raw_out += len;
+        pr_metrics_incr(PR_METRICS_CTR_BYTES_OUT, len);
 
         return -1;
       }
@@ -1496,6 +1504,7 @@ pr_sendfile_t pr_data_sendfile(int retr_fd, off_t *offset, off_t count) {
       session.total_bytes += len;
       session.total_bytes_out += len;
       session.total_raw_out += len;
+      pr_metrics_incr(PR_METRICS_CTR_BYTES_OUT, len);
       total += len;
 
       pr_signals_handle();
@@ -1589,6 +1598,7 @@ pr_sendfile_t pr_data_sendfile(int retr_fd, off_t *offset, off_t count) {
           session.total_bytes += len;
           session.total_bytes_out += len;
           session.total_raw_out += len;
+          pr_metrics_incr(PR_METRICS_CTR_BYTES_OUT, len);
 
           return -1;
         }
@@ -1617,6 +1627,7 @@ pr_sendfile_t pr_data_sendfile(int retr_fd, off_t *offset, off_t count) {
         session.total_bytes += len;
         session.total_bytes_out += len;
         session.total_raw_out += len;
+        pr_metrics_incr(PR_METRICS_CTR_BYTES_OUT, len);
         total += len;
 
         continue;
@@ -1647,6 +1658,7 @@ pr_sendfile_t pr_data_sendfile(int retr_fd, off_t *offset, off_t count) {
   session.total_bytes += len;
   session.total_bytes_out += len;
   session.total_raw_out += len;
+  pr_metrics_incr(PR_METRICS_CTR_BYTES_OUT, len);
   total += len;
 
   return total;
@@ -74,6 +74,83 @@ static pool *config_tab_pool = NULL;
 static pr_table_t *config_tab = NULL;
 static unsigned int config_id = 0;
 
+/* Hiding policies, resolved once per configuration context (or, for
+ * HideFiles and <Directory> matches, once per directory), and reused for the
+ * duration of a dir_hide_begin()/dir_hide_end() bracket.
+ */
+struct hide_id {
+  unsigned int id;
+  int inverted;
+};
+
+struct hide_policy {
+  struct hide_policy *next;
+  xaset_t *set;
+
+  /* HideUser, HideGroup */
+  array_header *hide_users;
+  array_header *hide_groups;
+
+  /* HideNoAccess */
+  int no_access;
+
+  /* UserOwner, GroupOwner */
+  uid_t fsuid;
+  gid_t fsgid;
+};
+
+/* HideFiles */
+struct hide_files_policy {
+  struct hide_files_policy *next;
+  const char *dir_name;
+
+  pr_regex_t *pre;
+  unsigned char negated;
+  const char *label;
+};
+
+/* The <Directory> section matching the entries of a directory. */
+struct hide_dir_match {
+  struct hide_dir_match *next;
+  const char *dir_name;
+  config_rec *c;
+
+  /* FALSE if some <Directory> section might match an entry in the directory
+   * without matching the directory itself; each entry then has to be
+   * matched separately.
+   */
+  int usable;
+};
+
+/* Once this many policies are cached, the cache is flushed.  Listings go
+ * directory by directory, so only the most recent ones are likely to be
+ * needed again.
+ */
+#define DIR_HIDE_MAX_POLICIES	32
+
+static pool *hide_pool = NULL;
+static unsigned int hide_depth = 0;
+static unsigned int hide_npolicies = 0;
+static struct hide_policy *hide_policies = NULL;
+static struct hide_files_policy *hide_files_policies = NULL;
+static struct hide_dir_match *hide_dir_matches = NULL;
+static int hide_sys_access = FALSE;
+
+static void hide_flush(void) {
+  hide_policies = NULL;
+  hide_files_policies = NULL;
+  hide_dir_matches = NULL;
+  hide_npolicies = 0;
+
+  /* Free the cached policies, keeping a pool for any new ones. */
+  if (hide_pool != NULL) {
+    destroy_pool(hide_pool);
+
+    hide_pool = make_sub_pool(session.pool ? session.pool : permanent_pool);
+    pr_pool_tag(hide_pool, "Hide Policy Pool");
+  }
+}
+
 static int allow_dyn_config(const char *path) {
   config_rec *c = NULL;
   unsigned int ctxt_precedence = 0;
@@ -135,8 +212,10 @@ int is_dotdir(const char *dir) {
  * into a table, rather than a single pointer like session.dir_config,
  * might help.
  */
-xaset_t *get_dir_ctxt(pool *p, char *dir_path) {
-  config_rec *c = NULL;
+/* Returns the absolute path, including any chroot, of the given directory
+ * (relative to the session's current directory).
+ */
+static char *dir_ctxt_path(pool *p, char *dir_path) {
   char *full_path = dir_path;
 
   if (session.chroot_path) {
@@ -151,7 +230,13 @@ xaset_t *get_dir_ctxt(pool *p, char *dir_path) {
     full_path = pdircat(p, session.cwd, dir_path, NULL);
   }
 
-  c = dir_match_path(p, full_path);
+  return full_path;
+}
+
+xaset_t *get_dir_ctxt(pool *p, char *dir_path) {
+  config_rec *c = NULL;
+
+  c = dir_match_path(p, dir_ctxt_path(p, dir_path));
 
   return c ? c->subset : session.anon_config ? session.anon_config->subset :
     main_server->conf;
@@ -276,63 +361,60 @@ char *path_subst_uservar(pool *path_pool, char **path) {
   return new_path;
 }
 
-/* Check for configured HideFiles directives, and check the given path (full
- * _path_, not just filename) against those regexes if configured.
- *
- * Returns FALSE if the path should be shown/listed, TRUE if it should not
- * be visible.
- */
-unsigned char dir_hide_file(const char *path) {
-#ifdef PR_USE_REGEX
-  char *file_name = NULL, *dir_name = NULL;
-  config_rec *c = NULL;
-  pr_regex_t *pre = NULL;
-  pool *tmp_pool;
-  unsigned int ctxt_precedence = 0;
-  unsigned char have_user_regex, have_group_regex, have_class_regex,
-    have_all_regex, negated = FALSE;
+int dir_hide_begin(void) {
+  if (hide_depth == 0) {
+    hide_flush();
 
-  if (path == NULL) {
-    return FALSE;
-  }
+    hide_pool = make_sub_pool(session.pool ? session.pool : permanent_pool);
+    pr_pool_tag(hide_pool, "Hide Policy Pool");
 
-  tmp_pool = make_sub_pool(session.pool);
-  pr_pool_tag(tmp_pool, "dir_hide_file() tmp pool");
+    /* Only if no FS overrides the access checks can HideNoAccess use the
+     * stat(2) data already obtained for each entry.
+     */
+    hide_sys_access = pr_fs_have_sys_access();
+  }
 
-  have_user_regex = have_group_regex = have_class_regex = have_all_regex =
-    FALSE;
+  hide_depth++;
+  return 0;
+}
 
-  /* Separate the given path into directory and file components. */
-  dir_name = pstrdup(tmp_pool, path);
+int dir_hide_end(void) {
+  if (hide_depth == 0) {
+    errno = EPERM;
+    return -1;
+  }
 
-  file_name = strrchr(dir_name, '/');
-  if (file_name != NULL) {
+  hide_depth--;
+  if (hide_depth == 0) {
+    destroy_pool(hide_pool);
+    hide_pool = NULL;
 
-    if (file_name != dir_name) {
-      /* Handle paths like "/path". */
-      *file_name = '\0';
-      file_name++;
+    hide_flush();
+  }
 
-    } else {
-      /* Handle "/". */
-      dir_name = "/";
+  return 0;
+}
 
-      if (strlen(file_name) > 1) {
-        file_name++;
+#ifdef PR_USE_REGEX
+/* Resolves which HideFiles pattern, if any, applies to the files in the
+ * given directory, for the current user/group/class.
+ */
+static void hide_files_resolve(pool *p, char *dir_name,
+    struct hide_files_policy *hfp) {
+  config_rec *c = NULL;
+  unsigned int ctxt_precedence = 0;
+  unsigned char have_user_regex, have_group_regex, have_class_regex,
+    have_all_regex;
 
-      } else {
-        /* Handle "/". */
-        file_name = "/";
-      }
-    }
+  hfp->pre = NULL;
+  hfp->negated = FALSE;
+  hfp->label = NULL;
 
-  } else {
-    file_name = dir_name;
-  }
+  have_user_regex = have_group_regex = have_class_regex = have_all_regex =
+    FALSE;
 
   /* Check for any configured HideFiles */
-  c = find_config(get_dir_ctxt(tmp_pool, dir_name), CONF_PARAM, "HideFiles",
-    FALSE);
+  c = find_config(get_dir_ctxt(p, dir_name), CONF_PARAM, "HideFiles", FALSE);
 
   while (c) {
     pr_signals_handle();
@@ -346,8 +428,8 @@ unsigned char dir_hide_file(const char *path) {
           if (*((unsigned int *) c->argv[2]) > ctxt_precedence) {
             ctxt_precedence = *((unsigned int *) c->argv[2]);
 
-            pre = *((pr_regex_t **) c->argv[0]);
-            negated = *((unsigned char *) c->argv[1]);
+            hfp->pre = *((pr_regex_t **) c->argv[0]);
+            hfp->negated = *((unsigned char *) c->argv[1]);
 
             have_group_regex = have_class_regex = have_all_regex = FALSE;
             have_user_regex = TRUE;
@@ -360,8 +442,8 @@ unsigned char dir_hide_file(const char *path) {
           if (*((unsigned int *) c->argv[2]) > ctxt_precedence) {
             ctxt_precedence = *((unsigned int *) c->argv[2]);
 
-            pre = *((pr_regex_t **) c->argv[0]);
-            negated = *((unsigned char *) c->argv[1]);
+            hfp->pre = *((pr_regex_t **) c->argv[0]);
+            hfp->negated = *((unsigned char *) c->argv[1]);
 
             have_user_regex = have_class_regex = have_all_regex = FALSE;
             have_group_regex = TRUE;
@@ -378,8 +460,8 @@ unsigned char dir_hide_file(const char *path) {
           if (*((unsigned int *) c->argv[2]) > ctxt_precedence) {
             ctxt_precedence = *((unsigned int *) c->argv[2]);
 
-            pre = *((pr_regex_t **) c->argv[0]);
-            negated = *((unsigned char *) c->argv[1]);
+            hfp->pre = *((pr_regex_t **) c->argv[0]);
+            hfp->negated = *((unsigned char *) c->argv[1]);
 
             have_user_regex = have_group_regex = have_all_regex = FALSE;
             have_class_regex = TRUE;
@@ -390,15 +472,16 @@ unsigned char dir_hide_file(const char *path) {
     } else if (c->argc == 1) {
 
       /* This is the "none" HideFiles parameter. */
-      destroy_pool(tmp_pool);
-      return FALSE;
+      hfp->pre = NULL;
+      hfp->negated = FALSE;
+      return;
 
     } else {
       if (*((unsigned int *) c->argv[2]) > ctxt_precedence) {
         ctxt_precedence = *((unsigned int *) c->argv[2]);
 
-        pre = *((pr_regex_t **) c->argv[0]);
-        negated = *((unsigned char *) c->argv[1]);
+        hfp->pre = *((pr_regex_t **) c->argv[0]);
+        hfp->negated = *((unsigned char *) c->argv[1]);
 
         have_user_regex = have_group_regex = have_class_regex = FALSE;
         have_all_regex = TRUE;
@@ -410,45 +493,140 @@ unsigned char dir_hide_file(const char *path) {
 
   if (have_user_regex || have_group_regex ||
       have_class_regex || have_all_regex) {
+    hfp->label = have_user_regex ? "user" : have_group_regex ? "group" :
+      have_class_regex ? "class" : "session";
 
-    pr_log_debug(DEBUG4, "checking %sHideFiles pattern for current %s",
-      negated ? "negated " : "",
-      have_user_regex ? "user" : have_group_regex ? "group" :
-      have_class_regex ? "class" : "session");
+  } else {
+    hfp->pre = NULL;
+    hfp->negated = FALSE;
+  }
+}
 
-    if (pre == NULL) {
-      destroy_pool(tmp_pool);
+static struct hide_files_policy *hide_files_get(pool *p, char *dir_name,
+    struct hide_files_policy *buf) {
+  struct hide_files_policy *hfp;
+  char *full_path;
+
+  /* A name without any directory is resolved as is, as it always has been,
+   * rather than as its directory.
+   */
+  if (hide_depth == 0 ||
+      strchr(dir_name, '/') == NULL) {
+    hide_files_resolve(p, dir_name, buf);
+    return buf;
+  }
+
+  /* Relative paths are resolved against the current directory, which may
+   * change during a listing, so the policies are cached by the resolved
+   * directory.
+   */
+  full_path = dir_ctxt_path(p, dir_name);
+
+  for (hfp = hide_files_policies; hfp; hfp = hfp->next) {
+    if (strcmp(hfp->dir_name, full_path) == 0) {
+      return hfp;
+    }
+  }
+
+  if (hide_npolicies >= DIR_HIDE_MAX_POLICIES) {
+    hide_flush();
+  }
+
+  hfp = pcalloc(hide_pool, sizeof(struct hide_files_policy));
+  hfp->dir_name = pstrdup(hide_pool, full_path);
+  hide_files_resolve(p, dir_name, hfp);
+
+  hfp->next = hide_files_policies;
+  hide_files_policies = hfp;
+  hide_npolicies++;
+
+  return hfp;
+}
+#endif /* PR_USE_REGEX */
+
+/* Check for configured HideFiles directives, and check the given path (full
+ * _path_, not just filename) against those regexes if configured.
+ *
+ * Returns FALSE if the path should be shown/listed, TRUE if it should not
+ * be visible.
+ */
+unsigned char dir_hide_file(const char *path) {
+#ifdef PR_USE_REGEX
+  char *file_name = NULL, *dir_name = NULL;
+  struct hide_files_policy *hfp, hfp_buf;
+  pool *tmp_pool;
+
+  if (path == NULL) {
+    return FALSE;
+  }
+
+  tmp_pool = make_sub_pool(session.pool);
+  pr_pool_tag(tmp_pool, "dir_hide_file() tmp pool");
+
+  /* Separate the given path into directory and file components. */
+  dir_name = pstrdup(tmp_pool, path);
+
+  file_name = strrchr(dir_name, '/');
+  if (file_name != NULL) {
+
+    if (file_name != dir_name) {
+      /* Handle paths like "/path". */
+      *file_name = '\0';
+      file_name++;
 
+    } else {
+      /* Handle "/". */
+      dir_name = "/";
+
+      if (strlen(file_name) > 1) {
+        file_name++;
+
+      } else {
+        /* Handle "/". */
+        file_name = "/";
+      }
+    }
+
+  } else {
+    file_name = dir_name;
+  }
+
+  hfp = hide_files_get(tmp_pool, dir_name, &hfp_buf);
+
+  if (hfp->label != NULL) {
+    pr_log_debug(DEBUG4, "checking %sHideFiles pattern for current %s",
+      hfp->negated ? "negated " : "", hfp->label);
+
+    if (hfp->pre == NULL) {
       /* HideFiles none for this user/group/class */
 
       pr_log_debug(DEBUG9, "file '%s' did not match HideFiles pattern 'none'",
         file_name);
+      destroy_pool(tmp_pool);
       return FALSE;
     }
 
-    if (pr_regexp_exec(pre, file_name, 0, NULL, 0, 0, 0) != 0) {
-      destroy_pool(tmp_pool);
-
+    if (pr_regexp_exec(hfp->pre, file_name, 0, NULL, 0, 0, 0) != 0) {
       pr_log_debug(DEBUG9, "file '%s' did not match %sHideFiles pattern",
-        file_name, negated ? "negated " : "");
+        file_name, hfp->negated ? "negated " : "");
+      destroy_pool(tmp_pool);
 
       /* The file failed to match the HideFiles regex, which means it should
        * be treated as a "visible" file.  If the regex was negated, though,
        * switch the result.
        */
-      return (negated ? TRUE : FALSE);
+      return (hfp->negated ? TRUE : FALSE);
 
     } else {
-      destroy_pool(tmp_pool);
-
       pr_log_debug(DEBUG9, "file '%s' matched %sHideFiles pattern", file_name,
-        negated ? "negated " : "");
+        hfp->negated ? "negated " : "");
+      destroy_pool(tmp_pool);
 
       /* The file matched the HideFiles regex, which means it should be
        * considered a "hidden" file.  If the regex was negated, though,
        * switch the result.
        */
-      return (negated ? FALSE : TRUE);
+      return (hfp->negated ? FALSE : TRUE);
     }
   }
 
@@ -561,8 +739,8 @@ config_rec *pr_config_add_set(xaset_t **set, const char *name, int flags) {
 
   if (!*set) {
 
-    /* Allocate a subpool from permanent_pool for the set. */
-    set_pool = make_sub_pool(permanent_pool);
+    /* Allocate a subpool from the arena for the set. */
+    set_pool = make_sub_pool(pr_pool_get_arena());
     pr_pool_tag(set_pool, "config set pool");
 
     *set = xaset_create(set_pool, NULL);
@@ -836,173 +1014,434 @@ config_rec *dir_match_path(pool *p, char *path) {
   return res;
 }
 
-/* Returns TRUE to allow, FALSE to deny. */
-static int dir_check_op(pool *p, xaset_t *set, int op, const char *path,
-    uid_t file_uid, gid_t file_gid, mode_t mode) {
-  int res = TRUE;
+/* Returns TRUE if any <Directory> section in the given set (or below it)
+ * might match an entry in the given directory without also matching the
+ * directory itself, i.e. if the <Directory> match for the directory cannot
+ * be used for its entries.  This errs on the side of returning TRUE.
+ */
+static int dir_match_entries_differ(pool *p, xaset_t *set, const char *dir,
+    size_t dirlen) {
   config_rec *c;
 
-  /* Default is to allow. */
-  if (!set)
-    return TRUE;
-
-  switch (op) {
-    case OP_HIDE:
-      c = find_config(set, CONF_PARAM, "HideUser", FALSE);
-      while (c) {
-        int inverted = FALSE;
-        const char *hide_user = NULL;
-        uid_t hide_uid = -1;
+  if (set == NULL) {
+    return FALSE;
+  }
 
-        pr_signals_handle();
+  for (c = (config_rec *) set->xas_list; c; c = c->next) {
+    const char *tmp_path;
+    size_t len;
 
-        hide_user = c->argv[0];
-        inverted = *((unsigned char *) c->argv[1]);
+    if (c->config_type != CONF_DIR) {
+      continue;
+    }
 
-        if (strncmp(hide_user, "~", 2) == 0) {
-          hide_uid = session.uid;
+    tmp_path = c->name;
 
-        } else {
-          struct passwd *pw;
+    if (c->argv[1]) {
+      if (*((char *) c->argv[1]) == '~') {
+        /* Not yet resolved; see recur_match_path(). */
+        return TRUE;
+      }
 
-          pw = pr_auth_getpwnam(p, hide_user);
-          if (pw == NULL) {
-            pr_log_debug(DEBUG1,
-              "HideUser '%s' is not a known/valid user, ignoring", hide_user);
+      tmp_path = pdircat(p, (char *) c->argv[1], tmp_path, NULL);
+    }
 
-            c = find_config_next(c, c->next, CONF_PARAM, "HideUser", FALSE);
-            continue;
-          }
+    if (pr_str_is_fnmatch(tmp_path) ||
+        strchr(tmp_path, '\\') != NULL) {
+      /* A pattern which matches the directory matches all of its entries,
+       * too.  Otherwise, only one whose literal prefix cannot lead to the
+       * directory's entries can be ruled out.
+       */
+      if (pr_fnmatch(tmp_path, dir, 0) != 0) {
+        len = strcspn(tmp_path, "*?[\\");
+        if (len > dirlen) {
+          len = dirlen;
+        }
 
-          hide_uid = pw->pw_uid;
+        if (strncmp(tmp_path, dir, len) == 0) {
+          return TRUE;
         }
+      }
 
-        if (file_uid == hide_uid) {
-          if (!inverted)
-            res = FALSE;
+    } else {
+      /* A literal path below the directory. */
+      len = strlen(tmp_path);
+      if (len > dirlen &&
+          strncmp(tmp_path, dir, dirlen) == 0 &&
+          (dirlen == 1 || tmp_path[dirlen] == '/')) {
+        return TRUE;
+      }
+    }
 
-          break;
+    if (dir_match_entries_differ(p, c->subset, dir, dirlen) == TRUE) {
+      return TRUE;
+    }
+  }
 
-        } else {
-          if (inverted) {
-            res = FALSE;
-            break;
-          }
-        }
+  return FALSE;
+}
+
+/* Like dir_match_path(), but between dir_hide_begin() and dir_hide_end(),
+ * the <Directory> section matched by the entries of a directory is found
+ * only once for the directory, where possible.
+ */
+static config_rec *dir_match_entry(pool *p, char *path) {
+  struct hide_dir_match *hdm;
+  char *dir_name, *ptr;
+  size_t dirlen;
+
+  ptr = strrchr(path, '/');
+  if (hide_depth == 0 ||
+      ptr == NULL ||
+      ptr[1] == '\0' ||
+      (ptr[1] == '*' && ptr[2] == '\0')) {
+    return dir_match_path(p, path);
+  }
+
+  dirlen = ptr > path ? (size_t) (ptr - path) : 1;
+  dir_name = pstrndup(p, path, dirlen);
+
+  for (hdm = hide_dir_matches; hdm; hdm = hdm->next) {
+    if (strcmp(hdm->dir_name, dir_name) == 0) {
+      break;
+    }
+  }
+
+  if (hdm == NULL) {
+    if (hide_npolicies >= DIR_HIDE_MAX_POLICIES) {
+      hide_flush();
+    }
+
+    hdm = pcalloc(hide_pool, sizeof(struct hide_dir_match));
+    hdm->dir_name = pstrdup(hide_pool, dir_name);
+    hdm->usable = TRUE;
+
+    if (session.anon_config != NULL &&
+        (dir_match_entries_differ(p, session.anon_config->subset, dir_name,
+           dirlen) == TRUE ||
+         (session.chroot_path != NULL &&
+          strncmp(session.chroot_path, dir_name,
+            strlen(session.chroot_path)) != 0))) {
+      hdm->usable = FALSE;
+    }
+
+    if (hdm->usable == TRUE &&
+        dir_match_entries_differ(p, main_server->conf, dir_name,
+          dirlen) == TRUE) {
+      hdm->usable = FALSE;
+    }
+
+    if (hdm->usable == TRUE) {
+      hdm->c = dir_match_path(p, dir_name);
+    }
+
+    hdm->next = hide_dir_matches;
+    hide_dir_matches = hdm;
+    hide_npolicies++;
+  }
+
+  if (hdm->usable == FALSE) {
+    return dir_match_path(p, path);
+  }
+
+  return hdm->c;
+}
+
+/* Resolves the UserOwner and GroupOwner directives in the given configuration
+ * context, looking up the configured user/group.
+ */
+static void dir_owner_resolve(pool *p, xaset_t *set, uid_t *fsuid,
+    gid_t *fsgid) {
+  char *owner;
+
+  *fsuid = (uid_t) -1;
+  *fsgid = (gid_t) -1;
+
+  owner = get_param_ptr(set, "UserOwner", FALSE);
+  if (owner != NULL) {
+    /* Attempt chown() on all new files. */
+    struct passwd *pw;
+
+    pw = pr_auth_getpwnam(p, owner);
+    if (pw != NULL)
+      *fsuid = pw->pw_uid;
+  }
+
+  owner = get_param_ptr(set, "GroupOwner", FALSE);
+  if (owner != NULL) {
+    /* Attempt chgrp() on all new files. */
+
+    if (strncmp(owner, "~", 2) != 0) {
+      struct group *gr;
+
+      gr = pr_auth_getgrnam(p, owner);
+      if (gr != NULL) {
+        *fsgid = gr->gr_gid;
+      }
+
+    } else {
+      *fsgid = session.gid;
+    }
+  }
+}
+
+/* Resolves the HideUser, HideGroup and HideNoAccess directives in the given
+ * configuration context, looking up the configured users/groups.
+ */
+static void hide_policy_resolve(pool *p, xaset_t *set, struct hide_policy *hp) {
+  config_rec *c;
+  unsigned char *hide_no_access;
+
+  hp->set = set;
+  hp->hide_users = make_array(p, 1, sizeof(struct hide_id));
+  hp->hide_groups = make_array(p, 1, sizeof(struct hide_id));
+  hp->no_access = FALSE;
+
+  c = find_config(set, CONF_PARAM, "HideUser", FALSE);
+  while (c) {
+    struct hide_id *hid;
+    const char *hide_user = NULL;
+    uid_t hide_uid = -1;
+
+    pr_signals_handle();
+
+    hide_user = c->argv[0];
+
+    if (strncmp(hide_user, "~", 2) == 0) {
+      hide_uid = session.uid;
+
+    } else {
+      struct passwd *pw;
+
+      pw = pr_auth_getpwnam(p, hide_user);
+      if (pw == NULL) {
+        pr_log_debug(DEBUG1,
+          "HideUser '%s' is not a known/valid user, ignoring", hide_user);
 
         c = find_config_next(c, c->next, CONF_PARAM, "HideUser", FALSE);
+        continue;
       }
 
-      /* We only need to check for HideGroup restrictions if we are not
-       * already hiding the file.  I.e. if res = FALSE, then the path is to
-       * be hidden, and we don't need to check for other reasons to hide it
-       * (Bug#3530).
-       */
-      if (res == TRUE) {
-        c = find_config(set, CONF_PARAM, "HideGroup", FALSE);
-        while (c) {
-          int inverted = FALSE;
-          const char *hide_group = NULL;
-          gid_t hide_gid = -1;
+      hide_uid = pw->pw_uid;
+    }
 
-          pr_signals_handle();
+    hid = push_array(hp->hide_users);
+    hid->id = (unsigned int) hide_uid;
+    hid->inverted = *((int *) c->argv[1]);
 
-          hide_group = c->argv[0];
-          inverted = *((int *) c->argv[1]);
+    c = find_config_next(c, c->next, CONF_PARAM, "HideUser", FALSE);
+  }
 
-          if (strncmp(hide_group, "~", 2) == 0) {
-            hide_gid = session.gid;
+  c = find_config(set, CONF_PARAM, "HideGroup", FALSE);
+  while (c) {
+    struct hide_id *hid;
+    const char *hide_group = NULL;
+    gid_t hide_gid = -1;
 
-          } else {
-            struct group *gr;
+    pr_signals_handle();
 
-            gr = pr_auth_getgrnam(p, hide_group);
-            if (gr == NULL) {
-              pr_log_debug(DEBUG1,
-                "HideGroup '%s' is not a known/valid group, ignoring",
-                hide_group);
+    hide_group = c->argv[0];
 
-              c = find_config_next(c, c->next, CONF_PARAM, "HideUser", FALSE);
-              continue;
-            }
+    if (strncmp(hide_group, "~", 2) == 0) {
+      hide_gid = session.gid;
 
-            hide_gid = gr->gr_gid;
-          }
+    } else {
+      struct group *gr;
 
-          if (hide_gid != (gid_t) -1) {
-            if (file_gid == hide_gid) {
-              if (!inverted)
-                res = FALSE;
+      gr = pr_auth_getgrnam(p, hide_group);
+      if (gr == NULL) {
+        pr_log_debug(DEBUG1,
+          "HideGroup '%s' is not a known/valid group, ignoring", hide_group);
 
-              break;
+        c = find_config_next(c, c->next, CONF_PARAM, "HideGroup", FALSE);
+        continue;
+      }
 
-            } else {
-              if (inverted) {
-                res = FALSE;
-                break;
-              }
-            }
+      hide_gid = gr->gr_gid;
+    }
 
-          } else {
-            register unsigned int i;
-            gid_t *group_ids = session.gids->elts;
+    hid = push_array(hp->hide_groups);
+    hid->id = (unsigned int) hide_gid;
+    hid->inverted = *((int *) c->argv[1]);
 
-            /* First check to see if the file GID matches the session GID. */
-            if (file_gid == session.gid) {
-              if (!inverted)
-                res = FALSE;
+    c = find_config_next(c, c->next, CONF_PARAM, "HideGroup", FALSE);
+  }
 
-              break;
-            }
+  hide_no_access = get_param_ptr(set, "HideNoAccess", FALSE);
+  if (hide_no_access &&
+      *hide_no_access == TRUE) {
+    hp->no_access = TRUE;
+  }
+}
 
-            /* Next, scan the list of supplemental groups for this user. */
-            for (i = 0; i < session.gids->nelts; i++) {
-              if (file_gid == group_ids[i]) {
-                if (!inverted)
-                  res = FALSE;
+static struct hide_policy *hide_policy_get(pool *p, xaset_t *set,
+    struct hide_policy *buf) {
+  struct hide_policy *hp;
 
-                break;
-              }
-            }
+  if (hide_depth == 0) {
+    hide_policy_resolve(p, set, buf);
+    return buf;
+  }
 
-            if (inverted) {
-              res = FALSE;
-              break;
-            }
-          }
+  for (hp = hide_policies; hp; hp = hp->next) {
+    if (hp->set == set) {
+      return hp;
+    }
+  }
 
-          c = find_config_next(c, c->next, CONF_PARAM, "HideGroup", FALSE);
-        }
+  if (hide_npolicies >= DIR_HIDE_MAX_POLICIES) {
+    hide_flush();
+  }
+
+  hp = pcalloc(hide_pool, sizeof(struct hide_policy));
+  hide_policy_resolve(hide_pool, set, hp);
+  dir_owner_resolve(hide_pool, set, &(hp->fsuid), &(hp->fsgid));
+
+  hp->next = hide_policies;
+  hide_policies = hp;
+  hide_npolicies++;
+
+  return hp;
+}
+
+/* Looks up the UserOwner and GroupOwner IDs for the given configuration
+ * context.
+ */
+static void dir_owner_get(pool *p, xaset_t *set, uid_t *fsuid, gid_t *fsgid) {
+  struct hide_policy *hp, hp_buf;
+
+  if (hide_depth == 0) {
+    dir_owner_resolve(p, set, fsuid, fsgid);
+    return;
+  }
+
+  hp = hide_policy_get(p, set, &hp_buf);
+  *fsuid = hp->fsuid;
+  *fsgid = hp->fsgid;
+}
+
+/* Returns TRUE to allow (i.e. show), FALSE to hide. */
+static int hide_policy_check(struct hide_policy *hp, const char *path,
+    struct stat *st) {
+  register unsigned int i;
+  int res = TRUE;
+  struct hide_id *hids;
+
+  hids = hp->hide_users->elts;
+  for (i = 0; i < hp->hide_users->nelts; i++) {
+    if (st->st_uid == (uid_t) hids[i].id) {
+      if (!hids[i].inverted)
+        res = FALSE;
+
+      break;
+
+    } else {
+      if (hids[i].inverted) {
+        res = FALSE;
+        break;
       }
+    }
+  }
 
-      /* If we have already decided to hide this path (i.e. res = FALSE),
-       * then we do not need to check for HideNoAccess.  Hence why we
-       * only look for HideNoAccess here if res = TRUE (Bug#3530).
-       */
-      if (res == TRUE) {
-        unsigned char *hide_no_access = NULL;
+  /* We only need to check for HideGroup restrictions if we are not
+   * already hiding the file.  I.e. if res = FALSE, then the path is to
+   * be hidden, and we don't need to check for other reasons to hide it
+   * (Bug#3530).
+   */
+  if (res == TRUE) {
+    hids = hp->hide_groups->elts;
+    for (i = 0; i < hp->hide_groups->nelts; i++) {
+      gid_t hide_gid = (gid_t) hids[i].id;
+
+      if (hide_gid != (gid_t) -1) {
+        if (st->st_gid == hide_gid) {
+          if (!hids[i].inverted)
+            res = FALSE;
 
-        hide_no_access = get_param_ptr(set, "HideNoAccess", FALSE);
-        if (hide_no_access &&
-            *hide_no_access == TRUE) {
+          break;
 
-          if (S_ISDIR(mode)) {
-            /* Check to see if the mode of this directory allows the
-             * current user to list its contents.
-             */
-            res = pr_fsio_access(path, X_OK, session.uid, session.gid,
-              session.gids) == 0 ? TRUE : FALSE;
+        } else {
+          if (hids[i].inverted) {
+            res = FALSE;
+            break;
+          }
+        }
 
-          } else {
-            /* Check to see if the mode of this file allows the current
-             * user to read it.
-             */
-            res = pr_fsio_access(path, R_OK, session.uid, session.gid,
-              session.gids) == 0 ? TRUE : FALSE;
+      } else {
+        register unsigned int j;
+        gid_t *group_ids = session.gids->elts;
+
+        /* First check to see if the file GID matches the session GID. */
+        if (st->st_gid == session.gid) {
+          if (!hids[i].inverted)
+            res = FALSE;
+
+          break;
+        }
+
+        /* Next, scan the list of supplemental groups for this user. */
+        for (j = 0; j < session.gids->nelts; j++) {
+          if (st->st_gid == group_ids[j]) {
+            if (!hids[i].inverted)
+              res = FALSE;
+
+            break;
           }
         }
+
+        if (hids[i].inverted) {
+          res = FALSE;
+          break;
+        }
       }
+    }
+  }
+
+  /* If we have already decided to hide this path (i.e. res = FALSE),
+   * then we do not need to check for HideNoAccess.  Hence why we
+   * only look for HideNoAccess here if res = TRUE (Bug#3530).
+   */
+  if (res == TRUE &&
+      hp->no_access == TRUE) {
+    int mode;
+
+    /* For a directory, check to see if its mode allows the current user to
+     * list its contents; for a file, whether it allows the user to read it.
+     */
+    mode = S_ISDIR(st->st_mode) ? X_OK : R_OK;
+
+    if (hide_depth > 0 &&
+        hide_sys_access == TRUE) {
+      /* The path was just stat'd by our caller; no need to do so again. */
+      res = pr_fs_check_access(st, mode, session.uid, session.gid,
+        session.gids) == 0 ? TRUE : FALSE;
+
+    } else {
+      res = pr_fsio_access(path, mode, session.uid, session.gid,
+        session.gids) == 0 ? TRUE : FALSE;
+    }
+  }
+
+  return res;
+}
+
+/* Returns TRUE to allow, FALSE to deny. */
+static int dir_check_op(pool *p, xaset_t *set, int op, const char *path,
+    struct stat *st) {
+  int res = TRUE;
+
+  /* Default is to allow. */
+  if (!set)
+    return TRUE;
+
+  switch (op) {
+    case OP_HIDE: {
+      struct hide_policy *hp, hp_buf;
+
+      hp = hide_policy_get(p, set, &hp_buf);
+      res = hide_policy_check(hp, path, st);
       break;
+    }
 
     case OP_COMMAND: {
       unsigned char *allow_all = get_param_ptr(set, "AllowAll", FALSE);
@@ -1774,6 +2213,7 @@ void build_dyn_config(pool *p, const char *_path, struct stat *stp,
       pr_trace_msg("ftpaccess", 6, "adding config for '%s'", ftpaccess_name);
 
       d = pr_config_add_set(set, ftpaccess_name, 0);
+      hide_flush();
       d->config_type = CONF_DIR;
       d->argc = 1;
       d->argv = pcalloc(d->pool, 2 * sizeof (void *));
@@ -1789,6 +2229,7 @@ void build_dyn_config(pool *p, const char *_path, struct stat *stp,
         pr_trace_msg("ftpaccess", 6, "adding config for '%s'", ftpaccess_name);
 
         newd = pr_config_add_set(set, ftpaccess_name, 0);
+        hide_flush();
         newd->config_type = CONF_DIR;
         newd->argc = 1;
         newd->argv = pcalloc(newd->pool, 2 * sizeof(void *));
@@ -1802,6 +2243,9 @@ void build_dyn_config(pool *p, const char *_path, struct stat *stp,
 
         set = (d->parent ? &d->parent->subset : &main_server->conf);
 
+        /* The policies resolved from the old entries are now stale. */
+        hide_flush();
+
 	if (d->subset &&
             d->subset->xas_list) {
 
@@ -1842,6 +2286,8 @@ void build_dyn_config(pool *p, const char *_path, struct stat *stp,
       d->argv[0] = pcalloc(d->pool, sizeof(time_t));
       *((time_t *) d->argv[0]) = st.st_mtime;
 
+      hide_flush();
+
       d->config_type = CONF_DYNDIR;
 
       pr_trace_msg("ftpaccess", 3, "parsing '%s'", ftpaccess_path);
@@ -1924,7 +2370,7 @@ void build_dyn_config(pool *p, const char *_path, struct stat *stp,
 
 int dir_check_full(pool *pp, cmd_rec *cmd, const char *group, const char *path,
     int *hidden) {
-  char *fullpath, *owner;
+  char *fullpath;
   config_rec *c;
   struct stat st;
   pool *p;
@@ -1962,7 +2408,7 @@ int dir_check_full(pool *pp, cmd_rec *cmd, const char *group, const char *path,
   /* Cache a pointer to the set of configuration data for this directory in
    * session.dir_config.
    */
-  session.dir_config = c = dir_match_path(p, fullpath);
+  session.dir_config = c = dir_match_entry(p, fullpath);
   if (session.dir_config) {
     pr_trace_msg("directory", 2, "matched <Directory %s> for '%s'",
       session.dir_config->name, fullpath);
@@ -1992,43 +2438,15 @@ int dir_check_full(pool *pp, cmd_rec *cmd, const char *group, const char *path,
     }
   }
 
-  session.fsuid = (uid_t) -1;
-  session.fsgid = (gid_t) -1;
-
-  owner = get_param_ptr(CURRENT_CONF, "UserOwner", FALSE);
-  if (owner != NULL) {
-    /* Attempt chown() on all new files. */
-    struct passwd *pw;
-
-    pw = pr_auth_getpwnam(p, owner);
-    if (pw != NULL)
-      session.fsuid = pw->pw_uid;
-  }
-
-  owner = get_param_ptr(CURRENT_CONF, "GroupOwner", FALSE);
-  if (owner != NULL) {
-    /* Attempt chgrp() on all new files. */
-
-    if (strncmp(owner, "~", 2) != 0) {
-      struct group *gr;
-
-      gr = pr_auth_getgrnam(p, owner);
-      if (gr != NULL) {
-        session.fsgid = gr->gr_gid;
-      }
-
-    } else {
-      session.fsgid = session.gid;
-    }
-  }
+  dir_owner_get(p, CURRENT_CONF, &session.fsuid, &session.fsgid);
 
   if (isfile != -1) {
     /* Check to see if the current config "hides" the path or not. */
     op_hidden = !dir_check_op(p, CURRENT_CONF, OP_HIDE,
-      session.chroot_path ? path : fullpath, st.st_uid, st.st_gid, st.st_mode);
+      session.chroot_path ? path : fullpath, &st);
 
     res = dir_check_op(p, CURRENT_CONF, OP_COMMAND,
-      session.chroot_path ? path : fullpath, st.st_uid, st.st_gid, st.st_mode);
+      session.chroot_path ? path : fullpath, &st);
   }
 
   if (res) {
@@ -2080,7 +2498,7 @@ int dir_check_full(pool *pp, cmd_rec *cmd, const char *group, const char *path,
 
 int dir_check(pool *pp, cmd_rec *cmd, const char *group, const char *path,
     int *hidden) {
-  char *fullpath, *owner;
+  char *fullpath;
   config_rec *c;
   struct stat st;
   pool *p;
@@ -2123,7 +2541,7 @@ int dir_check(pool *pp, cmd_rec *cmd, const char *group, const char *path,
   /* Cache a pointer to the set of configuration data for this directory in
    * session.dir_config.
    */
-  session.dir_config = c = dir_match_path(p, fullpath);
+  session.dir_config = c = dir_match_entry(p, fullpath);
   if (session.dir_config) {
     pr_trace_msg("directory", 2, "matched <Directory %s> for '%s'",
       session.dir_config->name, fullpath);
@@ -2153,45 +2571,17 @@ int dir_check(pool *pp, cmd_rec *cmd, const char *group, const char *path,
     }
   }
 
-  session.fsuid = (uid_t) -1;
-  session.fsgid = (gid_t) -1;
-
-  owner = get_param_ptr(CURRENT_CONF, "UserOwner", FALSE);
-  if (owner != NULL) {
-    /* Attempt chown() on all new files. */
-    struct passwd *pw;
-
-    pw = pr_auth_getpwnam(p, owner);
-    if (pw != NULL)
-      session.fsuid = pw->pw_uid;
-  }
-
-  owner = get_param_ptr(CURRENT_CONF, "GroupOwner", FALSE);
-  if (owner != NULL) {
-    /* Attempt chgrp() on all new files. */
-
-    if (strncmp(owner, "~", 2) != 0) {
-      struct group *gr;
-
-      gr = pr_auth_getgrnam(p, owner);
-      if (gr != NULL) {
-        session.fsgid = gr->gr_gid;
-      }
-
-    } else {
-      session.fsgid = session.gid;
-    }
-  }
+  dir_owner_get(p, CURRENT_CONF, &session.fsuid, &session.fsgid);
 
   if (isfile != -1) {
     /* If not already marked as hidden by its name, check to see if the path
      * is to be hidden by nature of its mode
      */
     op_hidden = !dir_check_op(p, CURRENT_CONF, OP_HIDE,
-      session.chroot_path ? path : fullpath, st.st_uid, st.st_gid, st.st_mode);
+      session.chroot_path ? path : fullpath, &st);
 
     res = dir_check_op(p, CURRENT_CONF, OP_COMMAND,
-      session.chroot_path ? path : fullpath, st.st_uid, st.st_gid, st.st_mode);
+      session.chroot_path ? path : fullpath, &st);
   }
 
   if (res) {
@@ -3618,7 +4008,7 @@ static void set_tcp_bufsz(server_rec *s) {
 }
 
 void init_config(void) {
-  pool *conf_pool = make_sub_pool(permanent_pool);
+  pool *conf_pool = make_sub_pool(pr_pool_get_arena());
   pr_pool_tag(conf_pool, "Config Pool");
 
   /* Make sure global_config_pool is destroyed */
@@ -3683,7 +4073,7 @@ void init_config(void) {
    */
   server_list = xaset_create(conf_pool, NULL);
 
-  conf_pool = make_sub_pool(permanent_pool);
+  conf_pool = make_sub_pool(pr_pool_get_arena());
   pr_pool_tag(conf_pool, "main_server pool");
 
   main_server = (server_rec *) pcalloc(conf_pool, sizeof(server_rec));
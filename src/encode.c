@@ -44,6 +44,11 @@ static const char *local_charset = NULL;
 static const char *encoding = "UTF-8";
 static int supports_telnet_iac = TRUE;
 
+/* TRUE if the conversion handles map each 7-bit ASCII character to itself,
+ * in which case pure ASCII strings need not be converted at all.
+ */
+static int ascii_passthrough = FALSE;
+
 static const char *trace_channel = "encode";
 
 static int str_convert(iconv_t conv, const char *inbuf, size_t *inbuflen,
@@ -98,6 +103,40 @@ static int str_convert(iconv_t conv, const char *inbuf, size_t *inbuflen,
 #endif /* !HAVE_ICONV_H */
 
 #ifdef HAVE_ICONV
+/* Determines whether both conversion handles leave ASCII characters as they
+ * are (e.g. UTF-8 and the ISO-8859 charsets), as opposed to changing their
+ * encoding (e.g. UCS-2, EBCDIC).
+ */
+static int get_ascii_passthrough(void) {
+  register unsigned int i;
+  char ascii[96], buf[PR_TUNABLE_BUFFER_SIZE];
+  size_t inlen, outlen;
+
+  for (i = 0; i < sizeof(ascii); i++) {
+    ascii[i] = (i < 95 ? (char) (0x20 + i) : '\t');
+  }
+
+  inlen = sizeof(ascii);
+  outlen = sizeof(buf);
+  if (str_convert(encode_conv, ascii, &inlen, buf, &outlen) < 0 ||
+      inlen != 0 ||
+      (sizeof(buf) - outlen) != sizeof(ascii) ||
+      memcmp(buf, ascii, sizeof(ascii)) != 0) {
+    return FALSE;
+  }
+
+  inlen = sizeof(ascii);
+  outlen = sizeof(buf);
+  if (str_convert(decode_conv, ascii, &inlen, buf, &outlen) < 0 ||
+      inlen != 0 ||
+      (sizeof(buf) - outlen) != sizeof(ascii) ||
+      memcmp(buf, ascii, sizeof(ascii)) != 0) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
 static void set_supports_telnet_iac(const char *codeset) {
 
   /* The full list of character sets which use 0xFF could be obtained from
@@ -145,6 +184,7 @@ int encode_free(void) {
     decode_conv = (iconv_t) -1;
   }
 
+  ascii_passthrough = FALSE;
   return res;
 # else
   errno = ENOSYS;
@@ -200,6 +240,11 @@ int encode_init(void) {
       errno = xerrno;
       return -1;
     }
+
+    ascii_passthrough = get_ascii_passthrough();
+    pr_trace_msg(trace_channel, 9, "ASCII strings %s conversion between "
+      "'%s' and '%s'", ascii_passthrough ? "do not need" : "need",
+      local_charset, encoding);
   }
 
   set_supports_telnet_iac(encoding);
@@ -213,7 +258,7 @@ int encode_init(void) {
 char *pr_decode_str(pool *p, const char *in, size_t inlen, size_t *outlen) {
 #ifdef HAVE_ICONV
   size_t inbuflen, outbuflen, outbufsz;
-  char *inbuf, outbuf[PR_TUNABLE_PATH_MAX*2], *res = NULL;
+  char outbuf[PR_TUNABLE_PATH_MAX*2], *res = NULL;
 
   if (p == NULL ||
       in == NULL ||
@@ -230,7 +275,17 @@ char *pr_decode_str(pool *p, const char *in, size_t inlen, size_t *outlen) {
   if (local_charset != NULL &&
       encoding != NULL &&
       strcasecmp(local_charset, encoding) == 0) {
-    return pstrdup(p, in);
+    *outlen = inlen;
+    return pstrndup(p, in, inlen);
+  }
+
+  /* Most strings, particularly paths, are plain ASCII; these are the same
+   * in both charsets, and so do not need to go through iconv(3).
+   */
+  if (ascii_passthrough &&
+      pr_encode_is_ascii(in, inlen) == TRUE) {
+    *outlen = inlen;
+    return pstrndup(p, in, inlen);
   }
 
   if (decode_conv == (iconv_t) -1) {
@@ -239,22 +294,21 @@ char *pr_decode_str(pool *p, const char *in, size_t inlen, size_t *outlen) {
     return pstrdup(p, in);
   }
 
-  inbuf = pcalloc(p, inlen);
-  memcpy(inbuf, in, inlen);
+  /* The input is only read by iconv(3), and so need not be copied. */
   inbuflen = inlen;
-
   outbuflen = sizeof(outbuf);
 
-  if (str_convert(decode_conv, inbuf, &inbuflen, outbuf, &outbuflen) < 0)
+  if (str_convert(decode_conv, in, &inbuflen, outbuf, &outbuflen) < 0)
     return NULL;
 
   *outlen = sizeof(outbuf) - outbuflen;
 
   /* We allocate one byte more, for a terminating NUL. */
   outbufsz = sizeof(outbuf) - outbuflen + 1;
-  res = pcalloc(p, outbufsz);
+  res = palloc(p, outbufsz);
 
   memcpy(res, outbuf, *outlen);
+  res[*outlen] = '\0';
 
   return res;
 #else
@@ -267,7 +321,7 @@ char *pr_decode_str(pool *p, const char *in, size_t inlen, size_t *outlen) {
 char *pr_encode_str(pool *p, const char *in, size_t inlen, size_t *outlen) {
 #ifdef HAVE_ICONV
   size_t inbuflen, outbuflen, outbufsz;
-  char *inbuf, outbuf[PR_TUNABLE_PATH_MAX*2], *res;
+  char outbuf[PR_TUNABLE_PATH_MAX*2], *res;
 
   if (p == NULL ||
       in == NULL ||
@@ -284,7 +338,17 @@ char *pr_encode_str(pool *p, const char *in, size_t inlen, size_t *outlen) {
   if (local_charset != NULL &&
       encoding != NULL &&
       strcasecmp(local_charset, encoding) == 0) {
-    return pstrdup(p, in);
+    *outlen = inlen;
+    return pstrndup(p, in, inlen);
+  }
+
+  /* Most strings, particularly paths, are plain ASCII; these are the same
+   * in both charsets, and so do not need to go through iconv(3).
+   */
+  if (ascii_passthrough &&
+      pr_encode_is_ascii(in, inlen) == TRUE) {
+    *outlen = inlen;
+    return pstrndup(p, in, inlen);
   }
 
   if (encode_conv == (iconv_t) -1) {
@@ -293,13 +357,11 @@ char *pr_encode_str(pool *p, const char *in, size_t inlen, size_t *outlen) {
     return pstrdup(p, in);
   }
 
-  inbuf = pcalloc(p, inlen);
-  memcpy(inbuf, in, inlen);
+  /* The input is only read by iconv(3), and so need not be copied. */
   inbuflen = inlen;
-
   outbuflen = sizeof(outbuf);
 
-  if (str_convert(encode_conv, inbuf, &inbuflen, outbuf, &outbuflen) < 0)
+  if (str_convert(encode_conv, in, &inbuflen, outbuf, &outbuflen) < 0)
     return NULL;
 
   *outlen = sizeof(outbuf) - outbuflen;
@@ -307,8 +369,9 @@ char *pr_encode_str(pool *p, const char *in, size_t inlen, size_t *outlen) {
   /* We allocate one byte more, for a terminating NUL. */
   outbufsz = sizeof(outbuf) - outbuflen + 1;
 
-  res = pcalloc(p, outbufsz);
+  res = palloc(p, outbufsz);
   memcpy(res, outbuf, *outlen);
+  res[*outlen] = '\0';
 
   return res;
 #else
@@ -318,6 +381,73 @@ char *pr_encode_str(pool *p, const char *in, size_t inlen, size_t *outlen) {
 #endif /* !HAVE_ICONV */
 }
 
+/* Every byte of a word has its high bit set in this mask, e.g.
+ * 0x8080808080808080 for 64-bit words.
+ */
+#define ENCODE_WORD_HIGH_BITS	((~0UL / 0xFF) * 0x80)
+
+int pr_encode_is_ascii(const char *in, size_t inlen) {
+  const unsigned char *ptr;
+
+  if (in == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ptr = (const unsigned char *) in;
+
+  /* Check a word's worth of bytes at a time, once the pointer is aligned.
+   * This is the portable equivalent of a vectorized high-bit test, and is
+   * fast enough that paths are no longer dominated by the iconv(3) calls.
+   */
+  while (inlen > 0 &&
+         ((unsigned long) ptr % sizeof(unsigned long)) != 0) {
+    if (*ptr & 0x80) {
+      return FALSE;
+    }
+
+    ptr++;
+    inlen--;
+  }
+
+  while (inlen >= sizeof(unsigned long)) {
+    unsigned long word;
+
+    memcpy(&word, ptr, sizeof(word));
+    if (word & ENCODE_WORD_HIGH_BITS) {
+      return FALSE;
+    }
+
+    ptr += sizeof(unsigned long);
+    inlen -= sizeof(unsigned long);
+  }
+
+  while (inlen > 0) {
+    if (*ptr & 0x80) {
+      return FALSE;
+    }
+
+    ptr++;
+    inlen--;
+  }
+
+  return TRUE;
+}
+
+int pr_encode_supports_ascii(void) {
+#ifdef HAVE_ICONV
+  /* No conversion at all is done if there are no conversion handles. */
+  if (encode_conv == (iconv_t) -1 &&
+      decode_conv == (iconv_t) -1) {
+    return TRUE;
+  }
+
+  return ascii_passthrough;
+#else
+  return TRUE;
+#endif /* !HAVE_ICONV */
+}
+
 void pr_encode_disable_encoding(void) {
 #ifdef HAVE_ICONV_H
   pr_trace_msg(trace_channel, 8, "%s encoding disabled", encoding);
@@ -55,6 +55,22 @@
 # include <acl/libacl.h>
 #endif
 
+#ifdef HAVE_SYS_IOCTL_H
+# include <sys/ioctl.h>
+#endif
+
+/* The reflink ioctl, from <linux/fs.h>, which cannot be included alongside
+ * <sys/mount.h>.
+ */
+#if defined(LINUX) && !defined(FICLONE) && defined(_IOW)
+# define FICLONE	_IOW(0x94, 9, int)
+#endif
+
+/* How much data to copy per copy_file_range(2) call; it is done in chunks
+ * so that signals can be handled during large copies.
+ */
+#define FS_COPY_CHUNKSZ		(64 * 1024 * 1024)
+
 /* For determining whether a file is on an NFS filesystem.  Note that
  * this value is Linux specific.  See Bug#3874 for details.
  */
@@ -108,6 +124,17 @@ static int use_mkdtemp = FALSE;
 /* Runtime enabling/disabling of encoding of paths. */
 static int use_encoding = TRUE;
 
+/* Runtime enabling/disabling of the use of openat(2) et al, relative to a
+ * descriptor for the directory last changed into, for absolute paths under
+ * that directory.  The descriptor is closed when the directory path may no
+ * longer refer to the same directory (e.g. after a rename), and reopened
+ * from the path on next use.
+ */
+static int use_openat = FALSE;
+static int cwd_fd = -1;
+static char cwd_fd_path[PR_TUNABLE_PATH_MAX + 1] = "";
+static size_t cwd_fd_pathlen = 0;
+
 /* Guard against attacks like "Roaring Beast" when we are chrooted.  See:
  *
  *  https://auscert.org.au/15286
@@ -155,10 +182,137 @@ static int chroot_allow_path(const char *path) {
   return res;
 }
 
+#ifdef HAVE_OPENAT
+static void fs_close_cwd_fd(void) {
+  if (cwd_fd >= 0) {
+    (void) close(cwd_fd);
+    cwd_fd = -1;
+  }
+}
+
+static void fs_clear_cwd_fd(void) {
+  fs_close_cwd_fd();
+  cwd_fd_path[0] = '\0';
+  cwd_fd_pathlen = 0;
+}
+
+/* Called once the process has changed into the given directory. */
+static void fs_set_cwd_fd(const char *path) {
+  size_t pathlen;
+
+  fs_clear_cwd_fd();
+
+  if (use_openat == FALSE ||
+      *path != '/') {
+    return;
+  }
+
+  pathlen = strlen(path);
+  if (pathlen >= sizeof(cwd_fd_path)) {
+    return;
+  }
+
+  /* Trailing slashes are dropped, except for the root directory. */
+  while (pathlen > 1 &&
+         path[pathlen-1] == '/') {
+    pathlen--;
+  }
+
+  cwd_fd = open(".", O_RDONLY|O_DIRECTORY);
+  if (cwd_fd < 0) {
+    pr_trace_msg(trace_channel, 3, "error opening directory '%s': %s", path,
+      strerror(errno));
+    return;
+  }
+
+  (void) fcntl(cwd_fd, F_SETFD, FD_CLOEXEC);
+
+  memcpy(cwd_fd_path, path, pathlen);
+  cwd_fd_path[pathlen] = '\0';
+  cwd_fd_pathlen = pathlen;
+}
+
+/* Returns TRUE if the given path has a ".." component. */
+static int fs_path_has_dotdot(const char *path) {
+  const char *ptr;
+
+  for (ptr = strstr(path, ".."); ptr != NULL; ptr = strstr(ptr + 2, "..")) {
+    if ((ptr == path || ptr[-1] == '/') &&
+        (ptr[2] == '\0' || ptr[2] == '/')) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* If the given absolute path lies beneath the directory for which we hold
+ * a descriptor, returns the path relative to that directory, for use with
+ * cwd_fd; returns NULL otherwise, including for any path with a ".."
+ * component.  The directory itself is never returned as "."; operations on
+ * it (e.g. rmdir) behave differently when relative.
+ */
+static const char *fs_cwd_relpath(const char *path) {
+  const char *relpath;
+
+  if (cwd_fd_pathlen == 0 ||
+      *path != '/') {
+    return NULL;
+  }
+
+  relpath = path;
+  if (cwd_fd_pathlen > 1) {
+    if (strncmp(path, cwd_fd_path, cwd_fd_pathlen) != 0 ||
+        path[cwd_fd_pathlen] != '/') {
+      return NULL;
+    }
+
+    relpath += cwd_fd_pathlen;
+  }
+
+  while (*relpath == '/') {
+    relpath++;
+  }
+
+  if (*relpath == '\0') {
+    return NULL;
+  }
+
+  /* A ".." component could lead back out of the directory (e.g. past a
+   * symlink, or to a directory which has since been renamed), so leave such
+   * paths to be resolved as given.
+   */
+  if (fs_path_has_dotdot(relpath) == TRUE) {
+    return NULL;
+  }
+
+  if (cwd_fd < 0) {
+    cwd_fd = open(cwd_fd_path, O_RDONLY|O_DIRECTORY);
+    if (cwd_fd < 0) {
+      fs_clear_cwd_fd();
+      return NULL;
+    }
+
+    (void) fcntl(cwd_fd, F_SETFD, FD_CLOEXEC);
+  }
+
+  return relpath;
+}
+#endif /* HAVE_OPENAT */
+
 /* The following static functions are simply wrappers for system functions
  */
 
 static int sys_stat(pr_fs_t *fs, const char *path, struct stat *sbuf) {
+#ifdef HAVE_OPENAT
+  const char *relpath;
+
+  relpath = fs_cwd_relpath(path);
+  if (relpath != NULL) {
+    return fstatat(cwd_fd, relpath, sbuf, 0);
+  }
+#endif /* HAVE_OPENAT */
+
   return stat(path, sbuf);
 }
 
@@ -167,6 +321,15 @@ static int sys_fstat(pr_fh_t *fh, int fd, struct stat *sbuf) {
 }
 
 static int sys_lstat(pr_fs_t *fs, const char *path, struct stat *sbuf) {
+#ifdef HAVE_OPENAT
+  const char *relpath;
+
+  relpath = fs_cwd_relpath(path);
+  if (relpath != NULL) {
+    return fstatat(cwd_fd, relpath, sbuf, AT_SYMLINK_NOFOLLOW);
+  }
+#endif /* HAVE_OPENAT */
+
   return lstat(path, sbuf);
 }
 
@@ -185,7 +348,35 @@ static int sys_rename(pr_fs_t *fs, const char *rnfm, const char *rnto) {
     }
   }
 
+#ifdef HAVE_OPENAT
+  if (cwd_fd_pathlen > 0) {
+    const char *relfm, *relto;
+
+    relfm = fs_cwd_relpath(rnfm);
+    relto = fs_cwd_relpath(rnto);
+
+    if (relfm != NULL ||
+        relto != NULL) {
+      res = renameat(relfm ? cwd_fd : AT_FDCWD, relfm ? relfm : rnfm,
+        relto ? cwd_fd : AT_FDCWD, relto ? relto : rnto);
+
+      /* A renamed directory may be (or contain) our directory. */
+      if (res == 0) {
+        fs_close_cwd_fd();
+      }
+
+      return res;
+    }
+  }
+#endif /* HAVE_OPENAT */
+
   res = rename(rnfm, rnto);
+#ifdef HAVE_OPENAT
+  if (res == 0) {
+    fs_close_cwd_fd();
+  }
+#endif /* HAVE_OPENAT */
+
   return res;
 }
 
@@ -199,6 +390,17 @@ static int sys_unlink(pr_fs_t *fs, const char *path) {
     }
   }
 
+#ifdef HAVE_OPENAT
+  {
+    const char *relpath;
+
+    relpath = fs_cwd_relpath(path);
+    if (relpath != NULL) {
+      return unlinkat(cwd_fd, relpath, 0);
+    }
+  }
+#endif /* HAVE_OPENAT */
+
   res = unlink(path);
   return res;
 }
@@ -223,6 +425,17 @@ static int sys_open(pr_fh_t *fh, const char *path, int flags) {
     }
   }
 
+#ifdef HAVE_OPENAT
+  {
+    const char *relpath;
+
+    relpath = fs_cwd_relpath(path);
+    if (relpath != NULL) {
+      return openat(cwd_fd, relpath, flags, PR_OPEN_MODE);
+    }
+  }
+#endif /* HAVE_OPENAT */
+
   res = open(path, flags, PR_OPEN_MODE);
   return res;
 }
@@ -237,6 +450,17 @@ static int sys_creat(pr_fh_t *fh, const char *path, mode_t mode) {
     }
   }
 
+#ifdef HAVE_OPENAT
+  {
+    const char *relpath;
+
+    relpath = fs_cwd_relpath(path);
+    if (relpath != NULL) {
+      return openat(cwd_fd, relpath, O_CREAT|O_WRONLY|O_TRUNC, mode);
+    }
+  }
+#endif /* HAVE_OPENAT */
+
   res = creat(path, mode);
   return res;
 }
@@ -287,6 +511,15 @@ static int sys_symlink(pr_fs_t *fs, const char *path1, const char *path2) {
 
 static int sys_readlink(pr_fs_t *fs, const char *path, char *buf,
     size_t buflen) {
+#ifdef HAVE_OPENAT
+  const char *relpath;
+
+  relpath = fs_cwd_relpath(path);
+  if (relpath != NULL) {
+    return readlinkat(cwd_fd, relpath, buf, buflen);
+  }
+#endif /* HAVE_OPENAT */
+
   return readlink(path, buf, buflen);
 }
 
@@ -318,6 +551,17 @@ static int sys_chmod(pr_fs_t *fs, const char *path, mode_t mode) {
     }
   }
 
+#ifdef HAVE_OPENAT
+  {
+    const char *relpath;
+
+    relpath = fs_cwd_relpath(path);
+    if (relpath != NULL) {
+      return fchmodat(cwd_fd, relpath, mode, 0);
+    }
+  }
+#endif /* HAVE_OPENAT */
+
   res = chmod(path, mode);
   return res;
 }
@@ -336,6 +580,17 @@ static int sys_chown(pr_fs_t *fs, const char *path, uid_t uid, gid_t gid) {
     }
   }
 
+#ifdef HAVE_OPENAT
+  {
+    const char *relpath;
+
+    relpath = fs_cwd_relpath(path);
+    if (relpath != NULL) {
+      return fchownat(cwd_fd, relpath, uid, gid, 0);
+    }
+  }
+#endif /* HAVE_OPENAT */
+
   res = chown(path, uid, gid);
   return res;
 }
@@ -354,6 +609,17 @@ static int sys_lchown(pr_fs_t *fs, const char *path, uid_t uid, gid_t gid) {
     }
   }
 
+#ifdef HAVE_OPENAT
+  {
+    const char *relpath;
+
+    relpath = fs_cwd_relpath(path);
+    if (relpath != NULL) {
+      return fchownat(cwd_fd, relpath, uid, gid, AT_SYMLINK_NOFOLLOW);
+    }
+  }
+#endif /* HAVE_OPENAT */
+
   res = lchown(path, uid, gid);
   return res;
 }
@@ -364,13 +630,24 @@ static int sys_lchown(pr_fs_t *fs, const char *path, uid_t uid, gid_t gid) {
  */
 static int sys_access(pr_fs_t *fs, const char *path, int mode, uid_t uid,
     gid_t gid, array_header *suppl_gids) {
-  mode_t mask;
   struct stat st;
 
   pr_fs_clear_cache();
   if (pr_fsio_stat(path, &st) < 0)
     return -1;
 
+  return pr_fs_check_access(&st, mode, uid, gid, suppl_gids);
+}
+
+int pr_fs_check_access(struct stat *st, int mode, uid_t uid, gid_t gid,
+    array_header *suppl_gids) {
+  mode_t mask;
+
+  if (st == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
   /* Root always succeeds. */
   if (uid == PR_ROOT_UID)
     return 0;
@@ -383,14 +660,14 @@ static int sys_access(pr_fs_t *fs, const char *path, int mode, uid_t uid,
    */
   mask = S_IROTH|S_IWOTH|S_IXOTH;
 
-  if (st.st_uid == uid)
+  if (st->st_uid == uid)
     mask |= S_IRUSR|S_IWUSR|S_IXUSR;
 
   /* Check the current group, as well as all supplementary groups.
    * Fortunately, we have this information cached, so accessing it is
    * almost free.
    */
-  if (st.st_gid == gid) {
+  if (st->st_gid == gid) {
     mask |= S_IRGRP|S_IWGRP|S_IXGRP;
 
   } else {
@@ -398,7 +675,7 @@ static int sys_access(pr_fs_t *fs, const char *path, int mode, uid_t uid,
       register unsigned int i = 0;
 
       for (i = 0; i < suppl_gids->nelts; i++) {
-        if (st.st_gid == ((gid_t *) suppl_gids->elts)[i]) {
+        if (st->st_gid == ((gid_t *) suppl_gids->elts)[i]) {
           mask |= S_IRGRP|S_IWGRP|S_IXGRP;
           break;
         }
@@ -406,7 +683,7 @@ static int sys_access(pr_fs_t *fs, const char *path, int mode, uid_t uid,
     }
   }
 
-  mask &= st.st_mode;
+  mask &= st->st_mode;
 
   /* Perform requested access checks. */
   if (mode & R_OK) {
@@ -473,10 +750,66 @@ static int sys_futimes(pr_fh_t *fh, int fd, struct timeval *tvs) {
 #endif
 }
 
+static int sys_fcopy(pr_fh_t *src_fh, int src_fd, pr_fh_t *dst_fh,
+    int dst_fd) {
+#if defined(FICLONE)
+  /* On filesystems such as Btrfs and XFS, the destination can share the
+   * source's data blocks; this is a metadata-only operation, regardless of
+   * the size of the file.
+   */
+  if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+    pr_trace_msg(trace_channel, 9, "cloned '%s' to '%s'", src_fh->fh_path,
+      dst_fh->fh_path);
+    return 0;
+  }
+
+  pr_trace_msg(trace_channel, 9, "unable to clone '%s' to '%s': %s",
+    src_fh->fh_path, dst_fh->fh_path, strerror(errno));
+#endif /* FICLONE */
+
+#if defined(HAVE_COPY_FILE_RANGE)
+  while (TRUE) {
+    ssize_t res;
+
+    pr_signals_handle();
+
+    res = copy_file_range(src_fd, NULL, dst_fd, NULL, FS_COPY_CHUNKSZ, 0);
+    if (res < 0) {
+      int xerrno = errno;
+
+      if (xerrno == EINTR) {
+        continue;
+      }
+
+      pr_trace_msg(trace_channel, 9,
+        "unable to copy_file_range '%s' to '%s': %s", src_fh->fh_path,
+        dst_fh->fh_path, strerror(xerrno));
+
+      errno = xerrno;
+      return -1;
+    }
+
+    if (res == 0) {
+      pr_trace_msg(trace_channel, 9, "used copy_file_range to copy '%s' to "
+        "'%s'", src_fh->fh_path, dst_fh->fh_path);
+      return 0;
+    }
+  }
+#endif /* HAVE_COPY_FILE_RANGE */
+
+  errno = ENOSYS;
+  return -1;
+}
+
 static int sys_chroot(pr_fs_t *fs, const char *path) {
   if (chroot(path) < 0)
     return -1;
 
+#ifdef HAVE_OPENAT
+  /* Our directory path no longer means the same thing. */
+  fs_clear_cwd_fd();
+#endif /* HAVE_OPENAT */
+
   session.chroot_path = (char *) path;
   return 0;
 }
@@ -486,6 +819,11 @@ static int sys_chdir(pr_fs_t *fs, const char *path) {
     return -1;
 
   pr_fs_setcwd(path);
+
+#ifdef HAVE_OPENAT
+  fs_set_cwd_fd(path);
+#endif /* HAVE_OPENAT */
+
   return 0;
 }
 
@@ -511,6 +849,17 @@ static int sys_mkdir(pr_fs_t *fs, const char *path, mode_t mode) {
     }
   }
 
+#ifdef HAVE_OPENAT
+  {
+    const char *relpath;
+
+    relpath = fs_cwd_relpath(path);
+    if (relpath != NULL) {
+      return mkdirat(cwd_fd, relpath, mode);
+    }
+  }
+#endif /* HAVE_OPENAT */
+
   res = mkdir(path, mode);
   return res;
 }
@@ -525,7 +874,25 @@ static int sys_rmdir(pr_fs_t *fs, const char *path) {
     }
   }
 
+#ifdef HAVE_OPENAT
+  {
+    const char *relpath;
+
+    relpath = fs_cwd_relpath(path);
+    if (relpath != NULL) {
+      return unlinkat(cwd_fd, relpath, AT_REMOVEDIR);
+    }
+  }
+#endif /* HAVE_OPENAT */
+
   res = rmdir(path);
+#ifdef HAVE_OPENAT
+  /* The removed directory may have been our directory. */
+  if (res == 0) {
+    fs_close_cwd_fd();
+  }
+#endif /* HAVE_OPENAT */
+
   return res;
 }
 
@@ -745,6 +1112,14 @@ static pr_fs_t *lookup_file_fs(const char *path, char **deref, int op) {
       struct stat sbuf;
       int (*mystat)(pr_fs_t *, const char *, struct stat *) = NULL;
 
+      /* With no filesystems registered, every path maps to the root FS; no
+       * need to check whether this path is a symlink pointing elsewhere.
+       */
+      if (fs == root_fs &&
+          (fs_map == NULL || fs_map->nelts == 0)) {
+        return fs;
+      }
+
       /* Determine which function to use, stat() or lstat(). */
       if (op == FSIO_FILE_STAT) {
         while (fs && fs->fs_next && !fs->stat) {
@@ -841,7 +1216,7 @@ int pr_fs_copy_file(const char *src, const char *dst) {
   struct stat src_st, dst_st;
   char *buf;
   size_t bufsz;
-  int dst_existed = FALSE, res;
+  int copied = FALSE, dst_existed = FALSE, res;
 
   if (src == NULL ||
       dst == NULL) {
@@ -952,13 +1327,6 @@ int pr_fs_copy_file(const char *src, const char *dst) {
     }
   }
 
-  bufsz = src_st.st_blksize;
-  buf = malloc(bufsz);
-  if (buf == NULL) {
-    pr_log_pri(PR_LOG_ALERT, "Out of memory!");
-    exit(1);
-  }
-
 #ifdef S_ISFIFO
   if (!S_ISFIFO(dst_st.st_mode)) {
     /* Make sure the destination file starts with a zero size. */
@@ -966,53 +1334,71 @@ int pr_fs_copy_file(const char *src, const char *dst) {
   }
 #endif
 
-  while ((res = pr_fsio_read(src_fh, buf, bufsz)) > 0) {
-    size_t datalen;
-    off_t offset;
+  /* Let the filesystem copy regular files itself, if it can (e.g. using
+   * reflinks); otherwise, copy the (remaining) data through our buffer.
+   */
+  if (S_ISREG(src_st.st_mode) &&
+      S_ISREG(dst_st.st_mode) &&
+      pr_fsio_fcopy(src_fh, dst_fh) == 0) {
+    copied = TRUE;
+  }
+
+  if (copied == FALSE) {
+    bufsz = src_st.st_blksize;
+    buf = malloc(bufsz);
+    if (buf == NULL) {
+      pr_log_pri(PR_LOG_ALERT, "Out of memory!");
+      exit(1);
+    }
 
-    pr_signals_handle();
+    while ((res = pr_fsio_read(src_fh, buf, bufsz)) > 0) {
+      size_t datalen;
+      off_t offset;
 
-    /* Be sure to handle short writes. */
-    datalen = res;
-    offset = 0;
+      pr_signals_handle();
 
-    while (datalen > 0) {
-      res = pr_fsio_write(dst_fh, buf + offset, datalen);
-      if (res < 0) {
-        int xerrno = errno;
+      /* Be sure to handle short writes. */
+      datalen = res;
+      offset = 0;
 
-        if (xerrno == EINTR ||
-            xerrno == EAGAIN) {
-          pr_signals_handle();
-          continue;
-        }
+      while (datalen > 0) {
+        res = pr_fsio_write(dst_fh, buf + offset, datalen);
+        if (res < 0) {
+          int xerrno = errno;
 
-        pr_fsio_close(src_fh);
-        pr_fsio_close(dst_fh);
+          if (xerrno == EINTR ||
+              xerrno == EAGAIN) {
+            pr_signals_handle();
+            continue;
+          }
 
-        if (!dst_existed) {
-          /* Don't unlink the destination file if it already existed. */
-          pr_fsio_unlink(dst);
-        }
+          pr_fsio_close(src_fh);
+          pr_fsio_close(dst_fh);
 
-        pr_log_pri(PR_LOG_WARNING, "error copying to '%s': %s", dst,
-          strerror(xerrno));
-        free(buf);
+          if (!dst_existed) {
+            /* Don't unlink the destination file if it already existed. */
+            pr_fsio_unlink(dst);
+          }
 
-        errno = xerrno;
-        return -1;
-      }
+          pr_log_pri(PR_LOG_WARNING, "error copying to '%s': %s", dst,
+            strerror(xerrno));
+          free(buf);
 
-      if (res == datalen) {
-        break;
-      }
+          errno = xerrno;
+          return -1;
+        }
 
-      offset += res;
-      datalen -= res;
+        if (res == datalen) {
+          break;
+        }
+
+        offset += res;
+        datalen -= res;
+      }
     }
-  }
 
-  free(buf);
+    free(buf);
+  }
 
 #if defined(HAVE_POSIX_ACL) && defined(PR_USE_FACL)
   {
@@ -1186,6 +1572,9 @@ int pr_insert_fs(pr_fs_t *fs, const char *path) {
     fs_map = make_array(map_pool, 0, sizeof(pr_fs_t *));
   }
 
+  /* Paths may now be handled by a different FS. */
+  pr_fs_clear_resolve_cache();
+
   /* Clean the path, but only if it starts with a '/'.  Non-local-filesystem
    * paths may not want/need to be cleaned.
    */
@@ -1277,6 +1666,9 @@ pr_fs_t *pr_unmount_fs(const char *path, const char *name) {
     return NULL;
   }
 
+  /* Paths may now be handled by a different FS. */
+  pr_fs_clear_resolve_cache();
+
   fs_objs = (pr_fs_t **) fs_map->elts;
 
   for (i = 0; i < fs_map->nelts; i++) {
@@ -1698,9 +2090,8 @@ const char *pr_fs_getvwd(void) {
 }
 
 int pr_fs_dircat(char *buf, int buflen, const char *dir1, const char *dir2) {
-  /* Make temporary copies so that memory areas can overlap */
-  char *_dir1 = NULL, *_dir2 = NULL, *ptr = NULL;
-  size_t dir1len = 0, dir2len = 0;
+  char tmp[PR_TUNABLE_PATH_MAX + 1];
+  size_t dir1len = 0, dir2len = 0, tmplen = 0;
 
   /* The shortest possible path is "/", which requires 2 bytes. */
 
@@ -1747,51 +2138,30 @@ int pr_fs_dircat(char *buf, int buflen, const char *dir1, const char *dir2) {
     return -1;
   }
 
-  _dir1 = strdup(dir1);
-  if (_dir1 == NULL) {
-    return -1;
-  }
-
-  _dir2 = strdup(dir2);
-  if (_dir2 == NULL) {
-    int xerrno = errno;
-
-    free(_dir1);
-
-    errno = xerrno;
-    return -1;
-  }
+  /* Assemble the path in a local buffer, so that buf may overlap either of
+   * the given directories.
+   */
+  if (*dir2 == '/') {
+    memcpy(tmp, dir2, dir2len + 1);
 
-  if (*_dir2 == '/') {
-    sstrncpy(buf, _dir2, buflen);
-    free(_dir1);
-    free(_dir2);
-    return 0;
-  }
+  } else {
+    memcpy(tmp, dir1, dir1len);
+    tmplen = dir1len;
 
-  ptr = buf;
-  sstrncpy(ptr, _dir1, buflen);
-  ptr += dir1len;
-  buflen -= dir1len;
+    if (dir1[dir1len-1] != '/') {
+      tmp[tmplen++] = '/';
+    }
 
-  if (buflen > 0 &&
-      dir1len >= 1 &&
-      *(_dir1 + (dir1len-1)) != '/') {
-    sstrcat(ptr, "/", buflen);
-    ptr += 1;
-    buflen -= 1;
+    memcpy(tmp + tmplen, dir2, dir2len + 1);
   }
 
-  sstrcat(ptr, _dir2, buflen);
+  sstrncpy(buf, tmp, buflen);
 
   if (*buf == '\0') {
    *buf++ = '/';
    *buf = '\0';
   }
 
-  free(_dir1);
-  free(_dir2);
-
   return 0;
 }
 
@@ -1933,43 +2303,27 @@ int pr_fs_interpolate(const char *path, char *buf, size_t buflen) {
   return 1;
 }
 
-int pr_fs_resolve_partial(const char *path, char *buf, size_t buflen, int op) {
-  char curpath[PR_TUNABLE_PATH_MAX + 1]  = {'\0'},
-       workpath[PR_TUNABLE_PATH_MAX + 1] = {'\0'},
-       namebuf[PR_TUNABLE_PATH_MAX + 1]  = {'\0'},
-       *where = NULL, *ptr = NULL, *last = NULL;
+/* Resolves the path in curpath, relative to the already resolved directory
+ * in workpath, following any symlinks; the result is left in workpath.  Both
+ * are PR_TUNABLE_PATH_MAX+1 byte buffers, and are modified in place.  If
+ * is_dir is not NULL, it is set to whether the result is a directory.
+ *
+ * The FSIO_RESOLVE_FL_PARTIAL flag selects the pr_fs_resolve_partial()
+ * behavior: a trailing ".." is handled, and the errno from a failed
+ * lstat(2) is preserved, rather than being reported as ENOENT.
+ */
+#define FSIO_RESOLVE_FL_PARTIAL		0x001
 
+static int fs_resolve_loop(char *curpath, char *workpath, int op, int flags,
+    int *is_dir) {
+  char namebuf[PR_TUNABLE_PATH_MAX + 1] = {'\0'},
+       *where = NULL, *ptr = NULL, *last = NULL;
   pr_fs_t *fs = NULL;
-  int len = 0, fini = 1, link_cnt = 0;
+  int len = 0, fini = 1, link_cnt = 0, dir = TRUE;
   ino_t prev_inode = 0;
   dev_t prev_device = 0;
   struct stat sbuf;
 
-  if (!path) {
-    errno = EINVAL;
-    return -1;
-  }
-
-  if (*path != '/') {
-    if (*path == '~') {
-      switch (pr_fs_interpolate(path, curpath, sizeof(curpath)-1)) {
-      case -1:
-        return -1;
-
-      case 0:
-        sstrncpy(curpath, path, sizeof(curpath));
-        sstrncpy(workpath, cwd, sizeof(workpath));
-        break;
-      }
-
-    } else {
-      sstrncpy(curpath, path, sizeof(curpath));
-      sstrncpy(workpath, cwd, sizeof(workpath));
-    }
-
-  } else
-    sstrncpy(curpath, path, sizeof(curpath));
-
   while (fini--) {
     where = curpath;
 
@@ -1983,7 +2337,8 @@ int pr_fs_resolve_partial(const char *path, char *buf, size_t buflen, int op) {
       }
 
       /* Handle ".." */
-      if (strncmp(where, "..", 3) == 0) {
+      if ((flags & FSIO_RESOLVE_FL_PARTIAL) &&
+          strncmp(where, "..", 3) == 0) {
         where += 2;
         ptr = last = workpath;
 
@@ -1994,6 +2349,7 @@ int pr_fs_resolve_partial(const char *path, char *buf, size_t buflen, int op) {
         }
 
         *last = '\0';
+        dir = TRUE;
         continue;
       }
 
@@ -2015,6 +2371,7 @@ int pr_fs_resolve_partial(const char *path, char *buf, size_t buflen, int op) {
         }
 
         *last = '\0';
+        dir = TRUE;
         continue;
       }
 
@@ -2047,8 +2404,13 @@ int pr_fs_resolve_partial(const char *path, char *buf, size_t buflen, int op) {
 
       fs = lookup_dir_fs(namebuf, op);
 
-      if (fs_cache_lstat(fs, namebuf, &sbuf) == -1)
+      if (fs_cache_lstat(fs, namebuf, &sbuf) == -1) {
+        if (!(flags & FSIO_RESOLVE_FL_PARTIAL)) {
+          errno = ENOENT;
+        }
+
         return -1;
+      }
 
       if (S_ISLNK(sbuf.st_mode)) {
         char linkpath[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
@@ -2097,13 +2459,14 @@ int pr_fs_resolve_partial(const char *path, char *buf, size_t buflen, int op) {
           sstrcat(linkpath, where, sizeof(linkpath)-1);
         }
 
-        sstrncpy(curpath, linkpath, sizeof(curpath));
+        sstrncpy(curpath, linkpath, PR_TUNABLE_PATH_MAX + 1);
         fini++;
         break; /* continue main loop */
       }
 
       if (S_ISDIR(sbuf.st_mode)) {
-        sstrncpy(workpath, namebuf, sizeof(workpath));
+        sstrncpy(workpath, namebuf, PR_TUNABLE_PATH_MAX + 1);
+        dir = TRUE;
         continue;
       }
 
@@ -2112,175 +2475,209 @@ int pr_fs_resolve_partial(const char *path, char *buf, size_t buflen, int op) {
         return -1;               /* path/notadir/morepath */
 
       } else {
-        sstrncpy(workpath, namebuf, sizeof(workpath));
+        sstrncpy(workpath, namebuf, PR_TUNABLE_PATH_MAX + 1);
+        dir = FALSE;
       }
     }
   }
 
-  if (!workpath[0])
-    sstrncpy(workpath, "/", sizeof(workpath));
-
-  sstrncpy(buf, workpath, buflen);
+  if (is_dir != NULL) {
+    *is_dir = dir;
+  }
 
   return 0;
 }
 
-int pr_fs_resolve_path(const char *path, char *buf, size_t buflen, int op) {
-  char curpath[PR_TUNABLE_PATH_MAX + 1]  = {'\0'},
-       workpath[PR_TUNABLE_PATH_MAX + 1] = {'\0'},
-       namebuf[PR_TUNABLE_PATH_MAX + 1]  = {'\0'},
-       *where = NULL, *ptr = NULL, *last = NULL;
-
-  pr_fs_t *fs = NULL;
-
-  int len = 0, fini = 1, link_cnt = 0;
-  ino_t prev_inode = 0;
-  dev_t prev_device = 0;
-  struct stat sbuf;
-
-  if (!path) {
-    errno = EINVAL;
-    return -1;
-  }
-
-  if (pr_fs_interpolate(path, curpath, sizeof(curpath)-1) != -1)
-    sstrncpy(curpath, path, sizeof(curpath));
-
-  if (curpath[0] != '/')
-    sstrncpy(workpath, cwd, sizeof(workpath));
-  else
-    workpath[0] = '\0';
-
-  while (fini--) {
-    where = curpath;
-
-    while (*where != '\0') {
-      pr_signals_handle();
-
-      if (strncmp(where, ".", 2) == 0) {
-        where++;
-        continue;
-      }
+/* Resolved directory cache.
+ *
+ * Resolving a path costs an lstat(2) per component, and the same directory
+ * prefixes are resolved repeatedly: several times for each path-based
+ * command, and once per entry when listing a directory.  The resolved
+ * directory part of each path is thus cached, keyed by how the path was
+ * resolved: the resolve flags and op, the starting directory (e.g. the
+ * cwd), and the unresolved directory part itself.  Only directories which
+ * resolved successfully are cached.
+ *
+ * Changes made to the filesystem by other processes are not seen here, so
+ * the cache is cleared for each command (see pr_fs_clear_resolve_cache()),
+ * as well as whenever this process renames or removes a path, or changes
+ * its root or FS map.  The daemon clears it on restart, too (see mod_core).
+ */
+#define FSIO_RESOLVE_CACHE_SIZE		64
 
-      /* handle "./" */
-      if (strncmp(where, "./", 2) == 0) {
-        where += 2;
-        continue;
-      }
+struct fs_resolve_ent {
+  unsigned int hash;
+  size_t keylen;
+  char *key;
+  char *path;
+};
 
-      /* handle "../" */
-      if (strncmp(where, "../", 3) == 0) {
-        where += 3;
-        ptr = last = workpath;
-        while (*ptr) {
-          if (*ptr == '/')
-            last = ptr;
-          ptr++;
-        }
+static pool *resolve_pool = NULL;
+static struct fs_resolve_ent resolve_cache[FSIO_RESOLVE_CACHE_SIZE];
+static unsigned int resolve_nents = 0;
 
-        *last = '\0';
-        continue;
-      }
+static unsigned int fs_resolve_hash(const char *key, size_t keylen) {
+  register unsigned int i;
+  unsigned int hash = 2166136261U;
 
-      ptr = strchr(where, '/');
+  for (i = 0; i < keylen; i++) {
+    hash ^= (unsigned char) key[i];
+    hash *= 16777619U;
+  }
 
-      if (!ptr) {
-        size_t wherelen = strlen(where);
+  return hash;
+}
 
-        ptr = where;
-        if (wherelen >= 1)
-          ptr += (wherelen - 1);
+void pr_fs_clear_resolve_cache(void) {
+  if (resolve_pool != NULL) {
+    destroy_pool(resolve_pool);
+    resolve_pool = NULL;
 
-      } else
-        *ptr = '\0';
+    memset(resolve_cache, 0, sizeof(resolve_cache));
+    resolve_nents = 0;
+  }
+}
 
-      sstrncpy(namebuf, workpath, sizeof(namebuf));
+static const char *fs_resolve_cache_get(const char *key, size_t keylen,
+    unsigned int hash) {
+  struct fs_resolve_ent *ent;
 
-      if (*namebuf) {
-        for (last = namebuf; *last; last++);
+  ent = &(resolve_cache[hash % FSIO_RESOLVE_CACHE_SIZE]);
+  if (ent->key != NULL &&
+      ent->hash == hash &&
+      ent->keylen == keylen &&
+      memcmp(ent->key, key, keylen) == 0) {
+    return ent->path;
+  }
 
-        if (*--last != '/')
-          sstrcat(namebuf, "/", sizeof(namebuf)-1);
+  return NULL;
+}
 
-      } else
-        sstrcat(namebuf, "/", sizeof(namebuf)-1);
+static void fs_resolve_cache_add(const char *key, size_t keylen,
+    unsigned int hash, const char *path) {
+  struct fs_resolve_ent *ent;
 
-      sstrcat(namebuf, where, sizeof(namebuf)-1);
+  /* Replaced entries are not freed individually; bound the memory used by
+   * starting over once enough entries have been added.
+   */
+  if (resolve_nents >= (FSIO_RESOLVE_CACHE_SIZE * 4)) {
+    pr_fs_clear_resolve_cache();
+  }
 
-      where = ++ptr;
+  if (resolve_pool == NULL) {
+    resolve_pool = make_sub_pool(NULL);
+    pr_pool_tag(resolve_pool, "FSIO Resolve Cache Pool");
+  }
 
-      fs = lookup_dir_fs(namebuf, op);
+  ent = &(resolve_cache[hash % FSIO_RESOLVE_CACHE_SIZE]);
+  ent->hash = hash;
+  ent->keylen = keylen;
+  ent->key = palloc(resolve_pool, keylen);
+  memcpy(ent->key, key, keylen);
+  ent->path = pstrdup(resolve_pool, path);
 
-      if (fs_cache_lstat(fs, namebuf, &sbuf) == -1) {
-        errno = ENOENT;
-        return -1;
-      }
+  resolve_nents++;
+}
 
-      if (S_ISLNK(sbuf.st_mode)) {
-        char linkpath[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
+/* Resolves curpath relative to workpath (see fs_resolve_loop()), using the
+ * cached resolution of the directory part of curpath, if there is one.
+ */
+static int fs_resolve(char *curpath, char *workpath, int op, int flags) {
+  char key[(PR_TUNABLE_PATH_MAX * 2) + 32], dirpath[PR_TUNABLE_PATH_MAX + 1],
+    dirwork[PR_TUNABLE_PATH_MAX + 1];
+  const char *base, *cached;
+  size_t dirlen, worklen, keylen;
+  unsigned int hash;
+  int is_dir = FALSE, res;
+
+  /* Only paths with a directory part, and a final component which is not
+   * itself "." or "..", are split.  The directory part keeps its trailing
+   * slash, so that it is resolved exactly as it would be as part of the
+   * full path.
+   */
+  base = strrchr(curpath, '/');
+  if (base == NULL ||
+      base[1] == '\0' ||
+      strcmp(base + 1, ".") == 0 ||
+      strcmp(base + 1, "..") == 0) {
+    return fs_resolve_loop(curpath, workpath, op, flags, NULL);
+  }
 
-        /* Detect an obvious recursive symlink */
-        if (sbuf.st_ino && (ino_t) sbuf.st_ino == prev_inode &&
-            sbuf.st_dev && (dev_t) sbuf.st_dev == prev_device) {
-          errno = ELOOP;
-          return -1;
-        }
+  base++;
+  dirlen = base - curpath;
+  worklen = strlen(workpath);
 
-        prev_inode = (ino_t) sbuf.st_ino;
-        prev_device = (dev_t) sbuf.st_dev;
+  keylen = snprintf(key, sizeof(key), "%d:%d:", flags, op);
+  if (keylen + worklen + 1 + dirlen > sizeof(key)) {
+    return fs_resolve_loop(curpath, workpath, op, flags, NULL);
+  }
 
-        if (++link_cnt > PR_FSIO_MAX_LINK_COUNT) {
-          errno = ELOOP;
-          return -1;
-        }
+  memcpy(key + keylen, workpath, worklen + 1);
+  keylen += worklen + 1;
+  memcpy(key + keylen, curpath, dirlen);
+  keylen += dirlen;
 
-        len = pr_fsio_readlink(namebuf, linkpath, sizeof(linkpath)-1);
-        if (len <= 0) {
-          errno = ENOENT;
-          return -1;
-        }
+  hash = fs_resolve_hash(key, keylen);
 
-        *(linkpath+len) = '\0';
+  cached = fs_resolve_cache_get(key, keylen, hash);
+  if (cached != NULL) {
+    sstrncpy(workpath, cached, PR_TUNABLE_PATH_MAX + 1);
 
-        if (*linkpath == '/')
-          *workpath = '\0';
+  } else {
+    memcpy(dirpath, curpath, dirlen);
+    dirpath[dirlen] = '\0';
+    memcpy(dirwork, workpath, worklen + 1);
 
-        /* Trim any trailing slash. */
-        if (linkpath[len-1] == '/')
-          linkpath[len-1] = '\0';
+    res = fs_resolve_loop(dirpath, dirwork, op, flags, &is_dir);
+    if (res < 0) {
+      return -1;
+    }
 
-        if (*linkpath == '~') {
-          char tmpbuf[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
-          *workpath = '\0';
+    if (!is_dir) {
+      /* path/notadir/morepath */
+      errno = ENOENT;
+      return -1;
+    }
 
-          sstrncpy(tmpbuf, linkpath, sizeof(tmpbuf));
+    fs_resolve_cache_add(key, keylen, hash, dirwork);
+    memcpy(workpath, dirwork, strlen(dirwork) + 1);
+  }
 
-          if (pr_fs_interpolate(tmpbuf, linkpath, sizeof(linkpath)-1) == -1)
-	    return -1;
-        }
+  memmove(curpath, base, strlen(base) + 1);
+  return fs_resolve_loop(curpath, workpath, op, flags, NULL);
+}
 
-        if (*where) {
-          sstrcat(linkpath, "/", sizeof(linkpath)-1);
-          sstrcat(linkpath, where, sizeof(linkpath)-1);
-        }
+int pr_fs_resolve_partial(const char *path, char *buf, size_t buflen, int op) {
+  char curpath[PR_TUNABLE_PATH_MAX + 1]  = {'\0'},
+       workpath[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
 
-        sstrncpy(curpath, linkpath, sizeof(curpath));
-        fini++;
-        break; /* continue main loop */
-      }
+  if (!path) {
+    errno = EINVAL;
+    return -1;
+  }
 
-      if (S_ISDIR(sbuf.st_mode)) {
-        sstrncpy(workpath, namebuf, sizeof(workpath));
-        continue;
-      }
+  if (*path != '/') {
+    if (*path == '~') {
+      switch (pr_fs_interpolate(path, curpath, sizeof(curpath)-1)) {
+      case -1:
+        return -1;
 
-      if (*where) {
-        errno = ENOENT;
-        return -1;               /* path/notadir/morepath */
+      case 0:
+        sstrncpy(curpath, path, sizeof(curpath));
+        sstrncpy(workpath, cwd, sizeof(workpath));
+        break;
+      }
 
-      } else
-        sstrncpy(workpath, namebuf, sizeof(workpath));
+    } else {
+      sstrncpy(curpath, path, sizeof(curpath));
+      sstrncpy(workpath, cwd, sizeof(workpath));
     }
+
+  } else
+    sstrncpy(curpath, path, sizeof(curpath));
+
+  if (fs_resolve(curpath, workpath, op, FSIO_RESOLVE_FL_PARTIAL) < 0) {
+    return -1;
   }
 
   if (!workpath[0])
@@ -2291,126 +2688,143 @@ int pr_fs_resolve_path(const char *path, char *buf, size_t buflen, int op) {
   return 0;
 }
 
-int pr_fs_clean_path2(const char *path, char *buf, size_t buflen, int flags) {
-  char workpath[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
-  char curpath[PR_TUNABLE_PATH_MAX + 1]  = {'\0'};
-  char namebuf[PR_TUNABLE_PATH_MAX + 1]  = {'\0'};
-  int fini = 1, have_abs_path = FALSE;
+int pr_fs_resolve_path(const char *path, char *buf, size_t buflen, int op) {
+  char curpath[PR_TUNABLE_PATH_MAX + 1]  = {'\0'},
+       workpath[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
 
-  if (path == NULL ||
-      buf == NULL) {
+  if (!path) {
     errno = EINVAL;
     return -1;
   }
 
-  if (buflen == 0) {
-    return 0;
-  }
+  if (pr_fs_interpolate(path, curpath, sizeof(curpath)-1) != -1)
+    sstrncpy(curpath, path, sizeof(curpath));
 
-  sstrncpy(curpath, path, sizeof(curpath));
+  if (curpath[0] != '/')
+    sstrncpy(workpath, cwd, sizeof(workpath));
+  else
+    workpath[0] = '\0';
 
-  if (*curpath == '/') {
-    have_abs_path = TRUE;
+  if (fs_resolve(curpath, workpath, op, 0) < 0) {
+    return -1;
   }
 
-  /* main loop */
-  while (fini--) {
-    char *where = NULL, *ptr = NULL, *last = NULL;
+  if (!workpath[0])
+    sstrncpy(workpath, "/", sizeof(workpath));
 
-    where = curpath;
-    while (*where != '\0') {
-      pr_signals_handle();
+  sstrncpy(buf, workpath, buflen);
 
-      if (strncmp(where, ".", 2) == 0) {
-        where++;
-        continue;
-      }
+  return 0;
+}
 
-      /* handle "./" */
-      if (strncmp(where, "./", 2) == 0) {
-        where += 2;
-        continue;
-      }
+/* Appends len bytes of str to the path being built by pr_fs_clean_path2(),
+ * truncating it (as that function always has) at PR_TUNABLE_PATH_MAX-1 bytes.
+ */
+static void fs_clean_path_add(char *path, size_t *pathlen, const char *str,
+    size_t len) {
+  if (*pathlen + len > PR_TUNABLE_PATH_MAX - 1) {
+    len = (PR_TUNABLE_PATH_MAX - 1) - *pathlen;
+  }
 
-      /* handle ".." */
-      if (strncmp(where, "..", 3) == 0) {
-        where += 2;
-        ptr = last = workpath;
+  memcpy(path + *pathlen, str, len);
+  *pathlen += len;
+}
 
-        while (*ptr) {
-          pr_signals_handle();
+int pr_fs_clean_path2(const char *path, char *buf, size_t buflen, int flags) {
+  char workpath[PR_TUNABLE_PATH_MAX + 1];
+  const char *where, *end;
+  size_t pathlen, worklen = 0;
+  int have_abs_path = FALSE;
 
-          if (*ptr == '/') {
-            last = ptr;
-          }
+  if (path == NULL ||
+      buf == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
 
-          ptr++;
-        }
+  if (buflen == 0) {
+    return 0;
+  }
 
-        *last = '\0';
-        continue;
-      }
+  pathlen = strlen(path);
+  if (pathlen > PR_TUNABLE_PATH_MAX) {
+    pathlen = PR_TUNABLE_PATH_MAX;
+  }
 
-      /* handle "../" */
-      if (strncmp(where, "../", 3) == 0) {
-        where += 3;
-        ptr = last = workpath;
+  if (*path == '/') {
+    have_abs_path = TRUE;
+  }
 
-        while (*ptr) {
-          pr_signals_handle();
+  /* Make a single pass over the path, one component at a time, appending
+   * each to workpath; "." components and empty components (from "//") are
+   * dropped, and ".." components remove the preceding component.
+   */
+  where = path;
+  end = path + pathlen;
 
-          if (*ptr == '/') {
-            last = ptr;
-          }
-          ptr++;
-        }
+  while (where < end) {
+    const char *sep;
+    size_t remaining, complen;
 
-        *last = '\0';
-        continue;
-      }
+    remaining = end - where;
 
-      ptr = strchr(where, '/');
-      if (ptr == NULL) {
-        size_t wherelen = strlen(where);
+    /* Handle "." */
+    if (remaining == 1 &&
+        where[0] == '.') {
+      break;
+    }
 
-        ptr = where;
-        if (wherelen >= 1) {
-          ptr += (wherelen - 1);
-        }
+    /* Handle "./" */
+    if (where[0] == '.' &&
+        where[1] == '/') {
+      where += 2;
+      continue;
+    }
 
-      } else {
-        *ptr = '\0';
+    /* Handle ".." and "../" */
+    if (where[0] == '.' &&
+        remaining >= 2 &&
+        where[1] == '.' &&
+        (remaining == 2 || where[2] == '/')) {
+      size_t i = worklen;
+
+      /* Truncate workpath at its last slash. */
+      while (i > 0 &&
+             workpath[i-1] != '/') {
+        i--;
       }
 
-      sstrncpy(namebuf, workpath, sizeof(namebuf));
+      worklen = (i > 0 ? i - 1 : 0);
+      where += (remaining == 2 ? 2 : 3);
+      continue;
+    }
 
-      if (*namebuf) {
-        for (last = namebuf; *last; last++);
-        if (*--last != '/') {
-          sstrcat(namebuf, "/", sizeof(namebuf)-1);
-        }
+    sep = memchr(where, '/', remaining);
+    complen = (sep != NULL ? (size_t) (sep - where) : remaining);
 
-      } else {
-        if (have_abs_path ||
-            (flags & PR_FSIO_CLEAN_PATH_FL_MAKE_ABS_PATH)) {
-          sstrcat(namebuf, "/", sizeof(namebuf)-1);
-          have_abs_path = FALSE;
-        }
+    if (worklen > 0) {
+      if (workpath[worklen-1] != '/') {
+        fs_clean_path_add(workpath, &worklen, "/", 1);
       }
 
-      sstrcat(namebuf, where, sizeof(namebuf)-1);
-      namebuf[sizeof(namebuf)-1] = '\0';
-
-      where = ++ptr;
-
-      sstrncpy(workpath, namebuf, sizeof(workpath));
+    } else {
+      if (have_abs_path ||
+          (flags & PR_FSIO_CLEAN_PATH_FL_MAKE_ABS_PATH)) {
+        fs_clean_path_add(workpath, &worklen, "/", 1);
+        have_abs_path = FALSE;
+      }
     }
+
+    fs_clean_path_add(workpath, &worklen, where, complen);
+    where += complen + (sep != NULL ? 1 : 0);
   }
 
-  if (!workpath[0]) {
-    sstrncpy(workpath, "/", sizeof(workpath));
+  if (worklen == 0) {
+    workpath[worklen++] = '/';
   }
 
+  workpath[worklen] = '\0';
+
   sstrncpy(buf, workpath, buflen);
   return 0;
 }
@@ -2428,7 +2842,7 @@ int pr_fs_use_encoding(int bool) {
 
 char *pr_fs_decode_path(pool *p, const char *path) {
 #ifdef PR_USE_NLS
-  size_t outlen;
+  size_t outlen, pathlen;
   char *res;
 
   if (p == NULL ||
@@ -2441,7 +2855,14 @@ char *pr_fs_decode_path(pool *p, const char *path) {
     return (char *) path;
   }
 
-  res = pr_decode_str(p, path, strlen(path), &outlen);
+  /* A plain ASCII path is the same once decoded, and needs no copying. */
+  pathlen = strlen(path);
+  if (pr_encode_supports_ascii() == TRUE &&
+      pr_encode_is_ascii(path, pathlen) == TRUE) {
+    return (char *) path;
+  }
+
+  res = pr_decode_str(p, path, pathlen, &outlen);
   if (res == NULL) {
     pr_trace_msg("encode", 1, "error decoding path '%s': %s", path,
       strerror(errno));
@@ -2450,9 +2871,8 @@ char *pr_fs_decode_path(pool *p, const char *path) {
       /* Write out the path we tried (and failed) to decode, in hex. */
       register unsigned int i;
       unsigned char *raw_path;
-      size_t pathlen, raw_pathlen;
+      size_t raw_pathlen;
 
-      pathlen = strlen(path);
       raw_pathlen = (pathlen * 5) + 1;
       raw_path = pcalloc(p, raw_pathlen + 1);
 
@@ -2477,7 +2897,7 @@ char *pr_fs_decode_path(pool *p, const char *path) {
 
 char *pr_fs_encode_path(pool *p, const char *path) {
 #ifdef PR_USE_NLS
-  size_t outlen;
+  size_t outlen, pathlen;
   char *res;
 
   if (p == NULL ||
@@ -2490,7 +2910,14 @@ char *pr_fs_encode_path(pool *p, const char *path) {
     return (char *) path;
   }
 
-  res = pr_encode_str(p, path, strlen(path), &outlen);
+  /* A plain ASCII path is the same once encoded, and needs no copying. */
+  pathlen = strlen(path);
+  if (pr_encode_supports_ascii() == TRUE &&
+      pr_encode_is_ascii(path, pathlen) == TRUE) {
+    return (char *) path;
+  }
+
+  res = pr_encode_str(p, path, pathlen, &outlen);
   if (res == NULL) {
     pr_trace_msg("encode", 1, "error encoding path '%s': %s", path,
       strerror(errno));
@@ -2499,9 +2926,8 @@ char *pr_fs_encode_path(pool *p, const char *path) {
       /* Write out the path we tried (and failed) to encode, in hex. */
       register unsigned int i; 
       unsigned char *raw_path;
-      size_t pathlen, raw_pathlen;
+      size_t raw_pathlen;
       
-      pathlen = strlen(path);
       raw_pathlen = (pathlen * 5) + 1;
       raw_path = pcalloc(p, raw_pathlen + 1);
 
@@ -2919,6 +3345,21 @@ int pr_fsio_guard_chroot(int guard) {
   return prev;
 }
 
+int pr_fsio_set_use_openat(int value) {
+  int prev_value;
+
+  prev_value = use_openat;
+
+#ifdef HAVE_OPENAT
+  use_openat = value;
+  if (use_openat == FALSE) {
+    fs_clear_cwd_fd();
+  }
+#endif /* HAVE_OPENAT */
+
+  return prev_value;
+}
+
 int pr_fsio_set_use_mkdtemp(int value) {
   int prev_value;
 
@@ -3370,6 +3811,9 @@ int pr_fsio_rmdir(const char *path) {
   pr_trace_msg(trace_channel, 8, "using %s rmdir() for path '%s'", fs->fs_name,
     path);
   res = (fs->rmdir)(fs, path);
+  if (res == 0) {
+    pr_fs_clear_resolve_cache();
+  }
 
   return res;
 }
@@ -3551,6 +3995,9 @@ int pr_fsio_rename_canon(const char *rfrom, const char *rto) {
   pr_trace_msg(trace_channel, 8, "using %s rename() for paths '%s', '%s'",
     fs->fs_name, rfrom, rto);
   res = (fs->rename)(fs, rfrom, rto);
+  if (res == 0) {
+    pr_fs_clear_resolve_cache();
+  }
 
   return res;
 }
@@ -3588,6 +4035,9 @@ int pr_fsio_rename(const char *rnfm, const char *rnto) {
   pr_trace_msg(trace_channel, 8, "using %s rename() for paths '%s', '%s'",
     fs->fs_name, rnfm, rnto);
   res = (fs->rename)(fs, rnfm, rnto);
+  if (res == 0) {
+    pr_fs_clear_resolve_cache();
+  }
 
   return res;
 }
@@ -3605,6 +4055,9 @@ int pr_fsio_unlink_canon(const char *name) {
   pr_trace_msg(trace_channel, 8, "using %s unlink() for path '%s'",
     fs->fs_name, name);
   res = (fs->unlink)(fs, name);
+  if (res == 0) {
+    pr_fs_clear_resolve_cache();
+  }
 
   return res;
 }
@@ -3627,6 +4080,9 @@ int pr_fsio_unlink(const char *name) {
   pr_trace_msg(trace_channel, 8, "using %s unlink() for path '%s'",
     fs->fs_name, name);
   res = (fs->unlink)(fs, name);
+  if (res == 0) {
+    pr_fs_clear_resolve_cache();
+  }
 
   return res;
 }
@@ -4293,6 +4749,32 @@ int pr_fsio_access(const char *path, int mode, uid_t uid, gid_t gid,
   return (fs->access)(fs, path, mode, uid, gid, suppl_gids);
 }
 
+static int fs_uses_sys_access(pr_fs_t *fs) {
+  while (fs && fs->fs_next && !fs->access)
+    fs = fs->fs_next;
+
+  return (fs == NULL || fs->access == sys_access) ? TRUE : FALSE;
+}
+
+int pr_fs_have_sys_access(void) {
+  if (fs_uses_sys_access(root_fs) == FALSE) {
+    return FALSE;
+  }
+
+  if (fs_map != NULL) {
+    register unsigned int i;
+    pr_fs_t **fs_objs = (pr_fs_t **) fs_map->elts;
+
+    for (i = 0; i < fs_map->nelts; i++) {
+      if (fs_uses_sys_access(fs_objs[i]) == FALSE) {
+        return FALSE;
+      }
+    }
+  }
+
+  return TRUE;
+}
+
 int pr_fsio_faccess(pr_fh_t *fh, int mode, uid_t uid, gid_t gid,
     array_header *suppl_gids) {
   pr_fs_t *fs;
@@ -4372,6 +4854,54 @@ int pr_fsio_futimes(pr_fh_t *fh, struct timeval *tvs) {
   return res;
 }
 
+int pr_fsio_fcopy(pr_fh_t *src_fh, pr_fh_t *dst_fh) {
+  int res;
+  pr_fs_t *fs;
+
+  if (src_fh == NULL ||
+      dst_fh == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* A custom FS can only be expected to copy between its own files. */
+  if (src_fh->fh_fs != dst_fh->fh_fs) {
+    errno = EXDEV;
+    return -1;
+  }
+
+  /* Find the first non-NULL custom fcopy handler.  If there are none,
+   * use the system fcopy.
+   *
+   * An FS which provides its own read/write, but not fcopy (e.g. one which
+   * transforms the data, or is not backed by the files' fds at all), must
+   * not be bypassed by an fcopy further down the chain; the caller then
+   * copies the data using read/write instead.
+   */
+  fs = src_fh->fh_fs;
+  while (fs && fs->fs_next && !fs->fcopy) {
+    if (fs->read != NULL ||
+        fs->write != NULL) {
+      pr_trace_msg(trace_channel, 8, "%s FS provides read/write but not "
+        "fcopy, not using fcopy() for path '%s'", fs->fs_name,
+        src_fh->fh_path);
+      errno = ENOSYS;
+      return -1;
+    }
+
+    fs = fs->fs_next;
+  }
+
+  pr_trace_msg(trace_channel, 8, "using %s fcopy() for path '%s'",
+    fs->fs_name, src_fh->fh_path);
+  res = (fs->fcopy)(src_fh, src_fh->fh_fd, dst_fh, dst_fh->fh_fd);
+
+  if (res == 0)
+    pr_fs_clear_cache();
+
+  return res;
+}
+
 /* If the wrapped chroot() function suceeds (eg returns 0), then all
  * pr_fs_ts currently registered in the fs_map will have their paths
  * rewritten to reflect the new root.
@@ -4397,6 +4927,9 @@ int pr_fsio_chroot(const char *path) {
   if (res == 0) {
     unsigned int iter_start = 0;
 
+    /* Paths now resolve relative to the new root. */
+    pr_fs_clear_resolve_cache();
+
     /* The filesystem handles in fs_map need to be readjusted to the new root.
      */
     register unsigned int i = 0;
@@ -5095,6 +5628,7 @@ int init_fs(void) {
   root_fs->faccess = sys_faccess;
   root_fs->utimes = sys_utimes;
   root_fs->futimes = sys_futimes;
+  root_fs->fcopy = sys_fcopy;
 
   root_fs->chdir = sys_chdir;
   root_fs->chroot = sys_chroot;
@@ -5193,6 +5727,9 @@ static const char *get_fs_hooks_str(pool *p, pr_fs_t *fs) {
   if (fs->futimes)
     hooks = pstrcat(p, hooks, *hooks ? ", " : "", "futimes(3)", NULL);
 
+  if (fs->fcopy)
+    hooks = pstrcat(p, hooks, *hooks ? ", " : "", "fcopy", NULL);
+
   if (fs->chdir)
     hooks = pstrcat(p, hooks, *hooks ? ", " : "", "chdir(2)", NULL);
 
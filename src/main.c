@@ -91,6 +91,19 @@ static int quiet     = 0;
 static int shutdownp = 0;
 static int syntax_check = 0;
 
+/* Configuration check process, forked on SIGHUP to validate the new
+ * configuration before the running one is torn down.
+ */
+static pid_t config_check_pid = 0;
+static int config_check_fd = -1;
+static time_t config_check_started = 0;
+static unsigned char config_check_pending = FALSE;
+
+/* How long a configuration check may take, in seconds, before it is
+ * abandoned (e.g. when an Include'd file is on an unresponsive filesystem).
+ */
+#define CONFIG_CHECK_TIMEOUT		60
+
 /* Command handling */
 static void cmd_loop(server_rec *, conn_t *);
 
@@ -366,7 +379,19 @@ static int _dispatch(cmd_rec *cmd, int cmd_type, int validate, char *match) {
 
       if (!c->group || strcmp(c->group, G_WRITE) != 0)
         kludge_disable_umask();
-      mr = pr_module_call(c->m, c->handler, cmd);
+
+      if (pr_metrics_enabled()) {
+        unsigned long start_usecs;
+
+        start_usecs = pr_metrics_now();
+        mr = pr_module_call(c->m, c->handler, cmd);
+        (void) pr_metrics_add_cmd_time(cmd, cmd_type, c->m,
+          pr_metrics_now() - start_usecs);
+
+      } else {
+        mr = pr_module_call(c->m, c->handler, cmd);
+      }
+
       kludge_enable_umask();
 
       if (MODRET_ISHANDLED(mr)) {
@@ -602,6 +627,11 @@ int pr_cmd_dispatch_phase(cmd_rec *cmd, int phase, int flags) {
 
   cmd->server = main_server;
 
+  /* Paths may have been changed by other processes since the last command;
+   * do not reuse any directories resolved for it.
+   */
+  pr_fs_clear_resolve_cache();
+
   if (flags & PR_CMD_DISPATCH_FL_CLEAR_RESPONSE) {
     pr_trace_msg("response", 9,
       "clearing response lists before dispatching command '%s'", cmd->argv[0]);
@@ -635,7 +665,8 @@ int pr_cmd_dispatch_phase(cmd_rec *cmd, int phase, int flags) {
   }
 
   if (phase == 0) {
-        
+    pr_metrics_incr(PR_METRICS_CTR_COMMANDS, 1);
+
     /* First, dispatch to wildcard PRE_CMD handlers. */
     success = _dispatch(cmd, PRE_CMD, FALSE, C_ANY);
 
@@ -643,6 +674,8 @@ int pr_cmd_dispatch_phase(cmd_rec *cmd, int phase, int flags) {
       success = _dispatch(cmd, PRE_CMD, FALSE, NULL);
 
     if (success < 0) {
+      pr_metrics_incr(PR_METRICS_CTR_COMMAND_ERRORS, 1);
+
       /* Dispatch to POST_CMD_ERR handlers as well. */
 
       _dispatch(cmd, POST_CMD_ERR, FALSE, C_ANY);
@@ -683,6 +716,7 @@ int pr_cmd_dispatch_phase(cmd_rec *cmd, int phase, int flags) {
       errno = xerrno;
 
     } else if (success < 0) {
+      pr_metrics_incr(PR_METRICS_CTR_COMMAND_ERRORS, 1);
 
       /* Allow for non-logging command handlers to be run if CMD fails. */
 
@@ -838,6 +872,14 @@ static void cmd_loop(server_rec *server, conn_t *c) {
       pr_timer_reset(PR_TIMER_IDLE, ANY_MODULE);
     }
 
+    /* If the client has pipelined more commands, which are already buffered,
+     * hold the responses, so that they are written out together with those
+     * of the following commands.
+     */
+    if (pr_netio_telnet_has_line(session.c->instrm)) {
+      pr_response_defer(TRUE);
+    }
+
     if (cmd) {
 
       /* Detect known commands for other protocols; if found, drop the
@@ -861,11 +903,34 @@ static void cmd_loop(server_rec *server, conn_t *c) {
       pr_response_send(R_500, _("Invalid command: try being more creative"));
     }
 
+    if (!pr_netio_telnet_has_line(session.c->instrm)) {
+      pr_response_defer(FALSE);
+    }
+
     /* Release any working memory allocated in inet */
     pr_inet_clear();
   }
 }
 
+/* Freeze the configuration arena, now that the configuration has been
+ * parsed and the daemon is about to start forking session processes.
+ */
+static void freeze_config_arena(void) {
+  unsigned char *protect;
+  int flags = 0;
+
+  protect = get_param_ptr(main_server->conf, "ConfigMemoryProtect", FALSE);
+  if (protect != NULL &&
+      *protect == TRUE) {
+    flags |= PR_POOL_ARENA_FL_PROTECT;
+  }
+
+  if (pr_pool_arena_freeze(flags) < 0) {
+    pr_log_pri(PR_LOG_NOTICE, "unable to protect configuration memory: %s",
+      strerror(errno));
+  }
+}
+
 static void core_restart_cb(void *d1, void *d2, void *d3, void *d4) {
   if (is_master && mpid) {
     int maxfd;
@@ -910,6 +975,14 @@ static void core_restart_cb(void *d1, void *d2, void *d3, void *d4) {
       }
     }
 
+    /* The old configuration is about to be torn down, and the new one
+     * parsed; both require a writable arena.
+     */
+    if (pr_pool_arena_thaw() < 0) {
+      pr_log_pri(PR_LOG_WARNING, "unable to unprotect configuration memory: "
+        "%s", strerror(errno));
+    }
+
     free_bindings();
 
     /* Run through the list of registered restart callbacks. */
@@ -972,6 +1045,8 @@ static void core_restart_cb(void *d1, void *d2, void *d3, void *d4) {
      */
     init_bindings();
 
+    freeze_config_arena();
+
     gettimeofday(&restart_finish, NULL);
 
     restart_elapsed = ((restart_finish.tv_sec - restart_start.tv_sec) * 1000L) +
@@ -985,6 +1060,146 @@ static void core_restart_cb(void *d1, void *d2, void *d3, void *d4) {
   }
 }
 
+/* Parse the configuration file in a forked process, reporting the outcome
+ * back to the daemon via a pipe.  The daemon keeps accepting connections
+ * with its current configuration while this happens, and only performs the
+ * restart once the new configuration is known to be good.
+ *
+ * Note that the restart itself still parses the file again, in the daemon:
+ * the result of the check cannot be reused, since modules keep their
+ * configuration state in globals of the process doing the parsing.  New
+ * connections thus still wait while the daemon re-reads the configuration.
+ */
+static void config_check_cb(void *d1, void *d2, void *d3, void *d4) {
+  int fds[2];
+  pid_t pid;
+
+  if (!is_master ||
+      !mpid) {
+    pr_log_pri(PR_LOG_ERR, "received SIGHUP, cannot restart child process");
+    return;
+  }
+
+  if (config_check_fd != -1) {
+    /* A check is already in progress; run another once it completes, so that
+     * the latest changes to the file are the ones which are checked.
+     */
+    pr_trace_msg("config", 9, "configuration check (pid %lu) in progress, "
+      "deferring restart", (unsigned long) config_check_pid);
+    config_check_pending = TRUE;
+    return;
+  }
+
+  config_check_pending = FALSE;
+
+  if (pipe(fds) < 0) {
+    pr_log_pri(PR_LOG_NOTICE, "unable to open configuration check pipe: %s; "
+      "restarting without check", strerror(errno));
+    schedule(core_restart_cb, 0, NULL, NULL, NULL, NULL);
+    return;
+  }
+
+  pid = fork();
+  switch (pid) {
+    case -1:
+      pr_log_pri(PR_LOG_NOTICE, "unable to fork configuration check: %s; "
+        "restarting without check", strerror(errno));
+      (void) close(fds[0]);
+      (void) close(fds[1]);
+      schedule(core_restart_cb, 0, NULL, NULL, NULL, NULL);
+      return;
+
+    case 0: {
+      unsigned char ok = FALSE;
+
+      /* Make sure that this process never cleans up after the daemon. */
+      is_master = FALSE;
+      (void) close(fds[0]);
+      pr_ipbind_close_listeners();
+
+      (void) pr_pool_arena_thaw();
+
+      init_config();
+      pr_parser_prepare(NULL, NULL);
+      pr_event_generate("core.preparse", NULL);
+
+      PRIVS_ROOT
+      if (pr_parser_parse_file(NULL, config_filename, NULL, 0) == 0 &&
+          pr_parser_cleanup() == 0 &&
+          fixup_servers(server_list) == 0) {
+        ok = TRUE;
+      }
+      PRIVS_RELINQUISH
+
+      (void) write(fds[1], &ok, sizeof(ok));
+      _exit(0);
+    }
+  }
+
+  (void) close(fds[1]);
+  (void) fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+  config_check_pid = pid;
+  config_check_fd = fds[0];
+  config_check_started = time(NULL);
+
+  pr_log_pri(PR_LOG_NOTICE, "received SIGHUP -- checking configuration file "
+    "'%s' (pid %lu)", config_filename, (unsigned long) pid);
+}
+
+static void config_check_end(void) {
+  (void) close(config_check_fd);
+  config_check_fd = -1;
+  config_check_pid = 0;
+  config_check_started = 0;
+
+  if (config_check_pending) {
+    schedule(config_check_cb, 0, NULL, NULL, NULL, NULL);
+  }
+}
+
+/* Read the outcome of a configuration check, and restart if it succeeded. */
+static void config_check_done(void) {
+  unsigned char ok = FALSE;
+
+  if (read(config_check_fd, &ok, sizeof(ok)) != sizeof(ok)) {
+    ok = FALSE;
+  }
+
+  if (ok) {
+    schedule(core_restart_cb, 0, NULL, NULL, NULL, NULL);
+
+  } else {
+    pr_log_pri(PR_LOG_WARNING, "error processing configuration file '%s', "
+      "keeping current configuration", config_filename);
+  }
+
+  config_check_end();
+}
+
+/* Abandon a configuration check which has taken too long, keeping the
+ * current configuration.  Otherwise, every later restart would be deferred
+ * behind the hung check.
+ */
+static void config_check_timeout(void) {
+  if (config_check_fd == -1 ||
+      time(NULL) - config_check_started < CONFIG_CHECK_TIMEOUT) {
+    return;
+  }
+
+  pr_log_pri(PR_LOG_WARNING, "configuration check (pid %lu) of '%s' took "
+    "longer than %d secs, keeping current configuration",
+    (unsigned long) config_check_pid, config_filename, CONFIG_CHECK_TIMEOUT);
+
+  if (kill(config_check_pid, SIGKILL) < 0 &&
+      errno != ESRCH) {
+    pr_log_pri(PR_LOG_NOTICE, "error terminating configuration check "
+      "(pid %lu): %s", (unsigned long) config_check_pid, strerror(errno));
+  }
+
+  config_check_end();
+}
+
 #ifndef PR_DEVEL_NO_FORK
 static int dup_low_fd(int fd) {
   int i, need_close[3] = {-1, -1, -1};
@@ -1148,6 +1363,7 @@ static void fork_server(int fd, conn_t *l, unsigned char nofork) {
 
   /* No longer need any listening fds. */
   pr_ipbind_close_listeners();
+  pr_metrics_close();
 
   /* There would appear to be no useful purpose behind setting the process
    * group of the newly forked child.  In daemon/inetd mode, we should have no
@@ -1172,6 +1388,14 @@ static void fork_server(int fd, conn_t *l, unsigned char nofork) {
 
 #endif /* PR_DEVEL_NO_FORK */
 
+  /* Session processes are free to modify their (copy of the) configuration,
+   * e.g. for <IfUser>/<IfClass> sections.
+   */
+  if (pr_pool_arena_thaw() < 0) {
+    pr_log_pri(PR_LOG_NOTICE, "unable to unprotect configuration memory: %s",
+      strerror(errno));
+  }
+
   /* Child is running here */
   if (signal(SIGUSR1, sig_disconnect) == SIG_ERR) {
     pr_log_pri(PR_LOG_NOTICE,
@@ -1459,7 +1683,7 @@ static void disc_children(void) {
 }
 
 static void daemon_loop(void) {
-  fd_set listenfds;
+  fd_set listenfds, writefds;
   conn_t *listen_conn;
   int fd, maxfd;
   int i, err_count = 0, xerrno = 0;
@@ -1476,11 +1700,28 @@ static void daemon_loop(void) {
     run_schedule();
 
     FD_ZERO(&listenfds);
+    FD_ZERO(&writefds);
     maxfd = pr_ipbind_listen(&listenfds);
 
     /* Monitor children pipes */
     maxfd = semaphore_fds(&listenfds, maxfd);
 
+    /* Monitor the configuration check pipe */
+    if (config_check_fd != -1) {
+      FD_SET(config_check_fd, &listenfds);
+      if (config_check_fd > maxfd) {
+        maxfd = config_check_fd;
+      }
+    }
+
+    /* Monitor the metrics socket, and its clients */
+    maxfd = pr_metrics_add_fds(&listenfds, &writefds, maxfd);
+
+#ifdef PR_USE_CTRLS
+    /* Monitor the Controls socket, and its clients */
+    maxfd = pr_ctrls_add_fds(&listenfds, &writefds, maxfd);
+#endif /* PR_USE_CTRLS */
+
     /* Check for ftp shutdown message file */
     switch (check_shutmsg(&shut, &deny, &disc, shutmsg, sizeof(shutmsg))) {
       case 1:
@@ -1505,6 +1746,20 @@ static void daemon_loop(void) {
       tv.tv_usec = 0L;
     }
 
+    /* Wake up in time to abandon a configuration check which hangs. */
+    if (config_check_fd != -1) {
+      time_t remaining;
+
+      remaining = CONFIG_CHECK_TIMEOUT - (time(NULL) - config_check_started);
+      if (remaining < 1) {
+        remaining = 1;
+      }
+
+      if (remaining < tv.tv_sec) {
+        tv.tv_sec = remaining;
+      }
+    }
+
     /* If running (a flag signaling whether proftpd is just starting up)
      * AND shutdownp (a flag signalling the present of /etc/shutmsg) are
      * true, then log an error stating this -- but don't stop the server.
@@ -1532,7 +1787,7 @@ static void daemon_loop(void) {
     running = 1;
     xerrno = errno = 0;
 
-    PR_DEVEL_CLOCK(i = select(maxfd + 1, &listenfds, NULL, NULL, &tv));
+    PR_DEVEL_CLOCK(i = select(maxfd + 1, &listenfds, &writefds, NULL, &tv));
     if (i < 0) {
       xerrno = errno;
     }
@@ -1589,6 +1844,8 @@ static void daemon_loop(void) {
         strerror(xerrno));
     }
 
+    config_check_timeout();
+
     if (i == 0)
       continue;
 
@@ -1623,6 +1880,17 @@ static void daemon_loop(void) {
       continue;
     }
 
+    if (config_check_fd != -1 &&
+        FD_ISSET(config_check_fd, &listenfds)) {
+      config_check_done();
+    }
+
+#ifdef PR_USE_CTRLS
+    pr_ctrls_handle_fds(&listenfds, &writefds);
+#endif /* PR_USE_CTRLS */
+
+    pr_metrics_handle_fds(&listenfds, &writefds);
+
     /* Accept the connection. */
     listen_conn = pr_ipbind_accept_conn(&listenfds, &fd);
 
@@ -1746,8 +2014,8 @@ void pr_signals_handle(void) {
       recvd_signal_flags &= ~RECEIVED_SIG_RESTART;
       pr_trace_msg("signal", 9, "handling SIGHUP (signal %d)", SIGHUP);
 
-      /* NOTE: should this be done here, rather than using a schedule? */
-      schedule(core_restart_cb, 0, NULL, NULL, NULL, NULL);
+      /* Check the new configuration before committing to the restart. */
+      schedule(config_check_cb, 0, NULL, NULL, NULL, NULL);
     }
 
     if (recvd_signal_flags & RECEIVED_SIG_EXIT) {
@@ -1968,6 +2236,10 @@ static RETSIGTYPE sig_terminate(int signo) {
     pr_trace_msg("signal", 9, "handling %s (signal %d)",
       signo == SIGSEGV ? "SIGSEGV" : 
         signo == SIGXCPU ? "SIGXCPU" : "SIGBUS", signo);
+
+    /* Write out any buffered trace messages leading up to the crash. */
+    (void) pr_trace_dump();
+
     pr_log_pri(PR_LOG_NOTICE, "ProFTPD terminating (signal %d)", signo);
 
     pr_log_pri(PR_LOG_INFO, "%s session closed.",
@@ -2034,6 +2306,10 @@ static void handle_xcpu(void) {
 
 static void handle_terminate_other(void) {
   pr_log_pri(PR_LOG_WARNING, "ProFTPD terminating (signal %d)", term_signo);
+
+  /* Don't lose any buffered trace messages; they may explain why. */
+  (void) pr_trace_dump();
+
   finish_terminate();
 }
 
@@ -2439,6 +2715,8 @@ static void standalone_main(void) {
     PROFTPD_VERSION_TEXT " " PR_STATUS, BUILD_STAMP);
 
   pr_pidfile_write();
+
+  freeze_config_arena();
   daemon_loop();
 }
 
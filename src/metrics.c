@@ -0,0 +1,1107 @@
+/*
+ * ProFTPD - FTP server daemon
+ * Copyright (c) 2014 The ProFTPD Project team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, The ProFTPD Project team and other respective
+ * copyright holders give permission to link this program with OpenSSL, and
+ * distribute the resulting executable, without including the source code for
+ * OpenSSL in the source distribution.
+ */
+
+/* Metrics collection
+ *
+ * The histograms live in a shared anonymous mapping, created by the daemon
+ * before any sessions are forked; the sessions record into it, and the
+ * daemon (e.g. via ftpdctl) reads from it.  The command and module names
+ * which index the histograms are determined when the mapping is created,
+ * and are inherited by the sessions; they are never changed afterward.
+ *
+ * The per-vhost counters live in a separate shared mapping, indexed by the
+ * server SID.  The daemon answers HTTP requests for them, in the Prometheus
+ * text format, on a local Unix domain socket.
+ */
+
+#include "conf.h"
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include <sys/un.h>
+
+#if defined(__GNUC__)
+# define METRICS_INCR(v, n)	(void) __sync_fetch_and_add(&(v), (n))
+#else
+# define METRICS_INCR(v, n)	((v) += (n))
+#endif
+
+extern module *loaded_modules;
+extern xaset_t *server_list;
+
+/* PRE_CMD through LOG_CMD_ERR */
+#define METRICS_NPHASES		6
+
+#define METRICS_CMD_NOTE	"metrics.cmd-usecs"
+
+static pool *metrics_pool = NULL;
+
+static pr_metrics_histo_t *metrics_segment = NULL;
+static size_t metrics_segmentsz = 0;
+
+/* Command names are indexed by a table, mapping the name to its index;
+ * index 0 is used for any commands not handled by a specific module.
+ */
+static pr_table_t *metrics_cmd_tab = NULL;
+static array_header *metrics_cmds = NULL;
+static array_header *metrics_modules = NULL;
+
+static unsigned long *metrics_counters = NULL;
+static size_t metrics_countersz = 0;
+static unsigned int metrics_nsids = 0;
+
+static int metrics_listenfd = -1;
+
+/* Clients of the metrics socket are served from the daemon's main loop,
+ * using nonblocking I/O, so that a slow client cannot hold up the handling
+ * of new connections.
+ */
+struct metrics_client {
+  struct metrics_client *next;
+  pool *pool;
+  int fd;
+
+  /* When the client will be dropped, if it has not sent its request and
+   * read our response by then.
+   */
+  time_t deadline;
+
+  char req[1024];
+  size_t reqlen;
+
+  const char *resp;
+  size_t resplen;
+  size_t resppos;
+};
+
+static struct metrics_client *metrics_clients = NULL;
+static unsigned int metrics_nclients = 0;
+
+/* How long a client has to send its request, and read our response. */
+#define METRICS_REQUEST_TIMEOUT		5
+
+/* How many clients may be served at the same time. */
+#define METRICS_MAX_CLIENTS		8
+
+static struct {
+  const char *name;
+  const char *help;
+
+} metrics_counter_info[PR_METRICS_NCOUNTERS] = {
+  { "proftpd_connections_total",	"Number of connections handled." },
+  { "proftpd_logins_total",		"Number of successful logins." },
+  { "proftpd_login_failures_total",	"Number of failed logins." },
+  { "proftpd_commands_total",		"Number of commands handled." },
+  { "proftpd_command_errors_total",	"Number of commands which failed." },
+  { "proftpd_bytes_in_total",		"Number of data bytes received." },
+  { "proftpd_bytes_out_total",		"Number of data bytes sent." },
+  { "proftpd_files_in_total",		"Number of files uploaded." },
+  { "proftpd_files_out_total",		"Number of files downloaded." }
+};
+
+static const char *trace_channel = "metrics";
+
+#ifdef HAVE_SYS_MMAN_H
+# if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS	MAP_ANON
+# endif
+
+static void *metrics_map(size_t len) {
+  void *ptr;
+
+  ptr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    int xerrno = errno;
+
+    pr_trace_msg(trace_channel, 1, "error mapping %lu bytes for metrics: %s",
+      (unsigned long) len, strerror(xerrno));
+
+    errno = xerrno;
+    return NULL;
+  }
+
+  return ptr;
+}
+
+static void metrics_unmap(void *ptr, size_t len) {
+  if (munmap(ptr, len) < 0) {
+    pr_trace_msg(trace_channel, 3, "error unmapping metrics: %s",
+      strerror(errno));
+  }
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+static void metrics_add_cmd(const char *name) {
+  int *idx;
+
+  if (pr_table_get(metrics_cmd_tab, name, NULL) != NULL) {
+    return;
+  }
+
+  idx = palloc(metrics_pool, sizeof(int));
+  *idx = metrics_cmds->nelts;
+
+  *((const char **) push_array(metrics_cmds)) = pstrdup(metrics_pool, name);
+  (void) pr_table_add(metrics_cmd_tab, pstrdup(metrics_pool, name), idx,
+    sizeof(int));
+}
+
+static pr_metrics_histo_t *metrics_get_histo(int type, unsigned int idx,
+    int phase) {
+  unsigned int offset;
+
+  if (phase < PRE_CMD ||
+      phase > LOG_CMD_ERR) {
+    return NULL;
+  }
+
+  switch (type) {
+    case PR_METRICS_TYPE_CMD:
+      if (idx >= metrics_cmds->nelts) {
+        return NULL;
+      }
+
+      offset = idx;
+      break;
+
+    case PR_METRICS_TYPE_MODULE:
+      if (idx >= metrics_modules->nelts) {
+        return NULL;
+      }
+
+      offset = metrics_cmds->nelts + idx;
+      break;
+
+    default:
+      return NULL;
+  }
+
+  return &(metrics_segment[(offset * METRICS_NPHASES) + (phase - 1)]);
+}
+
+static void metrics_histo_add(pr_metrics_histo_t *histo, unsigned long usecs) {
+  register unsigned int i = 0;
+  unsigned long v;
+
+  /* Find the bucket, i.e. the number of bits needed for the value. */
+  for (v = usecs; v > 0 && i < PR_METRICS_HISTO_NBUCKETS-1; v >>= 1) {
+    i++;
+  }
+
+  METRICS_INCR(histo->count, 1);
+  METRICS_INCR(histo->total_usecs, usecs);
+  METRICS_INCR(histo->buckets[i], 1);
+}
+
+int pr_metrics_add_cmd_time(cmd_rec *cmd, int phase, module *m,
+    unsigned long usecs) {
+  pr_metrics_histo_t *histo;
+  const int *idx = NULL;
+  register unsigned int i;
+  module **modules;
+
+  if (cmd == NULL ||
+      m == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (metrics_segment == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (cmd->argv[0] != NULL) {
+    idx = pr_table_get(metrics_cmd_tab, cmd->argv[0], NULL);
+  }
+
+  histo = metrics_get_histo(PR_METRICS_TYPE_CMD, idx ? *idx : 0, phase);
+  if (histo == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  metrics_histo_add(histo, usecs);
+
+  modules = metrics_modules->elts;
+  for (i = 0; i < metrics_modules->nelts; i++) {
+    if (modules[i] == m) {
+      metrics_histo_add(metrics_get_histo(PR_METRICS_TYPE_MODULE, i, phase),
+        usecs);
+      break;
+    }
+  }
+
+  /* Keep a running total of the time spent handling this command, for
+   * logging.
+   */
+  if (phase != LOG_CMD &&
+      phase != LOG_CMD_ERR &&
+      cmd->notes != NULL) {
+    unsigned long *total;
+
+    total = (unsigned long *) pr_table_get(cmd->notes, METRICS_CMD_NOTE, NULL);
+    if (total == NULL) {
+      total = pcalloc(cmd->pool, sizeof(unsigned long));
+      (void) pr_table_add(cmd->notes, METRICS_CMD_NOTE, total,
+        sizeof(unsigned long));
+    }
+
+    *total += usecs;
+  }
+
+  return 0;
+}
+
+int pr_metrics_get_cmd_usecs(cmd_rec *cmd, unsigned long *usecs) {
+  unsigned long *total;
+
+  if (cmd == NULL ||
+      usecs == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (cmd->notes == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  total = (unsigned long *) pr_table_get(cmd->notes, METRICS_CMD_NOTE, NULL);
+  if (total == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  *usecs = *total;
+  return 0;
+}
+
+unsigned int pr_metrics_get_count(int type) {
+  if (metrics_segment == NULL) {
+    return 0;
+  }
+
+  switch (type) {
+    case PR_METRICS_TYPE_CMD:
+      return metrics_cmds->nelts;
+
+    case PR_METRICS_TYPE_MODULE:
+      return metrics_modules->nelts;
+  }
+
+  return 0;
+}
+
+const char *pr_metrics_get_name(int type, unsigned int idx) {
+  if (metrics_segment == NULL) {
+    errno = EPERM;
+    return NULL;
+  }
+
+  switch (type) {
+    case PR_METRICS_TYPE_CMD:
+      if (idx < metrics_cmds->nelts) {
+        return ((const char **) metrics_cmds->elts)[idx];
+      }
+      break;
+
+    case PR_METRICS_TYPE_MODULE:
+      if (idx < metrics_modules->nelts) {
+        return ((module **) metrics_modules->elts)[idx]->name;
+      }
+      break;
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+int pr_metrics_get_histo(int type, unsigned int idx, int phase,
+    pr_metrics_histo_t *histo) {
+  pr_metrics_histo_t *src;
+
+  if (histo == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (metrics_segment == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  src = metrics_get_histo(type, idx, phase);
+  if (src == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  memcpy(histo, src, sizeof(pr_metrics_histo_t));
+  return 0;
+}
+
+unsigned long pr_metrics_histo_percentile(const pr_metrics_histo_t *histo,
+    unsigned int pct) {
+  register unsigned int i;
+  unsigned long count = 0, target;
+
+  if (histo == NULL ||
+      histo->count == 0) {
+    return 0;
+  }
+
+  if (pct > 100) {
+    pct = 100;
+  }
+
+  /* Use the sum of the buckets, rather than the count, since the two may
+   * briefly disagree while sessions are recording.
+   */
+  for (i = 0; i < PR_METRICS_HISTO_NBUCKETS; i++) {
+    count += histo->buckets[i];
+  }
+
+  target = ((count * pct) + 99) / 100;
+  if (target == 0) {
+    target = 1;
+  }
+
+  count = 0;
+  for (i = 0; i < PR_METRICS_HISTO_NBUCKETS-1; i++) {
+    count += histo->buckets[i];
+    if (count >= target) {
+      break;
+    }
+  }
+
+  return (1UL << i);
+}
+
+unsigned long pr_metrics_now(void) {
+  struct timeval tv;
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+    return (unsigned long) ((ts.tv_sec * 1000000UL) + (ts.tv_nsec / 1000));
+  }
+#endif /* CLOCK_MONOTONIC */
+
+  gettimeofday(&tv, NULL);
+  return (unsigned long) ((tv.tv_sec * 1000000UL) + tv.tv_usec);
+}
+
+int pr_metrics_enabled(void) {
+  return (metrics_segment != NULL ? TRUE : FALSE);
+}
+
+int pr_metrics_reset(void) {
+  if (metrics_segment == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  memset(metrics_segment, 0, metrics_segmentsz);
+  return 0;
+}
+
+int pr_metrics_free(void) {
+  if (metrics_segment != NULL) {
+#ifdef HAVE_SYS_MMAN_H
+    metrics_unmap(metrics_segment, metrics_segmentsz);
+#endif /* HAVE_SYS_MMAN_H */
+
+    metrics_segment = NULL;
+    metrics_segmentsz = 0;
+  }
+
+  if (metrics_pool != NULL) {
+    destroy_pool(metrics_pool);
+    metrics_pool = NULL;
+  }
+
+  metrics_cmd_tab = NULL;
+  metrics_cmds = NULL;
+  metrics_modules = NULL;
+
+  return 0;
+}
+
+int pr_metrics_init(void) {
+#ifdef HAVE_SYS_MMAN_H
+  module *m;
+  void *ptr;
+  size_t segmentsz;
+
+  pr_metrics_free();
+
+  metrics_pool = make_sub_pool(permanent_pool);
+  pr_pool_tag(metrics_pool, "Metrics Pool");
+
+  metrics_cmd_tab = pr_table_alloc(metrics_pool, 0);
+  metrics_cmds = make_array(metrics_pool, 64, sizeof(char *));
+  metrics_modules = make_array(metrics_pool, 32, sizeof(module *));
+
+  *((const char **) push_array(metrics_cmds)) = "(other)";
+
+  for (m = loaded_modules; m; m = m->next) {
+    *((module **) push_array(metrics_modules)) = m;
+
+    if (m->cmdtable != NULL) {
+      cmdtable *c;
+
+      for (c = m->cmdtable; c->command; c++) {
+        if (c->cmd_type == HOOK ||
+            strcmp(c->command, C_ANY) == 0) {
+          continue;
+        }
+
+        metrics_add_cmd(c->command);
+      }
+    }
+  }
+
+  segmentsz = sizeof(pr_metrics_histo_t) * METRICS_NPHASES *
+    (metrics_cmds->nelts + metrics_modules->nelts);
+
+  ptr = metrics_map(segmentsz);
+  if (ptr == NULL) {
+    int xerrno = errno;
+
+    pr_metrics_free();
+
+    errno = xerrno;
+    return -1;
+  }
+
+  metrics_segment = ptr;
+  metrics_segmentsz = segmentsz;
+
+  pr_trace_msg(trace_channel, 9,
+    "allocated %lu bytes of metrics for %u commands, %u modules",
+    (unsigned long) segmentsz, metrics_cmds->nelts, metrics_modules->nelts);
+  return 0;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif /* HAVE_SYS_MMAN_H */
+}
+
+int pr_metrics_counters_free(void) {
+  if (metrics_counters != NULL) {
+#ifdef HAVE_SYS_MMAN_H
+    metrics_unmap(metrics_counters, metrics_countersz);
+#endif /* HAVE_SYS_MMAN_H */
+
+    metrics_counters = NULL;
+    metrics_countersz = 0;
+    metrics_nsids = 0;
+  }
+
+  return 0;
+}
+
+int pr_metrics_counters_init(void) {
+#ifdef HAVE_SYS_MMAN_H
+  server_rec *s;
+  unsigned int nsids = 0;
+  size_t countersz;
+  void *ptr;
+
+  pr_metrics_counters_free();
+
+  if (server_list == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  for (s = (server_rec *) server_list->xas_list; s; s = s->next) {
+    if (s->sid > nsids) {
+      nsids = s->sid;
+    }
+  }
+
+  countersz = sizeof(unsigned long) * PR_METRICS_NCOUNTERS * (nsids + 1);
+
+  ptr = metrics_map(countersz);
+  if (ptr == NULL) {
+    return -1;
+  }
+
+  metrics_counters = ptr;
+  metrics_countersz = countersz;
+  metrics_nsids = nsids;
+
+  pr_trace_msg(trace_channel, 9,
+    "allocated %lu bytes of counters for %u servers",
+    (unsigned long) countersz, nsids);
+  return 0;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif /* HAVE_SYS_MMAN_H */
+}
+
+void pr_metrics_incr(int ctr, unsigned long n) {
+  unsigned int sid;
+
+  if (metrics_counters == NULL ||
+      main_server == NULL ||
+      ctr < 0 ||
+      ctr >= PR_METRICS_NCOUNTERS) {
+    return;
+  }
+
+  sid = main_server->sid;
+  if (sid > metrics_nsids) {
+    return;
+  }
+
+  METRICS_INCR(metrics_counters[(sid * PR_METRICS_NCOUNTERS) + ctr], n);
+}
+
+int pr_metrics_get_counter(unsigned int sid, int ctr, unsigned long *val) {
+  if (val == NULL ||
+      ctr < 0 ||
+      ctr >= PR_METRICS_NCOUNTERS) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (metrics_counters == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (sid > metrics_nsids) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  *val = metrics_counters[(sid * PR_METRICS_NCOUNTERS) + ctr];
+  return 0;
+}
+
+/* Escapes a label value, per the Prometheus text format. */
+static const char *metrics_escape(pool *p, const char *str) {
+  char *buf, *ptr;
+
+  if (str == NULL) {
+    return "";
+  }
+
+  if (strpbrk(str, "\\\"\n") == NULL) {
+    return str;
+  }
+
+  buf = ptr = pcalloc(p, (strlen(str) * 2) + 1);
+  for (; *str; str++) {
+    switch (*str) {
+      case '\\':
+      case '"':
+        *ptr++ = '\\';
+        *ptr++ = *str;
+        break;
+
+      case '\n':
+        *ptr++ = '\\';
+        *ptr++ = 'n';
+        break;
+
+      default:
+        *ptr++ = *str;
+    }
+  }
+
+  return buf;
+}
+
+static void metrics_text_add(array_header *lines, size_t *textlen,
+    const char *line) {
+  *((const char **) push_array(lines)) = line;
+  *textlen += strlen(line);
+}
+
+char *pr_metrics_get_text(pool *p) {
+  register unsigned int i;
+  array_header *lines;
+  const char **elts;
+  size_t textlen = 0;
+  char *text, *ptr;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  /* Collect the lines first, then concatenate them all at once, rather
+   * than repeatedly copying an ever-growing string.
+   */
+  lines = make_array(p, 64, sizeof(char *));
+
+  if (metrics_counters != NULL &&
+      server_list != NULL) {
+    for (i = 0; i < PR_METRICS_NCOUNTERS; i++) {
+      server_rec *s;
+
+      metrics_text_add(lines, &textlen, pstrcat(p,
+        "# HELP ", metrics_counter_info[i].name, " ",
+        metrics_counter_info[i].help, "\n",
+        "# TYPE ", metrics_counter_info[i].name, " counter\n", NULL));
+
+      for (s = (server_rec *) server_list->xas_list; s; s = s->next) {
+        char val[64];
+
+        if (s->sid > metrics_nsids) {
+          continue;
+        }
+
+        memset(val, '\0', sizeof(val));
+        snprintf(val, sizeof(val)-1, "\",port=\"%u\"} %lu\n", s->ServerPort,
+          metrics_counters[(s->sid * PR_METRICS_NCOUNTERS) + i]);
+
+        metrics_text_add(lines, &textlen, pstrcat(p,
+          metrics_counter_info[i].name, "{server=\"",
+          metrics_escape(p, s->ServerName), "\",address=\"",
+          metrics_escape(p, s->ServerAddress), val, NULL));
+      }
+    }
+  }
+
+  if (metrics_segment != NULL) {
+    const char *name = "proftpd_command_duration_microseconds";
+
+    metrics_text_add(lines, &textlen, pstrcat(p,
+      "# HELP ", name, " Time spent handling commands.\n",
+      "# TYPE ", name, " summary\n", NULL));
+
+    for (i = 0; i < metrics_cmds->nelts; i++) {
+      pr_metrics_histo_t *histo;
+      const char *cmd_name;
+      char val[64];
+
+      histo = metrics_get_histo(PR_METRICS_TYPE_CMD, i, CMD);
+      if (histo->count == 0) {
+        continue;
+      }
+
+      cmd_name = metrics_escape(p, ((const char **) metrics_cmds->elts)[i]);
+
+      memset(val, '\0', sizeof(val));
+      snprintf(val, sizeof(val)-1, "\"} %lu\n", histo->total_usecs);
+      metrics_text_add(lines, &textlen, pstrcat(p, name, "_sum{command=\"",
+        cmd_name, val, NULL));
+
+      memset(val, '\0', sizeof(val));
+      snprintf(val, sizeof(val)-1, "\"} %lu\n", histo->count);
+      metrics_text_add(lines, &textlen, pstrcat(p, name, "_count{command=\"",
+        cmd_name, val, NULL));
+    }
+  }
+
+  text = ptr = palloc(p, textlen + 1);
+
+  elts = lines->elts;
+  for (i = 0; i < lines->nelts; i++) {
+    size_t len;
+
+    len = strlen(elts[i]);
+    memcpy(ptr, elts[i], len);
+    ptr += len;
+  }
+
+  *ptr = '\0';
+  return text;
+}
+
+int pr_metrics_get_listen_fd(void) {
+  return metrics_listenfd;
+}
+
+static void metrics_client_close(struct metrics_client *client) {
+  struct metrics_client **prev;
+
+  for (prev = &metrics_clients; *prev != NULL; prev = &((*prev)->next)) {
+    if (*prev == client) {
+      *prev = client->next;
+      break;
+    }
+  }
+
+  (void) close(client->fd);
+  destroy_pool(client->pool);
+  metrics_nclients--;
+}
+
+int pr_metrics_close(void) {
+  while (metrics_clients != NULL) {
+    metrics_client_close(metrics_clients);
+  }
+
+  if (metrics_listenfd >= 0) {
+    (void) close(metrics_listenfd);
+    metrics_listenfd = -1;
+  }
+
+  return 0;
+}
+
+static int metrics_setnonblock(int fd) {
+  int flags;
+
+  flags = fcntl(fd, F_GETFL);
+  if (flags < 0) {
+    return -1;
+  }
+
+  return fcntl(fd, F_SETFL, flags|O_NONBLOCK);
+}
+
+int pr_metrics_listen(const char *path, mode_t mode) {
+  int fd, res;
+  struct sockaddr_un sock;
+  struct stat st;
+
+  if (path == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (strlen(path) >= sizeof(sock.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  pr_metrics_close();
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  /* Ensure that the socket used is not one of the major three fds (stdin,
+   * stdout, or stderr).
+   */
+  if (fd <= STDERR_FILENO) {
+    res = pr_fs_get_usable_fd(fd);
+    if (res < 0) {
+      int xerrno = errno;
+
+      (void) close(fd);
+      errno = xerrno;
+      return -1;
+    }
+
+    (void) close(fd);
+    fd = res;
+  }
+
+  if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+    pr_trace_msg(trace_channel, 3,
+      "unable to set CLO_EXEC on metrics socket fd %d: %s", fd,
+      strerror(errno));
+  }
+
+  if (metrics_setnonblock(fd) < 0) {
+    int xerrno = errno;
+
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  /* Remove any socket left behind by a previous daemon -- but only a
+   * socket, lest a misconfigured path clobber some other file.
+   */
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      pr_trace_msg(trace_channel, 1,
+        "unable to listen on '%s': existing file is not a socket", path);
+      (void) close(fd);
+
+      errno = EEXIST;
+      return -1;
+    }
+
+    (void) unlink(path);
+  }
+
+  memset(&sock, 0, sizeof(sock));
+  sock.sun_family = AF_UNIX;
+  sstrncpy(sock.sun_path, path, sizeof(sock.sun_path));
+
+  if (bind(fd, (struct sockaddr *) &sock, sizeof(sock)) < 0) {
+    int xerrno = errno;
+
+    pr_trace_msg(trace_channel, 1, "unable to bind to '%s': %s", path,
+      strerror(xerrno));
+    (void) close(fd);
+
+    errno = xerrno;
+    return -1;
+  }
+
+  if (chmod(path, mode) < 0) {
+    pr_trace_msg(trace_channel, 3, "unable to set mode %04o on '%s': %s",
+      (unsigned int) mode, path, strerror(errno));
+  }
+
+  if (listen(fd, 5) < 0) {
+    int xerrno = errno;
+
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  pr_trace_msg(trace_channel, 7, "listening for metrics requests on '%s'",
+    path);
+  metrics_listenfd = fd;
+  return fd;
+}
+
+static void metrics_accept(void) {
+  while (metrics_nclients < METRICS_MAX_CLIENTS) {
+    struct metrics_client *client;
+    pool *client_pool;
+    int fd;
+
+    fd = accept(metrics_listenfd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      if (errno != EAGAIN &&
+          errno != EWOULDBLOCK) {
+        pr_trace_msg(trace_channel, 3,
+          "error accepting metrics connection: %s", strerror(errno));
+      }
+
+      break;
+    }
+
+    if (metrics_setnonblock(fd) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "unable to set nonblocking on metrics client fd %d: %s", fd,
+        strerror(errno));
+      (void) close(fd);
+      continue;
+    }
+
+    (void) fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    client_pool = make_sub_pool(permanent_pool);
+    pr_pool_tag(client_pool, "Metrics client pool");
+
+    client = pcalloc(client_pool, sizeof(struct metrics_client));
+    client->pool = client_pool;
+    client->fd = fd;
+    client->deadline = time(NULL) + METRICS_REQUEST_TIMEOUT;
+
+    client->next = metrics_clients;
+    metrics_clients = client;
+    metrics_nclients++;
+  }
+}
+
+/* Prepares the response to the client's request. */
+static void metrics_client_respond(struct metrics_client *client) {
+  const char *status, *text = NULL;
+  char textlen[32];
+  int head_only = FALSE;
+
+  if (strncmp(client->req, "GET ", 4) == 0) {
+    status = "200 OK";
+    text = pr_metrics_get_text(client->pool);
+
+  } else if (strncmp(client->req, "HEAD ", 5) == 0) {
+    status = "200 OK";
+    text = pr_metrics_get_text(client->pool);
+    head_only = TRUE;
+
+  } else {
+    status = "405 Method Not Allowed";
+    text = "";
+  }
+
+  memset(textlen, '\0', sizeof(textlen));
+  snprintf(textlen, sizeof(textlen)-1, "%lu", (unsigned long) strlen(text));
+
+  client->resp = pstrcat(client->pool,
+    "HTTP/1.0 ", status, "\r\n",
+    "Content-Type: text/plain; version=0.0.4\r\n",
+    "Content-Length: ", textlen, "\r\n",
+    "Connection: close\r\n\r\n", head_only ? "" : text, NULL);
+  client->resplen = strlen(client->resp);
+  client->resppos = 0;
+}
+
+/* Reads whatever the client has sent.  Returns -1 if the client should be
+ * dropped.
+ */
+static int metrics_client_read(struct metrics_client *client) {
+  ssize_t res;
+
+  res = read(client->fd, client->req + client->reqlen,
+    sizeof(client->req) - client->reqlen - 1);
+  if (res < 0) {
+    if (errno == EINTR ||
+        errno == EAGAIN ||
+        errno == EWOULDBLOCK) {
+      return 0;
+    }
+
+    return -1;
+  }
+
+  client->reqlen += res;
+  client->req[client->reqlen] = '\0';
+
+  /* We do not care about the headers, but the client may not read our
+   * response until it has sent them.
+   */
+  if (res == 0 ||
+      client->reqlen == sizeof(client->req) - 1 ||
+      strstr(client->req, "\r\n\r\n") != NULL ||
+      strstr(client->req, "\n\n") != NULL) {
+    metrics_client_respond(client);
+  }
+
+  return 0;
+}
+
+/* Writes as much of the response as the client will take.  Returns -1 if
+ * the client should be dropped, 1 once the entire response is written.
+ */
+static int metrics_client_write(struct metrics_client *client) {
+  while (client->resppos < client->resplen) {
+    ssize_t res;
+
+    res = write(client->fd, client->resp + client->resppos,
+      client->resplen - client->resppos);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      if (errno == EAGAIN ||
+          errno == EWOULDBLOCK) {
+        return 0;
+      }
+
+      pr_trace_msg(trace_channel, 3, "error writing metrics response: %s",
+        strerror(errno));
+      return -1;
+    }
+
+    client->resppos += res;
+  }
+
+  return 1;
+}
+
+int pr_metrics_add_fds(fd_set *rfds, fd_set *wfds, int maxfd) {
+  struct metrics_client *client, *next_client;
+  time_t now;
+
+  if (metrics_listenfd < 0) {
+    return maxfd;
+  }
+
+  if (metrics_nclients < METRICS_MAX_CLIENTS) {
+    FD_SET(metrics_listenfd, rfds);
+    if (metrics_listenfd > maxfd) {
+      maxfd = metrics_listenfd;
+    }
+  }
+
+  now = time(NULL);
+
+  for (client = metrics_clients; client != NULL; client = next_client) {
+    next_client = client->next;
+
+    if (now >= client->deadline) {
+      pr_trace_msg(trace_channel, 3,
+        "dropping metrics client fd %d: request timed out", client->fd);
+      metrics_client_close(client);
+      continue;
+    }
+
+    if (client->resp == NULL) {
+      FD_SET(client->fd, rfds);
+
+    } else {
+      FD_SET(client->fd, wfds);
+    }
+
+    if (client->fd > maxfd) {
+      maxfd = client->fd;
+    }
+  }
+
+  return maxfd;
+}
+
+void pr_metrics_handle_fds(fd_set *rfds, fd_set *wfds) {
+  struct metrics_client *client, *next_client;
+
+  if (metrics_listenfd < 0) {
+    return;
+  }
+
+  for (client = metrics_clients; client != NULL; client = next_client) {
+    int res = 0;
+
+    next_client = client->next;
+
+    if (client->resp == NULL) {
+      if (FD_ISSET(client->fd, rfds)) {
+        res = metrics_client_read(client);
+
+        /* Try to send the response right away; the client is usually
+         * waiting for it.
+         */
+        if (res == 0 &&
+            client->resp != NULL) {
+          res = metrics_client_write(client);
+        }
+      }
+
+    } else if (FD_ISSET(client->fd, wfds)) {
+      res = metrics_client_write(client);
+    }
+
+    if (res != 0) {
+      metrics_client_close(client);
+    }
+  }
+
+  if (FD_ISSET(metrics_listenfd, rfds)) {
+    metrics_accept();
+  }
+}
@@ -433,6 +433,11 @@ int pr_module_unload(module *m) {
   pr_event_unregister(m, NULL, NULL);
   pr_timer_remove(-1, m);
 
+  /* Buffered trace messages may refer to format strings in the module being
+   * unloaded (e.g. by mod_dso); write them out while they are still valid.
+   */
+  (void) pr_trace_dump();
+
   return 0;
 }
 
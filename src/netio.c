@@ -1160,6 +1160,30 @@ char *pr_netio_gets(char *buf, size_t buflen, pr_netio_stream_t *nstrm) {
 
 static int telnet_mode = 0;
 
+int pr_netio_telnet_has_line(pr_netio_stream_t *nstrm) {
+  pr_buffer_t *pbuf;
+  size_t len;
+
+  if (nstrm == NULL) {
+    errno = EINVAL;
+    return FALSE;
+  }
+
+  pbuf = nstrm->strm_buf;
+  if (pbuf == NULL ||
+      pbuf->current == NULL ||
+      pbuf->remaining >= pbuf->buflen) {
+    return FALSE;
+  }
+
+  len = pbuf->buflen - pbuf->remaining;
+  if (memchr(pbuf->current, '\n', len) != NULL) {
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
 char *pr_netio_telnet_gets(char *buf, size_t buflen,
     pr_netio_stream_t *in_nstrm, pr_netio_stream_t *out_nstrm) {
   char *bp = buf;
@@ -1218,6 +1242,41 @@ char *pr_netio_telnet_gets(char *buf, size_t buflen,
 
     toread = pbuf->buflen - pbuf->remaining;
 
+    /* Fast path: copy everything up to the newline (or the end of the
+     * buffered data) at once, stopping short of any Telnet IAC byte; only
+     * the bytes from the IAC onward need the byte-by-byte state machine.
+     */
+    if (telnet_mode == 0 &&
+        toread > 0 &&
+        buflen > 0) {
+      size_t len;
+      char *ptr;
+
+      len = ((size_t) toread < buflen ? (size_t) toread : buflen);
+
+      ptr = memchr(pbuf->current, '\n', len);
+      if (ptr != NULL) {
+        len = ptr - pbuf->current;
+      }
+
+      if (handle_iac == TRUE) {
+        ptr = memchr(pbuf->current, TELNET_IAC, len);
+        if (ptr != NULL) {
+          len = ptr - pbuf->current;
+        }
+      }
+
+      if (len > 0) {
+        memcpy(bp, pbuf->current, len);
+        bp += len;
+        buflen -= len;
+
+        pbuf->current += len;
+        pbuf->remaining += len;
+        toread -= len;
+      }
+    }
+
     while (buflen > 0 &&
            toread > 0 &&
            *pbuf->current != '\n' &&
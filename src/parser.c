@@ -286,7 +286,7 @@ config_rec *pr_parser_config_ctxt_open(const char *name) {
    */
   if (strncasecmp(name, "<Global>", 9) == 0) {
     if (!global_config_pool) {
-      global_config_pool = make_sub_pool(permanent_pool);
+      global_config_pool = make_sub_pool(pr_pool_get_arena());
       pr_pool_tag(global_config_pool, "<Global> Pool");
     }
 
@@ -710,7 +710,7 @@ server_rec *pr_parser_server_ctxt_open(const char *addrstr) {
   server_rec *s;
   pool *p;
 
-  p = make_sub_pool(permanent_pool);
+  p = make_sub_pool(pr_pool_get_arena());
   pr_pool_tag(p, "<VirtualHost> Pool");
 
   s = (server_rec *) pcalloc(p, sizeof(server_rec));
@@ -30,6 +30,14 @@
 
 #include "conf.h"
 
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#if defined(__GLIBC__)
+# include <malloc.h>
+#endif
+
 /* Manage free storage blocks */
 
 union align {
@@ -55,11 +63,37 @@ union block_hdr {
     char *endp;
     union block_hdr *next;
     char *first_avail;
+    int flags;
   } h;
 };
 
+/* Block is carved out of an arena chunk, rather than malloc'd */
+#define BLOCK_FL_ARENA		0x0001
+
 static union block_hdr *block_freelist = NULL;
 
+/* The arena holds long-lived, read-mostly data (configuration trees, stash
+ * symbols, regex records).  Its blocks are carved out of dedicated,
+ * page-aligned chunks, and never share pages with the blocks of other pools.
+ * Once frozen, the arena pages of the daemon are not written to, and so
+ * remain shared (copy-on-write) with all of the forked session processes.
+ */
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+};
+
+#define ARENA_CHUNK_SZ		(256 * 1024)
+#define ARENA_CHUNK_HDR_SZ \
+  (sizeof(union block_hdr) * \
+   (1 + ((sizeof(struct arena_chunk) - 1) / sizeof(union block_hdr))))
+
+static struct arena_chunk *arena_chunks = NULL;
+static union block_hdr *arena_freelist = NULL;
+static pool *arena_pool = NULL;
+static int arena_flags = 0;
+
 /* Statistics */
 static unsigned int stat_malloc = 0;	/* incr when malloc required */
 static unsigned int stat_freehit = 0;	/* incr when freelist used */
@@ -129,8 +163,80 @@ static union block_hdr *malloc_block(size_t size) {
   blok->h.next = NULL;
   blok->h.first_avail = (char *) (blok + 1);
   blok->h.endp = size + blok->h.first_avail;
+  blok->h.flags = 0;
+
+  return blok;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+static struct arena_chunk *arena_new_chunk(size_t size) {
+  struct arena_chunk *chunk;
+  size_t chunksz, pagesz;
+  long res;
+  void *ptr;
+
+  res = sysconf(_SC_PAGESIZE);
+  pagesz = res > 0 ? (size_t) res : 4096;
+
+  chunksz = ARENA_CHUNK_HDR_SZ + size;
+  if (chunksz < ARENA_CHUNK_SZ) {
+    chunksz = ARENA_CHUNK_SZ;
+  }
+
+  chunksz = pagesz * (1 + ((chunksz - 1) / pagesz));
+
+# if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS	MAP_ANON
+# endif
+  ptr = mmap(NULL, chunksz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+    -1, 0);
+  if (ptr == MAP_FAILED) {
+    return NULL;
+  }
+
+  chunk = ptr;
+  chunk->size = chunksz;
+  chunk->used = ARENA_CHUNK_HDR_SZ;
+  chunk->next = arena_chunks;
+  arena_chunks = chunk;
+
+  return chunk;
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+/* Grab a new block from the arena chunks, mapping a new chunk if needed.
+ * If the arena cannot be used on this platform, fall back to malloc().
+ */
+static union block_hdr *arena_malloc_block(size_t size) {
+#ifdef HAVE_SYS_MMAN_H
+  union block_hdr *blok;
+  struct arena_chunk *chunk;
+  size_t blocksz;
+
+  blocksz = sizeof(union block_hdr) +
+    (CLICK_SZ * (1 + ((size - 1) / CLICK_SZ)));
+
+  chunk = arena_chunks;
+  if (chunk == NULL ||
+      (chunk->size - chunk->used) < blocksz) {
+    chunk = arena_new_chunk(blocksz);
+    if (chunk == NULL) {
+      return malloc_block(size);
+    }
+  }
+
+  blok = (union block_hdr *) (((char *) chunk) + chunk->used);
+  chunk->used += blocksz;
+
+  blok->h.next = NULL;
+  blok->h.first_avail = (char *) (blok + 1);
+  blok->h.endp = size + blok->h.first_avail;
+  blok->h.flags = BLOCK_FL_ARENA;
 
   return blok;
+#else
+  return malloc_block(size);
+#endif /* HAVE_SYS_MMAN_H */
 }
 
 static void chk_on_blk_list(union block_hdr *blok, union block_hdr *free_blk,
@@ -155,42 +261,51 @@ static void chk_on_blk_list(union block_hdr *blok, union block_hdr *free_blk,
 /* Free a chain of blocks -- _must_ call with alarms blocked. */
 
 static void free_blocks(union block_hdr *blok, const char *pool_tag) {
-  /* Puts new blocks at head of block list, point next pointer of
-   * last block in chain to free blocks we already had.
+  /* Puts the blocks at the head of the block list they came from (arena
+   * blocks are kept apart from malloc'd blocks), pointing the next pointer
+   * of each block to the free blocks we already had.
    */
 
   union block_hdr *old_free_list = block_freelist;
+  union block_hdr *old_arena_list = arena_freelist;
 
   if (!blok)
     return;		/* Shouldn't be freeing an empty pool */
 
-  block_freelist = blok;
-
-  /* Adjust first_avail pointers */
+  while (blok) {
+    union block_hdr *next = blok->h.next;
 
-  while (blok->h.next) {
-    chk_on_blk_list(blok, old_free_list, pool_tag);
+    /* Adjust first_avail pointers */
     blok->h.first_avail = (char *) (blok + 1);
-    blok = blok->h.next;
-  }
 
-  chk_on_blk_list(blok, old_free_list, pool_tag);
-  blok->h.first_avail = (char *) (blok + 1);
-  blok->h.next = old_free_list;
+    if (blok->h.flags & BLOCK_FL_ARENA) {
+      chk_on_blk_list(blok, old_arena_list, pool_tag);
+      blok->h.next = arena_freelist;
+      arena_freelist = blok;
+
+    } else {
+      chk_on_blk_list(blok, old_free_list, pool_tag);
+      blok->h.next = block_freelist;
+      block_freelist = blok;
+    }
+
+    blok = next;
+  }
 }
 
 /* Get a new block, from the free list if possible, otherwise malloc a new
  * one.  minsz is the requested size of the block to be allocated.
  * If exact is TRUE, then minsz is the exact size of the allocated block;
  * otherwise, the allocated size will be rounded up from minsz to the nearest
- * multiple of BLOCK_MINFREE.
+ * multiple of BLOCK_MINFREE.  If arena is TRUE, the block is taken from
+ * the arena, rather than from the general free list.
  *
  * Important: BLOCK ALARMS BEFORE CALLING
  */
 
-static union block_hdr *new_block(int minsz, int exact) {
-  union block_hdr **lastptr = &block_freelist;
-  union block_hdr *blok = block_freelist;
+static union block_hdr *new_block(int minsz, int exact, int arena) {
+  union block_hdr **lastptr = arena ? &arena_freelist : &block_freelist;
+  union block_hdr *blok = *lastptr;
 
   if (!exact) {
     minsz = 1 + ((minsz - 1) / BLOCK_MINFREE);
@@ -215,6 +330,11 @@ static union block_hdr *new_block(int minsz, int exact) {
 
   /* Nope...damn.  Have to malloc() a new one. */
   stat_malloc++;
+
+  if (arena) {
+    return arena_malloc_block(minsz);
+  }
+
   return malloc_block(minsz);
 }
 
@@ -234,8 +354,12 @@ struct pool_rec {
   struct pool_rec *parent;
   char *free_first_avail;
   const char *tag;
+  int flags;
 };
 
+/* Pool (and its sub-pools) allocate their blocks from the arena */
+#define POOL_FL_ARENA		0x0001
+
 pool *permanent_pool = NULL;
 pool *global_config_pool = NULL;
 
@@ -340,6 +464,10 @@ static long walk_pools(pool *p, int level,
 }
 
 static void debug_pool_info(void (*debugf)(const char *, ...)) {
+  struct arena_chunk *chunk;
+  unsigned long arena_total = 0, arena_used = 0;
+  unsigned int arena_count = 0;
+
   if (block_freelist) {
     debugf("Free block list: %lu bytes",
       bytes_in_block_list(block_freelist));
@@ -348,13 +476,24 @@ static void debug_pool_info(void (*debugf)(const char *, ...)) {
     debugf("Free block list: empty");
   }
 
+  for (chunk = arena_chunks; chunk; chunk = chunk->next) {
+    arena_count++;
+    arena_total += chunk->size;
+    arena_used += chunk->used;
+  }
+
+  debugf("Arena: %lu of %lu bytes used in %u %s%s", arena_used, arena_total,
+    arena_count, arena_count != 1 ? "chunks" : "chunk",
+    (arena_flags & PR_POOL_ARENA_FL_PROTECT) ? " (protected)" : "");
+
   debugf("%u blocks allocated", stat_malloc);
   debugf("%u blocks reused", stat_freehit);
 }
 
 void pr_pool_debug_memory(void (*debugf)(const char *, ...)) {
   debugf("Memory pool allocation:");
-  debugf("Total %lu bytes allocated", walk_pools(permanent_pool, 0, debugf));
+  debugf("Total %lu bytes allocated", walk_pools(permanent_pool, 0, debugf) +
+    walk_pools(arena_pool, 0, debugf));
   debug_pool_info(debugf);
 }
 
@@ -395,7 +534,7 @@ struct pool_rec *make_sub_pool(struct pool_rec *p) {
 
   pr_alarms_block();
 
-  blok = new_block(0, FALSE);
+  blok = new_block(0, FALSE, p ? (p->flags & POOL_FL_ARENA) : FALSE);
 
   new_pool = (pool *) blok->h.first_avail;
   blok->h.first_avail += POOL_HDR_BYTES;
@@ -405,6 +544,7 @@ struct pool_rec *make_sub_pool(struct pool_rec *p) {
   new_pool->first = new_pool->last = blok;
 
   if (p) {
+    new_pool->flags = p->flags;
     new_pool->parent = p;
     new_pool->sub_next = p->sub_pools;
 
@@ -425,7 +565,8 @@ struct pool_rec *pr_pool_create_sz(struct pool_rec *p, size_t sz) {
 
   pr_alarms_block();
 
-  blok = new_block(sz + POOL_HDR_BYTES, TRUE);
+  blok = new_block(sz + POOL_HDR_BYTES, TRUE,
+    p ? (p->flags & POOL_FL_ARENA) : FALSE);
 
   new_pool = (pool *) blok->h.first_avail;
   blok->h.first_avail += POOL_HDR_BYTES;
@@ -435,6 +576,7 @@ struct pool_rec *pr_pool_create_sz(struct pool_rec *p, size_t sz) {
   new_pool->first = new_pool->last = blok;
 
   if (p) {
+    new_pool->flags = p->flags;
     new_pool->parent = p;
     new_pool->sub_next = p->sub_pools;
 
@@ -460,9 +602,161 @@ void init_pools(void) {
 }
 
 void free_pools(void) {
+  pr_pool_arena_thaw();
+
   destroy_pool(permanent_pool);
   permanent_pool = NULL;
+  destroy_pool(arena_pool);
+  arena_pool = NULL;
+  pool_release_free_block_list();
+
+#ifdef HAVE_SYS_MMAN_H
+  while (arena_chunks) {
+    struct arena_chunk *chunk = arena_chunks;
+
+    arena_chunks = chunk->next;
+    (void) munmap((void *) chunk, chunk->size);
+  }
+#endif /* HAVE_SYS_MMAN_H */
+  arena_freelist = NULL;
+}
+
+/* Arena management */
+
+pool *pr_pool_get_arena(void) {
+  union block_hdr *blok;
+
+  if (arena_pool != NULL) {
+    return arena_pool;
+  }
+
+  pr_alarms_block();
+
+  blok = new_block(0, FALSE, TRUE);
+
+  arena_pool = (pool *) blok->h.first_avail;
+  blok->h.first_avail += POOL_HDR_BYTES;
+
+  memset(arena_pool, 0, sizeof(struct pool_rec));
+  arena_pool->free_first_avail = blok->h.first_avail;
+  arena_pool->first = arena_pool->last = blok;
+  arena_pool->flags = POOL_FL_ARENA;
+  arena_pool->tag = "Arena Pool";
+
+  /* Note that the arena pool is deliberately not a sub-pool of the
+   * permanent pool; creating or destroying any sibling pool would otherwise
+   * write to the arena.
+   */
+
+  pr_alarms_unblock();
+
+  return arena_pool;
+}
+
+int pr_pool_arena_freeze(int flags) {
+  int res = 0;
+
+  pr_alarms_block();
+
+  /* The free blocks left over from parsing the configuration would otherwise
+   * be inherited by, and dirtied in, every session process.  Hand them (and
+   * any trimmable heap) back to the system before we start forking.
+   */
   pool_release_free_block_list();
+
+#if defined(__GLIBC__)
+  (void) malloc_trim(0);
+#endif /* __GLIBC__ */
+
+  if (flags & PR_POOL_ARENA_FL_PROTECT) {
+#ifdef HAVE_SYS_MMAN_H
+    struct arena_chunk *chunk;
+
+    for (chunk = arena_chunks; chunk; chunk = chunk->next) {
+      if (mprotect((void *) chunk, chunk->size, PROT_READ) < 0) {
+        int xerrno = errno;
+
+        pr_alarms_unblock();
+        pr_pool_arena_thaw();
+
+        errno = xerrno;
+        return -1;
+      }
+    }
+
+    arena_flags |= PR_POOL_ARENA_FL_PROTECT;
+#else
+    errno = ENOSYS;
+    res = -1;
+#endif /* HAVE_SYS_MMAN_H */
+  }
+
+  pr_alarms_unblock();
+  return res;
+}
+
+int pr_pool_arena_thaw(void) {
+#ifdef HAVE_SYS_MMAN_H
+  struct arena_chunk *chunk;
+
+  if (!(arena_flags & PR_POOL_ARENA_FL_PROTECT)) {
+    return 0;
+  }
+
+  for (chunk = arena_chunks; chunk; chunk = chunk->next) {
+    if (mprotect((void *) chunk, chunk->size, PROT_READ|PROT_WRITE) < 0) {
+      return -1;
+    }
+  }
+
+  arena_flags &= ~PR_POOL_ARENA_FL_PROTECT;
+#endif /* HAVE_SYS_MMAN_H */
+
+  return 0;
+}
+
+int pr_pool_arena_get_flags(void) {
+  return arena_flags;
+}
+
+int pr_pool_get_page_usage(unsigned long *shared_kb,
+    unsigned long *private_kb) {
+  FILE *fh;
+  char buf[256];
+  unsigned long shared = 0, private = 0;
+
+  if (shared_kb == NULL ||
+      private_kb == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* The rollup of the per-mapping counters is only available on Linux (and
+   * only as of 4.14); other platforms get ENOENT.
+   */
+  fh = fopen("/proc/self/smaps_rollup", "r");
+  if (fh == NULL) {
+    return -1;
+  }
+
+  while (fgets(buf, sizeof(buf), fh) != NULL) {
+    unsigned long kb = 0;
+
+    if (sscanf(buf, "Shared_Clean: %lu kB", &kb) == 1 ||
+        sscanf(buf, "Shared_Dirty: %lu kB", &kb) == 1) {
+      shared += kb;
+
+    } else if (sscanf(buf, "Private_Clean: %lu kB", &kb) == 1 ||
+               sscanf(buf, "Private_Dirty: %lu kB", &kb) == 1) {
+      private += kb;
+    }
+  }
+
+  fclose(fh);
+
+  *shared_kb = shared;
+  *private_kb = private;
+  return 0;
 }
 
 static void clear_pool(struct pool_rec *p) {
@@ -566,7 +860,7 @@ static void *alloc_pool(struct pool_rec *p, size_t reqsz, int exact) {
   /* Need a new one that's big enough */
   pr_alarms_block();
 
-  blok = new_block(sz, exact);
+  blok = new_block(sz, exact, p->flags & POOL_FL_ARENA);
   p->last->h.next = blok;
   p->last = blok;
 
@@ -32,6 +32,26 @@
 
 #ifdef PR_USE_REGEX
 
+/* Compiled regexes are shared, via a cache keyed by the pattern and flags,
+ * among all of the pr_regex_t objects using them; the same HideFiles or
+ * PathDenyFilter pattern, for example, is often configured many times.
+ * Each record has its own pool, destroyed along with the compiled regex
+ * when the last reference is dropped.
+ */
+struct regexp_cache_rec {
+  pool *pool;
+
+  /* NULL for a regex which failed to compile; such regexes are not cached. */
+  const char *key;
+  unsigned int refcount;
+
+  regex_t *re;
+#ifdef PR_USE_PCRE
+  pcre *pcre;
+  pcre_extra *pcre_extra;
+#endif /* PR_USE_PCRE */
+};
+
 #ifdef PR_USE_PCRE
 struct regexp_rec {
   pool *regex_pool;
@@ -42,6 +62,9 @@ struct regexp_rec {
   /* Copy of the original regular expression pattern */
   const char *pattern;
 
+  /* Shared compiled regex, if any */
+  struct regexp_cache_rec *cached;
+
   /* For callers wishing to use POSIX REs */
   regex_t *re;
 
@@ -65,6 +88,9 @@ struct regexp_rec {
   /* Copy of the original regular expression pattern */
   const char *pattern;
 
+  /* Shared compiled regex, if any */
+  struct regexp_cache_rec *cached;
+
   /* For callers wishing to use POSIX REs */
   regex_t *re;
 };
@@ -73,31 +99,151 @@ struct regexp_rec {
 
 static pool *regexp_pool = NULL;
 static array_header *regexp_list = NULL;
+static pr_table_t *regexp_cache = NULL;
 
 static const char *trace_channel = "regexp";
 
+#ifdef PR_USE_PCRE
+static void regexp_free_pcre_extra(pcre_extra *extra) {
+  if (extra == NULL) {
+    return;
+  }
+
+# ifdef PCRE_STUDY_JIT_COMPILE
+  /* Studied data, including any JIT code, must be freed via
+   * pcre_free_study().
+   */
+  pcre_free_study(extra);
+# else
+  pcre_free(extra);
+# endif /* PCRE_STUDY_JIT_COMPILE */
+}
+#endif /* PR_USE_PCRE */
+
+static void regexp_cache_free(struct regexp_cache_rec *rc) {
+  if (rc->key != NULL) {
+    (void) pr_table_remove(regexp_cache, rc->key, NULL);
+  }
+
+#ifdef PR_USE_PCRE
+  if (rc->pcre_extra != NULL) {
+    regexp_free_pcre_extra(rc->pcre_extra);
+    rc->pcre_extra = NULL;
+  }
+
+  if (rc->pcre != NULL) {
+    pcre_free(rc->pcre);
+    rc->pcre = NULL;
+  }
+#endif /* PR_USE_PCRE */
+
+  if (rc->re != NULL &&
+      rc->key != NULL) {
+    /* This frees memory associated with this pointer by regcomp(3). */
+    regfree(rc->re);
+    rc->re = NULL;
+  }
+
+  destroy_pool(rc->pool);
+}
+
+/* Releases the compiled regex of the given pr_regex_t, by dropping its
+ * reference to the cache record.
+ */
+static void regexp_release(pr_regex_t *pre) {
+  if (pre->cached != NULL) {
+    struct regexp_cache_rec *rc;
+
+    rc = pre->cached;
+    pre->cached = NULL;
+
+    rc->refcount--;
+    if (rc->refcount == 0) {
+      if (rc->key != NULL) {
+        pr_trace_msg(trace_channel, 17, "freeing cached regex for key '%s'",
+          rc->key);
+      }
+
+      regexp_cache_free(rc);
+    }
+  }
+
+#ifdef PR_USE_PCRE
+  pre->pcre = NULL;
+  pre->pcre_extra = NULL;
+#endif /* PR_USE_PCRE */
+  pre->re = NULL;
+}
+
+static const char *regexp_cache_key(pool *p, char engine,
+    const char *pattern, int flags) {
+  char buf[32];
+
+  memset(buf, '\0', sizeof(buf));
+  snprintf(buf, sizeof(buf)-1, "%c%d:", engine, flags);
+
+  return pstrcat(p, buf, pattern, NULL);
+}
+
+static struct regexp_cache_rec *regexp_cache_get(const char *key) {
+  struct regexp_cache_rec *rc;
+
+  if (regexp_cache == NULL) {
+    return NULL;
+  }
+
+  rc = (struct regexp_cache_rec *) pr_table_get(regexp_cache, key, NULL);
+  if (rc != NULL) {
+    pr_trace_msg(trace_channel, 17, "using cached regex for key '%s'", key);
+    rc->refcount++;
+  }
+
+  return rc;
+}
+
+/* Allocates a new, not yet cached, record holding a single reference. */
+static struct regexp_cache_rec *regexp_cache_alloc(void) {
+  pool *rc_pool;
+  struct regexp_cache_rec *rc;
+
+  rc_pool = pr_pool_create_sz(regexp_pool, 128);
+  pr_pool_tag(rc_pool, "regexp cache pool");
+
+  rc = pcalloc(rc_pool, sizeof(struct regexp_cache_rec));
+  rc->pool = rc_pool;
+  rc->refcount = 1;
+
+  return rc;
+}
+
+/* Adds a successfully compiled record to the cache, for sharing. */
+static void regexp_cache_add(struct regexp_cache_rec *rc, const char *key) {
+  if (regexp_cache == NULL) {
+    unsigned int max_ents = (unsigned int) -1;
+
+    regexp_cache = pr_table_nalloc(regexp_pool, 0, 256);
+    (void) pr_table_ctl(regexp_cache, PR_TABLE_CTL_SET_MAX_ENTS, &max_ents);
+  }
+
+  rc->key = pstrdup(rc->pool, key);
+
+  if (pr_table_add(regexp_cache, rc->key, rc, sizeof(struct regexp_cache_rec))
+      < 0) {
+    pr_trace_msg(trace_channel, 3, "error caching regex for key '%s': %s",
+      key, strerror(errno));
+  }
+}
+
 static void regexp_cleanup(void) {
   /* Only perform this cleanup if necessary */
   if (regexp_pool) {
     register unsigned int i = 0;
     pr_regex_t **pres = (pr_regex_t **) regexp_list->elts;
 
+    /* Releasing every regex drops every cache record as well. */
     for (i = 0; i < regexp_list->nelts; i++) {
       if (pres[i] != NULL) {
-
-#ifdef PR_USE_PCRE
-        if (pres[i]->pcre != NULL) {
-          /* This frees memory associated with this pointer by regcomp(3). */
-          pcre_free(pres[i]->pcre);
-          pres[i]->pcre = NULL;
-        }
-#endif /* PR_USE_PCRE */
-
-        if (pres[i]->re != NULL) {
-          /* This frees memory associated with this pointer by regcomp(3). */
-          regfree(pres[i]->re);
-          pres[i]->re = NULL;
-        }
+        regexp_release(pres[i]);
 
         /* This frees the memory allocated for the object itself. */
         destroy_pool(pres[i]->regex_pool);
@@ -107,6 +253,7 @@ static void regexp_cleanup(void) {
     destroy_pool(regexp_pool);
     regexp_pool = NULL;
     regexp_list = NULL;
+    regexp_cache = NULL;
   }
 }
 
@@ -128,7 +275,7 @@ pr_regex_t *pr_regexp_alloc(module *m) {
    * cleanup handler for this pool, to free up the data in the list.
    */
   if (regexp_pool == NULL) {
-    regexp_pool = make_sub_pool(permanent_pool);
+    regexp_pool = make_sub_pool(pr_pool_get_arena());
     pr_pool_tag(regexp_pool, "Regexp Pool");
     regexp_list = make_array(regexp_pool, 0, sizeof(pr_regex_t *));
   }
@@ -163,21 +310,7 @@ void pr_regexp_free(module *m, pr_regex_t *pre) {
 
     if ((pre != NULL && pres[i] == pre) ||
         (m != NULL && pres[i]->m == m)) {
-
-#ifdef PR_USE_PCRE
-      if (pres[i]->pcre != NULL) {
-        /* This frees memory associated with this pointer by regcomp(3). */
-        pcre_free(pres[i]->pcre);
-        pres[i]->pcre = NULL;
-      }
-#endif /* PR_USE_PCRE */
-
-      if (pres[i]->re != NULL) {
-        /* This frees memory associated with this pointer by regcomp(3). */
-        regfree(pres[i]->re);
-        pres[i]->re = NULL;
-      }
-
+      regexp_release(pres[i]);
       pres[i]->pattern = NULL;
 
       /* This frees the memory allocated for the object itself. */
@@ -190,7 +323,10 @@ void pr_regexp_free(module *m, pr_regex_t *pre) {
 #ifdef PR_USE_PCRE
 static int regexp_compile_pcre(pr_regex_t *pre, const char *pattern,
     int flags) {
-  int err_offset;
+  int err_offset, study_flags = 0;
+  const char *key;
+  struct regexp_cache_rec *rc;
+  pcre *pcre;
 
   if (pre == NULL ||
       pattern == NULL) {
@@ -198,30 +334,56 @@ static int regexp_compile_pcre(pr_regex_t *pre, const char *pattern,
     return -1;
   }
 
-  pr_trace_msg(trace_channel, 9, "compiling pattern '%s' into PCRE regex",
-    pattern);
+  regexp_release(pre);
+  pre->pcre_errstr = NULL;
   pre->pattern = pstrdup(pre->regex_pool, pattern);
 
-  pre->pcre = pcre_compile(pattern, flags, &(pre->pcre_errstr), &err_offset,
-    NULL);
+  key = regexp_cache_key(pre->regex_pool, 'p', pattern, flags);
+  rc = regexp_cache_get(key);
+  if (rc != NULL) {
+    pre->cached = rc;
+    pre->pcre = rc->pcre;
+    pre->pcre_extra = rc->pcre_extra;
+    return 0;
+  }
 
-  if (pre->pcre == NULL) {
+  pr_trace_msg(trace_channel, 9, "compiling pattern '%s' into PCRE regex",
+    pattern);
+  pcre = pcre_compile(pattern, flags, &(pre->pcre_errstr), &err_offset, NULL);
+  if (pcre == NULL) {
     pr_trace_msg(trace_channel, 4,
       "error compiling pattern '%s' into PCRE regex: %s", pattern,
       pre->pcre_errstr);
     return -1;
   }
 
-  /* Study the pattern as well, just in case. */
+  rc = regexp_cache_alloc();
+  rc->pcre = pcre;
+  regexp_cache_add(rc, key);
+
+  /* Study the pattern as well, requesting JIT compilation where supported.
+   * Patterns are mostly compiled while parsing the configuration, so the
+   * JIT code is generated once in the daemon, and shared by the sessions.
+   */
+#ifdef PCRE_STUDY_JIT_COMPILE
+  study_flags |= PCRE_STUDY_JIT_COMPILE;
+#endif /* PCRE_STUDY_JIT_COMPILE */
+
   pr_trace_msg(trace_channel, 9, "studying pattern '%s' for PCRE extra data",
     pattern);
-  pre->pcre_extra = pcre_study(pre->pcre, 0, &(pre->pcre_errstr));
+  rc->pcre_extra = pcre_study(pcre, study_flags, &(pre->pcre_errstr));
+
+  pre->cached = rc;
+  pre->pcre = rc->pcre;
+  pre->pcre_extra = rc->pcre_extra;
   return 0;
 }
 #endif /* PR_USE_PCRE */
 
 int pr_regexp_compile_posix(pr_regex_t *pre, const char *pattern, int flags) {
   int res;
+  const char *key;
+  struct regexp_cache_rec *rc;
 
   if (pre == NULL ||
       pattern == NULL) {
@@ -229,19 +391,35 @@ int pr_regexp_compile_posix(pr_regex_t *pre, const char *pattern, int flags) {
     return -1;
   }
 
-  if (pre->re != NULL) {
-    regfree(pre->re);
-    pre->re = NULL;
+  regexp_release(pre);
+  pre->pattern = pstrdup(pre->regex_pool, pattern);
+
+  key = regexp_cache_key(pre->regex_pool, 'x', pattern, flags);
+  rc = regexp_cache_get(key);
+  if (rc != NULL) {
+    pre->cached = rc;
+    pre->re = rc->re;
+    return 0;
   }
 
   pr_trace_msg(trace_channel, 9, "compiling pattern '%s' into POSIX regex",
     pattern);
-  pre->pattern = pstrdup(pre->regex_pool, pattern);
 
-  pre->re = pcalloc(pre->regex_pool, sizeof(regex_t));
-  res = regcomp(pre->re, pattern, flags);
+  /* Compile directly into the record; a regex_t may not be copied. */
+  rc = regexp_cache_alloc();
+  rc->re = pcalloc(rc->pool, sizeof(regex_t));
 
-  return res;
+  pre->cached = rc;
+  pre->re = rc->re;
+
+  res = regcomp(rc->re, pattern, flags);
+  if (res != 0) {
+    /* Keep the failed regex private, for use by pr_regexp_error(). */
+    return res;
+  }
+
+  regexp_cache_add(rc, key);
+  return 0;
 }
 
 int pr_regexp_compile(pr_regex_t *pre, const char *pattern, int flags) {
@@ -314,6 +492,7 @@ static int regexp_exec_pcre(pr_regex_t *pre, const char *str,
   if (pre->pcre != NULL) {
     int res;
     size_t str_len;
+    pcre_extra *extra, limits_extra;
 
     str_len = strlen(str);
 
@@ -328,29 +507,37 @@ static int regexp_exec_pcre(pr_regex_t *pre, const char *str,
       match_limit_recursion = pcre_match_limit_recursion;
     }
 
-    if (match_limit > 0) {
-      if (pre->pcre_extra == NULL) {
-        pre->pcre_extra = pcalloc(pre->regex_pool, sizeof(pcre_extra));
+    /* The studied data may be shared with other regexes; apply any limits
+     * to a copy of it.
+     */
+    extra = pre->pcre_extra;
+
+    if (match_limit > 0 ||
+        match_limit_recursion > 0) {
+      if (pre->pcre_extra != NULL) {
+        memcpy(&limits_extra, pre->pcre_extra, sizeof(pcre_extra));
+
+      } else {
+        memset(&limits_extra, 0, sizeof(pcre_extra));
       }
 
-      pre->pcre_extra->flags |= PCRE_EXTRA_MATCH_LIMIT;
-      pre->pcre_extra->match_limit = match_limit;
-    }
+      if (match_limit > 0) {
+        limits_extra.flags |= PCRE_EXTRA_MATCH_LIMIT;
+        limits_extra.match_limit = match_limit;
+      }
 
-    if (match_limit_recursion > 0) {
-      if (pre->pcre_extra == NULL) {
-        pre->pcre_extra = pcalloc(pre->regex_pool, sizeof(pcre_extra));
+      if (match_limit_recursion > 0) {
+        limits_extra.flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+        limits_extra.match_limit_recursion = match_limit_recursion;
       }
 
-      pre->pcre_extra->flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
-      pre->pcre_extra->match_limit_recursion = match_limit_recursion;
+      extra = &limits_extra;
     }
 
     pr_trace_msg(trace_channel, 9,
       "executing PCRE regex '%s' against subject '%s'",
       pr_regexp_get_pattern(pre), str);
-    res = pcre_exec(pre->pcre, pre->pcre_extra, str, str_len, 0, flags,
-      NULL, 0);
+    res = pcre_exec(pre->pcre, extra, str, str_len, 0, flags, NULL, 0);
 
     if (res < 0) {
       if (pr_trace_get_level(trace_channel) >= 9) {
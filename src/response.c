@@ -36,6 +36,15 @@ static pool *resp_pool = NULL;
 
 static char resp_buf[PR_RESPONSE_BUFFER_SIZE] = {'\0'};
 
+/* Responses flushed while deferral is enabled are collected here, and
+ * written out together; responses sent directly are never deferred.
+ */
+#define RESPONSE_DEFERRED_BUFSZ		(PR_RESPONSE_BUFFER_SIZE * 4)
+
+static int resp_deferred = FALSE, resp_flushing = FALSE;
+static char resp_deferred_buf[RESPONSE_DEFERRED_BUFSZ];
+static size_t resp_deferred_buflen = 0;
+
 static char *resp_last_response_code = NULL;
 static char *resp_last_response_msg = NULL;
 
@@ -46,17 +55,17 @@ static const char *trace_channel = "response";
 #define RESPONSE_WRITE_NUM_STR(strm, fmt, numeric, msg) \
   pr_trace_msg(trace_channel, 1, (fmt), (numeric), (msg)); \
   if (resp_handler_cb) \
-    pr_netio_printf((strm), "%s", resp_handler_cb(resp_pool, (fmt), (numeric), \
+    resp_printf((strm), "%s", resp_handler_cb(resp_pool, (fmt), (numeric), \
       (msg))); \
   else \
-    pr_netio_printf((strm), (fmt), (numeric), (msg));
+    resp_printf((strm), (fmt), (numeric), (msg));
 
 #define RESPONSE_WRITE_STR(strm, fmt, msg) \
   pr_trace_msg(trace_channel, 1, (fmt), (msg)); \
   if (resp_handler_cb) \
-    pr_netio_printf((strm), "%s", resp_handler_cb(resp_pool, (fmt), (msg))); \
+    resp_printf((strm), "%s", resp_handler_cb(resp_pool, (fmt), (msg))); \
   else \
-    pr_netio_printf((strm), (fmt), (msg));
+    resp_printf((strm), (fmt), (msg));
 
 #define RESPONSE_WRITE_STR_ASYNC(strm, fmt, msg) \
   pr_trace_msg(trace_channel, 1, pstrcat(session.pool, "async: ", (fmt), NULL), \
@@ -67,6 +76,84 @@ static const char *trace_channel = "response";
   else \
     pr_netio_printf_async((strm), (fmt), (msg));
 
+static int resp_write_deferred(void) {
+  int res = 0;
+
+  if (resp_deferred_buflen == 0) {
+    return 0;
+  }
+
+  if (session.c != NULL) {
+    pr_trace_msg(trace_channel, 19, "writing %lu bytes of deferred responses",
+      (unsigned long) resp_deferred_buflen);
+    res = pr_netio_write(session.c->outstrm, resp_deferred_buf,
+      resp_deferred_buflen);
+  }
+
+  resp_deferred_buflen = 0;
+  return res;
+}
+
+/* Async responses, e.g. sent from signal handlers, must not overtake any
+ * deferred ones either; write those out without blocking.
+ */
+static int resp_write_deferred_async(void) {
+  int res = 0;
+
+  if (resp_deferred_buflen == 0) {
+    return 0;
+  }
+
+  if (session.c != NULL) {
+    res = pr_netio_write_async(session.c->outstrm, resp_deferred_buf,
+      resp_deferred_buflen);
+  }
+
+  resp_deferred_buflen = 0;
+  return res;
+}
+
+static int resp_printf(pr_netio_stream_t *strm, const char *fmt, ...)
+#ifdef __GNUC__
+  __attribute__ ((format (printf, 2, 3)));
+#else
+  ;
+#endif
+
+static int resp_printf(pr_netio_stream_t *strm, const char *fmt, ...) {
+  char buf[PR_RESPONSE_BUFFER_SIZE];
+  size_t buflen;
+  va_list msg;
+
+  if (resp_deferred == FALSE ||
+      resp_flushing == FALSE) {
+    int res;
+
+    va_start(msg, fmt);
+    res = pr_netio_vprintf(strm, fmt, msg);
+    va_end(msg);
+
+    return res;
+  }
+
+  va_start(msg, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, msg);
+  va_end(msg);
+  buf[sizeof(buf)-1] = '\0';
+
+  buflen = strlen(buf);
+  if (resp_deferred_buflen + buflen > sizeof(resp_deferred_buf)) {
+    if (resp_write_deferred() < 0) {
+      return -1;
+    }
+  }
+
+  memcpy(resp_deferred_buf + resp_deferred_buflen, buf, buflen);
+  resp_deferred_buflen += buflen;
+
+  return (int) buflen;
+}
+
 pool *pr_response_get_pool(void) {
   return resp_pool;
 }
@@ -139,6 +226,21 @@ int pr_response_block(int bool) {
   return -1;
 }
 
+int pr_response_defer(int bool) {
+  if (bool == TRUE) {
+    resp_deferred = TRUE;
+    return 0;
+  }
+
+  if (bool == FALSE) {
+    resp_deferred = FALSE;
+    return resp_write_deferred();
+  }
+
+  errno = EINVAL;
+  return -1;
+}
+
 void pr_response_clear(pr_response_t **head) {
   reset_last_response();
 
@@ -167,6 +269,8 @@ void pr_response_flush(pr_response_t **head) {
     return;
   }
 
+  resp_flushing = TRUE;
+
   for (resp = *head; resp; resp = resp->next) {
     if (ml) {
       /* Look for end of multiline */
@@ -205,6 +309,7 @@ void pr_response_flush(pr_response_t **head) {
     }
   }
 
+  resp_flushing = FALSE;
   pr_response_clear(head);
 }
 
@@ -328,6 +433,8 @@ void pr_response_send_async(const char *resp_numeric, const char *fmt, ...) {
   resp_last_response_code = pstrdup(resp_pool, resp_numeric);
   resp_last_response_msg = pstrdup(resp_pool, buf + strlen(resp_numeric) + 1);
 
+  (void) resp_write_deferred_async();
+
   sstrcat(buf, "\r\n", sizeof(buf));
   RESPONSE_WRITE_STR_ASYNC(session.c->outstrm, "%s", buf)
 }
@@ -346,6 +453,9 @@ void pr_response_send(const char *resp_numeric, const char *fmt, ...) {
     return;
   }
 
+  /* Responses sent immediately must not overtake any deferred ones. */
+  (void) resp_write_deferred();
+
   va_start(msg, fmt);
   vsnprintf(resp_buf, sizeof(resp_buf), fmt, msg);
   va_end(msg);
@@ -373,6 +483,8 @@ void pr_response_send_raw(const char *fmt, ...) {
     return;
   }
 
+  (void) resp_write_deferred();
+
   va_start(msg, fmt);
   vsnprintf(resp_buf, sizeof(resp_buf), fmt, msg);
   va_end(msg);
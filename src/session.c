@@ -31,6 +31,14 @@ extern unsigned char is_master;
 
 static void sess_cleanup(int flags) {
 
+  /* The exit handlers may need to release configuration memory, so make
+   * sure that the arena is writable again.
+   */
+  pr_pool_arena_thaw();
+
+  /* Write out any responses still waiting for more pipelined commands. */
+  pr_response_defer(FALSE);
+
   /* Clear the scoreboard entry. */
   if (ServerType == SERVER_STANDALONE) {
 
@@ -86,6 +94,13 @@ static void sess_cleanup(int flags) {
   if (!is_master ||
       (ServerType == SERVER_INETD &&
       !(flags & PR_SESS_END_FL_SYNTAX_CHECK))) {
+    unsigned long shared_kb = 0, private_kb = 0;
+
+    if (pr_pool_get_page_usage(&shared_kb, &private_kb) == 0) {
+      pr_log_debug(DEBUG5, "session memory: %lu KB shared, %lu KB private",
+        shared_kb, private_kb);
+    }
+
     pr_log_pri(PR_LOG_INFO, "%s session closed.",
       pr_session_get_protocol(PR_SESS_PROTO_FL_LOGOUT));
   }
@@ -53,6 +53,7 @@ xaset_t *xaset_create(pool *p, XASET_COMPARE cmpfunc) {
   new_set->xas_list = NULL;
   new_set->pool = p;
   new_set->xas_compare = cmpfunc;
+  new_set->xas_last = NULL;
 
   return new_set;
 }
@@ -74,6 +75,9 @@ int xaset_insert(xaset_t *set, xasetmember_t *member) {
   if (set->xas_list)
     set->xas_list->prev = member;
 
+  else
+    set->xas_last = member;
+
   set->xas_list = member;
   return 0;
 }
@@ -89,8 +93,16 @@ int xaset_insert_end(xaset_t *set, xasetmember_t *member) {
     return -1;
   }
 
-  for (tmp = &set->xas_list; *tmp; prev = *tmp, tmp = &(*tmp)->next)
-    ;
+  if (set->xas_list != NULL &&
+      set->xas_last != NULL &&
+      set->xas_last->next == NULL) {
+    prev = set->xas_last;
+    tmp = &prev->next;
+
+  } else {
+    for (tmp = &set->xas_list; *tmp; prev = *tmp, tmp = &(*tmp)->next)
+      ;
+  }
 
   *tmp = member;
   member->prev = prev;
@@ -99,6 +111,7 @@ int xaset_insert_end(xaset_t *set, xasetmember_t *member) {
   if (prev)
     prev->next = member;
 
+  set->xas_last = member;
   return 0;
 }
 
@@ -133,6 +146,9 @@ int xaset_insert_sort(xaset_t *set, xasetmember_t *member, int dups_allowed) {
   if (*setp)
     (*setp)->prev = member;
 
+  else
+    set->xas_last = member;
+
   member->prev = mprev;
   member->next = *setp;
   *setp = member;
@@ -173,6 +189,9 @@ int xaset_remove(xaset_t *set, xasetmember_t *member) {
   if (member->next)
     member->next->prev = member->prev;
 
+  else /* member is last in the list */
+    set->xas_last = member->prev;
+
   member->next = member->prev = NULL;
   return 0;
 }
@@ -220,6 +239,7 @@ xaset_t *xaset_copy(pool *p, xaset_t *set, size_t msize, XASET_MCOPY copyfunc) {
     if (*pos)
       pos = &(*pos)->next;
     *pos = n;
+    new_set->xas_last = n;
   }
 
   return new_set;
@@ -721,7 +721,7 @@ int init_stash(void) {
     destroy_pool(symbol_pool);
   }
 
-  symbol_pool = make_sub_pool(permanent_pool); 
+  symbol_pool = make_sub_pool(pr_pool_get_arena());
   pr_pool_tag(symbol_pool, "Stash Pool");
   memset(symbol_table, '\0', sizeof(symbol_table));
 
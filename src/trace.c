@@ -59,6 +59,7 @@ static const char *trace_channels[] = {
   "ident",
   "inet",
   "lock",
+  "metrics",
   "netacl",
   "netio",
   "pam",
@@ -74,6 +75,77 @@ static const char *trace_channels[] = {
   NULL
 };
 
+/* In-memory trace buffer.  When enabled, trace messages are not formatted
+ * as they are logged; instead, a binary record (the format string pointer,
+ * and copies of the arguments) is stored in a ring buffer.  The records are
+ * only formatted, and written to the TraceLog, when the buffer is dumped
+ * (on demand, periodically, or on a crash).  Once the ring is full, the
+ * oldest records are overwritten.
+ *
+ * Since the format string is only used at dump time, it must remain valid
+ * until then, i.e. it should be a string literal, as it is for nearly all
+ * callers.  Any string arguments are copied into the record.
+ */
+static pool *trace_buf_pool = NULL;
+static unsigned char *trace_buf = NULL;
+static size_t trace_bufsz = 0, trace_buf_head = 0, trace_buf_tail = 0;
+static unsigned int trace_buf_count = 0;
+static pid_t trace_buf_pid = 0;
+
+#define TRACE_BUFFER_MIN_SIZE		(32 * PR_TUNABLE_BUFFER_SIZE)
+#define TRACE_BUFFER_MAX_ARGS		16
+#define TRACE_BUFFER_MAX_CHANNEL_LEN	64
+#define TRACE_BUFFER_MAX_SPEC_LEN	32
+#define TRACE_DUMP_BUFFER_SIZE		(16 * PR_TUNABLE_BUFFER_SIZE)
+#define TRACE_BUFFER_ALIGN(n)		(((n) + 7) & ~((size_t) 7))
+
+#define TRACE_ARG_INT		1
+#define TRACE_ARG_LONG		2
+#define TRACE_ARG_LLONG		3
+#define TRACE_ARG_INTMAX	4
+#define TRACE_ARG_SIZE		5
+#define TRACE_ARG_PTRDIFF	6
+#define TRACE_ARG_DOUBLE	7
+#define TRACE_ARG_LDOUBLE	8
+#define TRACE_ARG_STR		9
+#define TRACE_ARG_PTR		10
+
+/* A %s precision taken from the preceding '*' argument. */
+#define TRACE_PREC_STAR		-2
+
+union trace_arg {
+  int i;
+  long l;
+  long long ll;
+  intmax_t j;
+  size_t z;
+  ptrdiff_t t;
+  double d;
+  const void *p;
+
+  /* Offset of the copied string within the record (zero for a NULL
+   * string), and its length.
+   */
+  struct {
+    unsigned int off;
+    unsigned int len;
+  } s;
+};
+
+/* Each record is laid out as: the header, the args, the arg types, the
+ * NUL-terminated channel, and then the copied strings.  A NULL fmt means
+ * that the message was formatted when logged; its text follows the
+ * channel.  A record length of zero marks the wrap point of the ring.
+ */
+struct trace_rec {
+  unsigned int reclen;
+  int level;
+  struct timeval tv;
+  const char *fmt;
+  unsigned int nargs;
+  unsigned int channel_off;
+};
+
 static void trace_restart_ev(const void *event_data, void *user_data) {
   trace_opts = PR_TRACE_OPT_DEFAULT;
 
@@ -91,42 +163,31 @@ static void trace_restart_ev(const void *event_data, void *user_data) {
   return;
 }
 
-static int trace_write(const char *channel, int level, const char *msg,
-    int discard) {
-  char buf[PR_TUNABLE_BUFFER_SIZE];
-  size_t buflen, len;
+/* Formats a TraceLog line, including the trailing newline, into the given
+ * buffer of PR_TUNABLE_BUFFER_SIZE bytes, returning the line length.
+ */
+static size_t trace_fmt_line(char *buf, const struct timeval *tv,
+    const char *channel, int level, const char *msg) {
+  size_t bufsz = PR_TUNABLE_BUFFER_SIZE, buflen, len;
+  time_t now;
   struct tm *tm;
   int use_conn_ips = FALSE;
 
-  if (trace_logfd < 0)
-    return 0;
-
-  memset(buf, '\0', sizeof(buf));
-
-  if (!(trace_opts & PR_TRACE_OPT_USE_TIMESTAMP_MILLIS)) {
-    time_t now;
+  memset(buf, '\0', bufsz);
 
-    now = time(NULL);
-    tm = pr_localtime(NULL, &now);
+  now = tv->tv_sec;
+  tm = pr_localtime(NULL, &now);
 
-    len = strftime(buf, sizeof(buf)-1, "%Y-%m-%d %H:%M:%S", tm);
-    buflen = len;
+  len = strftime(buf, bufsz-1, "%Y-%m-%d %H:%M:%S", tm);
+  buflen = len;
 
-  } else {
-    struct timeval now;
+  if (trace_opts & PR_TRACE_OPT_USE_TIMESTAMP_MILLIS) {
     unsigned long millis;
 
-    gettimeofday(&now, NULL);
-
-    tm = pr_localtime(NULL, (const time_t *) &(now.tv_sec));
-
-    len = strftime(buf, sizeof(buf)-1, "%Y-%m-%d %H:%M:%S", tm);
-    buflen = len;
-
     /* Convert microsecs to millisecs. */
-    millis = now.tv_usec / 1000;
+    millis = tv->tv_usec / 1000;
 
-    len = snprintf(buf + buflen, sizeof(buf) - buflen, ",%03lu", millis);
+    len = snprintf(buf + buflen, bufsz - buflen, ",%03lu", millis);
     buflen += len;
   }
 
@@ -140,7 +201,7 @@ static int trace_write(const char *channel, int level, const char *msg,
   }
 
   if (use_conn_ips == FALSE) {
-    len = snprintf(buf + buflen, sizeof(buf) - buflen, " [%u] <%s:%d>: %s",
+    len = snprintf(buf + buflen, bufsz - buflen, " [%u] <%s:%d>: %s",
       (unsigned int) (session.pid ? session.pid : getpid()), channel, level,
       msg);
     buflen += len;
@@ -153,7 +214,7 @@ static int trace_write(const char *channel, int level, const char *msg,
     server_ip = pr_netaddr_get_ipstr(session.c->local_addr);
     server_port = pr_netaddr_get_port(session.c->local_addr);
 
-    len = snprintf(buf + buflen, sizeof(buf) - buflen,
+    len = snprintf(buf + buflen, bufsz - buflen,
       " [%u] (client %s, server %s:%d) <%s:%d>: %s",
       (unsigned int) (session.pid ? session.pid : getpid()),
       client_ip != NULL ? client_ip : "none",
@@ -161,16 +222,32 @@ static int trace_write(const char *channel, int level, const char *msg,
     buflen += len;
   }
 
-  buf[sizeof(buf)-1] = '\0';
+  buf[bufsz-1] = '\0';
 
-  if (buflen < (sizeof(buf) - 1)) {
+  if (buflen < (bufsz - 1)) {
     buf[buflen] = '\n';
     buflen++;
 
   } else {
-    buf[sizeof(buf)-2] = '\n';
+    buf[bufsz-2] = '\n';
+    buflen = bufsz - 1;
   }
 
+  return buflen;
+}
+
+static int trace_write(const char *channel, int level, const char *msg,
+    int discard) {
+  char buf[PR_TUNABLE_BUFFER_SIZE];
+  size_t buflen;
+  struct timeval now;
+
+  if (trace_logfd < 0)
+    return 0;
+
+  gettimeofday(&now, NULL);
+  buflen = trace_fmt_line(buf, &now, channel, level, msg);
+
   pr_log_event_generate(PR_LOG_TYPE_TRACELOG, trace_logfd, level, buf, buflen);
 
   if (discard) {
@@ -185,6 +262,572 @@ static int trace_write(const char *channel, int level, const char *msg,
   return write(trace_logfd, buf, buflen);
 }
 
+static void trace_buffer_reset(void) {
+  trace_buf_head = trace_buf_tail = 0;
+  trace_buf_count = 0;
+  trace_buf_pid = session.pid;
+}
+
+static struct trace_rec *trace_buffer_rec(size_t off) {
+  struct trace_rec *rec;
+
+  if (off + sizeof(struct trace_rec) > trace_bufsz) {
+    return NULL;
+  }
+
+  rec = (struct trace_rec *) (trace_buf + off);
+  if (rec->reclen == 0) {
+    return NULL;
+  }
+
+  return rec;
+}
+
+/* Drops the oldest record from the ring. */
+static void trace_buffer_drop(void) {
+  struct trace_rec *rec;
+
+  rec = trace_buffer_rec(trace_buf_head);
+  if (rec == NULL) {
+    trace_buf_head = 0;
+    rec = trace_buffer_rec(0);
+  }
+
+  trace_buf_head += rec->reclen;
+  trace_buf_count--;
+
+  if (trace_buf_count == 0) {
+    trace_buf_head = trace_buf_tail;
+
+  } else if (trace_buffer_rec(trace_buf_head) == NULL) {
+    trace_buf_head = 0;
+  }
+}
+
+/* Makes room for a record of reclen bytes at the tail of the ring, dropping
+ * the oldest records as needed, and returns its offset.  The record is not
+ * part of the ring until trace_buf_tail/trace_buf_count are updated.
+ */
+static size_t trace_buffer_reserve(size_t reclen) {
+  if (trace_buf_tail + reclen > trace_bufsz) {
+    /* Wrap around, dropping the records between the tail and the end of
+     * the ring (if any).
+     */
+    while (trace_buf_count > 0 &&
+           trace_buf_head >= trace_buf_tail) {
+      trace_buffer_drop();
+    }
+
+    if (trace_buf_tail + sizeof(unsigned int) <= trace_bufsz) {
+      *((unsigned int *) (trace_buf + trace_buf_tail)) = 0;
+    }
+
+    trace_buf_tail = 0;
+    if (trace_buf_count == 0) {
+      trace_buf_head = 0;
+    }
+  }
+
+  while (trace_buf_count > 0 &&
+         trace_buf_head >= trace_buf_tail &&
+         trace_buf_head < trace_buf_tail + reclen) {
+    trace_buffer_drop();
+  }
+
+  return trace_buf_tail;
+}
+
+/* Parses the conversions in fmt, filling in the type of each argument (and
+ * the precision of any %s conversions).  Returns the number of arguments,
+ * or -1 if fmt uses anything which cannot be captured for formatting later
+ * (e.g. %n, %m, wide characters, positional arguments), in which case the
+ * message is formatted immediately.
+ */
+static int trace_buffer_parse_fmt(const char *fmt, unsigned char *types,
+    int *precs) {
+  const char *ptr;
+  int nargs = 0;
+
+  for (ptr = fmt; *ptr; ptr++) {
+    const char *spec;
+    int prec = -1;
+    char lmod = '\0';
+
+    if (*ptr != '%') {
+      continue;
+    }
+
+    spec = ptr++;
+    if (*ptr == '%') {
+      continue;
+    }
+
+    while (*ptr == '-' || *ptr == '+' || *ptr == ' ' || *ptr == '#' ||
+           *ptr == '0' || *ptr == '\'') {
+      ptr++;
+    }
+
+    /* Field width */
+    if (*ptr == '*') {
+      if (nargs == TRACE_BUFFER_MAX_ARGS) {
+        return -1;
+      }
+
+      types[nargs++] = TRACE_ARG_INT;
+      ptr++;
+
+    } else {
+      while (PR_ISDIGIT(*ptr)) {
+        ptr++;
+      }
+
+      if (*ptr == '$') {
+        return -1;
+      }
+    }
+
+    /* Precision */
+    if (*ptr == '.') {
+      ptr++;
+
+      if (*ptr == '*') {
+        if (nargs == TRACE_BUFFER_MAX_ARGS) {
+          return -1;
+        }
+
+        types[nargs++] = TRACE_ARG_INT;
+        prec = TRACE_PREC_STAR;
+        ptr++;
+
+      } else {
+        prec = 0;
+        while (PR_ISDIGIT(*ptr)) {
+          if (prec < PR_TUNABLE_BUFFER_SIZE) {
+            prec = (prec * 10) + (*ptr - '0');
+          }
+
+          ptr++;
+        }
+      }
+    }
+
+    /* Length modifier; "hh" and "h" arguments are promoted to int. */
+    switch (*ptr) {
+      case 'h':
+        ptr++;
+        if (*ptr == 'h') {
+          ptr++;
+        }
+        break;
+
+      case 'l':
+        lmod = 'l';
+        ptr++;
+        if (*ptr == 'l') {
+          lmod = 'q';
+          ptr++;
+        }
+        break;
+
+      case 'q':
+      case 'L':
+      case 'j':
+      case 'z':
+      case 't':
+        lmod = *ptr++;
+        break;
+
+      case 'Z':
+        lmod = 'z';
+        ptr++;
+        break;
+    }
+
+    if (nargs == TRACE_BUFFER_MAX_ARGS ||
+        (ptr - spec) >= TRACE_BUFFER_MAX_SPEC_LEN) {
+      return -1;
+    }
+
+    switch (*ptr) {
+      case 'd':
+      case 'i':
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        switch (lmod) {
+          case '\0':
+            types[nargs] = TRACE_ARG_INT;
+            break;
+
+          case 'l':
+            types[nargs] = TRACE_ARG_LONG;
+            break;
+
+          case 'q':
+            types[nargs] = TRACE_ARG_LLONG;
+            break;
+
+          case 'j':
+            types[nargs] = TRACE_ARG_INTMAX;
+            break;
+
+          case 'z':
+            types[nargs] = TRACE_ARG_SIZE;
+            break;
+
+          case 't':
+            types[nargs] = TRACE_ARG_PTRDIFF;
+            break;
+
+          default:
+            return -1;
+        }
+        break;
+
+      case 'c':
+        if (lmod != '\0') {
+          return -1;
+        }
+
+        types[nargs] = TRACE_ARG_INT;
+        break;
+
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        if (lmod == '\0' ||
+            lmod == 'l') {
+          types[nargs] = TRACE_ARG_DOUBLE;
+
+        } else if (lmod == 'L') {
+          types[nargs] = TRACE_ARG_LDOUBLE;
+
+        } else {
+          return -1;
+        }
+        break;
+
+      case 's':
+        if (lmod != '\0') {
+          return -1;
+        }
+
+        types[nargs] = TRACE_ARG_STR;
+        precs[nargs] = prec;
+        break;
+
+      case 'p':
+        if (lmod != '\0') {
+          return -1;
+        }
+
+        types[nargs] = TRACE_ARG_PTR;
+        break;
+
+      default:
+        return -1;
+    }
+
+    nargs++;
+  }
+
+  return nargs;
+}
+
+static int trace_buffer_add(const char *channel, int level, const char *fmt,
+    va_list msg) {
+  unsigned char types[TRACE_BUFFER_MAX_ARGS];
+  int precs[TRACE_BUFFER_MAX_ARGS];
+  union trace_arg args[TRACE_BUFFER_MAX_ARGS];
+  const char *strs[TRACE_BUFFER_MAX_ARGS];
+  char buf[PR_TUNABLE_BUFFER_SIZE];
+  struct trace_rec *rec;
+  size_t channel_len, datalen = 0, reclen, off;
+  unsigned char *ptr;
+  int i, nargs;
+
+  if (trace_buf_pid != session.pid) {
+    /* These are our parent's records, not ours. */
+    trace_buffer_reset();
+  }
+
+  nargs = trace_buffer_parse_fmt(fmt, types, precs);
+  if (nargs < 0) {
+    int res;
+
+    res = vsnprintf(buf, sizeof(buf), fmt, msg);
+    if (res < 0) {
+      return -1;
+    }
+
+    datalen = (size_t) res;
+    if (datalen >= sizeof(buf)) {
+      datalen = sizeof(buf) - 1;
+    }
+
+    fmt = NULL;
+    nargs = 0;
+  }
+
+  for (i = 0; i < nargs; i++) {
+    switch (types[i]) {
+      case TRACE_ARG_INT:
+        args[i].i = va_arg(msg, int);
+        break;
+
+      case TRACE_ARG_LONG:
+        args[i].l = va_arg(msg, long);
+        break;
+
+      case TRACE_ARG_LLONG:
+        args[i].ll = va_arg(msg, long long);
+        break;
+
+      case TRACE_ARG_INTMAX:
+        args[i].j = va_arg(msg, intmax_t);
+        break;
+
+      case TRACE_ARG_SIZE:
+        args[i].z = va_arg(msg, size_t);
+        break;
+
+      case TRACE_ARG_PTRDIFF:
+        args[i].t = va_arg(msg, ptrdiff_t);
+        break;
+
+      case TRACE_ARG_DOUBLE:
+        args[i].d = va_arg(msg, double);
+        break;
+
+      case TRACE_ARG_LDOUBLE:
+        args[i].d = (double) va_arg(msg, long double);
+        break;
+
+      case TRACE_ARG_PTR:
+        args[i].p = va_arg(msg, void *);
+        break;
+
+      case TRACE_ARG_STR: {
+        const char *str, *end;
+        size_t maxlen;
+        int prec;
+
+        str = va_arg(msg, const char *);
+        strs[i] = str;
+        args[i].s.off = 0;
+        args[i].s.len = 0;
+
+        if (str == NULL) {
+          break;
+        }
+
+        /* Copy no more than the precision allows (the string need not be
+         * NUL-terminated then), nor more than would fit in the message.
+         */
+        maxlen = datalen < sizeof(buf) - 1 ? sizeof(buf) - 1 - datalen : 0;
+
+        prec = precs[i];
+        if (prec == TRACE_PREC_STAR) {
+          prec = args[i-1].i;
+        }
+
+        if (prec >= 0 &&
+            (size_t) prec < maxlen) {
+          maxlen = prec;
+        }
+
+        end = memchr(str, '\0', maxlen);
+        args[i].s.len = end != NULL ? (size_t) (end - str) : maxlen;
+        datalen += args[i].s.len + 1;
+        break;
+      }
+    }
+  }
+
+  channel_len = strlen(channel);
+  if (channel_len > TRACE_BUFFER_MAX_CHANNEL_LEN) {
+    channel_len = TRACE_BUFFER_MAX_CHANNEL_LEN;
+  }
+
+  reclen = sizeof(struct trace_rec) + (nargs * sizeof(union trace_arg)) +
+    nargs + channel_len + 1;
+  if (fmt == NULL) {
+    datalen++;
+  }
+  reclen = TRACE_BUFFER_ALIGN(reclen + datalen);
+
+  off = trace_buffer_reserve(reclen);
+  rec = (struct trace_rec *) (trace_buf + off);
+
+  rec->reclen = reclen;
+  rec->level = level;
+  gettimeofday(&(rec->tv), NULL);
+  rec->fmt = fmt;
+  rec->nargs = nargs;
+
+  ptr = trace_buf + off + sizeof(struct trace_rec) +
+    (nargs * sizeof(union trace_arg));
+  memcpy(ptr, types, nargs);
+  ptr += nargs;
+
+  rec->channel_off = ptr - (trace_buf + off);
+  memcpy(ptr, channel, channel_len);
+  ptr[channel_len] = '\0';
+  ptr += channel_len + 1;
+
+  if (fmt == NULL) {
+    memcpy(ptr, buf, datalen);
+    ptr[datalen-1] = '\0';
+  }
+
+  for (i = 0; i < nargs; i++) {
+    if (types[i] == TRACE_ARG_STR &&
+        strs[i] != NULL) {
+      memcpy(ptr, strs[i], args[i].s.len);
+      ptr[args[i].s.len] = '\0';
+      args[i].s.off = ptr - (trace_buf + off);
+      ptr += args[i].s.len + 1;
+    }
+  }
+
+  memcpy(trace_buf + off + sizeof(struct trace_rec), args,
+    nargs * sizeof(union trace_arg));
+
+  trace_buf_tail = off + reclen;
+  trace_buf_count++;
+
+  return 0;
+}
+
+#define TRACE_BUFFER_FMT_ARG(type, val) \
+  (nstars == 0 ? snprintf(buf + buflen, bufsz - buflen, spec, (type) (val)) : \
+   nstars == 1 ? snprintf(buf + buflen, bufsz - buflen, spec, stars[0], \
+     (type) (val)) : \
+   snprintf(buf + buflen, bufsz - buflen, spec, stars[0], stars[1], \
+     (type) (val)))
+
+/* Formats the message of the given record, as vsnprintf(3) would have done
+ * when it was logged.
+ */
+static size_t trace_buffer_fmt_msg(struct trace_rec *rec, char *buf,
+    size_t bufsz) {
+  union trace_arg *args;
+  unsigned char *types;
+  const char *ptr;
+  size_t buflen = 0;
+  unsigned int argno = 0;
+
+  if (rec->fmt == NULL) {
+    ptr = (const char *) rec + rec->channel_off;
+    ptr += strlen(ptr) + 1;
+
+    sstrncpy(buf, ptr, bufsz);
+    return strlen(buf);
+  }
+
+  args = (union trace_arg *) ((char *) rec + sizeof(struct trace_rec));
+  types = (unsigned char *) (args + rec->nargs);
+
+  ptr = rec->fmt;
+  while (*ptr &&
+         buflen < bufsz - 1) {
+    char spec[TRACE_BUFFER_MAX_SPEC_LEN + 1];
+    int res = 0, stars[2], nstars = 0;
+    const char *start;
+    union trace_arg *arg;
+
+    if (*ptr != '%') {
+      buf[buflen++] = *ptr++;
+      continue;
+    }
+
+    if (ptr[1] == '%') {
+      buf[buflen++] = '%';
+      ptr += 2;
+      continue;
+    }
+
+    start = ptr++;
+    while (strchr("diouxXceEfFgGaAsp", *ptr) == NULL) {
+      if (*ptr == '*' &&
+          nstars < 2) {
+        stars[nstars++] = args[argno++].i;
+      }
+
+      ptr++;
+    }
+    ptr++;
+
+    memcpy(spec, start, ptr - start);
+    spec[ptr - start] = '\0';
+
+    arg = &(args[argno]);
+    switch (types[argno]) {
+      case TRACE_ARG_INT:
+        res = TRACE_BUFFER_FMT_ARG(int, arg->i);
+        break;
+
+      case TRACE_ARG_LONG:
+        res = TRACE_BUFFER_FMT_ARG(long, arg->l);
+        break;
+
+      case TRACE_ARG_LLONG:
+        res = TRACE_BUFFER_FMT_ARG(long long, arg->ll);
+        break;
+
+      case TRACE_ARG_INTMAX:
+        res = TRACE_BUFFER_FMT_ARG(intmax_t, arg->j);
+        break;
+
+      case TRACE_ARG_SIZE:
+        res = TRACE_BUFFER_FMT_ARG(size_t, arg->z);
+        break;
+
+      case TRACE_ARG_PTRDIFF:
+        res = TRACE_BUFFER_FMT_ARG(ptrdiff_t, arg->t);
+        break;
+
+      case TRACE_ARG_DOUBLE:
+        res = TRACE_BUFFER_FMT_ARG(double, arg->d);
+        break;
+
+      case TRACE_ARG_LDOUBLE:
+        res = TRACE_BUFFER_FMT_ARG(long double, arg->d);
+        break;
+
+      case TRACE_ARG_PTR:
+        res = TRACE_BUFFER_FMT_ARG(const void *, arg->p);
+        break;
+
+      case TRACE_ARG_STR:
+        res = TRACE_BUFFER_FMT_ARG(const char *,
+          arg->s.off ? (const char *) rec + arg->s.off : NULL);
+        break;
+    }
+    argno++;
+
+    if (res > 0) {
+      buflen += res;
+      if (buflen >= bufsz) {
+        buflen = bufsz - 1;
+      }
+    }
+  }
+
+  buf[buflen] = '\0';
+  return buflen;
+}
+
+static void trace_usr2_ev(const void *event_data, void *user_data) {
+  (void) pr_trace_dump();
+}
+
 pr_table_t *pr_trace_get_table(void) {
   if (!trace_tab) {
     errno = EPERM;
@@ -329,6 +972,11 @@ int pr_trace_set_file(const char *path) {
       return -1;
     }
 
+    /* Write out any buffered messages before closing the TraceLog. */
+    if (trace_buf != NULL) {
+      (void) pr_trace_dump();
+    }
+
     (void) close(trace_logfd);
     trace_logfd = -1;
     return 0;
@@ -469,6 +1117,102 @@ int pr_trace_use_stderr(int use_stderr) {
   return 0;
 }
 
+int pr_trace_set_buffer(size_t size) {
+  if (size > 0 &&
+      (size < TRACE_BUFFER_MIN_SIZE ||
+       size > (size_t) INT_MAX)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (trace_buf != NULL) {
+    (void) pr_trace_dump();
+
+    destroy_pool(trace_buf_pool);
+    trace_buf_pool = NULL;
+    trace_buf = NULL;
+    trace_bufsz = 0;
+
+    pr_event_unregister(NULL, "core.signal.USR2", trace_usr2_ev);
+  }
+
+  if (size == 0) {
+    return 0;
+  }
+
+  trace_buf_pool = make_sub_pool(permanent_pool);
+  pr_pool_tag(trace_buf_pool, "Trace Buffer Pool");
+
+  trace_bufsz = size & ~((size_t) 7);
+  trace_buf = palloc(trace_buf_pool, trace_bufsz);
+  trace_buffer_reset();
+
+  pr_event_register(NULL, "core.signal.USR2", trace_usr2_ev, NULL);
+  return 0;
+}
+
+int pr_trace_dump(void) {
+  static char buf[TRACE_DUMP_BUFFER_SIZE];
+  size_t buflen = 0, off;
+  unsigned int i;
+  int count = 0;
+
+  if (trace_buf == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (trace_buf_pid != session.pid ||
+      trace_logfd < 0) {
+    trace_buffer_reset();
+    return 0;
+  }
+
+  off = trace_buf_head;
+  for (i = 0; i < trace_buf_count; i++) {
+    char msg[PR_TUNABLE_BUFFER_SIZE];
+    struct trace_rec *rec;
+    size_t msglen, linelen;
+
+    rec = trace_buffer_rec(off);
+    if (rec == NULL) {
+      off = 0;
+      rec = trace_buffer_rec(off);
+    }
+
+    msglen = trace_buffer_fmt_msg(rec, msg, sizeof(msg));
+
+    /* Trim trailing newlines. */
+    while (msglen >= 1 &&
+           msg[msglen-1] == '\n') {
+      msg[msglen-1] = '\0';
+      msglen--;
+    }
+
+    /* Write out the formatted lines in large chunks. */
+    if (buflen + PR_TUNABLE_BUFFER_SIZE > TRACE_DUMP_BUFFER_SIZE) {
+      (void) write(trace_logfd, buf, buflen);
+      buflen = 0;
+    }
+
+    linelen = trace_fmt_line(buf + buflen, &(rec->tv),
+      (const char *) rec + rec->channel_off, rec->level, msg);
+    pr_log_event_generate(PR_LOG_TYPE_TRACELOG, trace_logfd, rec->level,
+      buf + buflen, linelen);
+    buflen += linelen;
+
+    off += rec->reclen;
+    count++;
+  }
+
+  if (buflen > 0) {
+    (void) write(trace_logfd, buf, buflen);
+  }
+
+  trace_buffer_reset();
+  return count;
+}
+
 int pr_trace_msg(const char *channel, int level, const char *fmt, ...) {
   int res;
   va_list msg;
@@ -532,6 +1276,15 @@ int pr_trace_vmsg(const char *channel, int level, const char *fmt,
     }
   }
 
+  /* If buffering, store the message for formatting later -- unless there
+   * are listeners for TraceLog events, which need the formatted message now.
+   */
+  if (trace_buf != NULL &&
+      discard == FALSE &&
+      pr_log_event_listening(PR_LOG_TYPE_TRACELOG) <= 0) {
+    return trace_buffer_add(channel, level, fmt, msg);
+  }
+
   buflen = vsnprintf(buf, sizeof(buf), fmt, msg);
 
   /* Always make sure the buffer is NUL-terminated. */
@@ -601,4 +1354,14 @@ int pr_trace_vmsg(const char *channel, int level, const char *fmt,
   return -1;
 }
 
+int pr_trace_set_buffer(size_t size) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int pr_trace_dump(void) {
+  errno = ENOSYS;
+  return -1;
+}
+
 #endif /* PR_USE_TRACE */
@@ -0,0 +1,146 @@
+/*
+ * ProFTPD - FTP server testsuite
+ * Copyright (c) 2014 The ProFTPD Project team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, The ProFTPD Project team and other respective
+ * copyright holders give permission to link this program with OpenSSL, and
+ * distribute the resulting executable, without including the source code for
+ * OpenSSL in the source distribution.
+ */
+
+/* Encode API tests */
+
+#include "tests.h"
+
+#ifdef PR_USE_NLS
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = permanent_pool = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  (void) pr_encode_set_charset_encoding("UTF-8", "UTF-8");
+
+  if (p) {
+    destroy_pool(p);
+    p = permanent_pool = NULL;
+  }
+}
+
+START_TEST (encode_is_ascii_test) {
+  char buf[64];
+  unsigned int offset, len;
+  int res;
+
+  res = pr_encode_is_ascii(NULL, 0);
+  fail_unless(res == -1, "Failed to handle null string");
+  fail_unless(errno == EINVAL, "Failed to set errno to EINVAL");
+
+  res = pr_encode_is_ascii("", 0);
+  fail_unless(res == TRUE, "Expected TRUE for empty string, got %d", res);
+
+  res = pr_encode_is_ascii("/home/ftp/file.txt", 18);
+  fail_unless(res == TRUE, "Expected TRUE for ASCII string, got %d", res);
+
+  res = pr_encode_is_ascii("caf\xc3\xa9.txt", 9);
+  fail_unless(res == FALSE, "Expected FALSE for UTF-8 string, got %d", res);
+
+  /* Make sure that a non-ASCII byte is found wherever it falls, relative to
+   * the word-at-a-time checks.
+   */
+  for (offset = 0; offset < 8; offset++) {
+    for (len = 1; len < 40; len++) {
+      memset(buf, 'a', sizeof(buf));
+      res = pr_encode_is_ascii(buf + offset, len);
+      fail_unless(res == TRUE, "Expected TRUE (offset %u, len %u), got %d",
+        offset, len, res);
+
+      buf[offset + len - 1] = (char) 0xff;
+      res = pr_encode_is_ascii(buf + offset, len);
+      fail_unless(res == FALSE, "Expected FALSE (offset %u, len %u), got %d",
+        offset, len, res);
+
+      /* A non-ASCII byte just past the given length is not checked. */
+      buf[offset + len - 1] = 'a';
+      buf[offset + len] = (char) 0xff;
+      res = pr_encode_is_ascii(buf + offset, len);
+      fail_unless(res == TRUE, "Expected TRUE (offset %u, len %u), got %d",
+        offset, len, res);
+    }
+  }
+}
+END_TEST
+
+START_TEST (encode_supports_ascii_test) {
+  const char *path = "/home/ftp/file.txt";
+  char *res;
+  size_t outlen = 0;
+
+  if (pr_encode_set_charset_encoding("ISO-8859-1", "UTF-8") < 0) {
+    return;
+  }
+
+  fail_unless(pr_encode_supports_ascii() == TRUE,
+    "Expected ASCII passthrough for ISO-8859-1/UTF-8");
+
+  res = pr_decode_str(p, path, strlen(path), &outlen);
+  fail_unless(res != NULL, "Failed to decode '%s': %s", path,
+    strerror(errno));
+  fail_unless(strcmp(res, path) == 0, "Expected '%s', got '%s'", path, res);
+  fail_unless(outlen == strlen(path), "Expected %lu, got %lu",
+    (unsigned long) strlen(path), (unsigned long) outlen);
+
+  /* Non-ASCII strings are still converted. */
+  res = pr_encode_str(p, "caf\xe9", 4, &outlen);
+  fail_unless(res != NULL, "Failed to encode string: %s", strerror(errno));
+  fail_unless(outlen == 5, "Expected 5, got %lu", (unsigned long) outlen);
+  fail_unless(strcmp(res, "caf\xc3\xa9") == 0, "Failed to encode string");
+
+  if (pr_encode_set_charset_encoding("UCS-2", "UTF-8") < 0) {
+    return;
+  }
+
+  fail_unless(pr_encode_supports_ascii() == FALSE,
+    "Expected no ASCII passthrough for UCS-2/UTF-8");
+}
+END_TEST
+
+#endif /* PR_USE_NLS */
+
+Suite *tests_get_encode_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("encode");
+
+  testcase = tcase_create("base");
+
+#ifdef PR_USE_NLS
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, encode_is_ascii_test);
+  tcase_add_test(testcase, encode_supports_ascii_test);
+#endif /* PR_USE_NLS */
+
+  suite_add_tcase(suite, testcase);
+
+  return suite;
+}
@@ -109,6 +109,29 @@ START_TEST (fs_clean_path2_test) {
   fail_unless(strcmp(res, expected) == 0,
     "Expected cleaned path '%s', got '%s'", expected, res);
 
+  res[sizeof(res)-1] = '\0';
+  path = "test.d/foo/../bar/./test.txt";
+  pr_fs_clean_path2(path, res, sizeof(res)-1, 0);
+
+  expected = "test.d/bar/test.txt";
+  fail_unless(strcmp(res, expected) == 0,
+    "Expected cleaned path '%s', got '%s'", expected, res);
+
+  res[sizeof(res)-1] = '\0';
+  path = "/test.d/..";
+  pr_fs_clean_path2(path, res, sizeof(res)-1, 0);
+
+  expected = "/";
+  fail_unless(strcmp(res, expected) == 0,
+    "Expected cleaned path '%s', got '%s'", expected, res);
+
+  res[sizeof(res)-1] = '\0';
+  path = "/test.d/.";
+  pr_fs_clean_path2(path, res, sizeof(res)-1, 0);
+
+  expected = "/test.d";
+  fail_unless(strcmp(res, expected) == 0,
+    "Expected cleaned path '%s', got '%s'", expected, res);
 }
 END_TEST
 
@@ -203,6 +226,422 @@ START_TEST (fs_setcwd_test) {
 }
 END_TEST
 
+START_TEST (fs_resolve_path_test) {
+  char buf[PR_TUNABLE_PATH_MAX+1], dir[PR_TUNABLE_PATH_MAX+1], *expected;
+  const char *tmpdir = "/tmp/prt-fsio.d";
+  int fd, res;
+
+  (void) unlink("/tmp/prt-fsio.d/c");
+  (void) unlink("/tmp/prt-fsio.d/a/f");
+  (void) unlink("/tmp/prt-fsio.d/b/f");
+  (void) rmdir("/tmp/prt-fsio.d/a");
+  (void) rmdir("/tmp/prt-fsio.d/b");
+  (void) rmdir(tmpdir);
+
+  fail_unless(mkdir(tmpdir, 0755) == 0, "Failed to create '%s': %s",
+    tmpdir, strerror(errno));
+  fail_unless(mkdir("/tmp/prt-fsio.d/a", 0755) == 0, "Failed to create dir");
+  fail_unless(mkdir("/tmp/prt-fsio.d/b", 0755) == 0, "Failed to create dir");
+
+  fd = open("/tmp/prt-fsio.d/a/f", O_CREAT|O_WRONLY, 0644);
+  fail_unless(fd >= 0, "Failed to create file: %s", strerror(errno));
+  (void) close(fd);
+
+  fd = open("/tmp/prt-fsio.d/b/f", O_CREAT|O_WRONLY, 0644);
+  fail_unless(fd >= 0, "Failed to create file: %s", strerror(errno));
+  (void) close(fd);
+
+  fail_unless(symlink("a", "/tmp/prt-fsio.d/c") == 0,
+    "Failed to create symlink: %s", strerror(errno));
+
+  res = pr_fs_resolve_path(NULL, buf, sizeof(buf)-1, FSIO_FILE_OPEN);
+  fail_unless(res == -1, "Failed to handle null path");
+  fail_unless(errno == EINVAL, "Failed to set errno to EINVAL");
+
+  /* /tmp may itself be a symlink. */
+  res = pr_fs_resolve_path(tmpdir, dir, sizeof(dir)-1, FSIO_FILE_OPEN);
+  fail_unless(res == 0, "Failed to resolve '%s': %s", tmpdir,
+    strerror(errno));
+
+  expected = pdircat(p, dir, "a", "f", NULL);
+
+  /* Resolve twice, to check the cached directory as well. */
+  res = pr_fs_resolve_path("/tmp/prt-fsio.d/c/f", buf, sizeof(buf)-1,
+    FSIO_FILE_OPEN);
+  fail_unless(res == 0, "Failed to resolve path: %s", strerror(errno));
+  fail_unless(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+    expected, buf);
+
+  res = pr_fs_resolve_partial("/tmp/prt-fsio.d/c/f", buf, sizeof(buf)-1,
+    FSIO_FILE_OPEN);
+  fail_unless(res == 0, "Failed to resolve path: %s", strerror(errno));
+  fail_unless(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+    expected, buf);
+
+  res = pr_fs_resolve_path("/tmp/prt-fsio.d/c/f", buf, sizeof(buf)-1,
+    FSIO_FILE_OPEN);
+  fail_unless(res == 0, "Failed to resolve path: %s", strerror(errno));
+  fail_unless(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+    expected, buf);
+
+  res = pr_fs_resolve_path("/tmp/prt-fsio.d/c/g", buf, sizeof(buf)-1,
+    FSIO_FILE_OPEN);
+  fail_unless(res == -1, "Resolved nonexistent path unexpectedly");
+  fail_unless(errno == ENOENT, "Failed to set errno to ENOENT");
+
+  res = pr_fs_resolve_path("/tmp/prt-fsio.d/a/f/g", buf, sizeof(buf)-1,
+    FSIO_FILE_OPEN);
+  fail_unless(res == -1, "Resolved path through a file unexpectedly");
+  fail_unless(errno == ENOENT, "Failed to set errno to ENOENT");
+
+  /* Repointing the symlink, via the FSIO API, must not leave the old
+   * directory cached.
+   */
+  res = pr_fsio_unlink("/tmp/prt-fsio.d/c");
+  fail_unless(res == 0, "Failed to remove symlink: %s", strerror(errno));
+  fail_unless(symlink("b", "/tmp/prt-fsio.d/c") == 0,
+    "Failed to create symlink: %s", strerror(errno));
+
+  expected = pdircat(p, dir, "b", "f", NULL);
+
+  res = pr_fs_resolve_path("/tmp/prt-fsio.d/c/f", buf, sizeof(buf)-1,
+    FSIO_FILE_OPEN);
+  fail_unless(res == 0, "Failed to resolve path: %s", strerror(errno));
+  fail_unless(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+    expected, buf);
+
+  /* Nor must changes made by other means, once the cache is cleared. */
+  (void) unlink("/tmp/prt-fsio.d/c");
+  fail_unless(symlink("a", "/tmp/prt-fsio.d/c") == 0,
+    "Failed to create symlink: %s", strerror(errno));
+  pr_fs_clear_resolve_cache();
+
+  expected = pdircat(p, dir, "a", "f", NULL);
+
+  res = pr_fs_resolve_path("/tmp/prt-fsio.d/c/f", buf, sizeof(buf)-1,
+    FSIO_FILE_OPEN);
+  fail_unless(res == 0, "Failed to resolve path: %s", strerror(errno));
+  fail_unless(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+    expected, buf);
+
+  (void) unlink("/tmp/prt-fsio.d/c");
+  (void) unlink("/tmp/prt-fsio.d/a/f");
+  (void) unlink("/tmp/prt-fsio.d/b/f");
+  (void) rmdir("/tmp/prt-fsio.d/a");
+  (void) rmdir("/tmp/prt-fsio.d/b");
+  (void) rmdir(tmpdir);
+}
+END_TEST
+
+START_TEST (fsio_use_openat_test) {
+  char cwdbuf[PR_TUNABLE_PATH_MAX+1];
+  const char *tmpdir = "/tmp/prt-fsio.d", *tmpdir2 = "/tmp/prt-fsio2.d";
+  pr_fh_t *fh;
+  struct stat st;
+  int res;
+
+  (void) unlink("/tmp/prt-fsio.d/a/f");
+  (void) unlink("/tmp/prt-fsio.d/b/f");
+  (void) rmdir("/tmp/prt-fsio.d/a");
+  (void) rmdir("/tmp/prt-fsio.d/b");
+  (void) rmdir(tmpdir);
+  (void) unlink("/tmp/prt-fsio2.d/b/f");
+  (void) rmdir("/tmp/prt-fsio2.d/b");
+  (void) rmdir(tmpdir2);
+
+  fail_unless(getcwd(cwdbuf, sizeof(cwdbuf)) != NULL,
+    "Failed to get current directory: %s", strerror(errno));
+  fail_unless(mkdir(tmpdir, 0755) == 0, "Failed to create '%s': %s",
+    tmpdir, strerror(errno));
+
+  res = pr_fsio_set_use_openat(TRUE);
+  fail_unless(res == FALSE, "Expected openat(2) to be disabled by default");
+
+  res = pr_fsio_chdir(tmpdir, FALSE);
+  fail_unless(res == 0, "Failed to chdir to '%s': %s", tmpdir,
+    strerror(errno));
+
+  res = pr_fsio_mkdir("/tmp/prt-fsio.d/a", 0755);
+  fail_unless(res == 0, "Failed to create directory: %s", strerror(errno));
+
+  fh = pr_fsio_open("/tmp/prt-fsio.d/a/f", O_CREAT|O_WRONLY);
+  fail_unless(fh != NULL, "Failed to create file: %s", strerror(errno));
+  (void) pr_fsio_close(fh);
+
+  pr_fs_clear_cache();
+  res = pr_fsio_stat("/tmp/prt-fsio.d/a/f", &st);
+  fail_unless(res == 0, "Failed to stat file: %s", strerror(errno));
+  fail_unless(S_ISREG(st.st_mode), "Expected a regular file");
+
+  res = pr_fsio_rename("/tmp/prt-fsio.d/a", "/tmp/prt-fsio.d/b");
+  fail_unless(res == 0, "Failed to rename directory: %s", strerror(errno));
+
+  pr_fs_clear_cache();
+  res = pr_fsio_stat("/tmp/prt-fsio.d/a/f", &st);
+  fail_unless(res == -1, "Found renamed file unexpectedly");
+  fail_unless(errno == ENOENT, "Failed to set errno to ENOENT");
+
+  /* Renaming the current directory itself, then creating another in its
+   * place, must not leave paths referring to the renamed directory.
+   */
+  res = pr_fsio_rename(tmpdir, tmpdir2);
+  fail_unless(res == 0, "Failed to rename directory: %s", strerror(errno));
+  res = pr_fsio_mkdir(tmpdir, 0755);
+  fail_unless(res == 0, "Failed to create directory: %s", strerror(errno));
+
+  pr_fs_clear_cache();
+  res = pr_fsio_stat("/tmp/prt-fsio.d/b/f", &st);
+  fail_unless(res == -1, "Found file in renamed directory unexpectedly");
+  fail_unless(errno == ENOENT, "Failed to set errno to ENOENT");
+
+  pr_fs_clear_cache();
+  res = pr_fsio_stat("/tmp/prt-fsio2.d/b/f", &st);
+  fail_unless(res == 0, "Failed to stat file: %s", strerror(errno));
+
+  res = pr_fsio_unlink("/tmp/prt-fsio2.d/b/f");
+  fail_unless(res == 0, "Failed to remove file: %s", strerror(errno));
+  res = pr_fsio_rmdir("/tmp/prt-fsio2.d/b");
+  fail_unless(res == 0, "Failed to remove directory: %s", strerror(errno));
+
+  res = pr_fsio_set_use_openat(FALSE);
+#if defined(HAVE_OPENAT)
+  fail_unless(res == TRUE, "Expected openat(2) to be enabled");
+#endif /* HAVE_OPENAT */
+
+  (void) chdir(cwdbuf);
+  (void) rmdir(tmpdir);
+  (void) rmdir(tmpdir2);
+}
+END_TEST
+
+START_TEST (fs_copy_file_test) {
+  const char *src = "/tmp/prt-fsio-src.dat", *dst = "/tmp/prt-fsio-dst.dat";
+  char buf[8192], buf2[8192];
+  pr_fh_t *fh, *fh2;
+  register unsigned int i;
+  int fd, res;
+
+  res = pr_fsio_fcopy(NULL, NULL);
+  fail_unless(res == -1, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Failed to set errno to EINVAL");
+
+  for (i = 0; i < sizeof(buf); i++) {
+    buf[i] = (char) (i % 251);
+  }
+
+  fd = open(src, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+  fail_unless(fd >= 0, "Failed to create '%s': %s", src, strerror(errno));
+  for (i = 0; i < 64; i++) {
+    fail_unless(write(fd, buf, sizeof(buf)) == sizeof(buf),
+      "Failed to write '%s': %s", src, strerror(errno));
+  }
+  (void) close(fd);
+
+  /* A longer existing destination must be truncated. */
+  fd = open(dst, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+  fail_unless(fd >= 0, "Failed to create '%s': %s", dst, strerror(errno));
+  for (i = 0; i < 65; i++) {
+    fail_unless(write(fd, "x", 1) == 1, "Failed to write '%s': %s", dst,
+      strerror(errno));
+  }
+  (void) close(fd);
+
+  res = pr_fs_copy_file(src, dst);
+  fail_unless(res == 0, "Failed to copy '%s' to '%s': %s", src, dst,
+    strerror(errno));
+
+  fh = pr_fsio_open(src, O_RDONLY);
+  fail_unless(fh != NULL, "Failed to open '%s': %s", src, strerror(errno));
+  fh2 = pr_fsio_open(dst, O_RDONLY);
+  fail_unless(fh2 != NULL, "Failed to open '%s': %s", dst, strerror(errno));
+
+  while ((res = pr_fsio_read(fh, buf, sizeof(buf))) > 0) {
+    fail_unless(pr_fsio_read(fh2, buf2, res) == res,
+      "Failed to read %d bytes from '%s'", res, dst);
+    fail_unless(memcmp(buf, buf2, res) == 0, "Copied data differs");
+  }
+
+  fail_unless(pr_fsio_read(fh2, buf2, sizeof(buf2)) == 0,
+    "Destination '%s' longer than source", dst);
+
+  (void) pr_fsio_close(fh);
+  (void) pr_fsio_close(fh2);
+  (void) unlink(src);
+  (void) unlink(dst);
+}
+END_TEST
+
+static int fs_xor_read(pr_fh_t *fh, int fd, char *buf, size_t bufsz) {
+  register unsigned int i;
+  int res;
+
+  res = read(fd, buf, bufsz);
+  for (i = 0; res > 0 && i < (unsigned int) res; i++) {
+    buf[i] ^= 0x5a;
+  }
+
+  return res;
+}
+
+START_TEST (fs_copy_file_custom_fs_test) {
+  const char *dir = "/tmp/prt-fsio-xor";
+  const char *src = "/tmp/prt-fsio-xor/src.dat";
+  const char *dst = "/tmp/prt-fsio-xor/dst.dat";
+  char buf[1024], buf2[1024];
+  register unsigned int i;
+  pr_fs_t *fs;
+  int fd, res;
+
+  (void) mkdir(dir, 0755);
+
+  for (i = 0; i < sizeof(buf); i++) {
+    buf[i] = (char) (i % 251);
+  }
+
+  fd = open(src, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+  fail_unless(fd >= 0, "Failed to create '%s': %s", src, strerror(errno));
+  fail_unless(write(fd, buf, sizeof(buf)) == sizeof(buf),
+    "Failed to write '%s': %s", src, strerror(errno));
+  (void) close(fd);
+
+  /* An FS which transforms the data it reads, but does not provide its own
+   * fcopy, must not be bypassed by the system fcopy.
+   */
+  fs = pr_register_fs(p, "testsuite", "/tmp/prt-fsio-xor/");
+  fail_unless(fs != NULL, "Failed to register FS: %s", strerror(errno));
+  fs->read = fs_xor_read;
+
+  res = pr_fs_copy_file(src, dst);
+  fail_unless(res == 0, "Failed to copy '%s' to '%s': %s", src, dst,
+    strerror(errno));
+
+  (void) pr_unregister_fs("/tmp/prt-fsio-xor/");
+
+  fd = open(dst, O_RDONLY);
+  fail_unless(fd >= 0, "Failed to open '%s': %s", dst, strerror(errno));
+  fail_unless(read(fd, buf2, sizeof(buf2)) == sizeof(buf2),
+    "Failed to read '%s': %s", dst, strerror(errno));
+  (void) close(fd);
+
+  for (i = 0; i < sizeof(buf); i++) {
+    fail_unless(buf2[i] == (char) (buf[i] ^ 0x5a),
+      "Copy bypassed the FS read() at offset %u", i);
+  }
+
+  (void) unlink(src);
+  (void) unlink(dst);
+  (void) rmdir(dir);
+}
+END_TEST
+
+START_TEST (fsio_use_openat_dotdot_test) {
+  char cwdbuf[PR_TUNABLE_PATH_MAX+1];
+  const char *tmpdir = "/tmp/prt-fsio.d", *tmpdir2 = "/tmp/prt-fsio3.d";
+  const char *marker = "/tmp/prt-fsio-marker";
+  pr_fh_t *fh;
+  struct stat st;
+  int res;
+
+  (void) unlink(marker);
+  (void) rmdir("/tmp/prt-fsio3.d/inner");
+  (void) rmdir(tmpdir2);
+  (void) rmdir(tmpdir);
+
+  fail_unless(getcwd(cwdbuf, sizeof(cwdbuf)) != NULL,
+    "Failed to get current directory: %s", strerror(errno));
+  fail_unless(mkdir(tmpdir, 0755) == 0, "Failed to create '%s': %s",
+    tmpdir, strerror(errno));
+  fail_unless(mkdir(tmpdir2, 0755) == 0, "Failed to create '%s': %s",
+    tmpdir2, strerror(errno));
+
+  fh = pr_fsio_open(marker, O_CREAT|O_WRONLY);
+  fail_unless(fh != NULL, "Failed to create file: %s", strerror(errno));
+  (void) pr_fsio_close(fh);
+
+  pr_fsio_set_use_openat(TRUE);
+
+  res = pr_fsio_chdir(tmpdir, FALSE);
+  fail_unless(res == 0, "Failed to chdir to '%s': %s", tmpdir,
+    strerror(errno));
+
+  pr_fs_clear_cache();
+  res = pr_fsio_stat("/tmp/prt-fsio.d/../prt-fsio-marker", &st);
+  fail_unless(res == 0, "Failed to stat file: %s", strerror(errno));
+
+  /* Move the current directory elsewhere behind our back.  Paths with ".."
+   * must still be resolved as given, not relative to the moved directory.
+   */
+  fail_unless(rename(tmpdir, "/tmp/prt-fsio3.d/inner") == 0,
+    "Failed to rename directory: %s", strerror(errno));
+  fail_unless(mkdir(tmpdir, 0755) == 0, "Failed to create '%s': %s",
+    tmpdir, strerror(errno));
+
+  pr_fs_clear_cache();
+  res = pr_fsio_stat("/tmp/prt-fsio.d/../prt-fsio-marker", &st);
+  fail_unless(res == 0, "Failed to stat file: %s", strerror(errno));
+
+  pr_fsio_set_use_openat(FALSE);
+
+  (void) chdir(cwdbuf);
+  (void) unlink(marker);
+  (void) rmdir("/tmp/prt-fsio3.d/inner");
+  (void) rmdir(tmpdir2);
+  (void) rmdir(tmpdir);
+}
+END_TEST
+
+START_TEST (fs_check_access_test) {
+  int res;
+  struct stat st;
+  gid_t *gids;
+  array_header *suppl_gids;
+
+  res = pr_fs_check_access(NULL, R_OK, 1, 1, NULL);
+  fail_unless(res == -1, "Failed to handle null stat");
+  fail_unless(errno == EINVAL, "Failed to set errno to EINVAL");
+
+  memset(&st, 0, sizeof(st));
+  st.st_uid = 1;
+  st.st_gid = 2;
+  st.st_mode = S_IFREG|0640;
+
+  res = pr_fs_check_access(&st, R_OK, PR_ROOT_UID, PR_ROOT_GID, NULL);
+  fail_unless(res == 0, "Failed to allow root access");
+
+  res = pr_fs_check_access(&st, R_OK|W_OK, 1, 5, NULL);
+  fail_unless(res == 0, "Failed to allow owner access");
+
+  res = pr_fs_check_access(&st, X_OK, 1, 5, NULL);
+  fail_unless(res == -1, "Allowed owner execute access unexpectedly");
+  fail_unless(errno == EACCES, "Failed to set errno to EACCES");
+
+  res = pr_fs_check_access(&st, R_OK, 3, 2, NULL);
+  fail_unless(res == 0, "Failed to allow group access");
+
+  res = pr_fs_check_access(&st, W_OK, 3, 2, NULL);
+  fail_unless(res == -1, "Allowed group write access unexpectedly");
+
+  suppl_gids = make_array(p, 1, sizeof(gid_t));
+  gids = push_array(suppl_gids);
+  *gids = 2;
+
+  res = pr_fs_check_access(&st, R_OK, 3, 4, suppl_gids);
+  fail_unless(res == 0, "Failed to allow supplemental group access");
+
+  res = pr_fs_check_access(&st, R_OK, 3, 4, NULL);
+  fail_unless(res == -1, "Allowed other read access unexpectedly");
+  fail_unless(errno == EACCES, "Failed to set errno to EACCES");
+}
+END_TEST
+
+START_TEST (fs_have_sys_access_test) {
+  int res;
+
+  res = pr_fs_have_sys_access();
+  fail_unless(res == TRUE, "Expected system access handler only");
+}
+END_TEST
+
 Suite *tests_get_fsio_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -217,6 +656,13 @@ Suite *tests_get_fsio_suite(void) {
   tcase_add_test(testcase, fs_clean_path2_test);
   tcase_add_test(testcase, fs_dircat_test);
   tcase_add_test(testcase, fs_setcwd_test);
+  tcase_add_test(testcase, fs_resolve_path_test);
+  tcase_add_test(testcase, fsio_use_openat_test);
+  tcase_add_test(testcase, fsio_use_openat_dotdot_test);
+  tcase_add_test(testcase, fs_copy_file_test);
+  tcase_add_test(testcase, fs_copy_file_custom_fs_test);
+  tcase_add_test(testcase, fs_check_access_test);
+  tcase_add_test(testcase, fs_have_sys_access_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
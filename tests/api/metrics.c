@@ -0,0 +1,329 @@
+/*
+ * ProFTPD - FTP server testsuite
+ * Copyright (c) 2014 The ProFTPD Project team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, The ProFTPD Project team and other respective
+ * copyright holders give permission to link this program with OpenSSL, and
+ * distribute the resulting executable, without including the source code for
+ * OpenSSL in the source distribution.
+ */
+
+/* Metrics API tests */
+
+#include "tests.h"
+
+static pool *p = NULL;
+
+static cmdtable metrics_cmdtab[] = {
+  { CMD, C_USER, G_NONE, NULL, FALSE, FALSE },
+  { CMD, C_PASS, G_NONE, NULL, FALSE, FALSE },
+  { POST_CMD, C_PASS, G_NONE, NULL, FALSE, FALSE },
+  { 0, NULL }
+};
+
+static module metrics_module;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = permanent_pool = make_sub_pool(NULL);
+  }
+
+  memset(&metrics_module, 0, sizeof(metrics_module));
+  metrics_module.name = "metrics";
+  metrics_module.cmdtable = metrics_cmdtab;
+
+  loaded_modules = &metrics_module;
+}
+
+static void tear_down(void) {
+  pr_metrics_free();
+  loaded_modules = NULL;
+
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+    permanent_pool = NULL;
+  }
+}
+
+START_TEST (metrics_init_test) {
+  int res;
+
+  fail_unless(pr_metrics_enabled() == FALSE, "Expected metrics disabled");
+  fail_unless(pr_metrics_get_count(PR_METRICS_TYPE_CMD) == 0,
+    "Expected no commands");
+
+  res = pr_metrics_reset();
+  fail_unless(res == -1, "Failed to handle uninitialized metrics");
+  fail_unless(errno == EPERM, "Failed to set errno to EPERM (got %d)", errno);
+
+  res = pr_metrics_init();
+  fail_unless(res == 0, "Failed to init metrics: %s", strerror(errno));
+  fail_unless(pr_metrics_enabled() == TRUE, "Expected metrics enabled");
+
+  /* "(other)", plus USER and PASS (only once). */
+  fail_unless(pr_metrics_get_count(PR_METRICS_TYPE_CMD) == 3,
+    "Expected 3 commands, got %u", pr_metrics_get_count(PR_METRICS_TYPE_CMD));
+  fail_unless(pr_metrics_get_count(PR_METRICS_TYPE_MODULE) == 1,
+    "Expected 1 module, got %u",
+    pr_metrics_get_count(PR_METRICS_TYPE_MODULE));
+
+  fail_unless(strcmp(pr_metrics_get_name(PR_METRICS_TYPE_CMD, 1), C_USER) == 0,
+    "Expected '%s', got '%s'", C_USER,
+    pr_metrics_get_name(PR_METRICS_TYPE_CMD, 1));
+  fail_unless(strcmp(pr_metrics_get_name(PR_METRICS_TYPE_MODULE, 0),
+    "metrics") == 0, "Expected 'metrics', got '%s'",
+    pr_metrics_get_name(PR_METRICS_TYPE_MODULE, 0));
+
+  fail_unless(pr_metrics_get_name(PR_METRICS_TYPE_CMD, 3) == NULL,
+    "Failed to handle out-of-range index");
+  fail_unless(errno == ENOENT, "Failed to set errno to ENOENT (got %d)", errno);
+
+  res = pr_metrics_free();
+  fail_unless(res == 0, "Failed to free metrics: %s", strerror(errno));
+  fail_unless(pr_metrics_enabled() == FALSE, "Expected metrics disabled");
+}
+END_TEST
+
+START_TEST (metrics_add_cmd_time_test) {
+  int res;
+  cmd_rec *cmd;
+  pr_metrics_histo_t histo;
+  unsigned long usecs = 0;
+
+  cmd = pr_cmd_alloc(p, 2, C_PASS, "secret");
+
+  res = pr_metrics_add_cmd_time(NULL, CMD, &metrics_module, 1);
+  fail_unless(res == -1, "Failed to handle null cmd");
+  fail_unless(errno == EINVAL, "Failed to set errno to EINVAL (got %d)", errno);
+
+  res = pr_metrics_add_cmd_time(cmd, CMD, &metrics_module, 1);
+  fail_unless(res == -1, "Failed to handle uninitialized metrics");
+  fail_unless(errno == EPERM, "Failed to set errno to EPERM (got %d)", errno);
+
+  res = pr_metrics_init();
+  fail_unless(res == 0, "Failed to init metrics: %s", strerror(errno));
+
+  res = pr_metrics_get_cmd_usecs(cmd, &usecs);
+  fail_unless(res == -1, "Failed to handle untimed command");
+  fail_unless(errno == ENOENT, "Failed to set errno to ENOENT (got %d)", errno);
+
+  res = pr_metrics_add_cmd_time(cmd, CMD, &metrics_module, 100);
+  fail_unless(res == 0, "Failed to add time: %s", strerror(errno));
+  res = pr_metrics_add_cmd_time(cmd, POST_CMD, &metrics_module, 20);
+  fail_unless(res == 0, "Failed to add time: %s", strerror(errno));
+
+  /* Logging times are not included in the command's total. */
+  res = pr_metrics_add_cmd_time(cmd, LOG_CMD, &metrics_module, 5000);
+  fail_unless(res == 0, "Failed to add time: %s", strerror(errno));
+
+  res = pr_metrics_get_cmd_usecs(cmd, &usecs);
+  fail_unless(res == 0, "Failed to get command time: %s", strerror(errno));
+  fail_unless(usecs == 120, "Expected 120 usecs, got %lu", usecs);
+
+  res = pr_metrics_get_histo(PR_METRICS_TYPE_CMD, 2, CMD, &histo);
+  fail_unless(res == 0, "Failed to get histogram: %s", strerror(errno));
+  fail_unless(histo.count == 1, "Expected count 1, got %lu", histo.count);
+  fail_unless(histo.total_usecs == 100, "Expected 100 usecs, got %lu",
+    histo.total_usecs);
+
+  res = pr_metrics_get_histo(PR_METRICS_TYPE_MODULE, 0, LOG_CMD, &histo);
+  fail_unless(res == 0, "Failed to get histogram: %s", strerror(errno));
+  fail_unless(histo.count == 1, "Expected count 1, got %lu", histo.count);
+  fail_unless(histo.total_usecs == 5000, "Expected 5000 usecs, got %lu",
+    histo.total_usecs);
+
+  /* Unknown commands are counted as "(other)". */
+  cmd = pr_cmd_alloc(p, 1, "FOO");
+  res = pr_metrics_add_cmd_time(cmd, CMD, &metrics_module, 7);
+  fail_unless(res == 0, "Failed to add time: %s", strerror(errno));
+
+  res = pr_metrics_get_histo(PR_METRICS_TYPE_CMD, 0, CMD, &histo);
+  fail_unless(res == 0, "Failed to get histogram: %s", strerror(errno));
+  fail_unless(histo.count == 1, "Expected count 1, got %lu", histo.count);
+
+  res = pr_metrics_get_histo(PR_METRICS_TYPE_CMD, 0, 0, &histo);
+  fail_unless(res == -1, "Failed to handle invalid phase");
+  fail_unless(errno == ENOENT, "Failed to set errno to ENOENT (got %d)", errno);
+
+  res = pr_metrics_reset();
+  fail_unless(res == 0, "Failed to reset metrics: %s", strerror(errno));
+
+  res = pr_metrics_get_histo(PR_METRICS_TYPE_CMD, 0, CMD, &histo);
+  fail_unless(res == 0, "Failed to get histogram: %s", strerror(errno));
+  fail_unless(histo.count == 0, "Expected count 0, got %lu", histo.count);
+}
+END_TEST
+
+START_TEST (metrics_histo_percentile_test) {
+  pr_metrics_histo_t histo;
+  unsigned long res;
+
+  memset(&histo, 0, sizeof(histo));
+
+  res = pr_metrics_histo_percentile(NULL, 50);
+  fail_unless(res == 0, "Failed to handle null histogram");
+
+  res = pr_metrics_histo_percentile(&histo, 50);
+  fail_unless(res == 0, "Failed to handle empty histogram");
+
+  /* 90 values in [2, 4) usecs, 10 values in [512, 1024) usecs. */
+  histo.count = 100;
+  histo.buckets[2] = 90;
+  histo.buckets[10] = 10;
+
+  res = pr_metrics_histo_percentile(&histo, 50);
+  fail_unless(res == 4, "Expected 4, got %lu", res);
+
+  res = pr_metrics_histo_percentile(&histo, 90);
+  fail_unless(res == 4, "Expected 4, got %lu", res);
+
+  res = pr_metrics_histo_percentile(&histo, 99);
+  fail_unless(res == 1024, "Expected 1024, got %lu", res);
+}
+END_TEST
+
+START_TEST (metrics_now_test) {
+  unsigned long start, end;
+
+  start = pr_metrics_now();
+  end = pr_metrics_now();
+  fail_unless(end >= start, "Expected monotonic times (%lu < %lu)", end,
+    start);
+}
+END_TEST
+
+START_TEST (metrics_counters_test) {
+  int res;
+  server_rec s;
+  unsigned long val = 0;
+  char *text;
+
+  res = pr_metrics_counters_init();
+  fail_unless(res == -1, "Failed to handle missing server list");
+  fail_unless(errno == EPERM, "Failed to set errno to EPERM (got %d)", errno);
+
+  /* Incrementing unallocated counters is a no-op. */
+  pr_metrics_incr(PR_METRICS_CTR_LOGINS, 1);
+
+  memset(&s, 0, sizeof(s));
+  s.sid = 1;
+  s.ServerName = "Test \"FTP\" Server";
+  s.ServerAddress = "127.0.0.1";
+  s.ServerPort = 21;
+
+  server_list = xaset_create(p, NULL);
+  xaset_insert(server_list, (xasetmember_t *) &s);
+  main_server = &s;
+
+  res = pr_metrics_counters_init();
+  fail_unless(res == 0, "Failed to init counters: %s", strerror(errno));
+
+  pr_metrics_incr(PR_METRICS_CTR_LOGINS, 1);
+  pr_metrics_incr(PR_METRICS_CTR_BYTES_OUT, 1024);
+  pr_metrics_incr(PR_METRICS_CTR_BYTES_OUT, 1024);
+  pr_metrics_incr(PR_METRICS_NCOUNTERS, 1);
+
+  res = pr_metrics_get_counter(1, PR_METRICS_CTR_BYTES_OUT, &val);
+  fail_unless(res == 0, "Failed to get counter: %s", strerror(errno));
+  fail_unless(val == 2048, "Expected 2048, got %lu", val);
+
+  res = pr_metrics_get_counter(2, PR_METRICS_CTR_BYTES_OUT, &val);
+  fail_unless(res == -1, "Failed to handle unknown SID");
+  fail_unless(errno == ENOENT, "Failed to set errno to ENOENT (got %d)", errno);
+
+  res = pr_metrics_get_counter(1, PR_METRICS_NCOUNTERS, &val);
+  fail_unless(res == -1, "Failed to handle unknown counter");
+  fail_unless(errno == EINVAL, "Failed to set errno to EINVAL (got %d)", errno);
+
+  text = pr_metrics_get_text(p);
+  fail_unless(text != NULL, "Failed to get text: %s", strerror(errno));
+  fail_unless(strstr(text, "# TYPE proftpd_logins_total counter\n") != NULL,
+    "Missing logins type in '%s'", text);
+  fail_unless(strstr(text, "proftpd_bytes_out_total{server=\"Test \\\"FTP\\\" "
+    "Server\",address=\"127.0.0.1\",port=\"21\"} 2048\n") != NULL,
+    "Missing bytes out counter in '%s'", text);
+
+  res = pr_metrics_counters_free();
+  fail_unless(res == 0, "Failed to free counters: %s", strerror(errno));
+
+  server_list = NULL;
+  main_server = NULL;
+}
+END_TEST
+
+START_TEST (metrics_listen_test) {
+  int fd, res;
+  const char *path = "/tmp/prt-metrics.sock";
+  struct stat st;
+
+  (void) unlink(path);
+
+  res = pr_metrics_listen(NULL, 0600);
+  fail_unless(res == -1, "Failed to handle null path");
+  fail_unless(errno == EINVAL, "Failed to set errno to EINVAL (got %d)", errno);
+
+  /* An existing file which is not a socket must be left alone. */
+  fd = open(path, O_CREAT|O_WRONLY, 0600);
+  fail_unless(fd >= 0, "Failed to create '%s': %s", path, strerror(errno));
+  (void) close(fd);
+
+  res = pr_metrics_listen(path, 0600);
+  fail_unless(res == -1, "Failed to handle existing non-socket file");
+  fail_unless(errno == EEXIST, "Failed to set errno to EEXIST (got %d)", errno);
+
+  res = lstat(path, &st);
+  fail_unless(res == 0 && S_ISREG(st.st_mode), "File '%s' was removed", path);
+  (void) unlink(path);
+
+  res = pr_metrics_listen(path, 0600);
+  fail_unless(res >= 0, "Failed to listen on '%s': %s", path, strerror(errno));
+  fail_unless(pr_metrics_get_listen_fd() == res, "Expected listen fd %d",
+    res);
+
+  /* The socket left behind by a previous listener is replaced. */
+  (void) pr_metrics_close();
+
+  res = pr_metrics_listen(path, 0600);
+  fail_unless(res >= 0, "Failed to replace stale socket '%s': %s", path,
+    strerror(errno));
+
+  (void) pr_metrics_close();
+  (void) unlink(path);
+}
+END_TEST
+
+Suite *tests_get_metrics_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("metrics");
+
+  testcase = tcase_create("base");
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, metrics_init_test);
+  tcase_add_test(testcase, metrics_add_cmd_time_test);
+  tcase_add_test(testcase, metrics_histo_percentile_test);
+  tcase_add_test(testcase, metrics_now_test);
+  tcase_add_test(testcase, metrics_counters_test);
+  tcase_add_test(testcase, metrics_listen_test);
+
+  suite_add_tcase(suite, testcase);
+
+  return suite;
+}
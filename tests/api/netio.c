@@ -254,6 +254,83 @@ START_TEST (netio_telnet_gets_multi_line_test) {
 }
 END_TEST
 
+START_TEST (netio_telnet_gets_pipelined_test) {
+  char buf[256], *cmd, *res;
+  pr_netio_stream_t *in, *out;
+  pr_buffer_t *pbuf;
+  int len, xerrno;
+
+  in = pr_netio_open(p, PR_NETIO_STRM_CTRL, -1, PR_NETIO_IO_RD);
+  out = pr_netio_open(p, PR_NETIO_STRM_CTRL, -1, PR_NETIO_IO_WR);
+
+  cmd = "SIZE a\r\nMDTM b\r\nNOOP\r\n";
+
+  pr_netio_buffer_alloc(in);
+  pbuf = in->strm_buf;
+  len = snprintf(pbuf->buf, pbuf->buflen-1, "%s", cmd);
+  pbuf->remaining = pbuf->buflen - len;
+  pbuf->current = pbuf->buf;
+
+  buf[sizeof(buf)-1] = '\0';
+
+  res = pr_netio_telnet_gets(buf, sizeof(buf)-1, in, out);
+  fail_unless(res != NULL, "Failed to get string from stream: %s",
+    strerror(errno));
+  fail_unless(strcmp(buf, "SIZE a\r\n") == 0, "Expected 'SIZE a', got '%s'",
+    buf);
+
+  res = pr_netio_telnet_gets(buf, sizeof(buf)-1, in, out);
+  fail_unless(res != NULL, "Failed to get string from stream: %s",
+    strerror(errno));
+  fail_unless(strcmp(buf, "MDTM b\r\n") == 0, "Expected 'MDTM b', got '%s'",
+    buf);
+
+  res = pr_netio_telnet_gets(buf, sizeof(buf)-1, in, out);
+  xerrno = errno;
+
+  pr_netio_close(in);
+  pr_netio_close(out);
+
+  fail_unless(res != NULL, "Failed to get string from stream: (%d) %s",
+    xerrno, strerror(xerrno));
+  fail_unless(strcmp(buf, "NOOP\r\n") == 0, "Expected 'NOOP', got '%s'",
+    buf);
+}
+END_TEST
+
+START_TEST (netio_telnet_has_line_test) {
+  pr_netio_stream_t *in;
+  pr_buffer_t *pbuf;
+  int len, res;
+
+  res = pr_netio_telnet_has_line(NULL);
+  fail_unless(res == FALSE, "Failed to handle null argument");
+
+  in = pr_netio_open(p, PR_NETIO_STRM_CTRL, -1, PR_NETIO_IO_RD);
+
+  res = pr_netio_telnet_has_line(in);
+  fail_unless(res == FALSE, "Expected no line in unbuffered stream");
+
+  pr_netio_buffer_alloc(in);
+  pbuf = in->strm_buf;
+  len = snprintf(pbuf->buf, pbuf->buflen-1, "%s", "NOOP\r\nSIZE fo");
+  pbuf->remaining = pbuf->buflen - len;
+  pbuf->current = pbuf->buf;
+
+  res = pr_netio_telnet_has_line(in);
+  fail_unless(res == TRUE, "Expected buffered line");
+
+  /* Consume the first line; the rest is not a complete line. */
+  pbuf->current += 6;
+  pbuf->remaining += 6;
+
+  res = pr_netio_telnet_has_line(in);
+  fail_unless(res == FALSE, "Expected no complete buffered line");
+
+  pr_netio_close(in);
+}
+END_TEST
+
 START_TEST (netio_telnet_gets_no_newline_test) {
   char buf[8], *cmd, *res;
   pr_netio_stream_t *in, *out;
@@ -1032,6 +1109,8 @@ Suite *tests_get_netio_suite(void) {
   tcase_add_test(testcase, netio_telnet_gets_args_test);
   tcase_add_test(testcase, netio_telnet_gets_single_line_test);
   tcase_add_test(testcase, netio_telnet_gets_multi_line_test);
+  tcase_add_test(testcase, netio_telnet_gets_pipelined_test);
+  tcase_add_test(testcase, netio_telnet_has_line_test);
   tcase_add_test(testcase, netio_telnet_gets_no_newline_test);
   tcase_add_test(testcase, netio_telnet_gets_telnet_will_test);
   tcase_add_test(testcase, netio_telnet_gets_telnet_bare_will_test);
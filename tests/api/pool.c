@@ -189,6 +189,83 @@ START_TEST (pcalloc_test) {
 }
 END_TEST
 
+START_TEST (pool_arena_test) {
+  register unsigned int i;
+  pool *arena, *p;
+  char *v;
+  size_t sz;
+  int res;
+
+  arena = pr_pool_get_arena();
+  fail_unless(arena != NULL, "Failed to get arena pool");
+  fail_unless(pr_pool_get_arena() == arena, "Expected same arena pool");
+
+  p = make_sub_pool(arena);
+  fail_if(p == NULL, "Failed to allocate arena sub pool");
+
+  sz = 16382;
+  v = palloc(p, sz);
+  fail_if(v == NULL, "Failed to allocate %u-len memory", sz);
+  memset(v, 'A', sz);
+
+  res = pr_pool_arena_freeze(PR_POOL_ARENA_FL_PROTECT);
+  fail_unless(res == 0, "Failed to freeze arena: %s", strerror(errno));
+
+  for (i = 0; i < sz; i++) {
+    fail_unless(v[i] == 'A', "Expected 'A' at position %u, got '%c'", i, v[i]);
+  }
+
+  res = pr_pool_arena_thaw();
+  fail_unless(res == 0, "Failed to thaw arena: %s", strerror(errno));
+
+  v[0] = 'B';
+  destroy_pool(p);
+
+  /* Thawing an unprotected arena is a no-op. */
+  res = pr_pool_arena_thaw();
+  fail_unless(res == 0, "Failed to thaw arena: %s", strerror(errno));
+
+  res = pr_pool_arena_freeze(0);
+  fail_unless(res == 0, "Failed to freeze arena: %s", strerror(errno));
+
+  p = make_sub_pool(arena);
+  v = palloc(p, sz);
+  fail_if(v == NULL, "Failed to allocate %u-len memory", sz);
+  destroy_pool(p);
+}
+END_TEST
+
+START_TEST (pool_arena_protect_test) {
+  pool *p;
+
+  p = make_sub_pool(pr_pool_get_arena());
+  fail_if(p == NULL, "Failed to allocate arena sub pool");
+
+  pr_pool_arena_freeze(PR_POOL_ARENA_FL_PROTECT);
+
+  /* Growing a protected pool requires writing to it; expect a fault. */
+  (void) palloc(p, 16382);
+}
+END_TEST
+
+START_TEST (pool_get_page_usage_test) {
+  unsigned long shared_kb = 0, private_kb = 0;
+  int res;
+
+  res = pr_pool_get_page_usage(NULL, NULL);
+  fail_unless(res == -1, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Failed to set errno to EINVAL");
+
+  res = pr_pool_get_page_usage(&shared_kb, &private_kb);
+  if (res == 0) {
+    fail_unless(private_kb > 0, "Expected private memory, got none");
+
+  } else {
+    fail_unless(errno == ENOENT, "Failed to set errno to ENOENT");
+  }
+}
+END_TEST
+
 Suite *tests_get_pool_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -218,6 +295,9 @@ Suite *tests_get_pool_suite(void) {
 #endif
   tcase_add_test(testcase, palloc_test);
   tcase_add_test(testcase, pcalloc_test);
+  tcase_add_test(testcase, pool_arena_test);
+  tcase_add_test_raise_signal(testcase, pool_arena_protect_test, SIGSEGV);
+  tcase_add_test(testcase, pool_get_page_usage_test);
 
   suite_add_tcase(suite, testcase);
 
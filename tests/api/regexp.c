@@ -112,6 +112,91 @@ START_TEST (regexp_exec) {
 }
 END_TEST
 
+START_TEST (regexp_exec_shared_test) {
+  pr_regex_t *pre1 = NULL, *pre2 = NULL;
+  int res;
+  char *pattern;
+
+  pre1 = pr_regexp_alloc(NULL);
+  pre2 = pr_regexp_alloc(NULL);
+
+  /* Both regexes share the same compiled pattern. */
+  pattern = "^foo";
+  res = pr_regexp_compile(pre1, pattern, 0);
+  fail_unless(res == 0, "Failed to compile regex pattern");
+
+  res = pr_regexp_compile(pre2, pattern, 0);
+  fail_unless(res == 0, "Failed to compile regex pattern");
+
+  res = pr_regexp_exec(pre1, "foobar", 0, NULL, 0, 0, 0);
+  fail_unless(res == 0, "Failed to match string");
+
+  res = pr_regexp_exec(pre2, "foobar", 0, NULL, 0, 0, 0);
+  fail_unless(res == 0, "Failed to match string");
+
+  /* Freeing one must not affect the other. */
+  pr_regexp_free(NULL, pre1);
+
+  res = pr_regexp_exec(pre2, "foobar", 0, NULL, 0, 0, 0);
+  fail_unless(res == 0, "Failed to match string");
+
+  res = pr_regexp_exec(pre2, "barfoo", 0, NULL, 0, 0, 0);
+  fail_unless(res != 0, "Matched string unexpectedly");
+
+  /* Recompiling with a different pattern must not affect other users of the
+   * original pattern.
+   */
+  pre1 = pr_regexp_alloc(NULL);
+  res = pr_regexp_compile(pre1, pattern, 0);
+  fail_unless(res == 0, "Failed to compile regex pattern");
+
+  res = pr_regexp_compile(pre2, "bar$", 0);
+  fail_unless(res == 0, "Failed to compile regex pattern");
+
+  res = pr_regexp_exec(pre1, "foobar", 0, NULL, 0, 0, 0);
+  fail_unless(res == 0, "Failed to match string");
+
+  res = pr_regexp_exec(pre2, "foobar", 0, NULL, 0, 0, 0);
+  fail_unless(res == 0, "Failed to match string");
+
+  res = pr_regexp_exec(pre2, "barfoo", 0, NULL, 0, 0, 0);
+  fail_unless(res != 0, "Matched string unexpectedly");
+
+  pr_regexp_free(NULL, pre1);
+  pr_regexp_free(NULL, pre2);
+}
+END_TEST
+
+START_TEST (regexp_restart_test) {
+  pr_regex_t *pre1 = NULL, *pre2 = NULL;
+  int res;
+  char *pattern;
+
+  pre1 = pr_regexp_alloc(NULL);
+  pre2 = pr_regexp_alloc(NULL);
+
+  pattern = "^foo";
+  res = pr_regexp_compile(pre1, pattern, 0);
+  fail_unless(res == 0, "Failed to compile regex pattern");
+
+  /* A failed compilation is not shared, and is released with the rest. */
+  res = pr_regexp_compile(pre2, "[=foo", 0);
+  fail_unless(res != 0, "Successfully compiled pattern unexpectedly");
+
+  /* Restarting releases every regex, and the cache along with them. */
+  pr_event_generate("core.restart", NULL);
+
+  pre1 = pr_regexp_alloc(NULL);
+  res = pr_regexp_compile(pre1, pattern, 0);
+  fail_unless(res == 0, "Failed to compile regex pattern");
+
+  res = pr_regexp_exec(pre1, "foobar", 0, NULL, 0, 0, 0);
+  fail_unless(res == 0, "Failed to match string");
+
+  pr_regexp_free(NULL, pre1);
+}
+END_TEST
+
 Suite *tests_get_regexp_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -126,6 +211,8 @@ Suite *tests_get_regexp_suite(void) {
   tcase_add_test(testcase, regexp_free_test);
   tcase_add_test(testcase, regexp_compile);
   tcase_add_test(testcase, regexp_exec);
+  tcase_add_test(testcase, regexp_exec_shared_test);
+  tcase_add_test(testcase, regexp_restart_test);
 
   suite_add_tcase(suite, testcase);
 
@@ -28,6 +28,8 @@
 
 #include "tests.h"
 
+extern pr_response_t *resp_list;
+
 static pool *p = NULL;
 
 static void set_up(void) {
@@ -129,6 +131,87 @@ START_TEST (response_get_last_test) {
 }
 END_TEST
 
+START_TEST (response_defer_test) {
+  int fds[2], res;
+  char buf[256];
+  conn_t conn;
+  pr_netio_stream_t *out;
+
+  res = pr_response_defer(-1);
+  fail_unless(res == -1, "Failed to handle invalid argument");
+  fail_unless(errno == EINVAL, "Failed to set errno to EINVAL (got %d)", errno);
+
+  fail_unless(pipe(fds) == 0, "Failed to open pipe: %s", strerror(errno));
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  permanent_pool = p;
+  init_netio();
+  out = pr_netio_open(p, PR_NETIO_STRM_CTRL, fds[1], PR_NETIO_IO_WR);
+
+  memset(&conn, 0, sizeof(conn));
+  conn.outstrm = out;
+  session.c = &conn;
+
+  pr_response_set_pool(p);
+
+  res = pr_response_defer(TRUE);
+  fail_unless(res == 0, "Failed to defer responses: %s", strerror(errno));
+
+  pr_response_add(R_213, "%s", "1024");
+  pr_response_flush(&resp_list);
+  pr_response_add(R_213, "%s", "20140101000000");
+  pr_response_flush(&resp_list);
+
+  res = read(fds[0], buf, sizeof(buf)-1);
+  fail_unless(res == -1, "Read %d bytes of unexpectedly written responses",
+    res);
+
+  res = pr_response_defer(FALSE);
+  fail_unless(res >= 0, "Failed to write deferred responses: %s",
+    strerror(errno));
+
+  memset(buf, '\0', sizeof(buf));
+  res = read(fds[0], buf, sizeof(buf)-1);
+  fail_unless(strcmp(buf, "213 1024\r\n213 20140101000000\r\n") == 0,
+    "Expected both responses, got '%s'", buf);
+
+  /* Responses sent directly are never deferred, but may not overtake the
+   * deferred ones.
+   */
+  pr_response_defer(TRUE);
+  pr_response_add(R_200, "%s", "OK");
+  pr_response_flush(&resp_list);
+  pr_response_send(R_150, "%s", "Opening");
+
+  memset(buf, '\0', sizeof(buf));
+  res = read(fds[0], buf, sizeof(buf)-1);
+  fail_unless(strcmp(buf, "200 OK\r\n150 Opening\r\n") == 0,
+    "Expected ordered responses, got '%s'", buf);
+
+  pr_response_defer(FALSE);
+
+  /* Nor may async responses. */
+  session.pool = p;
+  pr_response_defer(TRUE);
+  pr_response_add(R_200, "%s", "OK");
+  pr_response_flush(&resp_list);
+  pr_response_send_async(R_421, "%s", "Timeout");
+
+  memset(buf, '\0', sizeof(buf));
+  res = read(fds[0], buf, sizeof(buf)-1);
+  fail_unless(strcmp(buf, "200 OK\r\n421 Timeout\r\n") == 0,
+    "Expected ordered responses, got '%s'", buf);
+
+  pr_response_defer(FALSE);
+  session.pool = NULL;
+  session.c = NULL;
+
+  pr_netio_close(out);
+  (void) close(fds[0]);
+  permanent_pool = NULL;
+}
+END_TEST
+
 START_TEST (response_pool_bug3711_test) {
   cmd_rec *cmd;
   pool *resp_pool, *cmd_pool;
@@ -189,6 +272,7 @@ Suite *tests_get_response_suite(void) {
   tcase_add_test(testcase, response_add_test);
   tcase_add_test(testcase, response_add_err_test);
   tcase_add_test(testcase, response_get_last_test);
+  tcase_add_test(testcase, response_defer_test);
 
   /* We expect this test to fail due to a segfault; see Bug#3711.
    *
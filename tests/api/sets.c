@@ -221,6 +221,65 @@ START_TEST (set_insert_end_test) {
 }
 END_TEST
 
+START_TEST (set_insert_end_remove_test) {
+  register unsigned int i;
+  int res;
+  xaset_t *set;
+  struct test_item *items[4];
+  xasetmember_t *member;
+
+  set = xaset_create(p, NULL);
+  fail_unless(set != NULL, "Failed to create set: %s", strerror(errno));
+
+  for (i = 0; i < 4; i++) {
+    items[i] = pcalloc(p, sizeof(struct test_item));
+    items[i]->num = i;
+  }
+
+  res = xaset_insert_end(set, (xasetmember_t *) items[0]);
+  fail_unless(res == 0, "Failed to insert item0: %s", strerror(errno));
+
+  res = xaset_insert_end(set, (xasetmember_t *) items[1]);
+  fail_unless(res == 0, "Failed to insert item1: %s", strerror(errno));
+
+  /* Removing the last member must not leave a dangling end of the list. */
+  res = xaset_remove(set, (xasetmember_t *) items[1]);
+  fail_unless(res == 0, "Failed to remove item1: %s", strerror(errno));
+
+  res = xaset_insert_end(set, (xasetmember_t *) items[2]);
+  fail_unless(res == 0, "Failed to insert item2: %s", strerror(errno));
+
+  member = set->xas_list;
+  fail_unless(member == (xasetmember_t *) items[0],
+    "Expected head of list to be item0 (%p), got %p", items[0], member);
+  fail_unless(member->next == (xasetmember_t *) items[2],
+    "Next item in list does not point to item2");
+  fail_unless(member->next->prev == member,
+    "Previous item of item2 does not point to item0");
+
+  /* Empty the list, then mix head and end insertions. */
+  res = xaset_remove(set, (xasetmember_t *) items[0]);
+  fail_unless(res == 0, "Failed to remove item0: %s", strerror(errno));
+
+  res = xaset_remove(set, (xasetmember_t *) items[2]);
+  fail_unless(res == 0, "Failed to remove item2: %s", strerror(errno));
+  fail_unless(set->xas_list == NULL, "Expected empty list");
+
+  res = xaset_insert(set, (xasetmember_t *) items[3]);
+  fail_unless(res == 0, "Failed to insert item3: %s", strerror(errno));
+
+  res = xaset_insert_end(set, (xasetmember_t *) items[1]);
+  fail_unless(res == 0, "Failed to insert item1: %s", strerror(errno));
+
+  member = set->xas_list;
+  fail_unless(member == (xasetmember_t *) items[3],
+    "Expected head of list to be item3 (%p), got %p", items[3], member);
+  fail_unless(member->next == (xasetmember_t *) items[1],
+    "Next item in list does not point to item1");
+  fail_unless(member->next->next == NULL, "Expected end of list");
+}
+END_TEST
+
 START_TEST (set_insert_sort_test) {
   int res;
   xaset_t *set;
@@ -457,6 +516,7 @@ Suite *tests_get_sets_suite(void) {
   tcase_add_test(testcase, set_create_test);
   tcase_add_test(testcase, set_insert_test);
   tcase_add_test(testcase, set_insert_end_test);
+  tcase_add_test(testcase, set_insert_end_remove_test);
   tcase_add_test(testcase, set_insert_sort_test);
   tcase_add_test(testcase, set_remove_test);
   tcase_add_test(testcase, set_copy_test);
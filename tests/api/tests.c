@@ -53,6 +53,9 @@ static struct testsuite_info suites[] = {
   { "response",		tests_get_response_suite },
   { "fsio",		tests_get_fsio_suite },
   { "netio",		tests_get_netio_suite },
+  { "metrics",		tests_get_metrics_suite },
+  { "encode",		tests_get_encode_suite },
+  { "trace",		tests_get_trace_suite },
 
   { NULL, NULL }
 };
@@ -126,6 +129,15 @@ static Suite *tests_get_suite(const char *suite) {
 
   } else if (strcmp(suite, "netio") == 0) {
     return tests_get_netio_suite();
+
+  } else if (strcmp(suite, "metrics") == 0) {
+    return tests_get_metrics_suite();
+
+  } else if (strcmp(suite, "encode") == 0) {
+    return tests_get_encode_suite();
+
+  } else if (strcmp(suite, "trace") == 0) {
+    return tests_get_trace_suite();
   }
 
   return NULL;
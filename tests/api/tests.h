@@ -61,6 +61,9 @@ Suite *tests_get_cmd_suite(void);
 Suite *tests_get_response_suite(void);
 Suite *tests_get_fsio_suite(void);
 Suite *tests_get_netio_suite(void);
+Suite *tests_get_metrics_suite(void);
+Suite *tests_get_encode_suite(void);
+Suite *tests_get_trace_suite(void);
 
 /* Temporary hack/placement for this variable, until we get to testing
  * the Signals API.
@@ -72,6 +75,7 @@ extern int ServerUseReverseDNS;
 extern server_rec *main_server;
 extern pid_t mpid;
 extern module *loaded_modules;
+extern xaset_t *server_list;
 extern module *static_modules[];
 
 #endif /* PR_TESTS_H */
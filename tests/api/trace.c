@@ -0,0 +1,478 @@
+/*
+ * ProFTPD - FTP server testsuite
+ * Copyright (c) 2014 The ProFTPD Project team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, The ProFTPD Project team and other respective
+ * copyright holders give permission to link this program with OpenSSL, and
+ * distribute the resulting executable, without including the source code for
+ * OpenSSL in the source distribution.
+ */
+
+/* Trace API tests */
+
+#include "tests.h"
+
+#ifdef PR_USE_TRACE
+
+static pool *p = NULL;
+
+static const char *trace_path = "/tmp/prt-trace.log";
+static const char *trace_channel = "testsuite";
+
+/* The trace buffer is allocated with at least this many bytes. */
+#define TRACE_TEST_BUFSZ	(32 * PR_TUNABLE_BUFFER_SIZE)
+
+/* Fixtures */
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = permanent_pool = make_sub_pool(NULL);
+  }
+
+  session.pid = getpid();
+
+  (void) unlink(trace_path);
+  (void) pr_trace_set_file(trace_path);
+  (void) pr_trace_set_levels(trace_channel, 1, 20);
+}
+
+static void tear_down(void) {
+  (void) pr_trace_set_buffer(0);
+
+  /* Closes the TraceLog, and frees the Trace API's pool. */
+  pr_event_generate("core.restart", NULL);
+  (void) unlink(trace_path);
+
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+    permanent_pool = NULL;
+  }
+}
+
+/* Helper functions */
+
+/* Reads the messages (without the timestamp, PID and channel prefix) of the
+ * lines in the TraceLog, then empties it.
+ */
+static array_header *read_msgs(void) {
+  array_header *msgs;
+  FILE *fh;
+  char line[PR_TUNABLE_BUFFER_SIZE * 2];
+
+  msgs = make_array(p, 0, sizeof(char *));
+
+  fh = fopen(trace_path, "r");
+  if (fh == NULL) {
+    return msgs;
+  }
+
+  while (fgets(line, sizeof(line), fh) != NULL) {
+    char *ptr;
+    size_t len;
+
+    len = strlen(line);
+    if (len > 0 &&
+        line[len-1] == '\n') {
+      line[len-1] = '\0';
+    }
+
+    ptr = strstr(line, ">: ");
+    *((char **) push_array(msgs)) = pstrdup(p, ptr != NULL ? ptr + 3 : line);
+  }
+
+  fclose(fh);
+  (void) truncate(trace_path, 0);
+
+  return msgs;
+}
+
+/* Logs the message, and formats the same message using snprintf(3), for
+ * comparing with what the buffer writes out later.
+ */
+#define TRACE_AND_EXPECT(i, ...) \
+  do { \
+    char expected[PR_TUNABLE_BUFFER_SIZE]; \
+    snprintf(expected, sizeof(expected), __VA_ARGS__); \
+    expects[i] = pstrdup(p, expected); \
+    res = pr_trace_msg(trace_channel, 1, __VA_ARGS__); \
+    fail_unless(res == 0, "Failed to buffer message %d: %s", i, \
+      strerror(errno)); \
+  } while (0)
+
+/* Tests */
+
+START_TEST (trace_set_buffer_test) {
+  int res;
+
+  res = pr_trace_set_buffer(1);
+  fail_unless(res < 0, "Failed to reject too-small buffer size");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = pr_trace_dump();
+  fail_unless(res < 0, "Failed to handle dump without a buffer");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  res = pr_trace_set_buffer(TRACE_TEST_BUFSZ);
+  fail_unless(res == 0, "Failed to set buffer: %s", strerror(errno));
+
+  res = pr_trace_msg(trace_channel, 1, "%s", "buffered");
+  fail_unless(res == 0, "Failed to buffer message: %s", strerror(errno));
+
+  /* Nothing is written until the buffer is dumped. */
+  fail_unless(read_msgs()->nelts == 0, "Message written before dump");
+
+  res = pr_trace_dump();
+  fail_unless(res == 1, "Expected 1 message dumped, got %d", res);
+
+  /* Disabling the buffer writes out what is left in it. */
+  res = pr_trace_msg(trace_channel, 1, "%s", "left over");
+  fail_unless(res == 0, "Failed to buffer message: %s", strerror(errno));
+
+  res = pr_trace_set_buffer(0);
+  fail_unless(res == 0, "Failed to disable buffer: %s", strerror(errno));
+
+  res = pr_trace_msg(trace_channel, 1, "%s", "unbuffered");
+  fail_unless(res > 0, "Failed to write message: %s", strerror(errno));
+
+  {
+    array_header *msgs;
+    char **elts;
+
+    msgs = read_msgs();
+    fail_unless(msgs->nelts == 3, "Expected 3 messages, got %d", msgs->nelts);
+
+    elts = msgs->elts;
+    fail_unless(strcmp(elts[0], "buffered") == 0, "Got '%s'", elts[0]);
+    fail_unless(strcmp(elts[1], "left over") == 0, "Got '%s'", elts[1]);
+    fail_unless(strcmp(elts[2], "unbuffered") == 0, "Got '%s'", elts[2]);
+  }
+}
+END_TEST
+
+START_TEST (trace_buffer_fmt_test) {
+  const char *expects[16];
+  char unterminated[4] = { 'a', 'b', 'c', 'd' };
+  char mutable[8];
+  array_header *msgs;
+  char **elts;
+  int i, res, n = 0;
+
+  res = pr_trace_set_buffer(TRACE_TEST_BUFSZ);
+  fail_unless(res == 0, "Failed to set buffer: %s", strerror(errno));
+
+  TRACE_AND_EXPECT(n++, "int %d, neg %i, unsigned %u, hex %x/%#X, oct %o",
+    42, -7, 4000000000U, 255, 255, 8);
+  TRACE_AND_EXPECT(n++, "long %ld, llong %lld, ullong %llu", -123456789L,
+    (long long) -9223372036854775807LL, (unsigned long long) 18446744073709551615ULL);
+  TRACE_AND_EXPECT(n++, "size %zu, ssize %zd, ptrdiff %td, intmax %jd",
+    (size_t) 65536, (ssize_t) -1, (ptrdiff_t) -42, (intmax_t) 1234567890123LL);
+  TRACE_AND_EXPECT(n++, "short %hd, char %hhu, c '%c'", (short) -2,
+    (unsigned char) 250, 'x');
+  TRACE_AND_EXPECT(n++, "double %f, %.3e, %g, width '%8.2f'", 3.25, 12345.678,
+    0.0001, -1.5);
+  TRACE_AND_EXPECT(n++, "long double %Lf, %.1Lf", 2.5L, 1024.25L);
+  TRACE_AND_EXPECT(n++, "width '%5d' '%-5d' '%05d' '%*d' '%-*d'", 12, 12, 12,
+    6, 34, 6, 34);
+  TRACE_AND_EXPECT(n++, "str '%s' '%10s' '%-10s' '%s'", "hello", "right",
+    "left", "");
+  TRACE_AND_EXPECT(n++, "prec '%.3s' '%.*s' '%.*s' '%.0s'", unterminated, 2,
+    unterminated, 4, unterminated, "gone");
+  TRACE_AND_EXPECT(n++, "width+prec '%8.3s' '%*.*s'", "abcdef", 6, 2,
+    "abcdef");
+  TRACE_AND_EXPECT(n++, "percent %% %d%%", 100);
+
+  /* String arguments are copied when logged, not when dumped. */
+  sstrncpy(mutable, "before", sizeof(mutable));
+  TRACE_AND_EXPECT(n++, "copied '%s'", mutable);
+  sstrncpy(mutable, "after", sizeof(mutable));
+
+  res = pr_trace_dump();
+  fail_unless(res == n, "Expected %d messages dumped, got %d", n, res);
+
+  msgs = read_msgs();
+  fail_unless(msgs->nelts == (unsigned int) n, "Expected %d messages, got %d",
+    n, msgs->nelts);
+
+  elts = msgs->elts;
+  for (i = 0; i < n; i++) {
+    fail_unless(strcmp(elts[i], expects[i]) == 0,
+      "Expected '%s', got '%s'", expects[i], elts[i]);
+  }
+}
+END_TEST
+
+START_TEST (trace_buffer_fallback_test) {
+  array_header *msgs;
+  char **elts, expected[256];
+  int res, count = 0;
+
+  res = pr_trace_set_buffer(TRACE_TEST_BUFSZ);
+  fail_unless(res == 0, "Failed to set buffer: %s", strerror(errno));
+
+  /* %m uses the errno at the time of logging, so such messages are formatted
+   * immediately.
+   */
+  errno = ENOENT;
+  res = pr_trace_msg(trace_channel, 1, "errno: %m");
+  fail_unless(res == 0, "Failed to buffer message: %s", strerror(errno));
+  errno = EACCES;
+
+  /* As are those using %n, which stores to its argument when logged... */
+  res = pr_trace_msg(trace_channel, 1, "count%n", &count);
+  fail_unless(res == 0, "Failed to buffer message: %s", strerror(errno));
+  fail_unless(count == 5, "Expected %%n count of 5, got %d", count);
+
+  /* ...and those using positional arguments. */
+  res = pr_trace_msg(trace_channel, 1, "%2$s %1$s", "world", "hello");
+  fail_unless(res == 0, "Failed to buffer message: %s", strerror(errno));
+
+  res = pr_trace_dump();
+  fail_unless(res == 3, "Expected 3 messages dumped, got %d", res);
+
+  msgs = read_msgs();
+  fail_unless(msgs->nelts == 3, "Expected 3 messages, got %d", msgs->nelts);
+
+  elts = msgs->elts;
+  snprintf(expected, sizeof(expected), "errno: %s", strerror(ENOENT));
+  fail_unless(strcmp(elts[0], expected) == 0, "Expected '%s', got '%s'",
+    expected, elts[0]);
+  fail_unless(strcmp(elts[1], "count") == 0, "Got '%s'", elts[1]);
+  fail_unless(strcmp(elts[2], "hello world") == 0, "Got '%s'", elts[2]);
+}
+END_TEST
+
+START_TEST (trace_buffer_wrap_test) {
+  array_header *msgs;
+  char **elts;
+  unsigned int i, nmsgs = 5000, first;
+  int res;
+
+  res = pr_trace_set_buffer(TRACE_TEST_BUFSZ);
+  fail_unless(res == 0, "Failed to set buffer: %s", strerror(errno));
+
+  for (i = 0; i < nmsgs; i++) {
+    res = pr_trace_msg(trace_channel, 1, "message %u", i);
+    fail_unless(res == 0, "Failed to buffer message %u: %s", i,
+      strerror(errno));
+  }
+
+  res = pr_trace_dump();
+  fail_unless(res > 0 && (unsigned int) res < nmsgs,
+    "Expected oldest messages to be overwritten, got %d messages", res);
+
+  /* What is left are the newest messages, in order. */
+  msgs = read_msgs();
+  fail_unless(msgs->nelts == (unsigned int) res,
+    "Expected %d messages, got %d", res, msgs->nelts);
+
+  elts = msgs->elts;
+  first = nmsgs - msgs->nelts;
+  for (i = 0; i < msgs->nelts; i++) {
+    char expected[64];
+
+    snprintf(expected, sizeof(expected), "message %u", first + i);
+    fail_unless(strcmp(elts[i], expected) == 0, "Expected '%s', got '%s'",
+      expected, elts[i]);
+  }
+
+  /* The buffer is empty after a dump. */
+  res = pr_trace_dump();
+  fail_unless(res == 0, "Expected empty buffer, got %d messages", res);
+}
+END_TEST
+
+START_TEST (trace_buffer_wrap_varying_test) {
+  array_header *msgs;
+  char **elts, str[PR_TUNABLE_BUFFER_SIZE];
+  unsigned int i, j, nmsgs = 3000, first;
+  int res;
+
+  res = pr_trace_set_buffer(TRACE_TEST_BUFSZ);
+  fail_unless(res == 0, "Failed to set buffer: %s", strerror(errno));
+
+  /* Records of varying sizes, some of them large, end at different places
+   * near the end of the ring, so that records which would not fit before the
+   * end are moved to the start of the ring instead.
+   */
+  for (i = 0; i < nmsgs; i++) {
+    size_t len;
+
+    len = (i * 37) % 900;
+    if (i % 11 == 0) {
+      len = 1000;
+    }
+
+    memset(str, 'a' + (i % 26), len);
+    str[len] = '\0';
+
+    res = pr_trace_msg(trace_channel, 1, "%u:%s", i, str);
+    fail_unless(res == 0, "Failed to buffer message %u: %s", i,
+      strerror(errno));
+
+    /* Dump now and then, so that the ring is checked at various points. */
+    if (i == 1234) {
+      res = pr_trace_dump();
+      fail_unless(res > 0, "Expected messages dumped, got %d", res);
+      (void) read_msgs();
+    }
+  }
+
+  res = pr_trace_dump();
+  fail_unless(res > 0 && (unsigned int) res < nmsgs - 1235,
+    "Expected oldest messages to be overwritten, got %d messages", res);
+
+  msgs = read_msgs();
+  fail_unless(msgs->nelts == (unsigned int) res,
+    "Expected %d messages, got %d", res, msgs->nelts);
+
+  elts = msgs->elts;
+  first = nmsgs - msgs->nelts;
+  for (i = 0; i < msgs->nelts; i++) {
+    unsigned int msgno;
+    char *ptr;
+    size_t len;
+
+    msgno = strtoul(elts[i], &ptr, 10);
+    fail_unless(msgno == first + i, "Expected message %u, got %u",
+      first + i, msgno);
+    fail_unless(*ptr == ':', "Malformed message '%s'", elts[i]);
+    ptr++;
+
+    len = (msgno * 37) % 900;
+    if (msgno % 11 == 0) {
+      len = 1000;
+    }
+
+    /* A long message is cut short by the TraceLog line length. */
+    fail_unless(strlen(ptr) == len ||
+      (strlen(ptr) < len && strlen(elts[i]) > 900),
+      "Expected %lu bytes in message %u, got %lu", (unsigned long) len,
+      msgno, (unsigned long) strlen(ptr));
+
+    for (j = 0; ptr[j]; j++) {
+      fail_unless(ptr[j] == (char) ('a' + (msgno % 26)),
+        "Corrupted message %u at byte %u", msgno, j);
+    }
+  }
+}
+END_TEST
+
+START_TEST (trace_buffer_fork_test) {
+  array_header *msgs;
+  char **elts, expected[64];
+  pid_t pid;
+  int res, status;
+
+  res = pr_trace_set_buffer(TRACE_TEST_BUFSZ);
+  fail_unless(res == 0, "Failed to set buffer: %s", strerror(errno));
+
+  res = pr_trace_msg(trace_channel, 1, "%s", "parent");
+  fail_unless(res == 0, "Failed to buffer message: %s", strerror(errno));
+
+  pid = fork();
+  fail_unless(pid >= 0, "Failed to fork: %s", strerror(errno));
+
+  if (pid == 0) {
+    session.pid = getpid();
+
+    /* The inherited records are the parent's; they are not written out by
+     * the child.
+     */
+    if (pr_trace_dump() != 0) {
+      _exit(1);
+    }
+
+    if (pr_trace_msg(trace_channel, 1, "%s", "child") != 0) {
+      _exit(2);
+    }
+
+    if (pr_trace_dump() != 1) {
+      _exit(3);
+    }
+
+    _exit(0);
+  }
+
+  fail_unless(waitpid(pid, &status, 0) == pid, "Failed to wait for child: %s",
+    strerror(errno));
+  fail_unless(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+    "Child failed with status %d", WEXITSTATUS(status));
+
+  res = pr_trace_dump();
+  fail_unless(res == 1, "Expected 1 message dumped, got %d", res);
+
+  /* Each line carries the PID of the process which logged it. */
+  {
+    FILE *fh;
+    char text[PR_TUNABLE_BUFFER_SIZE];
+    size_t len;
+
+    fh = fopen(trace_path, "r");
+    fail_unless(fh != NULL, "Failed to open '%s': %s", trace_path,
+      strerror(errno));
+    len = fread(text, 1, sizeof(text) - 1, fh);
+    text[len] = '\0';
+    fclose(fh);
+
+    snprintf(expected, sizeof(expected), "[%u] <%s:1>: child",
+      (unsigned int) pid, trace_channel);
+    fail_unless(strstr(text, expected) != NULL, "Missing '%s' in '%s'",
+      expected, text);
+
+    snprintf(expected, sizeof(expected), "[%u] <%s:1>: parent",
+      (unsigned int) getpid(), trace_channel);
+    fail_unless(strstr(text, expected) != NULL, "Missing '%s' in '%s'",
+      expected, text);
+  }
+
+  msgs = read_msgs();
+  fail_unless(msgs->nelts == 2, "Expected 2 messages, got %d", msgs->nelts);
+
+  elts = msgs->elts;
+  fail_unless(strcmp(elts[0], "child") == 0, "Got '%s'", elts[0]);
+  fail_unless(strcmp(elts[1], "parent") == 0, "Got '%s'", elts[1]);
+}
+END_TEST
+
+#endif /* PR_USE_TRACE */
+
+Suite *tests_get_trace_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("trace");
+
+  testcase = tcase_create("base");
+
+#ifdef PR_USE_TRACE
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, trace_set_buffer_test);
+  tcase_add_test(testcase, trace_buffer_fmt_test);
+  tcase_add_test(testcase, trace_buffer_fallback_test);
+  tcase_add_test(testcase, trace_buffer_wrap_test);
+  tcase_add_test(testcase, trace_buffer_wrap_varying_test);
+  tcase_add_test(testcase, trace_buffer_fork_test);
+#endif /* PR_USE_TRACE */
+
+  suite_add_tcase(suite, testcase);
+
+  return suite;
+}
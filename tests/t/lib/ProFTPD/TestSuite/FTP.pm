@@ -1384,6 +1384,16 @@ sub site {
   }
 }
 
+sub site_raw {
+  my $self = shift;
+  my $cmd = shift;
+  $cmd = '' unless defined($cmd);
+  my $conn;
+
+  $conn = $self->{ftp}->_data_cmd('SITE', $cmd, @_);
+  return $conn;
+}
+
 sub quote {
   my $self = shift;
   my $cmd = shift;
@@ -177,6 +177,41 @@ my $TESTS = {
     test_class => [qw(bug forking)],
   },
 
+  list_opt_R_deep_tree => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  list_opt_R_wide_tree => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  list_opt_R_hidden_files => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  list_opt_R_maxdepth => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  list_opt_R_path_too_long => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  list_glob_patterns => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  list_opt_R_hide_policies => {
+    order => ++$order,
+    test_class => [qw(forking rootprivs)],
+  },
+
   # XXX Plenty of other tests needed: params, maxfiles, maxdirs, depth, etc
 };
 
@@ -5089,4 +5124,1410 @@ sub list_opt_R_rel_symlinked_file_bug3719 {
   unlink($log_file);
 }
 
+sub list_opt_R_deep_tree {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/cmds.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/cmds.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/cmds.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/cmds.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/cmds.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  # Create a tree 32 directories deep, with a file in each directory.
+  my $depth = 32;
+
+  my $dir_path = $home_dir;
+  my $rel_path = '';
+  for (my $i = 1; $i <= $depth; $i++) {
+    my $dir_name = sprintf("d%02s", $i);
+    $dir_path .= "/$dir_name";
+    $rel_path .= ($rel_path ? "/$dir_name" : $dir_name);
+
+    mkpath($dir_path);
+
+    my $file_path = sprintf("%s/f%02s", $dir_path, $i);
+  if (open(my $fh, "> $file_path")) {
+    close($fh);
+
+  } else {
+    die("Can't open $file_path: $!");
+  }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      my $conn = $client->list_raw('-R');
+      unless ($conn) {
+        die("LIST -R failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf = '';
+      my $tmp;
+
+      my $res = $conn->read($tmp, 32768, 25);
+      while ($res) {
+        $buf .= $tmp;
+        $tmp = undef;
+
+        $res = $conn->read($tmp, 32768, 25);
+      }
+
+      eval { $conn->close() };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # Directory headings end in a colon; other lines end in the name.
+      my $dirs = {};
+      my $names = {};
+      foreach my $line (split(/\r?\n/, $buf)) {
+        if ($line =~ /^(\S+):$/) {
+          $dirs->{$1} = 1;
+
+        } elsif ($line =~ /\s+(\S+)$/) {
+          $names->{$1} = 1;
+        }
+      }
+
+      # Every directory in the tree, and every file in it, should be listed.
+      $rel_path = '';
+      for (my $i = 1; $i <= $depth; $i++) {
+        my $dir_name = sprintf("d%02s", $i);
+        $rel_path .= ($rel_path ? "/$dir_name" : $dir_name);
+
+        unless (defined($dirs->{$rel_path})) {
+          die("Directory '$rel_path' not listed");
+        }
+
+        my $file_name = sprintf("f%02s", $i);
+        unless (defined($names->{$file_name})) {
+          die("File '$file_name' not listed");
+        }
+      }
+
+      my $dir_count = scalar(keys(%$dirs));
+      unless ($dir_count == $depth) {
+        die("LIST returned wrong number of directories (expected $depth, got $dir_count)");
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub list_opt_R_wide_tree {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/cmds.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/cmds.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/cmds.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/cmds.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/cmds.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  # Create 200 directories, each with a subdirectory, and 10 files in each
+  # directory.
+  my $dir_count = 200;
+  my $file_count = 10;
+
+  for (my $i = 1; $i <= $dir_count; $i++) {
+    my $dir_path = sprintf("%s/%04s/sub", $home_dir, $i);
+    mkpath($dir_path);
+
+    for (my $j = 1; $j <= $file_count; $j++) {
+      my $file_path = sprintf("%s/%04s/%04s%02s", $home_dir, $i, $i, $j);
+      if (open(my $fh, "> $file_path")) {
+        close($fh);
+
+      } else {
+        die("Can't open $file_path: $!");
+      }
+
+      $file_path = sprintf("%s/s%04s%02s", $dir_path, $i, $j);
+      if (open(my $fh, "> $file_path")) {
+        close($fh);
+
+      } else {
+        die("Can't open $file_path: $!");
+      }
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      my $conn = $client->list_raw('-R');
+      unless ($conn) {
+        die("LIST -R failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf = '';
+      my $tmp;
+
+      my $res = $conn->read($tmp, 32768, 25);
+      while ($res) {
+        $buf .= $tmp;
+        $tmp = undef;
+
+        $res = $conn->read($tmp, 32768, 25);
+      }
+
+      eval { $conn->close() };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # Directory headings end in a colon; other lines end in the name.
+      my $dirs = {};
+      my $names = {};
+      foreach my $line (split(/\r?\n/, $buf)) {
+        if ($line =~ /^(\S+):$/) {
+          $dirs->{$1} = 1;
+
+        } elsif ($line =~ /\s+(\S+)$/) {
+          $names->{$1} = 1;
+        }
+      }
+
+      for (my $i = 1; $i <= $dir_count; $i++) {
+        foreach my $dir_name (sprintf("%04s", $i), sprintf("%04s/sub", $i)) {
+          unless (defined($dirs->{$dir_name})) {
+            die("Directory '$dir_name' not listed");
+          }
+        }
+      }
+
+      my $list_count = scalar(keys(%$dirs));
+      my $expected_count = $dir_count * 2;
+      unless ($list_count == $expected_count) {
+        die("LIST returned wrong number of directories (expected $expected_count, got $list_count)");
+      }
+
+      # Each directory, and its subdirectory, holds $file_count files, each
+      # with a unique name.
+      $list_count = scalar(grep { /^s?\d{6}$/ } keys(%$names));
+      $expected_count = $dir_count * $file_count * 2;
+      unless ($list_count == $expected_count) {
+        die("LIST returned wrong number of files (expected $expected_count, got $list_count)");
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub list_opt_R_hidden_files {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/cmds.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/cmds.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/cmds.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/cmds.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/cmds.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  my $sub_dir = File::Spec->rel2abs("$tmpdir/visible");
+  my $hidden_dir = File::Spec->rel2abs("$tmpdir/.hidden");
+  mkpath([$sub_dir, "$hidden_dir/inner"]);
+
+  foreach my $file_path ("$sub_dir/file.txt", "$sub_dir/.dotfile.txt",
+      "$hidden_dir/hidden.txt", "$hidden_dir/inner/inner.txt") {
+    if (open(my $fh, "> $file_path")) {
+      close($fh);
+
+    } else {
+      die("Can't open $file_path: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      my $conn = $client->list_raw('-R');
+      unless ($conn) {
+        die("LIST -R failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf = '';
+      my $tmp;
+
+      my $res = $conn->read($tmp, 32768, 25);
+      while ($res) {
+        $buf .= $tmp;
+        $tmp = undef;
+
+        $res = $conn->read($tmp, 32768, 25);
+      }
+
+      eval { $conn->close() };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # Directory headings end in a colon; other lines end in the name.
+      my $dirs = {};
+      my $names = {};
+      foreach my $line (split(/\r?\n/, $buf)) {
+        if ($line =~ /^(\S+):$/) {
+          $dirs->{$1} = 1;
+
+        } elsif ($line =~ /\s+(\S+)$/) {
+          $names->{$1} = 1;
+        }
+      }
+
+      # Without -a, dotfiles are neither listed nor descended into.
+      unless (defined($dirs->{'visible'})) {
+        die("Directory 'visible' not listed");
+      }
+
+      unless (defined($names->{'file.txt'})) {
+        die("File 'file.txt' not listed");
+      }
+
+      foreach my $name ('.dotfile.txt', '.hidden', 'hidden.txt',
+          'inner.txt') {
+        if (defined($names->{$name}) ||
+            defined($dirs->{$name})) {
+          die("Hidden '$name' unexpectedly listed");
+        }
+      }
+
+      if (scalar(grep { /hidden/ } keys(%$dirs)) > 0) {
+        die("Hidden directory unexpectedly listed");
+      }
+
+      my $conn2 = $client->list_raw('-aR');
+      unless ($conn2) {
+        die("LIST -aR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf2 = '';
+      my $tmp;
+
+      my $res = $conn2->read($tmp, 32768, 25);
+      while ($res) {
+        $buf2 .= $tmp;
+        $tmp = undef;
+
+        $res = $conn2->read($tmp, 32768, 25);
+      }
+
+      eval { $conn2->close() };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # Directory headings end in a colon; other lines end in the name.
+      my $dirs2 = {};
+      my $names2 = {};
+      foreach my $line (split(/\r?\n/, $buf2)) {
+        if ($line =~ /^(\S+):$/) {
+          $dirs2->{$1} = 1;
+
+        } elsif ($line =~ /\s+(\S+)$/) {
+          $names2->{$1} = 1;
+        }
+      }
+
+      # With -a, they are.
+      foreach my $dir_name ('visible', '.hidden', '.hidden/inner') {
+        unless (defined($dirs2->{$dir_name})) {
+          die("Directory '$dir_name' not listed");
+        }
+      }
+
+      foreach my $name ('file.txt', '.dotfile.txt', '.hidden', 'hidden.txt',
+          'inner.txt') {
+        unless (defined($names2->{$name})) {
+          die("File '$name' not listed");
+        }
+      }
+
+      # The . and .. entries are listed, but not descended into.
+      if (scalar(grep { /(^|\/)\.\.?$/ } keys(%$dirs2)) > 0) {
+        die("Directory '.' or '..' unexpectedly descended into");
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub list_opt_R_maxdepth {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/cmds.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/cmds.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/cmds.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/cmds.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/cmds.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  # Create a tree 6 directories deep, with a file in each directory.
+  my $dir_path = $home_dir;
+  for (my $i = 1; $i <= 6; $i++) {
+    $dir_path .= "/d$i";
+    mkpath($dir_path);
+
+    my $file_path = "$dir_path/f$i";
+    if (open(my $fh, "> $file_path")) {
+      close($fh);
+
+    } else {
+      die("Can't open $file_path: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    ListOptions => '"-l" maxdepth 3',
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      my $conn = $client->list_raw('-R');
+      unless ($conn) {
+        die("LIST -R failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf = '';
+      my $tmp;
+
+      my $res = $conn->read($tmp, 32768, 25);
+      while ($res) {
+        $buf .= $tmp;
+        $tmp = undef;
+
+        $res = $conn->read($tmp, 32768, 25);
+      }
+
+      eval { $conn->close() };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # Directory headings end in a colon; other lines end in the name.
+      my $dirs = {};
+      my $names = {};
+      foreach my $line (split(/\r?\n/, $buf)) {
+        if ($line =~ /^(\S+):$/) {
+          $dirs->{$1} = 1;
+
+        } elsif ($line =~ /\s+(\S+)$/) {
+          $names->{$1} = 1;
+        }
+      }
+
+      # With a maxdepth of 3, the listed directory and the two levels below
+      # it are listed, and no deeper.
+      foreach my $dir_name ('d1', 'd1/d2') {
+        unless (defined($dirs->{$dir_name})) {
+          die("Directory '$dir_name' not listed");
+        }
+      }
+
+      foreach my $name ('d1', 'f1', 'd2', 'f2', 'd3') {
+        unless (defined($names->{$name})) {
+          die("'$name' not listed");
+        }
+      }
+
+      my $dir_count = scalar(keys(%$dirs));
+      unless ($dir_count == 2) {
+        die("LIST returned wrong number of directories (expected 2, got $dir_count)");
+      }
+
+      foreach my $name ('f3', 'd4', 'f4') {
+        if (defined($names->{$name})) {
+          die("'$name' unexpectedly listed");
+        }
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub list_opt_R_path_too_long {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/cmds.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/cmds.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/cmds.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/cmds.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/cmds.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  # Give the user a home directory whose path is close to PATH_MAX (assumed
+  # to be 4096, as on Linux), and create a tree in it deep enough that the
+  # deepest absolute paths exceed that.  The paths relative to the home
+  # directory stay short.  Each level is created relative to the previous
+  # one, as the full path is too long for mkdir(2).
+  my $user_home = "$home_dir/" . join('/', ('h' x 200) x 17);
+  mkpath($user_home);
+
+  my $name_len = 20;
+  my $depth = 40;
+
+  my $cwd = getcwd();
+  unless (chdir($user_home)) {
+    die("Can't chdir to $user_home: $!");
+  }
+
+  for (my $i = 1; $i <= $depth; $i++) {
+    my $dir_name = sprintf("%02s", $i) . ('d' x ($name_len - 2));
+
+    unless (mkdir($dir_name)) {
+      die("Can't mkdir $dir_name: $!");
+    }
+
+    unless (chdir($dir_name)) {
+      die("Can't chdir to $dir_name: $!");
+    }
+  }
+
+  chdir($cwd);
+
+  my $test_file = File::Spec->rel2abs("$user_home/test.txt");
+  if (open(my $fh, "> $test_file")) {
+    close($fh);
+
+  } else {
+    die("Can't open $test_file: $!");
+  }
+
+  # The deepest directory whose absolute path still fits.
+  my $max_listed = int((4096 - length($user_home)) / ($name_len + 1));
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $user_home,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      my $conn = $client->list_raw('-R');
+      unless ($conn) {
+        die("LIST -R failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf = '';
+      my $tmp;
+
+      my $res = $conn->read($tmp, 32768, 25);
+      while ($res) {
+        $buf .= $tmp;
+        $tmp = undef;
+
+        $res = $conn->read($tmp, 32768, 25);
+      }
+
+      eval { $conn->close() };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # Directory headings end in a colon; other lines end in the name.
+      my $dirs = {};
+      my $names = {};
+      foreach my $line (split(/\r?\n/, $buf)) {
+        if ($line =~ /^(\S+):$/) {
+          $dirs->{$1} = 1;
+
+        } elsif ($line =~ /\s+(\S+)$/) {
+          $names->{$1} = 1;
+        }
+      }
+
+      # The listing succeeds, listing the directories up to the limit, and
+      # none of those beyond it.
+      unless (defined($names->{'test.txt'})) {
+        die("File 'test.txt' not listed");
+      }
+
+      # Directories are listed down to the deepest one whose absolute path
+      # fits within PR_TUNABLE_PATH_MAX, with no gaps, and not beyond it.
+      my $deepest = 0;
+      foreach my $dir_name (keys(%$dirs)) {
+        my $level = scalar(split(/\//, $dir_name));
+        if ($level > $deepest) {
+          $deepest = $level;
+        }
+      }
+
+      unless ($deepest == $max_listed) {
+        die("Deepest directory listed at wrong level (expected $max_listed, got $deepest)");
+      }
+
+      # Nor is the directory beyond it listed as an entry.
+      my $too_long = sprintf("%02s", $max_listed + 1) . ('d' x ($name_len - 2));
+      if (defined($names->{$too_long})) {
+        die("Directory '$too_long' unexpectedly listed");
+      }
+
+      unless (scalar(keys(%$dirs)) == $deepest) {
+        die("LIST returned wrong number of directories (expected $deepest, got " . scalar(keys(%$dirs)) . ")");
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub list_glob_patterns {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/cmds.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/cmds.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/cmds.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/cmds.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/cmds.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  # Files for exercising the glob patterns.  The names sort the same way in
+  # any locale.
+  my $sub_dir = File::Spec->rel2abs("$tmpdir/sub");
+  mkpath($sub_dir);
+
+  foreach my $name (qw(a1.txt a2.txt a3.txt b1.txt c1.txt .hidden1.txt
+      x*y.txt x1y.txt sub/s1.txt sub/s2.txt sub/t1.txt)) {
+    my $file_path = File::Spec->rel2abs("$tmpdir/$name");
+    if (open(my $fh, "> $file_path")) {
+      close($fh);
+
+    } else {
+      die("Can't open $file_path: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      my $patterns = [
+        # Ranges and negated ranges
+        ['a[1-2].txt', [qw(a1.txt a2.txt)]],
+        ['[!a]1.txt', [qw(b1.txt c1.txt)]],
+        ['x[0-9]y.txt', [qw(x1y.txt)]],
+
+        # Escaped wildcards match literally
+        ['x\\*y.tx?', [qw(x*y.txt)]],
+        ['x\\*?.txt', [qw(x*y.txt)]],
+
+        # Wildcards in the last component of a path
+        ['sub/s[0-9].txt', [qw(sub/s1.txt sub/s2.txt)]],
+        ['sub/?1.txt', [qw(sub/s1.txt sub/t1.txt)]],
+
+        # Hidden files only match a leading period given explicitly, and are
+        # only listed with -a
+        ['*1.txt', [qw(a1.txt b1.txt c1.txt)]],
+        ['-a *1.txt', [qw(a1.txt b1.txt c1.txt)]],
+        ['.h*', []],
+        ['-a .h*', [qw(.hidden1.txt)]],
+        ['a*', [qw(a1.txt a2.txt a3.txt)]],
+      ];
+
+      foreach my $pattern (@$patterns) {
+        my ($glob, $expected) = @$pattern;
+
+        my $conn = $client->list_raw($glob);
+        unless ($conn) {
+          die("LIST $glob failed: " . $client->response_code() . " " .
+            $client->response_msg());
+        }
+
+        my $buf = '';
+        my $tmp;
+
+        my $res = $conn->read($tmp, 8192, 25);
+        while ($res) {
+          $buf .= $tmp;
+          $tmp = undef;
+
+          $res = $conn->read($tmp, 8192, 25);
+        }
+
+        eval { $conn->close() };
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+        $self->assert_transfer_ok($resp_code, $resp_msg);
+
+        # LIST sorts glob matches by name.
+        my $names = [];
+        foreach my $line (split(/\r?\n/, $buf)) {
+          if ($line =~ /^\S+\s+\d+\s+\S+\s+\S+\s+\d+\s+\S+\s+\d+\s+\S+\s+(.*)$/) {
+            push(@$names, $1);
+          }
+        }
+
+        my $got = join(' ', @$names);
+        my $want = join(' ', @$expected);
+        $self->assert($want eq $got,
+          test_msg("Expected '$want' for LIST $glob, got '$got'"));
+      }
+
+      # Patterns which match nothing, including ones whose directory does not
+      # exist, give an empty listing.
+      foreach my $glob ('zz*', 'a[4-9].txt', 'sub/zz?', 'nosuchdir/*.txt') {
+        my $conn = $client->list_raw($glob);
+        unless ($conn) {
+          die("LIST $glob failed: " . $client->response_code() . " " .
+            $client->response_msg());
+        }
+
+        my $buf = '';
+        my $tmp;
+
+        my $res = $conn->read($tmp, 8192, 25);
+        while ($res) {
+          $buf .= $tmp;
+          $tmp = undef;
+
+          $res = $conn->read($tmp, 8192, 25);
+        }
+
+        eval { $conn->close() };
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+        $self->assert_transfer_ok($resp_code, $resp_msg);
+
+        $self->assert($buf eq '',
+          test_msg("Expected empty listing for LIST $glob, got '$buf'"));
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub list_opt_R_hide_policies {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/cmds.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/cmds.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/cmds.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/cmds.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/cmds.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  # Files hidden by HideFiles, and by HideUser, in a tree where a
+  # subdirectory has a different HideFiles policy, and where one file has a
+  # <Directory> section of its own.
+  my $other_user = 'other';
+  my $other_uid = 501;
+
+  foreach my $dir_name (qw(sub sub/deeper other)) {
+    mkpath(File::Spec->rel2abs("$tmpdir/$dir_name"));
+  }
+
+  foreach my $file_name (qw(a.txt a.secret owned.txt sub/b.txt sub/b.secret
+      sub/owned.txt sub/deeper/c.secret other/d.txt other/d.secret
+      other/owned.txt other/mine.txt other/yours.txt)) {
+    my $file_path = File::Spec->rel2abs("$tmpdir/$file_name");
+    if (open(my $fh, "> $file_path")) {
+      close($fh);
+
+    } else {
+      die("Can't open $file_path: $!");
+    }
+
+    if ($file_name =~ /owned/) {
+      unless (chown($other_uid, $gid, $file_path)) {
+        die("Can't set owner of $file_path to $other_uid/$gid: $!");
+      }
+
+    } elsif ($file_name =~ /(mine|yours)/) {
+      unless (chown($uid, $gid, $file_path)) {
+        die("Can't set owner of $file_path to $uid/$gid: $!");
+      }
+    }
+  }
+
+  auth_user_write($auth_user_file, $other_user, $passwd, $other_uid, $gid,
+    '/tmp', '/bin/bash');
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    Directory => {
+      $home_dir => {
+        HideFiles => '\.secret$',
+        HideUser => $other_user,
+      },
+
+      "$home_dir/sub" => {
+        HideFiles => 'none',
+      },
+
+      "$home_dir/other/mine.txt" => {
+        HideUser => '~',
+      },
+    },
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      my $conn = $client->list_raw('-R');
+      unless ($conn) {
+        die("LIST -R failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf = '';
+      my $tmp;
+
+      my $res = $conn->read($tmp, 32768, 25);
+      while ($res) {
+        $buf .= $tmp;
+        $tmp = undef;
+
+        $res = $conn->read($tmp, 32768, 25);
+      }
+
+      eval { $conn->close() };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # Directory headings end in a colon; other lines end in the name.
+      my $dirs = {};
+      my $names = {};
+      foreach my $line (split(/\r?\n/, $buf)) {
+        if ($line =~ /^(\S+):$/) {
+          $dirs->{$1} = 1;
+
+        } elsif ($line =~ /\s+(\S+)$/) {
+          $names->{$1} = 1;
+        }
+      }
+
+      foreach my $dir_name (qw(sub sub/deeper other)) {
+        unless (defined($dirs->{$dir_name})) {
+          die("Directory '$dir_name' not listed");
+        }
+      }
+
+      # The files hidden by HideFiles, and those owned by the HideUser, are
+      # not listed; those in the subdirectory with "HideFiles none" are.
+      foreach my $file_name (qw(a.txt b.txt b.secret c.secret d.txt
+          yours.txt)) {
+        unless (defined($names->{$file_name})) {
+          die("File '$file_name' not listed");
+        }
+      }
+
+      foreach my $file_name (qw(a.secret d.secret owned.txt mine.txt)) {
+        if (defined($names->{$file_name})) {
+          die("Hidden file '$file_name' unexpectedly listed");
+        }
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
 1;
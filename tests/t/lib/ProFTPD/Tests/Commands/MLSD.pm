@@ -5,6 +5,7 @@ use base qw(ProFTPD::TestSuite::Child);
 use strict;
 
 use Cwd;
+use File::Basename qw(dirname);
 use File::Path qw(mkpath);
 use File::Spec;
 use IO::Handle;
@@ -107,6 +108,11 @@ my $TESTS = {
     test_class => [qw(bug forking)],
   },
 
+  mlsd_symlink_long_target => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
   # XXX Plenty of other tests needed: params, maxfiles, maxdirs, depth, etc
 };
 
@@ -2634,4 +2640,189 @@ sub mlsd_symlinked_dir_showsymlinks_off_bug3859 {
   unlink($log_file);
 }
 
+
+sub mlsd_symlink_long_target {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/cmds.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/cmds.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/cmds.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/cmds.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/cmds.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  my $foo_dir = File::Spec->rel2abs("$tmpdir/foo");
+  mkpath($foo_dir);
+
+  # With UseSlink, the type fact includes the symlink target, which can make
+  # a line longer than the facts buffer (sized by SocketOptions sndbuf, below);
+  # the lines for these links must not be cut short.
+  my $targets = {};
+  foreach my $ndirs (2, 8, 12) {
+    my $target = join('/', map { ('d' x 200) . $_ } (1..$ndirs)) . '/test.txt';
+    my $target_dir = File::Spec->rel2abs("$foo_dir/" . dirname($target));
+    mkpath($target_dir);
+
+    my $test_file = "$foo_dir/$target";
+    if (open(my $fh, "> $test_file")) {
+      print $fh "Hello, World!\n";
+      unless (close($fh)) {
+        die("Can't write $test_file: $!");
+      }
+
+    } else {
+      die("Can't open $test_file: $!");
+    }
+
+    $targets->{"test$ndirs.lnk"} = $target;
+  }
+
+  # Change to the 'foo' directory in order to create relative paths in the
+  # symlinks we need
+
+  my $cwd = getcwd();
+  unless (chdir("$foo_dir")) {
+    die("Can't chdir to $foo_dir: $!");
+  }
+
+  foreach my $name (keys(%$targets)) {
+    unless (symlink($targets->{$name}, $name)) {
+      die("Can't symlink '$targets->{$name}' to '$name': $!");
+    }
+  }
+
+  unless (chdir($cwd)) {
+    die("Can't chdir to $cwd: $!");
+  }
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir, $foo_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir, $foo_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, 'ftpd', $gid, $user);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    ShowSymlinks => 'on',
+    FactsOptions => 'UseSlink',
+    SocketOptions => 'sndbuf 2048',
+
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+
+      $client->login($user, $passwd);
+
+      my $conn = $client->mlsd_raw('foo');
+      unless ($conn) {
+        die("MLSD failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 8192, 30)) {
+        $data .= $buf;
+      }
+      eval { $conn->close() };
+
+      my $res = {};
+      my $lines = [split(/\r?\n/, $data)];
+      foreach my $line (@$lines) {
+        if ($line =~ /^modify=\S+;perm=\S+;type=(\S+);unique=\S+;UNIX\.group=\d+;UNIX\.mode=\d+;UNIX.owner=\d+; (.*?)$/) {
+          $res->{$2} = $1;
+
+        } else {
+          die("Unexpected MLSD line '$line'");
+        }
+      }
+
+      # The target may be given as is, or made absolute.
+      foreach my $name (sort(keys(%$targets))) {
+        my $expected = "OS.unix=slink:(.*/)?$targets->{$name}";
+        my $got = $res->{$name};
+        $self->assert(defined($got) && $got =~ /^$expected$/,
+          test_msg("Expected type '$expected' for $name, got '" .
+            (defined($got) ? $got : '') . "'"));
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
 1;
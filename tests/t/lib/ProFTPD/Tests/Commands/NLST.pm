@@ -127,6 +127,11 @@ my $TESTS = {
     test_class => [qw(bug forking)],
   },
 
+  nlst_glob_patterns => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
 };
 
 sub new {
@@ -3407,4 +3412,199 @@ sub nlst_parent_dir_bug4011 {
   unlink($log_file);
 }
 
+sub nlst_glob_patterns {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/cmds.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/cmds.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/cmds.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/cmds.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/cmds.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  # Files for exercising the glob patterns.  The names sort the same way in
+  # any locale.
+  my $sub_dir = File::Spec->rel2abs("$tmpdir/sub");
+  mkpath($sub_dir);
+
+  foreach my $name (qw(a1.txt a2.txt a3.txt b1.txt c1.txt .hidden1.txt
+      x*y.txt x1y.txt sub/s1.txt sub/s2.txt sub/t1.txt)) {
+    my $file_path = File::Spec->rel2abs("$tmpdir/$name");
+    if (open(my $fh, "> $file_path")) {
+      close($fh);
+
+    } else {
+      die("Can't open $file_path: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      my $patterns = [
+        # Ranges and negated ranges
+        ['a[1-2].txt', [qw(a1.txt a2.txt)]],
+        ['[!a]1.txt', [qw(b1.txt c1.txt)]],
+        ['x[0-9]y.txt', [qw(x1y.txt)]],
+
+        # Escaped wildcards match literally
+        ['x\\*y.tx?', [qw(x*y.txt)]],
+        ['x\\*?.txt', [qw(x*y.txt)]],
+
+        # Wildcards in the last component of a path
+        ['sub/s[0-9].txt', [qw(sub/s1.txt sub/s2.txt)]],
+        ['sub/?1.txt', [qw(sub/s1.txt sub/t1.txt)]],
+
+        # Hidden files only match a leading period given explicitly, and are
+        # not listed even then
+        ['*1.txt', [qw(a1.txt b1.txt c1.txt)]],
+        ['.h*', []],
+        ['a*', [qw(a1.txt a2.txt a3.txt)]],
+      ];
+
+      foreach my $pattern (@$patterns) {
+        my ($glob, $expected) = @$pattern;
+
+        my $conn = $client->nlst_raw($glob);
+        unless ($conn) {
+          die("NLST $glob failed: " . $client->response_code() . " " .
+            $client->response_msg());
+        }
+
+        my $buf = '';
+        my $tmp;
+
+        my $res = $conn->read($tmp, 8192, 25);
+        while ($res) {
+          $buf .= $tmp;
+          $tmp = undef;
+
+          $res = $conn->read($tmp, 8192, 25);
+        }
+
+        eval { $conn->close() };
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+        $self->assert_transfer_ok($resp_code, $resp_msg);
+
+        # NLST does not sort glob matches, so compare them sorted.
+        my $names = [sort(split(/\r?\n/, $buf))];
+        $expected = [sort(@$expected)];
+
+        my $got = join(' ', @$names);
+        my $want = join(' ', @$expected);
+        $self->assert($want eq $got,
+          test_msg("Expected '$want' for NLST $glob, got '$got'"));
+      }
+
+      # Patterns which match nothing, including ones whose directory does not
+      # exist.
+      foreach my $glob ('zz*', 'a[4-9].txt', 'sub/zz?', 'nosuchdir/*.txt') {
+        my $conn = $client->nlst_raw($glob);
+        if ($conn) {
+          eval { $conn->close() };
+          die("NLST $glob succeeded unexpectedly");
+        }
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+
+        my $expected;
+
+        $expected = 450;
+        $self->assert($expected == $resp_code,
+          test_msg("Expected $expected for NLST $glob, got $resp_code"));
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
 1;
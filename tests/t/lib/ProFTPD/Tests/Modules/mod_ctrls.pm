@@ -30,6 +30,11 @@ my $TESTS = {
     test_class => [qw(bug forking os_linux)],
   },
 
+  ctrls_config_memory_protect_ok => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
 };
 
 sub new {
@@ -402,4 +407,93 @@ sub ctrls_sighup_bug3756 {
   unlink($log_file);
 }
 
+sub ctrls_config_memory_protect_ok {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/ctrls.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/ctrls.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/ctrls.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $ctrls_sock = File::Spec->rel2abs("$tmpdir/ctrls.sock");
+
+  my ($user, $group) = config_get_identity();
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+    TraceLog => $log_file,
+    Trace => 'ctrls:20',
+
+    ConfigMemoryProtect => 'on',
+
+    IfModules => {
+      'mod_ctrls.c' => {
+        ControlsEngine => 'on',
+        ControlsLog => $log_file,
+        ControlsSocket => $ctrls_sock,
+        ControlsACLs => "all allow user root,$user",
+        ControlsSocketACL => "allow user root,$user",
+      },
+
+      'mod_ctrls_admin.c' => {
+        AdminControlsACLs => "all allow user root,$user",
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  my $ex;
+
+  # Start server
+  server_start($config_file);
+
+  sleep(1);
+
+  eval {
+    # The "down" action closes the server's bindings, which live in the
+    # read-only configuration memory; the daemon must survive it.
+    my $lines = ftpdctl($ctrls_sock, 'down all');
+    my $output = join('', @$lines);
+
+    my $expected = 'all servers disabled';
+    $self->assert(qr/$expected/, $output,
+      test_msg("Expected '$expected', got '$output'"));
+
+    $lines = ftpdctl($ctrls_sock, "status 127.0.0.1#$port");
+    $output = join('', @$lines);
+
+    $expected = 'DOWN';
+    $self->assert(qr/$expected/, $output,
+      test_msg("Expected '$expected', got '$output'"));
+
+    my $pid = get_server_pid($pid_file);
+    $self->assert(kill(0, $pid),
+      test_msg("Server process $pid not running"));
+  };
+
+  if ($@) {
+    $ex = $@;
+  }
+
+  server_stop($pid_file);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
 1;
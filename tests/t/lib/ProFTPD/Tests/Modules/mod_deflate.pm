@@ -6,7 +6,7 @@ use strict;
 
 use Compress::Raw::Zlib;
 use Compress::Zlib;
-use Digest::MD5;
+use Digest::MD5 qw(md5_hex);
 use File::Spec;
 use IO::Handle;
 use Time::HiRes qw(gettimeofday tv_interval);
@@ -84,6 +84,26 @@ my $TESTS = {
     test_class => [qw(bug forking)],
   },
 
+  deflate_zstream_reuse => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  deflate_opts_auto_level => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  deflate_opts_skip_incompressible => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  deflate_skip_filter => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
 };
 
 sub new {
@@ -2348,4 +2368,816 @@ sub deflate_netio_close_bad_cmd_sequence_bug3828 {
   unlink($log_file);
 }
 
+sub deflate_zstream_reuse {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/deflate.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/deflate.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/deflate.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/deflate.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/deflate.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $test_file = File::Spec->rel2abs("$tmpdir/test.txt");
+  my $test_file_data = "Ab" x 8192;
+  if (open(my $fh, "> $test_file")) {
+    binmode($fh);
+    print $fh $test_file_data;
+    unless (close($fh)) {
+      die("Can't write $test_file: $!");
+    }
+
+  } else {
+    die("Can't open $test_file: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    TimeoutLinger => 1,
+
+    IfModules => {
+      'mod_deflate.c' => {
+        DeflateEngine => 'on',
+        DeflateLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+
+      $client->login($user, $passwd);
+      $client->type('binary');
+      $client->mode('Z');
+
+      # The zstreams are set up for the first download and upload, and then
+      # reset for the later ones; every transfer must be a complete stream.
+      my ($conn, $buf, $deflated, $inflated);
+
+      $conn = $client->retr_raw('test.txt');
+      unless ($conn) {
+        die("RETR test.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = '';
+      while ($conn->read($buf, 32768, 30)) {
+        $deflated .= $buf;
+      }
+      $conn->close();
+
+      $inflated = uncompress($deflated);
+      $self->assert(defined($inflated),
+        test_msg("Failed to inflate RETR test.txt data"));
+      $self->assert(md5_hex($inflated) eq md5_hex($test_file_data),
+        test_msg("RETR test.txt data does not match test.txt"));
+
+      $conn = $client->stor_raw('up1.txt');
+      unless ($conn) {
+        die("STOR up1.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = compress($test_file_data);
+      $conn->write($deflated, length($deflated));
+      $conn->close();
+
+      $conn = $client->retr_raw('test.txt');
+      unless ($conn) {
+        die("RETR test.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = '';
+      while ($conn->read($buf, 32768, 30)) {
+        $deflated .= $buf;
+      }
+      $conn->close();
+
+      $inflated = uncompress($deflated);
+      $self->assert(defined($inflated),
+        test_msg("Failed to inflate RETR test.txt data"));
+      $self->assert(md5_hex($inflated) eq md5_hex($test_file_data),
+        test_msg("RETR test.txt data does not match test.txt"));
+
+      $conn = $client->stor_raw('up2.txt');
+      unless ($conn) {
+        die("STOR up2.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = compress(scalar(reverse($test_file_data)));
+      $conn->write($deflated, length($deflated));
+      $conn->close();
+
+      $conn = $client->retr_raw('up1.txt');
+      unless ($conn) {
+        die("RETR up1.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = '';
+      while ($conn->read($buf, 32768, 30)) {
+        $deflated .= $buf;
+      }
+      $conn->close();
+
+      $inflated = uncompress($deflated);
+      $self->assert(defined($inflated),
+        test_msg("Failed to inflate RETR up1.txt data"));
+      $self->assert(md5_hex($inflated) eq md5_hex($test_file_data),
+        test_msg("RETR up1.txt data does not match up1.txt"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  if (open(my $fh, "< $tmpdir/up1.txt")) {
+    binmode($fh);
+    local $/;
+    my $data = <$fh>;
+    close($fh);
+
+    $self->assert(md5_hex($data) eq md5_hex($test_file_data),
+      test_msg("Uploaded up1.txt does not match test.txt"));
+
+  } else {
+    die("Can't read $tmpdir/up1.txt: $!");
+  }
+
+  if (open(my $fh, "< $tmpdir/up2.txt")) {
+    binmode($fh);
+    local $/;
+    my $data = <$fh>;
+    close($fh);
+
+    $self->assert(md5_hex($data) eq md5_hex(scalar(reverse($test_file_data))),
+      test_msg("Uploaded up2.txt does not match reversed test.txt"));
+
+  } else {
+    die("Can't read $tmpdir/up2.txt: $!");
+  }
+
+  unlink($log_file);
+}
+
+sub deflate_opts_auto_level {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/deflate.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/deflate.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/deflate.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/deflate.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/deflate.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  # Large enough for AutoLevel to reconsider the level a few times.
+  my $test_file = File::Spec->rel2abs("$tmpdir/test.txt");
+  my $test_file_data = join('', map { "Line $_ of a large, compressible file\n" } (1..200000));
+  if (open(my $fh, "> $test_file")) {
+    binmode($fh);
+    print $fh $test_file_data;
+    unless (close($fh)) {
+      die("Can't write $test_file: $!");
+    }
+
+  } else {
+    die("Can't open $test_file: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    TimeoutLinger => 1,
+
+    IfModules => {
+      'mod_deflate.c' => {
+        DeflateEngine => 'on',
+        DeflateLog => $log_file,
+        DeflateOptions => 'AutoLevel',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+
+      $client->login($user, $passwd);
+      $client->type('binary');
+      $client->mode('Z');
+
+      # The level may change mid-stream, and carries over to the next
+      # download; both must still inflate correctly.
+      my ($conn, $buf, $deflated, $inflated);
+
+      $conn = $client->retr_raw('test.txt');
+      unless ($conn) {
+        die("RETR test.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = '';
+      while ($conn->read($buf, 32768, 30)) {
+        $deflated .= $buf;
+      }
+      $conn->close();
+
+      $inflated = uncompress($deflated);
+      $self->assert(defined($inflated),
+        test_msg("Failed to inflate RETR test.txt data"));
+      $self->assert(md5_hex($inflated) eq md5_hex($test_file_data),
+        test_msg("RETR test.txt data does not match test.txt"));
+
+      $conn = $client->retr_raw('test.txt');
+      unless ($conn) {
+        die("RETR test.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = '';
+      while ($conn->read($buf, 32768, 30)) {
+        $deflated .= $buf;
+      }
+      $conn->close();
+
+      $inflated = uncompress($deflated);
+      $self->assert(defined($inflated),
+        test_msg("Failed to inflate RETR test.txt data"));
+      $self->assert(md5_hex($inflated) eq md5_hex($test_file_data),
+        test_msg("RETR test.txt data does not match test.txt"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub deflate_opts_skip_incompressible {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/deflate.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/deflate.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/deflate.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/deflate.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/deflate.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  # Random data, which will not compress.
+  my $rand_file = File::Spec->rel2abs("$tmpdir/rand.bin");
+  my $rand_file_data = join('', map { chr(int(rand(256))) } (1..262144));
+  if (open(my $fh, "> $rand_file")) {
+    binmode($fh);
+    print $fh $rand_file_data;
+    unless (close($fh)) {
+      die("Can't write $rand_file: $!");
+    }
+
+  } else {
+    die("Can't open $rand_file: $!");
+  }
+
+  my $text_file = File::Spec->rel2abs("$tmpdir/test.txt");
+  my $text_file_data = "Ab" x 131072;
+  if (open(my $fh, "> $text_file")) {
+    binmode($fh);
+    print $fh $text_file_data;
+    unless (close($fh)) {
+      die("Can't write $text_file: $!");
+    }
+
+  } else {
+    die("Can't open $text_file: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    TimeoutLinger => 1,
+
+    IfModules => {
+      'mod_deflate.c' => {
+        DeflateEngine => 'on',
+        DeflateLog => $log_file,
+        DeflateOptions => 'SkipIncompressible',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+
+      $client->login($user, $passwd);
+      $client->type('binary');
+      $client->mode('Z');
+
+      my ($conn, $buf, $deflated, $inflated);
+
+      $conn = $client->retr_raw('rand.bin');
+      unless ($conn) {
+        die("RETR rand.bin failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = '';
+      while ($conn->read($buf, 32768, 30)) {
+        $deflated .= $buf;
+      }
+      $conn->close();
+
+      $inflated = uncompress($deflated);
+      $self->assert(defined($inflated),
+        test_msg("Failed to inflate RETR rand.bin data"));
+      $self->assert(md5_hex($inflated) eq md5_hex($rand_file_data),
+        test_msg("RETR rand.bin data does not match rand.bin"));
+
+      $conn = $client->retr_raw('test.txt');
+      unless ($conn) {
+        die("RETR test.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = '';
+      while ($conn->read($buf, 32768, 30)) {
+        $deflated .= $buf;
+      }
+      $conn->close();
+
+      $inflated = uncompress($deflated);
+      $self->assert(defined($inflated),
+        test_msg("Failed to inflate RETR test.txt data"));
+      $self->assert(md5_hex($inflated) eq md5_hex($text_file_data),
+        test_msg("RETR test.txt data does not match test.txt"));
+
+      # Compressible data is still compressed.
+      $self->assert(length($deflated) < (length($text_file_data) / 10),
+        test_msg("Expected test.txt to be compressed, got " .
+          length($deflated) . " bytes"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  my $found = 0;
+  if (open(my $fh, "< $log_file")) {
+    while (my $line = <$fh>) {
+      if ($line =~ /RETR: data appears incompressible/) {
+        $found = 1;
+        last;
+      }
+    }
+
+    close($fh);
+
+  } else {
+    die("Can't read $log_file: $!");
+  }
+
+  $self->assert($found, test_msg("Expected rand.bin to be sent without compression"));
+
+  unlink($log_file);
+}
+
+sub deflate_skip_filter {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/deflate.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/deflate.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/deflate.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/deflate.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/deflate.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $skip_file = File::Spec->rel2abs("$tmpdir/test.gz");
+  my $skip_file_data = "Ab" x 131072;
+  if (open(my $fh, "> $skip_file")) {
+    binmode($fh);
+    print $fh $skip_file_data;
+    unless (close($fh)) {
+      die("Can't write $skip_file: $!");
+    }
+
+  } else {
+    die("Can't open $skip_file: $!");
+  }
+
+  my $text_file = File::Spec->rel2abs("$tmpdir/test.txt");
+  my $text_file_data = "Ab" x 131072;
+  if (open(my $fh, "> $text_file")) {
+    binmode($fh);
+    print $fh $text_file_data;
+    unless (close($fh)) {
+      die("Can't write $text_file: $!");
+    }
+
+  } else {
+    die("Can't open $text_file: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+    TimeoutLinger => 1,
+
+    IfModules => {
+      'mod_deflate.c' => {
+        DeflateEngine => 'on',
+        DeflateLog => $log_file,
+        DeflateSkipFilter => '\\.gz$',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+
+      $client->login($user, $passwd);
+      $client->type('binary');
+      $client->mode('Z');
+
+      my ($conn, $buf, $deflated, $inflated);
+
+      $conn = $client->retr_raw('test.gz');
+      unless ($conn) {
+        die("RETR test.gz failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = '';
+      while ($conn->read($buf, 32768, 30)) {
+        $deflated .= $buf;
+      }
+      $conn->close();
+
+      $inflated = uncompress($deflated);
+      $self->assert(defined($inflated),
+        test_msg("Failed to inflate RETR test.gz data"));
+      $self->assert(md5_hex($inflated) eq md5_hex($skip_file_data),
+        test_msg("RETR test.gz data does not match test.gz"));
+
+      # Matching files are sent in stored blocks, not compressed.
+      $self->assert(length($deflated) >= length($skip_file_data),
+        test_msg("Expected test.gz to be sent uncompressed, got " .
+          length($deflated) . " bytes"));
+
+      $conn = $client->retr_raw('test.txt');
+      unless ($conn) {
+        die("RETR test.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $deflated = '';
+      while ($conn->read($buf, 32768, 30)) {
+        $deflated .= $buf;
+      }
+      $conn->close();
+
+      $inflated = uncompress($deflated);
+      $self->assert(defined($inflated),
+        test_msg("Failed to inflate RETR test.txt data"));
+      $self->assert(md5_hex($inflated) eq md5_hex($text_file_data),
+        test_msg("RETR test.txt data does not match test.txt"));
+
+      # Other files are still compressed.
+      $self->assert(length($deflated) < (length($text_file_data) / 10),
+        test_msg("Expected test.txt to be compressed, got " .
+          length($deflated) . " bytes"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  my $found = 0;
+  if (open(my $fh, "< $log_file")) {
+    while (my $line = <$fh>) {
+      if ($line =~ /matches DeflateSkipFilter/) {
+        $found = 1;
+        last;
+      }
+    }
+
+    close($fh);
+
+  } else {
+    die("Can't read $log_file: $!");
+  }
+
+  $self->assert($found, test_msg("Expected test.gz to match DeflateSkipFilter"));
+
+  unlink($log_file);
+}
+
 1;
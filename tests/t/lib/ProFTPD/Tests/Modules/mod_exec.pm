@@ -7,6 +7,9 @@ use strict;
 use File::Copy;
 use File::Spec;
 use IO::Handle;
+use IO::Select;
+use IO::Socket::UNIX;
+use Socket qw(SOCK_DGRAM);
 
 use ProFTPD::TestSuite::FTP;
 use ProFTPD::TestSuite::Utils qw(:auth :config :running :test :testsuite);
@@ -96,6 +99,31 @@ my $TESTS = {
     test_class => [qw(forking rootprivs)],
   },
 
+  exec_helper_on_cmd => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  exec_helper_unreachable => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  exec_helper_gone => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  exec_helper_queue_full => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  exec_helper_oversize => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
 };
 
 sub new {
@@ -2393,4 +2421,820 @@ EOS
   unlink($log_file);
 }
 
+sub exec_helper_on_cmd {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/exec.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/exec.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/exec.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/exec.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/exec.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $cmd_file = File::Spec->rel2abs("$tmpdir/cmd.txt");
+
+  # Play the part of the ExecHelper ourselves.
+  my $helper_path = File::Spec->rel2abs("$tmpdir/helper.sock");
+  my $helper = IO::Socket::UNIX->new(
+    Type => SOCK_DGRAM,
+    Local => $helper_path,
+  );
+  unless ($helper) {
+    die("Can't create $helper_path: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_exec.c' => {
+        ExecEngine => 'on',
+        ExecLog => $log_file,
+        ExecTimeout => 1,
+        ExecHelper => $helper_path,
+        ExecOnCommand => "LIST,NLST /bin/bash -c \"echo %a > $cmd_file\"",
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->list();
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    # Only the parent plays the helper.
+    $helper->close();
+
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  # The command is handed to the helper, not executed by the session.
+  $self->assert(!-f $cmd_file,
+    test_msg("File $cmd_file exists unexpectedly"));
+
+  my $sel = IO::Select->new($helper);
+  unless ($sel->can_read(5)) {
+    die("No datagram received from ExecHelper socket");
+  }
+
+  my $msg;
+  unless (defined($helper->recv($msg, 8192))) {
+    die("Can't read from $helper_path: $!");
+  }
+  $helper->close();
+
+  my $fields = [split(/\0/, $msg, -1)];
+
+  my $expected = '/bin/bash';
+  $self->assert($expected eq $fields->[0],
+    test_msg("Expected path '$expected', got '$fields->[0]'"));
+
+  $expected = '-c';
+  $self->assert($expected eq $fields->[1],
+    test_msg("Expected argument '$expected', got '$fields->[1]'"));
+
+  $expected = "echo 127.0.0.1 > $cmd_file";
+  $self->assert($expected eq $fields->[2],
+    test_msg("Expected argument '$expected', got '$fields->[2]'"));
+
+  $expected = '';
+  $self->assert($expected eq $fields->[3],
+    test_msg("Expected empty separator field, got '$fields->[3]'"));
+
+  unlink($log_file);
+}
+
+sub exec_helper_unreachable {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/exec.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/exec.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/exec.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/exec.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/exec.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $cmd_file = File::Spec->rel2abs("$tmpdir/cmd.txt");
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_exec.c' => {
+        ExecEngine => 'on',
+        ExecLog => $log_file,
+        ExecTimeout => 1,
+        ExecHelper => File::Spec->rel2abs("$tmpdir/none.sock"),
+        ExecOnCommand => "LIST,NLST /bin/bash -c \"echo %a > $cmd_file\"",
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->list();
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  # With no helper listening, the command is executed directly.
+  if (open(my $fh, "< $cmd_file")) {
+    my $line = <$fh>;
+    close($fh);
+
+    chomp($line);
+
+    my $expected = '127.0.0.1';
+
+    $self->assert($expected eq $line,
+      test_msg("Expected '$expected', got '$line'"));
+
+  } else {
+    die("Can't read $cmd_file: $!");
+  }
+
+  unlink($log_file);
+}
+
+sub exec_helper_gone {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/exec.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/exec.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/exec.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/exec.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/exec.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $cmd_file = File::Spec->rel2abs("$tmpdir/cmd.txt");
+
+  # Play the part of the ExecHelper ourselves.
+  my $helper_path = File::Spec->rel2abs("$tmpdir/helper.sock");
+  my $helper = IO::Socket::UNIX->new(
+    Type => SOCK_DGRAM,
+    Local => $helper_path,
+  );
+  unless ($helper) {
+    die("Can't create $helper_path: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_exec.c' => {
+        ExecEngine => 'on',
+        ExecLog => $log_file,
+        ExecTimeout => 1,
+        ExecHelper => $helper_path,
+        ExecOnCommand => "LIST,NLST /bin/bash -c \"echo %a > $cmd_file\"",
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      # The session is connected to the helper by now; make it go away.
+      $helper->close();
+      unlink($helper_path);
+
+      $client->list();
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    # Only the parent plays the helper.
+    $helper->close();
+
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  # Once the helper has gone, the command is executed directly.
+  if (open(my $fh, "< $cmd_file")) {
+    my $line = <$fh>;
+    close($fh);
+
+    chomp($line);
+
+    my $expected = '127.0.0.1';
+
+    $self->assert($expected eq $line,
+      test_msg("Expected '$expected', got '$line'"));
+
+  } else {
+    die("Can't read $cmd_file: $!");
+  }
+
+  unlink($log_file);
+}
+
+sub exec_helper_queue_full {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/exec.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/exec.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/exec.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/exec.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/exec.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $cmd_file = File::Spec->rel2abs("$tmpdir/cmd.txt");
+
+  # Play the part of the ExecHelper ourselves.
+  my $helper_path = File::Spec->rel2abs("$tmpdir/helper.sock");
+  my $helper = IO::Socket::UNIX->new(
+    Type => SOCK_DGRAM,
+    Local => $helper_path,
+  );
+  unless ($helper) {
+    die("Can't create $helper_path: $!");
+  }
+
+  my $count_file = File::Spec->rel2abs("$tmpdir/helper.count");
+  my $nnoops = 20;
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_exec.c' => {
+        ExecEngine => 'on',
+        ExecLog => $log_file,
+        ExecTimeout => 1,
+        ExecHelper => $helper_path,
+        ExecOnCommand => "NOOP /bin/bash -c \"echo %a >> $cmd_file\"",
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+
+  # Drain the helper socket more slowly than the session fills it, so that
+  # the session keeps finding the queue full.
+  defined(my $drain_pid = fork()) or die("Can't fork: $!");
+  if ($drain_pid == 0) {
+    my $sel = IO::Select->new($helper);
+    my $count = 0;
+
+    while ($count < $nnoops &&
+           $sel->can_read(10)) {
+      my $msg;
+      last unless defined($helper->recv($msg, 8192));
+      $count++;
+
+      select(undef, undef, undef, 0.1);
+    }
+
+    if (open(my $fh, "> $count_file")) {
+      print $fh "$count\n";
+      close($fh);
+    }
+
+    exit 0;
+  }
+
+  # Only the drainer plays the helper.
+  $helper->close();
+
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+
+      for (my $i = 0; $i < $nnoops; $i++) {
+        $client->noop();
+      }
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  for (my $i = 0; $i < 20 && !-f $count_file; $i++) {
+    select(undef, undef, undef, 0.5);
+  }
+
+  $self->assert_child_ok($drain_pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  # Every command waited for room in the queue, rather than being executed
+  # by the session.
+  $self->assert(!-f $cmd_file,
+    test_msg("File $cmd_file exists unexpectedly"));
+
+  if (open(my $fh, "< $count_file")) {
+    my $count = <$fh>;
+    close($fh);
+
+    chomp($count);
+
+    $self->assert($nnoops == $count,
+      test_msg("Expected $nnoops datagrams, got $count"));
+
+  } else {
+    die("Can't read $count_file: $!");
+  }
+
+  unlink($log_file);
+}
+
+sub exec_helper_oversize {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/exec.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/exec.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/exec.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/exec.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/exec.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $cmd_file = File::Spec->rel2abs("$tmpdir/cmd.txt");
+
+  # Play the part of the ExecHelper ourselves.
+  my $helper_path = File::Spec->rel2abs("$tmpdir/helper.sock");
+  my $helper = IO::Socket::UNIX->new(
+    Type => SOCK_DGRAM,
+    Local => $helper_path,
+  );
+  unless ($helper) {
+    die("Can't create $helper_path: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_exec.c' => {
+        ExecEngine => 'on',
+        ExecLog => $log_file,
+        ExecTimeout => 1,
+        ExecHelper => $helper_path,
+        ExecOnCommand => "LIST,NLST /bin/bash -c \"echo %a >> $cmd_file\"",
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Make the environment, and thus the datagram for each command, larger
+  # than the helper socket will take.
+  if (open(my $fh, ">> $config_file")) {
+    print $fh "<IfModule mod_exec.c>\n";
+    for (my $i = 0; $i < 230; $i++) {
+      printf $fh "  ExecEnviron V%03d %s\n", $i, 'x' x 990;
+    }
+    print $fh "</IfModule>\n";
+
+    unless (close($fh)) {
+      die("Can't write $config_file: $!");
+    }
+
+  } else {
+    die("Can't open $config_file: $!");
+  }
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->list();
+      $client->nlst();
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    # Only the parent plays the helper.
+    $helper->close();
+
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  $helper->close();
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  # Each oversized command is executed directly, without giving up on the
+  # helper for the commands after it.
+  if (open(my $fh, "< $cmd_file")) {
+    my $lines = [<$fh>];
+    close($fh);
+
+    chomp(@$lines);
+
+    my $expected = '127.0.0.1,127.0.0.1';
+    my $got = join(',', @$lines);
+
+    $self->assert($expected eq $got,
+      test_msg("Expected '$expected', got '$got'"));
+
+  } else {
+    die("Can't read $cmd_file: $!");
+  }
+
+  if (open(my $fh, "< $log_file")) {
+    my $ntoo_large = 0;
+    my $nunusable = 0;
+
+    while (my $line = <$fh>) {
+      $ntoo_large++ if $line =~ /too large for ExecHelper/;
+      $nunusable++ if $line =~ /unusable/;
+    }
+
+    close($fh);
+
+    $self->assert($ntoo_large == 2,
+      test_msg("Expected 2 oversize ExecHelper messages, got $ntoo_large"));
+    $self->assert($nunusable == 0,
+      test_msg("ExecHelper unexpectedly given up on"));
+
+  } else {
+    die("Can't read $log_file: $!");
+  }
+
+  unlink($log_file);
+}
+
 1;
@@ -26,6 +26,26 @@ my $TESTS = {
     test_class => [qw(forking)],
   },
 
+  forensic_failed_login_last_msg => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  forensic_buffer_size_smaller_than_msgs => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  forensic_long_msg_truncated => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  forensic_arena_wraparound => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
 };
 
 sub new {
@@ -36,6 +56,57 @@ sub list_tests {
   return testsuite_get_runnable_tests($TESTS);
 }
 
+# Returns the buffered ExtendedLog messages written out between the FAILED
+# LOGIN markers (after the session metadata headers), one per line.
+sub get_forensic_msgs {
+  my $path = shift;
+
+  my $msgs = [];
+  my $in_dump = 0;
+  my $in_msgs = 0;
+  my $end_ok = 0;
+
+  if (open(my $fh, "< $path")) {
+    while (my $line = <$fh>) {
+      chomp($line);
+
+      if ($line =~ /^\-\-\-\-\-BEGIN FAILED LOGIN FORENSICS\-\-\-\-\-$/) {
+        $in_dump = 1;
+        next;
+      }
+
+      next unless $in_dump;
+
+      if ($line =~ /^\-\-\-\-\-END FAILED LOGIN FORENSICS\-\-\-\-\-$/) {
+        $end_ok = 1;
+        last;
+      }
+
+      if ($in_msgs) {
+        unless ($line =~ /^\[ExtendedLog:\-?\d+\] (.*)$/) {
+          die("Unexpected ForensicLogFile line '$line'");
+        }
+
+        push(@$msgs, $1);
+
+      } elsif ($line eq '') {
+        $in_msgs = 1;
+      }
+    }
+
+    close($fh);
+
+  } else {
+    die("Can't open $path: $!");
+  }
+
+  unless ($end_ok) {
+    die("Expected ForensicLogFile lines did not appear");
+  }
+
+  return $msgs;
+}
+
 sub forensic_failed_login {
   my $self = shift;
   my $tmpdir = $self->{tmpdir};
@@ -295,4 +366,569 @@ sub forensic_good_login {
   unlink($log_file);
 }
 
+sub forensic_failed_login_last_msg {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/forensic.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/forensic.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/forensic.scoreboard");
+
+  my $log_file = File::Spec->rel2abs('tests.log');
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/forensic.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/forensic.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $forensic_log_file = File::Spec->rel2abs("$tmpdir/forensic.log");
+  my $ext_log = File::Spec->rel2abs("$tmpdir/ext.log");
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    # Only capture the ExtendedLog lines, so that the buffered messages do
+    # not depend on the DebugLevel.
+    LogFormat => 'forensic "%r"',
+    ExtendedLog => "$ext_log ALL forensic",
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    AllowOverwrite => 'on',
+    AllowStoreRestart => 'on',
+
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_log_forensic.c' => {
+        ForensicLogEngine => 'on',
+        ForensicLogCriteria => 'FailedLogin',
+        ForensicLogFile => $forensic_log_file,
+        ForensicLogCapture => 'ExtendedLog',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      for (my $i = 1; $i <= 20; $i++) {
+        eval { $client->cwd(sprintf("d%02d", $i)) };
+      }
+
+      eval { $client->login($user, 'foo') };
+      unless ($@) {
+        die("Login succeeded unexpectedly");
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    die($ex);
+  }
+
+  my $msgs = get_forensic_msgs($forensic_log_file);
+
+  # Every command of the session is still buffered, up to and including the
+  # failed PASS which triggered the dump.
+  my $expected = [];
+  for (my $i = 1; $i <= 20; $i++) {
+    push(@$expected, sprintf("CWD d%02d", $i));
+  }
+  push(@$expected, 'USER proftpd', 'PASS (hidden)');
+
+  my $got = join("\n", @$msgs);
+  $expected = join("\n", @$expected);
+  $self->assert($expected eq $got,
+    test_msg("Expected messages:\n$expected\ngot:\n$got"));
+
+  unlink($log_file);
+}
+
+sub forensic_buffer_size_smaller_than_msgs {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/forensic.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/forensic.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/forensic.scoreboard");
+
+  my $log_file = File::Spec->rel2abs('tests.log');
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/forensic.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/forensic.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $forensic_log_file = File::Spec->rel2abs("$tmpdir/forensic.log");
+  my $ext_log = File::Spec->rel2abs("$tmpdir/ext.log");
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    # Only capture the ExtendedLog lines, so that the buffered messages do
+    # not depend on the DebugLevel.
+    LogFormat => 'forensic "%r"',
+    ExtendedLog => "$ext_log ALL forensic",
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    AllowOverwrite => 'on',
+    AllowStoreRestart => 'on',
+
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_log_forensic.c' => {
+        ForensicLogEngine => 'on',
+        ForensicLogCriteria => 'FailedLogin',
+        ForensicLogFile => $forensic_log_file,
+        ForensicLogCapture => 'ExtendedLog',
+        ForensicLogBufferSize => 8,
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      for (my $i = 1; $i <= 20; $i++) {
+        eval { $client->cwd(sprintf("d%02d", $i)) };
+      }
+
+      eval { $client->login($user, 'foo') };
+      unless ($@) {
+        die("Login succeeded unexpectedly");
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    die($ex);
+  }
+
+  my $msgs = get_forensic_msgs($forensic_log_file);
+
+  # Only the newest 8 messages are kept, oldest first.
+  my $expected = [];
+  for (my $i = 15; $i <= 20; $i++) {
+    push(@$expected, sprintf("CWD d%02d", $i));
+  }
+  push(@$expected, 'USER proftpd', 'PASS (hidden)');
+
+  my $got = join("\n", @$msgs);
+  $expected = join("\n", @$expected);
+  $self->assert($expected eq $got,
+    test_msg("Expected messages:\n$expected\ngot:\n$got"));
+
+  unlink($log_file);
+}
+
+sub forensic_long_msg_truncated {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/forensic.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/forensic.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/forensic.scoreboard");
+
+  my $log_file = File::Spec->rel2abs('tests.log');
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/forensic.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/forensic.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $forensic_log_file = File::Spec->rel2abs("$tmpdir/forensic.log");
+  my $ext_log = File::Spec->rel2abs("$tmpdir/ext.log");
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    # Only capture the ExtendedLog lines, so that the buffered messages do
+    # not depend on the DebugLevel.
+    LogFormat => 'forensic "%r"',
+    ExtendedLog => "$ext_log ALL forensic",
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    AllowOverwrite => 'on',
+    AllowStoreRestart => 'on',
+
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_log_forensic.c' => {
+        ForensicLogEngine => 'on',
+        ForensicLogCriteria => 'FailedLogin',
+        ForensicLogFile => $forensic_log_file,
+        ForensicLogCapture => 'ExtendedLog',
+        ForensicLogBufferSize => 4,
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      eval { $client->cwd('d' x 400) };
+
+      eval { $client->login($user, 'foo') };
+      unless ($@) {
+        die("Login succeeded unexpectedly");
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    die($ex);
+  }
+
+  my $msgs = get_forensic_msgs($forensic_log_file);
+
+  # With room for 4 messages, the buffer holds 1024 bytes of text; longer
+  # messages are truncated to a quarter of that (including the newline).
+  my $expected = [
+    'CWD ' . ('d' x 251),
+    'USER proftpd',
+    'PASS (hidden)',
+  ];
+
+  my $got = join("\n", @$msgs);
+  $expected = join("\n", @$expected);
+  $self->assert($expected eq $got,
+    test_msg("Expected messages:\n$expected\ngot:\n$got"));
+
+  unlink($log_file);
+}
+
+sub forensic_arena_wraparound {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/forensic.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/forensic.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/forensic.scoreboard");
+
+  my $log_file = File::Spec->rel2abs('tests.log');
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/forensic.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/forensic.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs($tmpdir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $forensic_log_file = File::Spec->rel2abs("$tmpdir/forensic.log");
+  my $ext_log = File::Spec->rel2abs("$tmpdir/ext.log");
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    # Only capture the ExtendedLog lines, so that the buffered messages do
+    # not depend on the DebugLevel.
+    LogFormat => 'forensic "%r"',
+    ExtendedLog => "$ext_log ALL forensic",
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    AllowOverwrite => 'on',
+    AllowStoreRestart => 'on',
+
+    IfModules => {
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_log_forensic.c' => {
+        ForensicLogEngine => 'on',
+        ForensicLogCriteria => 'FailedLogin',
+        ForensicLogFile => $forensic_log_file,
+        ForensicLogCapture => 'ExtendedLog',
+        ForensicLogBufferSize => 8,
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      for (my $i = 1; $i <= 10; $i++) {
+        eval { $client->cwd(sprintf("%02d", $i) . ('d' x 398)) };
+      }
+
+      eval { $client->login($user, 'foo') };
+      unless ($@) {
+        die("Login succeeded unexpectedly");
+      }
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    die($ex);
+  }
+
+  my $msgs = get_forensic_msgs($forensic_log_file);
+
+  # The 2048 bytes of text held for 8 messages only fit 4 of the long
+  # (405 byte) messages, plus the short ones; having wrapped around many
+  # times, fewer messages than the buffer size are left.
+  my $expected = [];
+  for (my $i = 7; $i <= 10; $i++) {
+    push(@$expected, sprintf("CWD %02d", $i) . ('d' x 398));
+  }
+  push(@$expected, 'USER proftpd', 'PASS (hidden)');
+
+  my $got = join("\n", @$msgs);
+  $expected = join("\n", @$expected);
+  $self->assert($expected eq $got,
+    test_msg("Expected messages:\n$expected\ngot:\n$got"));
+
+  unlink($log_file);
+}
+
 1;
@@ -0,0 +1,2906 @@
+package ProFTPD::Tests::Modules::mod_tar;
+
+use lib qw(t/lib);
+use base qw(ProFTPD::TestSuite::Child);
+use strict;
+
+use Archive::Tar;
+use Compress::Zlib;
+use File::Path qw(mkpath);
+use File::Spec;
+use IO::Handle;
+
+use ProFTPD::TestSuite::FTP;
+use ProFTPD::TestSuite::Utils qw(:auth :config :running :test :testsuite);
+
+$| = 1;
+
+my $order = 0;
+
+my $TESTS = {
+  tar_mretr_files => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_mretr_glob => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_mretr_missing => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_mretr_dir_check_denied => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_mretr_hidefiles => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_mretr_symlinks => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_mretr_type_ascii => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_mretr_sendfile => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_mretr_use_sendfile_off => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_mretr_mode_z => {
+    order => ++$order,
+    test_class => [qw(forking mod_deflate)],
+  },
+
+  tar_mretr_transfer_log => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_retr_dir_suffix => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_retr_dir_suffix_config => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_retr_file_exists => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_retr_dir_denied => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_retr_rest_refused => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  tar_retr_max_transfers_per_host => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+};
+
+sub new {
+  return shift()->SUPER::new(@_);
+}
+
+sub list_tests {
+  return testsuite_get_runnable_tests($TESTS);
+}
+
+# Reads the given archive data, returning an Archive::Tar object for it.
+sub tar_read_data {
+  my $data = shift;
+
+  my $tar = Archive::Tar->new();
+
+  open(my $fh, '<', \$data) or die("Can't read archive data: $!");
+  unless ($tar->read($fh)) {
+    die("Can't parse archive: " . $tar->error());
+  }
+
+  close($fh);
+  return $tar;
+}
+
+# Creates the directory tree used by the tests: a.txt, b.txt, and sub/c.txt.
+sub tar_make_tree {
+  my $home_dir = shift;
+  my $uid = shift;
+  my $gid = shift;
+
+  my $sub_dir = File::Spec->rel2abs("$home_dir/sub");
+  mkpath($sub_dir);
+
+  my $files = {
+    'a.txt' => "Hello, World!\n",
+    'b.txt' => "Goodbye, World!\n",
+    'sub/c.txt' => "Hello again.\n" x 16,
+  };
+
+  foreach my $name (keys(%$files)) {
+    my $path = File::Spec->rel2abs("$home_dir/$name");
+
+    if (open(my $fh, "> $path")) {
+      print $fh $files->{$name};
+      unless (close($fh)) {
+        die("Can't write $path: $!");
+      }
+
+    } else {
+      die("Can't open $path: $!");
+    }
+  }
+
+  if ($< == 0) {
+    unless (chown($uid, $gid, $sub_dir)) {
+      die("Can't set owner of $sub_dir to $uid/$gid: $!");
+    }
+  }
+
+  return $files;
+}
+
+sub tar_mretr_files {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->site_raw('MRETR', 'a.txt', 'sub');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (2 files sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $names = [sort(map { $_->full_path() } $tar->get_files())];
+      my $expected_names = [
+        'a.txt',
+        'sub/',
+        'sub/c.txt',
+      ];
+
+      $self->assert(join(' ', @$expected_names) eq join(' ', @$names),
+        test_msg("Expected entries '@$expected_names', got '@$names'"));
+
+      my $content = $tar->get_content('a.txt');
+      $self->assert($files->{'a.txt'} eq $content,
+        test_msg("Unexpected content for a.txt"));
+
+      my $content = $tar->get_content('sub/c.txt');
+      $self->assert($files->{'sub/c.txt'} eq $content,
+        test_msg("Unexpected content for sub/c.txt"));
+
+      my $entry = ($tar->get_files('sub/'))[0];
+      $self->assert($entry->is_dir(),
+        test_msg("Expected sub to be a directory entry"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_mretr_glob {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->site_raw('MRETR', '*.txt');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (2 files sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $names = [sort(map { $_->full_path() } $tar->get_files())];
+      my $expected_names = [
+        'a.txt',
+        'b.txt',
+      ];
+
+      $self->assert(join(' ', @$expected_names) eq join(' ', @$names),
+        test_msg("Expected entries '@$expected_names', got '@$names'"));
+
+      my $content = $tar->get_content('b.txt');
+      $self->assert($files->{'b.txt'} eq $content,
+        test_msg("Unexpected content for b.txt"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_mretr_missing {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->site_raw('MRETR', 'a.txt', 'none.txt');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (1 file sent, 1 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $names = [sort(map { $_->full_path() } $tar->get_files())];
+      my $expected_names = [
+        'a.txt',
+      ];
+
+      $self->assert(join(' ', @$expected_names) eq join(' ', @$names),
+        test_msg("Expected entries '@$expected_names', got '@$names'"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_mretr_dir_check_denied {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  # Files below sub/private may not be downloaded.
+  my $private_dir = File::Spec->rel2abs("$home_dir/sub/private");
+  mkpath($private_dir);
+
+  if (open(my $fh, "> $private_dir/d.txt")) {
+    print $fh "Private\n";
+    unless (close($fh)) {
+      die("Can't write $private_dir/d.txt: $!");
+    }
+
+  } else {
+    die("Can't open $private_dir/d.txt: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  if (open(my $fh, ">> $config_file")) {
+    print $fh <<EOC;
+<Directory $private_dir>
+  <Limit RETR>
+    DenyAll
+  </Limit>
+</Directory>
+EOC
+    unless (close($fh)) {
+      die("Can't write $config_file: $!");
+    }
+
+  } else {
+    die("Can't open $config_file: $!");
+  }
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->site_raw('MRETR', 'sub');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (1 file sent, 1 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $names = [sort(map { $_->full_path() } $tar->get_files())];
+      my $expected_names = [
+        'sub/',
+        'sub/c.txt',
+      ];
+
+      $self->assert(join(' ', @$expected_names) eq join(' ', @$names),
+        test_msg("Expected entries '@$expected_names', got '@$names'"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  my $found = 0;
+  if (open(my $fh, "< $log_file")) {
+    while (my $line = <$fh>) {
+      if ($line =~ /skipping .*private/) {
+        $found = 1;
+        last;
+      }
+    }
+
+    close($fh);
+
+  } else {
+    die("Can't read $log_file: $!");
+  }
+
+  $self->assert($found, test_msg("Expected TarLog to note the skipped private directory"));
+
+  unlink($log_file);
+}
+
+sub tar_mretr_hidefiles {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $hidden_file = File::Spec->rel2abs("$home_dir/sub/c.hidden");
+  if (open(my $fh, "> $hidden_file")) {
+    print $fh "Hidden\n";
+    unless (close($fh)) {
+      die("Can't write $hidden_file: $!");
+    }
+
+  } else {
+    die("Can't open $hidden_file: $!");
+  }
+
+  my $sub_dir = File::Spec->rel2abs("$home_dir/sub");
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  if (open(my $fh, ">> $config_file")) {
+    print $fh <<EOC;
+<Directory $sub_dir>
+  HideFiles \\.hidden\$
+</Directory>
+EOC
+    unless (close($fh)) {
+      die("Can't write $config_file: $!");
+    }
+
+  } else {
+    die("Can't open $config_file: $!");
+  }
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->site_raw('MRETR', 'sub');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (1 file sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $names = [sort(map { $_->full_path() } $tar->get_files())];
+      my $expected_names = [
+        'sub/',
+        'sub/c.txt',
+      ];
+
+      $self->assert(join(' ', @$expected_names) eq join(' ', @$names),
+        test_msg("Expected entries '@$expected_names', got '@$names'"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_mretr_symlinks {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  # Symlinks are stored as symlinks, not followed; this one would lead out of
+  # the tree.
+  my $link_path = File::Spec->rel2abs("$home_dir/sub/link");
+  unless (symlink('../a.txt', $link_path)) {
+    die("Can't symlink $link_path to ../a.txt: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->site_raw('MRETR', 'sub');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (1 file sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $names = [sort(map { $_->full_path() } $tar->get_files())];
+      my $expected_names = [
+        'sub/',
+        'sub/c.txt',
+        'sub/link',
+      ];
+
+      $self->assert(join(' ', @$expected_names) eq join(' ', @$names),
+        test_msg("Expected entries '@$expected_names', got '@$names'"));
+
+      my $entry = ($tar->get_files('sub/link'))[0];
+      $self->assert($entry->is_symlink(),
+        test_msg("Expected sub/link to be a symlink entry"));
+
+      my $linkname = $entry->linkname();
+      $expected = '../a.txt';
+      $self->assert($expected eq $linkname,
+        test_msg("Expected link name '$expected', got '$linkname'"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_mretr_type_ascii {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      # The archive is binary data, regardless of the TYPE; only tell the
+      # server, so that the client does not translate the data either.
+      $client->quote('TYPE', 'A');
+
+      my $conn = $client->site_raw('MRETR', 'a.txt', 'sub');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (2 files sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $content = $tar->get_content('a.txt');
+      $self->assert($files->{'a.txt'} eq $content,
+        test_msg("Unexpected content for a.txt"));
+
+      my $content = $tar->get_content('sub/c.txt');
+      $self->assert($files->{'sub/c.txt'} eq $content,
+        test_msg("Unexpected content for sub/c.txt"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_mretr_sendfile {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  # Larger than the transfer buffer, so that sendfile(2) would be used.
+  my $big_file = File::Spec->rel2abs("$home_dir/big.bin");
+  $files->{'big.bin'} = join('', map { chr($_ % 251) } (1..1048576));
+  if (open(my $fh, "> $big_file")) {
+    binmode($fh);
+    print $fh $files->{'big.bin'};
+    unless (close($fh)) {
+      die("Can't write $big_file: $!");
+    }
+
+  } else {
+    die("Can't open $big_file: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->site_raw('MRETR', 'big.bin', 'a.txt');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (2 files sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $content = $tar->get_content('big.bin');
+      $self->assert($files->{'big.bin'} eq $content,
+        test_msg("Unexpected content for big.bin"));
+
+      my $content = $tar->get_content('a.txt');
+      $self->assert($files->{'a.txt'} eq $content,
+        test_msg("Unexpected content for a.txt"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_mretr_use_sendfile_off {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  # Larger than the transfer buffer, so that sendfile(2) would be used.
+  my $big_file = File::Spec->rel2abs("$home_dir/big.bin");
+  $files->{'big.bin'} = join('', map { chr($_ % 251) } (1..1048576));
+  if (open(my $fh, "> $big_file")) {
+    binmode($fh);
+    print $fh $files->{'big.bin'};
+    unless (close($fh)) {
+      die("Can't write $big_file: $!");
+    }
+
+  } else {
+    die("Can't open $big_file: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+    UseSendfile => 'off',
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->site_raw('MRETR', 'big.bin', 'a.txt');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (2 files sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $content = $tar->get_content('big.bin');
+      $self->assert($files->{'big.bin'} eq $content,
+        test_msg("Unexpected content for big.bin"));
+
+      my $content = $tar->get_content('a.txt');
+      $self->assert($files->{'a.txt'} eq $content,
+        test_msg("Unexpected content for a.txt"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_mretr_mode_z {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  # Larger than the transfer buffer, so that sendfile(2) would be used.
+  my $big_file = File::Spec->rel2abs("$home_dir/big.bin");
+  $files->{'big.bin'} = join('', map { chr($_ % 251) } (1..1048576));
+  if (open(my $fh, "> $big_file")) {
+    binmode($fh);
+    print $fh $files->{'big.bin'};
+    unless (close($fh)) {
+      die("Can't write $big_file: $!");
+    }
+
+  } else {
+    die("Can't open $big_file: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+
+      'mod_deflate.c' => {
+        DeflateEngine => 'on',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      # With MODE Z, the data is deflated on its way out, so sendfile(2)
+      # cannot be used; the files are read instead.
+      $client->mode('Z');
+
+      my $conn = $client->site_raw('MRETR', 'big.bin', 'a.txt');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (2 files sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data(uncompress($data));
+
+      my $content = $tar->get_content('big.bin');
+      $self->assert($files->{'big.bin'} eq $content,
+        test_msg("Unexpected content for big.bin"));
+
+      my $content = $tar->get_content('a.txt');
+      $self->assert($files->{'a.txt'} eq $content,
+        test_msg("Unexpected content for a.txt"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_mretr_transfer_log {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $xfer_log = File::Spec->rel2abs("$tmpdir/xfer.log");
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+    TransferLog => $xfer_log,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->site_raw('MRETR', 'a.txt', 'sub');
+      unless ($conn) {
+        die("SITE MRETR failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (2 files sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  # Each file is logged as a download of its own.
+  my $logged = [];
+  if (open(my $fh, "< $xfer_log")) {
+    while (my $line = <$fh>) {
+      chomp($line);
+
+      my $fields = [split(/\s+/, $line)];
+      push(@$logged, "$fields->[8] $fields->[7] $fields->[11]");
+    }
+
+    close($fh);
+
+  } else {
+    die("Can't read $xfer_log: $!");
+  }
+
+  my $expected = join(', ', "$home_dir/a.txt 14 o",
+    "$home_dir/sub/c.txt 208 o");
+  my $got = join(', ', @$logged);
+  $self->assert($expected eq $got,
+    test_msg("Expected TransferLog entries '$expected', got '$got'"));
+
+  unlink($log_file);
+}
+
+sub tar_retr_dir_suffix {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $xfer_log = File::Spec->rel2abs("$tmpdir/xfer.log");
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+    TransferLog => $xfer_log,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->retr_raw('sub.tar');
+      unless ($conn) {
+        die("RETR sub.tar failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (1 file sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $names = [sort(map { $_->full_path() } $tar->get_files())];
+      my $expected_names = [
+        'sub/',
+        'sub/c.txt',
+      ];
+
+      $self->assert(join(' ', @$expected_names) eq join(' ', @$names),
+        test_msg("Expected entries '@$expected_names', got '@$names'"));
+
+      my $content = $tar->get_content('sub/c.txt');
+      $self->assert($files->{'sub/c.txt'} eq $content,
+        test_msg("Unexpected content for sub/c.txt"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  # The archive is logged as a single download; the files in it are not.
+  my $logged = [];
+  if (open(my $fh, "< $xfer_log")) {
+    while (my $line = <$fh>) {
+      chomp($line);
+
+      my $fields = [split(/\s+/, $line)];
+      push(@$logged, "$fields->[8] $fields->[7] $fields->[11]");
+    }
+
+    close($fh);
+
+  } else {
+    die("Can't read $xfer_log: $!");
+  }
+
+  my $expected = join(', ', "$home_dir/sub.tar 2560 o");
+  my $got = join(', ', @$logged);
+  $self->assert($expected eq $got,
+    test_msg("Expected TransferLog entries '$expected', got '$got'"));
+
+  unlink($log_file);
+}
+
+sub tar_retr_dir_suffix_config {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+        TarRetrSuffix => '-all.tar',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->retr_raw('sub-all.tar');
+      unless ($conn) {
+        die("RETR sub-all.tar failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+
+      my $expected = 226;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $expected = 'Transfer complete (1 file sent, 0 skipped)';
+      $self->assert($expected eq $resp_msg,
+        test_msg("Expected response message '$expected', got '$resp_msg'"));
+
+      my $tar = tar_read_data($data);
+
+      my $names = [sort(map { $_->full_path() } $tar->get_files())];
+      my $expected_names = [
+        'sub/',
+        'sub/c.txt',
+      ];
+
+      $self->assert(join(' ', @$expected_names) eq join(' ', @$names),
+        test_msg("Expected entries '@$expected_names', got '@$names'"));
+
+      # The default suffix no longer applies.
+      $conn = $client->retr_raw('sub.tar');
+      if ($conn) {
+        die("RETR sub.tar succeeded unexpectedly");
+      }
+
+      $resp_code = $client->response_code();
+      $expected = 550;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_retr_file_exists {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  # An actual file with the suffix is sent as is.
+  my $tar_file = File::Spec->rel2abs("$home_dir/sub.tar");
+  if (open(my $fh, "> $tar_file")) {
+    print $fh "Not an archive\n";
+    unless (close($fh)) {
+      die("Can't write $tar_file: $!");
+    }
+
+  } else {
+    die("Can't open $tar_file: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->retr_raw('sub.tar');
+      unless ($conn) {
+        die("RETR sub.tar failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      my $data = '';
+      while ($conn->read($buf, 16384, 30)) {
+        $data .= $buf;
+      }
+      $conn->close();
+
+      my $expected = "Not an archive\n";
+      $self->assert($expected eq $data,
+        test_msg("Expected '$expected', got '$data'"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_retr_dir_denied {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $sub_dir = File::Spec->rel2abs("$home_dir/sub");
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  if (open(my $fh, ">> $config_file")) {
+    print $fh <<EOC;
+<Directory $sub_dir>
+  <Limit RETR>
+    DenyAll
+  </Limit>
+</Directory>
+EOC
+    unless (close($fh)) {
+      die("Can't write $config_file: $!");
+    }
+
+  } else {
+    die("Can't open $config_file: $!");
+  }
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      my $conn = $client->retr_raw('sub.tar');
+      if ($conn) {
+        die("RETR sub.tar succeeded unexpectedly");
+      }
+
+      my $resp_code = $client->response_code();
+      my $expected = 550;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_retr_rest_refused {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      $client->quote('REST', 1024);
+
+      my $conn = $client->retr_raw('sub.tar');
+      if ($conn) {
+        die("RETR sub.tar succeeded unexpectedly");
+      }
+
+      my $resp_code = $client->response_code();
+      my $expected = 451;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+sub tar_retr_max_transfers_per_host {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+
+  my $config_file = "$tmpdir/tar.conf";
+  my $pid_file = File::Spec->rel2abs("$tmpdir/tar.pid");
+  my $scoreboard_file = File::Spec->rel2abs("$tmpdir/tar.scoreboard");
+
+  my $log_file = test_get_logfile();
+
+  my $auth_user_file = File::Spec->rel2abs("$tmpdir/tar.passwd");
+  my $auth_group_file = File::Spec->rel2abs("$tmpdir/tar.group");
+
+  my $user = 'proftpd';
+  my $passwd = 'test';
+  my $group = 'ftpd';
+  my $home_dir = File::Spec->rel2abs("$tmpdir/home");
+  mkpath($home_dir);
+  my $uid = 500;
+  my $gid = 500;
+
+  # Make sure that, if we're running as root, that the home directory has
+  # permissions/privs set for the account we create
+  if ($< == 0) {
+    unless (chmod(0755, $home_dir)) {
+      die("Can't set perms on $home_dir to 0755: $!");
+    }
+
+    unless (chown($uid, $gid, $home_dir)) {
+      die("Can't set owner of $home_dir to $uid/$gid: $!");
+    }
+  }
+
+  auth_user_write($auth_user_file, $user, $passwd, $uid, $gid, $home_dir,
+    '/bin/bash');
+  auth_group_write($auth_group_file, $group, $gid, $user);
+
+  my $files = tar_make_tree($home_dir, $uid, $gid);
+
+  # Larger than the transfer buffer, so that sendfile(2) would be used.
+  my $big_file = File::Spec->rel2abs("$home_dir/big.bin");
+  $files->{'big.bin'} = join('', map { chr($_ % 251) } (1..1048576));
+  if (open(my $fh, "> $big_file")) {
+    binmode($fh);
+    print $fh $files->{'big.bin'};
+    unless (close($fh)) {
+      die("Can't write $big_file: $!");
+    }
+
+  } else {
+    die("Can't open $big_file: $!");
+  }
+
+  my $config = {
+    PidFile => $pid_file,
+    ScoreboardFile => $scoreboard_file,
+    SystemLog => $log_file,
+    MaxTransfersPerHost => 'RETR 1',
+    TransferRate => 'RETR 64',
+
+    AuthUserFile => $auth_user_file,
+    AuthGroupFile => $auth_group_file,
+
+    IfModules => {
+      'mod_tar.c' => {
+        TarEngine => 'on',
+        TarLog => $log_file,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($config_file, $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($user, $passwd);
+      $client->type('binary');
+
+      # The archive RETR still goes through mod_xfer's checks, e.g. its
+      # transfer limits; while another session from this host is downloading,
+      # it is refused.
+      my $client2 = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client2->login($user, $passwd);
+      $client2->type('binary');
+
+      my $conn2 = $client2->retr_raw('big.bin');
+      unless ($conn2) {
+        die("RETR big.bin failed: " . $client2->response_code() . " " .
+          $client2->response_msg());
+      }
+
+      my $buf;
+      $conn2->read($buf, 8192, 30);
+
+      my $conn = $client->retr_raw('sub.tar');
+      if ($conn) {
+        die("RETR sub.tar succeeded unexpectedly");
+      }
+
+      my $resp_code = $client->response_code();
+      my $expected = 451;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $conn2->abort();
+      $client2->quit();
+
+      $client->quit();
+    };
+
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($config_file, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($pid_file);
+
+  $self->assert_child_ok($pid);
+
+  if ($ex) {
+    test_append_logfile($log_file, $ex);
+    unlink($log_file);
+
+    die($ex);
+  }
+
+  unlink($log_file);
+}
+
+1;
@@ -409,6 +409,11 @@ if (scalar(@ARGV) > 0) {
       test_class => [qw(mod_sql_sqlite)],
     },
 
+    't/modules/mod_tar.t' => {
+      order => ++$order,
+      test_class => [qw(mod_tar)],
+    },
+
     't/modules/mod_tls.t' => {
       order => ++$order,
       test_class => [qw(mod_tls)],
@@ -92,11 +92,47 @@ static const char *program = "ftptop";
   (FTPTOP_SHOW_DOWNLOAD|FTPTOP_SHOW_UPLOAD|FTPTOP_SHOW_IDLE)
 #define FTPTOP_SHOW_RATES		0x0010
 
+/* Sort orders */
+#define FTPTOP_SORT_SLOT		0
+#define FTPTOP_SORT_USER		1
+#define FTPTOP_SORT_TIME		2
+#define FTPTOP_SORT_RATE		3
+
+/* Aggregate (bandwidth per vhost/user) displays */
+#define FTPTOP_AGG_NONE			0
+#define FTPTOP_AGG_VHOST		1
+#define FTPTOP_AGG_USER			2
+
+/* These are for displaying aggregates: "VHOST/USER SESSIONS DL UL KB/s" */
+#define FTPTOP_AGG_HEADER_FMT	"%-32s %-8s %-5s %-5s %-10s\n"
+#define FTPTOP_AGG_DISPLAY_FMT	"%-*.*s %-8u %-5u %-5u %-10.2f\n"
+
+/* The number of lines above the list of sessions. */
+#define FTPTOP_HEADER_LINES	4
+
 static int delay = 2;
 static unsigned int display_mode = FTPTOP_SHOW_REG;
+static unsigned int sort_order = FTPTOP_SORT_SLOT;
+static unsigned int agg_mode = FTPTOP_AGG_NONE;
+static int sort_changed = FALSE;
 
 static char *config_filename = PR_CONFIG_FILE_PATH;
 
+/* A session in the scoreboard, classified once per refresh. */
+struct ftptop_sess {
+  pr_scoreboard_entry_t *score;
+  char status;
+  double rate;
+  unsigned char listed, placed;
+};
+
+/* Bandwidth totals for a vhost or user. */
+struct ftptop_agg {
+  const char *name;
+  unsigned int nsessions, ndownloads, nuploads;
+  double rate;
+};
+
 /* Scoreboard variables */
 static time_t ftp_uptime = 0;
 static unsigned int ftp_nsessions = 0;
@@ -104,8 +140,19 @@ static unsigned int ftp_nuploads = 0;
 static unsigned int ftp_ndownloads = 0;
 static unsigned int ftp_nidles = 0;
 static char *server_name = NULL;
-static char **ftp_sessions = NULL;
-static unsigned int chunklen = 3;
+
+/* Indexed by scoreboard slot; kept between refreshes. */
+static struct ftptop_sess *ftp_sessions = NULL;
+static unsigned int ftp_nslots = 0;
+
+/* The slots of the listed sessions, in display order. */
+static unsigned int *ftp_order = NULL;
+static unsigned int *ftp_prev_order = NULL;
+
+static struct ftptop_agg *ftp_aggs = NULL;
+static unsigned int ftp_naggs = 0;
+static unsigned int *ftp_agg_tab = NULL;
+static unsigned int ftp_agg_tabsz = 0;
 
 /* necessary prototypes */
 static void scoreboard_close(void);
@@ -117,18 +164,10 @@ static void usage(void);
 
 static void clear_counters(void) {
 
-  if (ftp_sessions &&
-      ftp_nsessions > 0) {
-    register unsigned int i = 0;
-
-    for (i = 0; i < ftp_nsessions; i++)
-      free(ftp_sessions[i]);
-    free(ftp_sessions);
-    ftp_sessions = NULL;
-  }
-
-  /* Reset the session counters. */
-  ftp_nsessions = 0;
+  /* Reset the session counters.  Note that ftp_nsessions is reset when the
+   * list from the previous refresh has been used.
+   */
+  ftp_naggs = 0;
   ftp_nuploads = 0;
   ftp_ndownloads = 0;
   ftp_nidles = 0;
@@ -389,144 +428,340 @@ static void process_opts(int argc, char *argv[]) {
   }
 }
 
-static void read_scoreboard(void) {
+static char get_status(pr_scoreboard_entry_t *score) {
 
-  /* NOTE: this buffer should probably be limited to the maximum window
-   * width, as it is used for display purposes.
-   */
-  static char buf[PR_TUNABLE_BUFFER_SIZE] = {'\0'};
-  pr_scoreboard_entry_t *score = NULL;
+  /* Has the user authenticated yet? */
+  if (strcmp(score->sce_user, "(none)") == 0) {
+    return 'A';
+  }
 
-  ftp_sessions = calloc(chunklen, sizeof(char *));
-  if (ftp_sessions == NULL)
-    exit(1);
+  if (strcmp(score->sce_cmd, "idle") == 0) {
+    return 'I';
+  }
 
-  if (scoreboard_open() < 0)
-    return;
+  if (strcmp(score->sce_cmd, "RETR") == 0 ||
+      strcmp(score->sce_cmd, "READ") == 0 ||
+      strcmp(score->sce_cmd, "scp download") == 0) {
+    return 'D';
+  }
 
-  /* Iterate through the scoreboard. */
-  while ((score = util_scoreboard_entry_read()) != NULL) {
+  if (strcmp(score->sce_cmd, "STOR") == 0 ||
+      strcmp(score->sce_cmd, "APPE") == 0 ||
+      strcmp(score->sce_cmd, "STOU") == 0 ||
+      strcmp(score->sce_cmd, "WRITE") == 0 ||
+      strcmp(score->sce_cmd, "scp upload") == 0) {
+    return 'U';
+  }
 
-    /* Default status: "A" for "authenticating" */
-    char *status = "A";
+  if (strcmp(score->sce_cmd, "LIST") == 0 ||
+      strcmp(score->sce_cmd, "NLST") == 0 ||
+      strcmp(score->sce_cmd, "MLST") == 0 ||
+      strcmp(score->sce_cmd, "MLSD") == 0 ||
+      strcmp(score->sce_cmd, "READDIR") == 0) {
+    return 'L';
+  }
 
-    /* If a ServerName was given, skip unless the scoreboard entry matches. */
-    if (server_name &&
-        strcmp(server_name, score->sce_server_label) != 0)
-      continue;
+  /* Default status: "A" for "authenticating" */
+  return 'A';
+}
 
-    /* Clear the buffer for this run. */
-    memset(buf, '\0', sizeof(buf));
+static double calc_rate(pr_scoreboard_entry_t *score) {
+  if (score->sce_xfer_elapsed == 0) {
+    return 0.0;
+  }
 
-    /* Has the user authenticated yet? */
-    if (strcmp(score->sce_user, "(none)") != 0) {
+  return (score->sce_xfer_len / 1024.0) /
+    (score->sce_xfer_elapsed / 1000.0);
+}
 
-      /* Determine the status symbol to display. */
-      if (strcmp(score->sce_cmd, "idle") == 0) {
-        status = "I";
-        ftp_nidles++;
+static int is_shown(struct ftptop_sess *sess) {
+  if (display_mode == FTPTOP_SHOW_RATES) {
+    /* Skip sessions unless they are actually transferring data */
+    return (sess->status == 'D' || sess->status == 'U');
+  }
 
-        if (display_mode != FTPTOP_SHOW_RATES &&
-            !(display_mode & FTPTOP_SHOW_IDLE))
-          continue;
+  switch (sess->status) {
+    case 'I':
+      return (display_mode & FTPTOP_SHOW_IDLE);
 
-      } else if (strcmp(score->sce_cmd, "RETR") == 0 ||
-                 strcmp(score->sce_cmd, "READ") == 0 ||
-                 strcmp(score->sce_cmd, "scp download") == 0) {
-        status = "D";
-        ftp_ndownloads++;
+    case 'D':
+      return (display_mode & FTPTOP_SHOW_DOWNLOAD);
 
-        if (display_mode != FTPTOP_SHOW_RATES &&
-            !(display_mode & FTPTOP_SHOW_DOWNLOAD))
-          continue;
+    case 'U':
+      return (display_mode & FTPTOP_SHOW_UPLOAD);
+  }
 
-      } else if (strcmp(score->sce_cmd, "STOR") == 0 ||
-                 strcmp(score->sce_cmd, "APPE") == 0 ||
-                 strcmp(score->sce_cmd, "STOU") == 0 ||
-                 strcmp(score->sce_cmd, "WRITE") == 0 ||
-                 strcmp(score->sce_cmd, "scp upload") == 0) {
-        status = "U";
-        ftp_nuploads++;
+  return TRUE;
+}
+
+static int sess_cmp(unsigned int a, unsigned int b) {
+  struct ftptop_sess *sa = &(ftp_sessions[a]), *sb = &(ftp_sessions[b]);
+  int res = 0;
 
-        if (display_mode != FTPTOP_SHOW_RATES &&
-            !(display_mode & FTPTOP_SHOW_UPLOAD))
-          continue;
+  switch (sort_order) {
+    case FTPTOP_SORT_USER:
+      res = strcmp(sa->score->sce_user, sb->score->sce_user);
+      break;
 
-      } else if (strcmp(score->sce_cmd, "LIST") == 0 ||
-                 strcmp(score->sce_cmd, "NLST") == 0 ||
-                 strcmp(score->sce_cmd, "MLST") == 0 ||
-                 strcmp(score->sce_cmd, "MLSD") == 0 ||
-                 strcmp(score->sce_cmd, "READDIR") == 0) {
-        status = "L";
+    case FTPTOP_SORT_TIME:
+      if (sa->score->sce_begin_session != sb->score->sce_begin_session) {
+        res = sa->score->sce_begin_session < sb->score->sce_begin_session ?
+          -1 : 1;
       }
+      break;
 
-    } else {
-      status = "A";
+    case FTPTOP_SORT_RATE:
+      if (sa->rate != sb->rate) {
+        res = sa->rate > sb->rate ? -1 : 1;
+      }
+      break;
+  }
 
-      /* Overwrite the "command", for display purposes */
-      util_sstrncpy(score->sce_cmd, "(authenticating)", sizeof(score->sce_cmd));
+  if (res == 0) {
+    /* Fall back to the scoreboard order. */
+    res = a < b ? -1 : (a > b ? 1 : 0);
+  }
+
+  return res;
+}
+
+static int sess_qsort_cmp(const void *a, const void *b) {
+  return sess_cmp(*((const unsigned int *) a), *((const unsigned int *) b));
+}
+
+/* Sorts the listed sessions.  The list starts out in the order from the
+ * previous refresh, which changes little between refreshes, so an insertion
+ * sort only has to move the few sessions whose positions changed.
+ */
+static void sort_sessions(void) {
+  register unsigned int i;
+
+  if (sort_changed) {
+    qsort(ftp_order, ftp_nsessions, sizeof(unsigned int), sess_qsort_cmp);
+    sort_changed = FALSE;
+    return;
+  }
+
+  for (i = 1; i < ftp_nsessions; i++) {
+    register unsigned int j;
+    unsigned int slot;
+
+    slot = ftp_order[i];
+    for (j = i; j > 0 && sess_cmp(ftp_order[j-1], slot) > 0; j--) {
+      ftp_order[j] = ftp_order[j-1];
     }
 
-    if (display_mode != FTPTOP_SHOW_RATES) {
-      int user_namelen, client_namelen, cmd_arglen;
-
-      user_namelen = str_getscreenlen(score->sce_user, 8);
-      client_namelen = str_getscreenlen(score->sce_client_name, 20);
-      cmd_arglen = str_getscreenlen(score->sce_cmd_arg, FTPTOP_REG_ARG_SIZE);
-
-      snprintf(buf, sizeof(buf), FTPTOP_REG_DISPLAY_FMT,
-        (unsigned int) score->sce_pid, status,
-        user_namelen, user_namelen, score->sce_user,
-        client_namelen, client_namelen, score->sce_client_name,
-        score->sce_server_addr,
-        show_time(&score->sce_begin_session), score->sce_cmd,
-        cmd_arglen, cmd_arglen, score->sce_cmd_arg);
-      buf[sizeof(buf)-1] = '\0';
-
-    } else {
-      int user_namelen, client_namelen;
-
-      user_namelen = str_getscreenlen(score->sce_user, 8);
-      client_namelen = str_getscreenlen(score->sce_client_name, 44);
-
-      /* Skip sessions unless they are actually transferring data */
-      if (*status != 'U' && *status != 'D')
-        continue;
-
-      snprintf(buf, sizeof(buf), FTPTOP_XFER_DISPLAY_FMT,
-        (unsigned int) score->sce_pid, status,
-        user_namelen, user_namelen, score->sce_user,
-        client_namelen, client_namelen, score->sce_client_name,
-        (score->sce_xfer_len / 1024.0) / (score->sce_xfer_elapsed / 1000),
-        FTPTOP_XFER_DONE_SIZE, FTPTOP_XFER_DONE_SIZE,
-        *status == 'D' ?
-          calc_percent_done(score->sce_xfer_size, score->sce_xfer_done) :
-          "(n/a)");
-      buf[sizeof(buf)-1] = '\0';
+    ftp_order[j] = slot;
+  }
+}
+
+static void add_aggregate(const char *name, struct ftptop_sess *sess) {
+  unsigned int h = 2166136261U, mask, idx;
+  const char *ptr;
+  struct ftptop_agg *agg;
+
+  /* FNV-1a hash of the name, into an open-addressed table of indices into
+   * the ftp_aggs list.
+   */
+  for (ptr = name; *ptr; ptr++) {
+    h = (h ^ (unsigned char) *ptr) * 16777619U;
+  }
+
+  mask = ftp_agg_tabsz - 1;
+  for (idx = h & mask; ftp_agg_tab[idx] != 0; idx = (idx + 1) & mask) {
+    agg = &(ftp_aggs[ftp_agg_tab[idx] - 1]);
+
+    if (strcmp(agg->name, name) == 0) {
+      break;
     }
+  }
 
-    /* Make sure there is enough memory allocated in the session list.
-     * Allocate more if needed.
-     */
-    if (ftp_nsessions &&
-        ftp_nsessions % chunklen == 0) {
-      ftp_sessions = realloc(ftp_sessions,
-        (ftp_nsessions + chunklen) * sizeof(char *));
+  if (ftp_agg_tab[idx] == 0) {
+    agg = &(ftp_aggs[ftp_naggs++]);
+    memset(agg, '\0', sizeof(struct ftptop_agg));
+    agg->name = name;
+    ftp_agg_tab[idx] = ftp_naggs;
 
-      if (ftp_sessions == NULL) {
-        exit(1);
-      }
+  } else {
+    agg = &(ftp_aggs[ftp_agg_tab[idx] - 1]);
+  }
+
+  agg->nsessions++;
+
+  if (sess->status == 'D') {
+    agg->ndownloads++;
+    agg->rate += sess->rate;
+
+  } else if (sess->status == 'U') {
+    agg->nuploads++;
+    agg->rate += sess->rate;
+  }
+}
+
+static int agg_cmp(const void *a, const void *b) {
+  const struct ftptop_agg *aa = a, *ab = b;
+
+  if (aa->rate != ab->rate) {
+    return aa->rate > ab->rate ? -1 : 1;
+  }
+
+  if (aa->nsessions != ab->nsessions) {
+    return aa->nsessions > ab->nsessions ? -1 : 1;
+  }
+
+  return strcmp(aa->name, ab->name);
+}
+
+/* Grows the per-slot arrays, which are kept between refreshes, to hold the
+ * given number of scoreboard slots.
+ */
+static void alloc_sessions(unsigned int nentries) {
+  unsigned int tabsz;
+
+  if (nentries > ftp_nslots) {
+    ftp_sessions = realloc(ftp_sessions,
+      nentries * sizeof(struct ftptop_sess));
+    ftp_order = realloc(ftp_order, nentries * sizeof(unsigned int));
+    ftp_prev_order = realloc(ftp_prev_order, nentries * sizeof(unsigned int));
+    ftp_aggs = realloc(ftp_aggs, nentries * sizeof(struct ftptop_agg));
+
+    if (ftp_sessions == NULL ||
+        ftp_order == NULL ||
+        ftp_prev_order == NULL ||
+        ftp_aggs == NULL) {
+      exit(1);
     }
 
-    ftp_sessions[ftp_nsessions] = calloc(1, strlen(buf) + 1);
-    if (ftp_sessions[ftp_nsessions] == NULL) {
+    ftp_nslots = nentries;
+  }
+
+  /* Keep the aggregate hash table at most half full. */
+  tabsz = 16;
+  while (tabsz < (nentries * 2)) {
+    tabsz *= 2;
+  }
+
+  if (tabsz > ftp_agg_tabsz) {
+    ftp_agg_tab = realloc(ftp_agg_tab, tabsz * sizeof(unsigned int));
+    if (ftp_agg_tab == NULL) {
       exit(1);
     }
 
-    util_sstrncpy(ftp_sessions[ftp_nsessions++], buf, strlen(buf) + 1);
+    ftp_agg_tabsz = tabsz;
   }
+}
 
-  scoreboard_close();
+static void read_scoreboard(void) {
+  register unsigned int i;
+  pr_scoreboard_entry_t *entries;
+  unsigned int nentries = 0, nprev;
+
+  if (scoreboard_open() < 0) {
+    ftp_nsessions = 0;
+    return;
+  }
+
+  entries = util_scoreboard_get_entries(&nentries);
+  if (entries == NULL ||
+      nentries == 0) {
+    ftp_nsessions = 0;
+    return;
+  }
+
+  alloc_sessions(nentries);
+
+  /* The list from the previous refresh is kept as the starting point for
+   * this one.
+   */
+  nprev = ftp_nsessions;
+  memcpy(ftp_prev_order, ftp_order, nprev * sizeof(unsigned int));
+  ftp_nsessions = 0;
+
+  if (agg_mode != FTPTOP_AGG_NONE) {
+    memset(ftp_agg_tab, 0, ftp_agg_tabsz * sizeof(unsigned int));
+  }
+
+  /* Iterate through the scoreboard, classifying each session; only the
+   * sessions actually shown on screen are formatted for display later.
+   */
+  for (i = 0; i < nentries; i++) {
+    struct ftptop_sess *sess = &(ftp_sessions[i]);
+    pr_scoreboard_entry_t *score = &(entries[i]);
+
+    sess->score = score;
+    sess->listed = FALSE;
+    sess->placed = FALSE;
+
+    if (score->sce_pid == 0)
+      continue;
+
+    /* If a ServerName was given, skip unless the scoreboard entry matches. */
+    if (server_name &&
+        strcmp(server_name, score->sce_server_label) != 0)
+      continue;
+
+    sess->status = get_status(score);
+    sess->rate = 0.0;
+
+    if (sess->status == 'A' &&
+        strcmp(score->sce_user, "(none)") == 0) {
+      /* Overwrite the "command", for display purposes */
+      util_sstrncpy(score->sce_cmd, "(authenticating)",
+        sizeof(score->sce_cmd));
+    }
+
+    switch (sess->status) {
+      case 'I':
+        ftp_nidles++;
+        break;
+
+      case 'D':
+        ftp_ndownloads++;
+        sess->rate = calc_rate(score);
+        break;
+
+      case 'U':
+        ftp_nuploads++;
+        sess->rate = calc_rate(score);
+        break;
+    }
+
+    if (agg_mode == FTPTOP_AGG_VHOST) {
+      add_aggregate(score->sce_server_label, sess);
+
+    } else if (agg_mode == FTPTOP_AGG_USER) {
+      add_aggregate(score->sce_user, sess);
+    }
+
+    sess->listed = is_shown(sess);
+  }
+
+  /* Sessions still listed keep their previous places; new ones are added
+   * at the end.
+   */
+  for (i = 0; i < nprev; i++) {
+    unsigned int slot = ftp_prev_order[i];
+
+    if (slot < nentries &&
+        ftp_sessions[slot].listed &&
+        !ftp_sessions[slot].placed) {
+      ftp_order[ftp_nsessions++] = slot;
+      ftp_sessions[slot].placed = TRUE;
+    }
+  }
+
+  for (i = 0; i < nentries; i++) {
+    if (ftp_sessions[i].listed &&
+        !ftp_sessions[i].placed) {
+      ftp_order[ftp_nsessions++] = i;
+    }
+  }
+
+  sort_sessions();
+
+  if (agg_mode != FTPTOP_AGG_NONE) {
+    qsort(ftp_aggs, ftp_naggs, sizeof(struct ftptop_agg), agg_cmp);
+  }
 }
 
 static void scoreboard_close(void) {
@@ -566,10 +801,60 @@ static int scoreboard_open(void) {
   return 0;
 }
 
+static void show_session(pr_scoreboard_entry_t *score, char status,
+    double rate) {
+
+  /* NOTE: this buffer should probably be limited to the maximum window
+   * width, as it is used for display purposes.
+   */
+  static char buf[PR_TUNABLE_BUFFER_SIZE] = {'\0'};
+  char status_str[2];
+
+  status_str[0] = status;
+  status_str[1] = '\0';
+
+  if (display_mode != FTPTOP_SHOW_RATES) {
+    int user_namelen, client_namelen, cmd_arglen;
+
+    user_namelen = str_getscreenlen(score->sce_user, 8);
+    client_namelen = str_getscreenlen(score->sce_client_name, 20);
+    cmd_arglen = str_getscreenlen(score->sce_cmd_arg, FTPTOP_REG_ARG_SIZE);
+
+    snprintf(buf, sizeof(buf), FTPTOP_REG_DISPLAY_FMT,
+      (unsigned int) score->sce_pid, status_str,
+      user_namelen, user_namelen, score->sce_user,
+      client_namelen, client_namelen, score->sce_client_name,
+      score->sce_server_addr,
+      show_time(&score->sce_begin_session), score->sce_cmd,
+      cmd_arglen, cmd_arglen, score->sce_cmd_arg);
+    buf[sizeof(buf)-1] = '\0';
+
+  } else {
+    int user_namelen, client_namelen;
+
+    user_namelen = str_getscreenlen(score->sce_user, 8);
+    client_namelen = str_getscreenlen(score->sce_client_name, 44);
+
+    snprintf(buf, sizeof(buf), FTPTOP_XFER_DISPLAY_FMT,
+      (unsigned int) score->sce_pid, status_str,
+      user_namelen, user_namelen, score->sce_user,
+      client_namelen, client_namelen, score->sce_client_name,
+      rate, FTPTOP_XFER_DONE_SIZE, FTPTOP_XFER_DONE_SIZE,
+      status == 'D' ?
+        calc_percent_done(score->sce_xfer_size, score->sce_xfer_done) :
+        "(n/a)");
+    buf[sizeof(buf)-1] = '\0';
+  }
+
+  printw("%s", buf);
+}
+
 static void show_sessions(void) {
+  register unsigned int i;
   time_t now;
   char *now_str = NULL;
   const char *uptime_str = NULL;
+  unsigned int nlines;
 
   clear_counters();
   read_scoreboard();
@@ -591,11 +876,31 @@ static void show_sessions(void) {
     ftp_nsessions, ftp_ndownloads, ftp_nuploads, ftp_nidles);
   attroff(A_BOLD);
 
-  printw("\n");
+  switch (sort_order) {
+    case FTPTOP_SORT_USER:
+      printw("Sorted by user\n");
+      break;
+
+    case FTPTOP_SORT_TIME:
+      printw("Sorted by session time\n");
+      break;
+
+    case FTPTOP_SORT_RATE:
+      printw("Sorted by transfer rate\n");
+      break;
+
+    default:
+      printw("\n");
+      break;
+  }
 
   attron(A_REVERSE);
 
-  if (display_mode != FTPTOP_SHOW_RATES) {
+  if (agg_mode != FTPTOP_AGG_NONE) {
+    printw(FTPTOP_AGG_HEADER_FMT, agg_mode == FTPTOP_AGG_VHOST ? "VHOST" :
+      "USER", "SESSIONS", "DL", "UL", "KB/s");
+
+  } else if (display_mode != FTPTOP_SHOW_RATES) {
     printw(FTPTOP_REG_HEADER_FMT, "PID", "S", "USER", "CLIENT", "SERVER",
       "TIME", FTPTOP_REG_ARG_SIZE, "COMMAND");
 
@@ -605,17 +910,48 @@ static void show_sessions(void) {
 
   attroff(A_REVERSE);
 
-  /* Write out the scoreboard entries. */
-  if (ftp_sessions &&
-      ftp_nsessions > 0) {
-    register unsigned int i = 0;
+  /* Only format as many entries as fit on the screen. */
+  nlines = LINES > FTPTOP_HEADER_LINES ? LINES - FTPTOP_HEADER_LINES : 0;
+
+  if (agg_mode != FTPTOP_AGG_NONE) {
+    for (i = 0; i < ftp_naggs && i < nlines; i++) {
+      struct ftptop_agg *agg = &(ftp_aggs[i]);
+      int namelen;
+
+      namelen = str_getscreenlen(agg->name, 32);
+      printw(FTPTOP_AGG_DISPLAY_FMT, namelen, namelen, agg->name,
+        agg->nsessions, agg->ndownloads, agg->nuploads, agg->rate);
+    }
+
+  } else {
+    /* Write out the scoreboard entries. */
+    for (i = 0; i < ftp_nsessions && i < nlines; i++) {
+      struct ftptop_sess *sess = &(ftp_sessions[ftp_order[i]]);
 
-    for (i = 0; i < ftp_nsessions; i++) {
-      printw("%s", ftp_sessions[i]);
+      show_session(sess->score, sess->status, sess->rate);
     }
   }
 
   wrefresh(stdscr);
+
+  /* The entries point into the scoreboard snapshot, which is only needed
+   * until they have been displayed.
+   */
+  scoreboard_close();
+}
+
+static void toggle_agg_mode(unsigned int mode) {
+  if (agg_mode == mode) {
+    agg_mode = FTPTOP_AGG_NONE;
+
+  } else {
+    agg_mode = mode;
+  }
+}
+
+static void toggle_sort_order(void) {
+  sort_order = (sort_order + 1) % (FTPTOP_SORT_RATE + 1);
+  sort_changed = TRUE;
 }
 
 static void toggle_mode(void) {
@@ -650,7 +986,9 @@ static void usage(void) {
   fprintf(stdout, "\t-V      \t\tshows version\n");
   fprintf(stdout, "\n");
   fprintf(stdout, "  Use the 't' key to toggle between \"regular\" and \"transfer speed\"\n");
-  fprintf(stdout, "  display modes. Use the 'q' key to quit.\n\n");
+  fprintf(stdout, "  display modes, the 's' key to change the sort order, and the 'v' or\n");
+  fprintf(stdout, "  'u' key to toggle the bandwidth totals per vhost or per user.\n");
+  fprintf(stdout, "  Use the 'q' key to quit.\n\n");
   exit(0);
 }
 
@@ -712,6 +1050,18 @@ int main(int argc, char *argv[]) {
       if (tolower(c) == 't') {
         toggle_mode();
       }
+
+      if (tolower(c) == 's') {
+        toggle_sort_order();
+      }
+
+      if (tolower(c) == 'v') {
+        toggle_agg_mode(FTPTOP_AGG_VHOST);
+      }
+
+      if (tolower(c) == 'u') {
+        toggle_agg_mode(FTPTOP_AGG_USER);
+      }
     }
 
     show_sessions();
@@ -33,7 +33,18 @@ static char util_scoreboard_file[PR_TUNABLE_PATH_MAX] = PR_RUN_DIR "/proftpd.sco
 
 static pr_scoreboard_header_t util_header;
 
-static unsigned char util_scoreboard_read_locked = FALSE;
+/* A private copy of all of the scoreboard slots, taken when the first entry
+ * is read.
+ */
+static pr_scoreboard_entry_t *util_snapshot = NULL;
+static unsigned int util_snapshot_nentries = 0;
+static unsigned int util_snapshot_idx = 0;
+static unsigned char util_have_snapshot = FALSE;
+
+/* How many times to re-copy a scoreboard slot which changed while it was
+ * being copied, before giving up on it.
+ */
+#define UTIL_SCOREBOARD_MAX_RETRIES	8
 
 /* Internal routines
  */
@@ -69,50 +80,127 @@ static int read_scoreboard_header(pr_scoreboard_header_t *header) {
   return 0;
 }
 
-static int rlock_scoreboard(void) {
-  struct flock lock;
+#ifdef HAVE_SYS_MMAN_H
+/* Copies the scoreboard slots out of the mapped file, which the daemon
+ * processes may be writing to concurrently.  Each session process rewrites
+ * its whole slot with a single write(2); a slot which reads back the same
+ * as its copy was therefore not torn by such a write.  Slots which never
+ * settle are cleared, rather than shown half-updated.
+ */
+static void copy_scoreboard_entries(const pr_scoreboard_entry_t *src,
+    unsigned int nentries) {
+  register unsigned int i;
 
-  lock.l_type = F_RDLCK;
-  lock.l_whence = 0;
-  lock.l_start = 0;
-  lock.l_len = 0;
+  memcpy(util_snapshot, src, nentries * sizeof(pr_scoreboard_entry_t));
 
-  while (fcntl(util_scoreboard_fd, F_SETLKW, &lock) < 0) {
+  for (i = 0; i < nentries; i++) {
+    unsigned int nretries = 0;
 
-    /* It would be nice to try to restart the fcntl(2) in cases where
-     * it is interrupted.  However, that could possibly lead to a tight
-     * loop which leaves the scoreboard file locked, which in turn causes
-     * problems for the proftpd daemon trying to read that scoreboard.
-     *
-     * Instead, only retry the fcntl(2) on EAGAIN, and NOT on EINTR.
-     */
-    if (errno == EAGAIN)
+    if (util_snapshot[i].sce_pid == 0) {
       continue;
+    }
 
-    return -1;
-  }
+    while (memcmp(&(util_snapshot[i]), &(src[i]),
+        sizeof(pr_scoreboard_entry_t)) != 0) {
+      if (++nretries > UTIL_SCOREBOARD_MAX_RETRIES) {
+        memset(&(util_snapshot[i]), '\0', sizeof(pr_scoreboard_entry_t));
+        break;
+      }
 
-  util_scoreboard_read_locked = TRUE;
-  return 0;
+      memcpy(&(util_snapshot[i]), &(src[i]), sizeof(pr_scoreboard_entry_t));
+    }
+  }
 }
+#endif /* HAVE_SYS_MMAN_H */
 
-static int unlock_scoreboard(void) {
-  struct flock lock;
+/* Takes a consistent snapshot of the scoreboard slots, without locking the
+ * scoreboard: the file is mapped and copied out all at once, so that
+ * readers neither block, nor are blocked by, the daemon processes updating
+ * their slots.
+ */
+static int snapshot_scoreboard(void) {
+  struct stat st;
+  size_t len;
+  unsigned int nentries;
 
-  lock.l_type = F_UNLCK;
-  lock.l_whence = 0;
-  lock.l_start = 0;
-  lock.l_len = 0;
+  util_have_snapshot = TRUE;
+  util_snapshot_idx = 0;
+  util_snapshot_nentries = 0;
 
-  util_scoreboard_read_locked = FALSE;
+  if (fstat(util_scoreboard_fd, &st) < 0) {
+    return -1;
+  }
 
-  while (fcntl(util_scoreboard_fd, F_SETLK, &lock) < 0) {
-    if (errno == EAGAIN)
-      continue;
+  if (st.st_size <= (off_t) sizeof(pr_scoreboard_header_t)) {
+    return 0;
+  }
+
+  /* Ignore any partially-written slot at the end of the file. */
+  nentries = (st.st_size - sizeof(pr_scoreboard_header_t)) /
+    sizeof(pr_scoreboard_entry_t);
+  if (nentries == 0) {
+    return 0;
+  }
+
+  len = nentries * sizeof(pr_scoreboard_entry_t);
 
+  util_snapshot = malloc(len);
+  if (util_snapshot == NULL) {
+    errno = ENOMEM;
     return -1;
   }
 
+#ifdef HAVE_SYS_MMAN_H
+  {
+    void *map;
+    size_t maplen;
+
+    maplen = sizeof(pr_scoreboard_header_t) + len;
+
+    map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, util_scoreboard_fd, 0);
+    if (map != MAP_FAILED) {
+      copy_scoreboard_entries((const pr_scoreboard_entry_t *)
+        ((char *) map + sizeof(pr_scoreboard_header_t)), nentries);
+      (void) munmap(map, maplen);
+
+      util_snapshot_nentries = nentries;
+      return 0;
+    }
+  }
+#endif /* HAVE_SYS_MMAN_H */
+
+  /* Without mmap(2), read all of the slots twice, with one read each time,
+   * and clear any slot which differs between the two.
+   */
+  {
+    register unsigned int i;
+    pr_scoreboard_entry_t *buf;
+
+    buf = malloc(len);
+    if (buf == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    if (pread(util_scoreboard_fd, buf, len,
+          sizeof(pr_scoreboard_header_t)) != (ssize_t) len ||
+        pread(util_scoreboard_fd, util_snapshot, len,
+          sizeof(pr_scoreboard_header_t)) != (ssize_t) len) {
+      free(buf);
+      return -1;
+    }
+
+    for (i = 0; i < nentries; i++) {
+      if (memcmp(&(util_snapshot[i]), &(buf[i]),
+          sizeof(pr_scoreboard_entry_t)) != 0) {
+        memset(&(util_snapshot[i]), '\0', sizeof(pr_scoreboard_entry_t));
+      }
+    }
+
+    free(buf);
+  }
+
+  util_snapshot_nentries = nentries;
   return 0;
 }
 
@@ -123,8 +211,14 @@ int util_close_scoreboard(void) {
   if (util_scoreboard_fd == -1)
     return 0;
 
-  if (util_scoreboard_read_locked)
-    unlock_scoreboard();
+  if (util_snapshot != NULL) {
+    free(util_snapshot);
+    util_snapshot = NULL;
+  }
+
+  util_snapshot_nentries = 0;
+  util_snapshot_idx = 0;
+  util_have_snapshot = FALSE;
 
   close(util_scoreboard_fd);
   util_scoreboard_fd = -1;
@@ -217,50 +311,48 @@ time_t util_scoreboard_get_daemon_uptime(void) {
 }
 
 pr_scoreboard_entry_t *util_scoreboard_entry_read(void) {
-  static pr_scoreboard_entry_t scan_entry;
-  int res = 0;
-
   if (util_scoreboard_fd < 0) {
     errno = EINVAL;
     return NULL;
   }
 
-  /* Make sure the scoreboard file is read-locked. */
-  if (!util_scoreboard_read_locked)
-    rlock_scoreboard();
-
-  memset(&scan_entry, '\0', sizeof(scan_entry));
+  if (!util_have_snapshot &&
+      snapshot_scoreboard() < 0) {
+    fprintf(stdout, "error reading scoreboard entries: %s\n",
+      strerror(errno));
+    return NULL;
+  }
 
-  /* NOTE: use readv(2)? */
-  errno = 0;
-  while (scan_entry.sce_pid == 0) {
-    while ((res = read(util_scoreboard_fd, &scan_entry,
-        sizeof(scan_entry))) <= 0) {
+  while (util_snapshot_idx < util_snapshot_nentries) {
+    pr_scoreboard_entry_t *score;
 
-      if (res < 0 &&
-          errno == EINTR) {
-        continue;
- 
-      } else {
-        unlock_scoreboard();
+    score = &(util_snapshot[util_snapshot_idx++]);
+    if (score->sce_pid) {
+      return score;
+    }
+  }
 
-        if (errno) {
-          fprintf(stdout, "error reading scoreboard entry: %s\n",
-            strerror(errno));
-        }
+  return NULL;
+}
 
-        return NULL;
-      }
-    }
+/* Returns all of the scoreboard slots, including empty ones (whose PID is
+ * zero), from the same snapshot used by util_scoreboard_entry_read().  The
+ * snapshot stays valid until util_close_scoreboard() is called.
+ */
+pr_scoreboard_entry_t *util_scoreboard_get_entries(unsigned int *nentries) {
+  if (util_scoreboard_fd < 0 ||
+      nentries == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
 
-    if (scan_entry.sce_pid) {
-      unlock_scoreboard();
-      return &scan_entry;
-    }
+  if (!util_have_snapshot &&
+      snapshot_scoreboard() < 0) {
+    return NULL;
   }
 
-  unlock_scoreboard();
-  return NULL;
+  *nentries = util_snapshot_nentries;
+  return util_snapshot;
 }
 
 int util_scoreboard_scrub(int verbose) {
@@ -74,6 +74,10 @@
 # include <sys/stat.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
 #include "ascii.h"
 #include "default_paths.h"
 
@@ -162,6 +166,7 @@ int util_open_scoreboard(int);
 pid_t util_scoreboard_get_daemon_pid(void);
 time_t util_scoreboard_get_daemon_uptime(void);
 pr_scoreboard_entry_t *util_scoreboard_entry_read(void);
+pr_scoreboard_entry_t *util_scoreboard_get_entries(unsigned int *);
 int util_scoreboard_scrub(int);
 
 #endif /* UTILS_UTILS_H */